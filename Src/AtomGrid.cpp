@@ -1,11 +1,20 @@
 #include "convenience.h"
 #include "AtomGrid.h"
 #include "sphere_lebedev_rule.h"
+#include "spherical_density.h"
+
+#include <atomic>
+#include <memory>
 
 #ifdef _WIN32
 #define NOMIMAX
 #include <algorithm>
 #include <io.h>
+#include <process.h>
+int atom_grid_process_id() { return _getpid(); }
+#else
+#include <unistd.h>
+int atom_grid_process_id() { return static_cast<int>(getpid()); }
 #endif
 
 int get_closest_num_angular(const int& n)
@@ -29,6 +38,39 @@ int get_angular_order(const int& n)
   return -1;
 };
 
+std::string AtomGrid::cache_directory_;
+
+void AtomGrid::set_cache_directory(const std::string& directory)
+{
+  cache_directory_ = directory;
+}
+
+/**
+ * @brief Points of the prototype grids built or read since the last AtomGrid::clear_prototype_cache, by their key.
+ */
+static std::map<vec, std::shared_ptr<const atom_grid_points>>& prototype_cache()
+{
+  static std::map<vec, std::shared_ptr<const atom_grid_points>> cache;
+  return cache;
+}
+
+void AtomGrid::clear_prototype_cache()
+{
+#pragma omp critical(atom_grid_cache)
+  prototype_cache().clear();
+}
+
+static const char atom_grid_cache_magic[8] = "NSA2AGC";
+
+struct atom_grid_cache_header
+{
+  char magic[8];            ///< "NSA2AGC" and a terminating zero
+  std::uint32_t version;    ///< atom_grid_cache_version
+  std::uint32_t key_size;   ///< Number of doubles in the key
+  std::uint32_t num_radial; ///< Number of radial points
+  std::uint32_t num_points; ///< Number of grid points
+};
+
 AtomGrid::AtomGrid(const double radial_precision,
   const int min_num_angular_points,
   const int max_num_angular_points,
@@ -36,7 +78,261 @@ AtomGrid::AtomGrid(const double radial_precision,
   const double alpha_max,
   const int max_l_quantum_number,
   const double alpha_min[],
-  std::ostream& file)
+  std::ostream& file,
+  const int pruning,
+  const int radial,
+  const bool cached)
+{
+  if (!cached) {
+    build(radial_precision, min_num_angular_points, max_num_angular_points, proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial);
+    return;
+  }
+  // every argument the grid depends on, compared exactly, so the accuracy level enters through its radial
+  // precision and Lebedev orders
+  vec key{ radial_precision,
+    static_cast<double>(min_num_angular_points),
+    static_cast<double>(max_num_angular_points),
+    static_cast<double>(proton_charge),
+    alpha_max,
+    static_cast<double>(max_l_quantum_number),
+    static_cast<double>(pruning),
+    static_cast<double>(radial) };
+  for (int l = 0; l <= max_l_quantum_number; l++)
+    key.push_back(alpha_min[l]);
+
+#pragma omp critical(atom_grid_cache)
+  {
+    std::map<vec, std::shared_ptr<const atom_grid_points>>::const_iterator found = prototype_cache().find(key);
+    if (found != prototype_cache().end())
+      points_ = found->second;
+  }
+  if (points_)
+    return;
+
+  std::string name;
+  if (!cache_directory_.empty()) {
+    fnv1a h;
+    h.add(atom_grid_cache_version);
+    h.add(key.data(), key.size() * sizeof(double));
+    std::stringstream hex;
+    hex << std::hex << std::setw(16) << std::setfill('0') << h.value;
+    name = cache_directory_ + "/atomgrid_" + hex.str() + ".bin";
+  }
+  if (name.empty() || !read_cache(name, key)) {
+    build(radial_precision, min_num_angular_points, max_num_angular_points, proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial);
+    if (!name.empty())
+      write_cache(name, key, file);
+  }
+#pragma omp critical(atom_grid_cache)
+  prototype_cache().emplace(key, points_);
+}
+
+bool AtomGrid::read_cache(const std::string& name, const vec& key)
+{
+  std::ifstream in(name.c_str(), std::ios::in | std::ios::binary);
+  if (!in.good())
+    return false;
+  atom_grid_cache_header head;
+  in.read(reinterpret_cast<char*>(&head), sizeof(head));
+  if (!in.good() || std::memcmp(head.magic, atom_grid_cache_magic, sizeof(head.magic)) != 0 || head.version != atom_grid_cache_version || head.key_size != key.size())
+    return false;
+  vec file_key(key.size());
+  in.read(reinterpret_cast<char*>(file_key.data()), file_key.size() * sizeof(double));
+  // the name is only a hash, so the key is compared in full
+  if (!in.good() || std::memcmp(file_key.data(), key.data(), key.size() * sizeof(double)) != 0)
+    return false;
+  vec r(head.num_radial), rw(head.num_radial), x(head.num_points), y(head.num_points), z(head.num_points), w(head.num_points);
+  ivec partner(head.num_points);
+  for (vec* v : { &r, &rw, &x, &y, &z, &w })
+    in.read(reinterpret_cast<char*>(v->data()), v->size() * sizeof(double));
+  in.read(reinterpret_cast<char*>(partner.data()), partner.size() * sizeof(int));
+  // a file cut short by a crashed writer fails here
+  if (!in.good() || in.peek() != std::char_traits<char>::eof())
+    return false;
+  std::shared_ptr<atom_grid_points> g = std::make_shared<atom_grid_points>();
+  g->radial_r_bohr.swap(r);
+  g->radial_w.swap(rw);
+  g->x_bohr.swap(x);
+  g->y_bohr.swap(y);
+  g->z_bohr.swap(z);
+  g->w.swap(w);
+  g->partner.swap(partner);
+  points_ = g;
+  return true;
+}
+
+bool AtomGrid::write_cache(const std::string& name, const vec& key, std::ostream& file) const
+{
+  atom_grid_cache_header head;
+  std::memset(&head, 0, sizeof(head));
+  std::memcpy(head.magic, atom_grid_cache_magic, sizeof(head.magic));
+  head.version = atom_grid_cache_version;
+  head.key_size = static_cast<std::uint32_t>(key.size());
+  head.num_radial = static_cast<std::uint32_t>(get_num_radial_grid_points());
+  head.num_points = static_cast<std::uint32_t>(points_->x_bohr.size());
+
+  // unique per process and call, concurrent runs building the same grid each rename a complete file of the same content
+  static std::atomic<unsigned int> temp_counter(0);
+  const std::string temp_name = name + ".tmp" + std::to_string(atom_grid_process_id()) + "_" + std::to_string(temp_counter++);
+  {
+    std::ofstream out(temp_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.good()) {
+      file << "Could not write prototype grid cache " << name << ": " << temp_name << " can not be opened" << std::endl;
+      return false;
+    }
+    out.write(reinterpret_cast<const char*>(&head), sizeof(head));
+    out.write(reinterpret_cast<const char*>(key.data()), key.size() * sizeof(double));
+    for (const vec* v : { &points_->radial_r_bohr, &points_->radial_w, &points_->x_bohr, &points_->y_bohr, &points_->z_bohr, &points_->w })
+      out.write(reinterpret_cast<const char*>(v->data()), v->size() * sizeof(double));
+    out.write(reinterpret_cast<const char*>(points_->partner.data()), points_->partner.size() * sizeof(int));
+    out.flush();
+    if (out.bad()) {
+      out.close();
+      std::remove(temp_name.c_str());
+      file << "Could not write prototype grid cache " << name << ": writing " << temp_name << " failed" << std::endl;
+      return false;
+    }
+  }
+  if (std::rename(temp_name.c_str(), name.c_str()) != 0) {
+    // Windows does not replace existing files on rename, then another run has already written the same grid
+    std::remove(temp_name.c_str());
+    if (!exists(name)) {
+      file << "Could not write prototype grid cache " << name << ": renaming " << temp_name << " failed" << std::endl;
+      return false;
+    }
+  }
+  return true;
+}
+
+// electrons of a spherical atom, by Simpson's rule in u = sqrt(r) on the mesh of its spline
+static double spherical_atom_electrons(const spherical_density_spline& atom)
+{
+  const int n = 4 * spherical_density_intervals;
+  const double h = std::sqrt(atom.get_radius()) / n;
+  double sum = 0.0;
+  for (int i = 0; i <= n; i++) {
+    const double u = i * h;
+    const double f = std::pow(u, 5) * atom.get(u * u);
+    sum += (i == 0 || i == n) ? f : (i % 2 == 1 ? 4.0 * f : 2.0 * f);
+  }
+  return 8.0 * constants::PI * sum * h / 3.0;
+}
+
+// error of the radial quadrature r, w (r^2 dr included) for the spherical atom and normalised Gaussian densities
+// r^2l exp(-2 alpha r^2) of the most diffuse functions of every l and of the tightest function
+static double radial_quadrature_error(const vec& r,
+  const vec& w,
+  const spherical_density_spline& atom,
+  const double electrons,
+  const double alpha_max,
+  const int max_l_quantum_number,
+  const double alpha_min[])
+{
+  const int n = (int)r.size();
+  double error = 0.0;
+  if (atom.valid()) {
+    double sum = 0.0;
+    for (int i = 0; i < n; i++)
+      sum += w[i] * atom.get(r[i]);
+    error = std::abs(constants::FOUR_PI * sum - electrons);
+  }
+  auto gaussian_error = [&](const double alpha, const int l) {
+    const double norm = std::tgamma(l + 1.5) / (2.0 * std::pow(2.0 * alpha, l + 1.5));
+    double sum = 0.0;
+    for (int i = 0; i < n; i++)
+      sum += w[i] * std::pow(r[i], 2 * l) * std::exp(-2.0 * alpha * r[i] * r[i]);
+    return std::abs(sum / norm - 1.0);
+  };
+  if (alpha_max > 0.0)
+    error = std::max(error, gaussian_error(alpha_max, 0));
+  // l without functions keep a placeholder above alpha_max in alpha_min
+  for (int l = 0; l <= max_l_quantum_number; l++)
+    if (alpha_min[l] > 0.0 && alpha_min[l] <= alpha_max)
+      error = std::max(error, gaussian_error(alpha_min[l], l));
+  return error;
+}
+
+// xi of the Treutler-Ahlrichs M4 mapping for H to Kr, Table 1 of the paper, heavier elements use 1.0
+static const double treutler_xi[37] = { 1.0,
+  0.8, 0.9,
+  1.8, 1.4, 1.3, 1.1, 0.9, 0.9, 0.9, 0.9,
+  1.4, 1.3, 1.3, 1.2, 1.1, 1.0, 1.0, 1.0,
+  1.5, 1.4, 1.3, 1.2, 1.2, 1.2, 1.2, 1.2, 1.2, 1.1, 1.1, 1.1, 1.1, 1.0, 0.9, 0.9, 0.9, 0.9 };
+
+/**
+ * @brief Radial quadrature of n shells of scheme RADIAL_TREUTLER or RADIAL_MURA for the element, weights including
+ * r^2 dr, ordered from the nucleus outwards.
+ */
+static void radial_quadrature(const int scheme, const int n, const int proton_charge, vec& r, vec& w)
+{
+  r.resize(n);
+  w.resize(n);
+  if (scheme == RADIAL_TREUTLER) {
+    // M4 mapping with alpha = 0.6 on Chebyshev points of the second kind
+    const double xi = (proton_charge < 37 ? treutler_xi[proton_charge] : 1.0) / std::log(2.0);
+    for (int i = 0; i < n; i++) {
+      const double t = (n - i) * constants::PI / (n + 1);
+      const double x = std::cos(t);
+      const double rx = xi * std::pow(1.0 + x, 0.6) * std::log(2.0 / (1.0 - x));
+      const double dr = xi * (0.6 * std::pow(1.0 + x, -0.4) * std::log(2.0 / (1.0 - x)) + std::pow(1.0 + x, 0.6) / (1.0 - x));
+      r[i] = rx;
+      w[i] = constants::PI / (n + 1) * std::sin(t) * dr * rx * rx;
+    }
+  }
+  else {
+    // r = -alpha ln(1 - x^3) on the midpoints of n intervals in x, alpha 5 for groups 1 and 2, 7 otherwise
+    const int z = proton_charge;
+    const double alpha = (z == 3 || z == 4 || z == 11 || z == 12 || z == 19 || z == 20 || z == 37 || z == 38 || z == 55 || z == 56 || z == 87 || z == 88) ? 5.0 : 7.0;
+    for (int i = 0; i < n; i++) {
+      const double x = (i + 0.5) / n;
+      const double rx = -alpha * std::log(1.0 - x * x * x);
+      r[i] = rx;
+      w[i] = 3.0 * alpha * x * x / (1.0 - x * x * x) / n * rx * rx;
+    }
+  }
+}
+
+int default_radial_scheme(const int proton_charge)
+{
+  // The tight s functions of the heavier elements are integrated best by the basis-aware logarithmic grid
+  return proton_charge <= 18 ? RADIAL_TREUTLER : RADIAL_LOG;
+}
+
+/**
+ * @brief Angular points of a shell at r_over_bragg Bragg radii for PRUNING_SG.
+ *
+ * The regions are those of SG-1 for the first three rows, heavier elements use the ones of the third row. Inside
+ * the valence region the orders of SG-1 (6, 38, 86 points below 194) are taken relative to max_num_angular and
+ * never go below min_num_angular. Unlike SG-1 the tail keeps the full order: the tails of the Hirshfeld atoms
+ * overlap their neighbours, and the lower order there changes the structure factors at high angles by percents.
+ */
+static int sg_num_angular(const double r_over_bragg, const int proton_charge, const int min_num_angular, const int max_num_angular)
+{
+  static const double alphas[3][3] = { { 0.25, 0.5, 1.0 },
+                                       { 0.1667, 0.5, 0.9 },
+                                       { 0.1, 0.4, 0.8 } };
+  const double* alpha = alphas[proton_charge <= 2 ? 0 : (proton_charge <= 10 ? 1 : 2)];
+  const int low = get_angular_order(min_num_angular), high = get_angular_order(max_num_angular);
+  int order = high;
+  if (r_over_bragg <= alpha[0])
+    order = low;
+  else if (r_over_bragg <= alpha[1])
+    order = high - 7;
+  else if (r_over_bragg <= alpha[2])
+    order = high - 4;
+  return constants::lebedev_table[std::max(low, order)];
+}
+
+void AtomGrid::build(const double radial_precision,
+  const int min_num_angular_points,
+  const int max_num_angular_points,
+  const int proton_charge,
+  const double alpha_max,
+  const int max_l_quantum_number,
+  const double alpha_min[],
+  std::ostream& file,
+  const int pruning,
+  const int radial)
 {
   using namespace std;
   const int min_num_angular_points_closest =
@@ -45,22 +341,6 @@ AtomGrid::AtomGrid(const double radial_precision,
     get_closest_num_angular(max_num_angular_points);
   err_checkf(min_num_angular_points_closest != -1 && max_num_angular_points_closest != -1, "No valid value for angular number found!", file);
 
-  vec angular_x(constants::max_LT * constants::MAG, 0.0);
-  vec angular_y(constants::max_LT * constants::MAG, 0.0);
-  vec angular_z(constants::max_LT * constants::MAG, 0.0);
-  vec angular_w(constants::max_LT * constants::MAG, 0.0);
-  int angular_off;
-  lebedev_sphere ls;
-
-  for (int i = get_angular_order(min_num_angular_points_closest); i < get_angular_order(max_num_angular_points_closest) + 1; i++) {
-    angular_off = i * constants::MAG;
-    ls.ld_by_order(constants::lebedev_table[i],
-      angular_x.data() + angular_off,
-      angular_y.data() + angular_off,
-      angular_z.data() + angular_off,
-      angular_w.data() + angular_off);
-  }
-
   // radial parameters
   const double r_inner = get_r_inner(radial_precision, alpha_max * 2.0); // factor 2.0 to match DIRAC
   double h = (std::numeric_limits<double>::max)();
@@ -92,9 +372,10 @@ AtomGrid::AtomGrid(const double radial_precision,
   //  << " h: " << h
   //  << " r_outer: " << r_outer << endl;
 
-  num_radial_grid_points_ = 0;
+  std::shared_ptr<atom_grid_points> g = std::make_shared<atom_grid_points>();
 
   const double rb = constants::bragg_angstrom[proton_charge] / (5.0E10 * constants::a0);
+  const double bragg_bohr = constants::ang2bohr(constants::bragg_angstrom[proton_charge]);
   const double c = r_inner / (exp(h) - 1.0);
   const int num_radial = int(log(1.0 + (r_outer / c)) / h);
 
@@ -108,12 +389,43 @@ AtomGrid::AtomGrid(const double radial_precision,
     double radial_r = c * (exp(static_cast<double>(irad + 1.0) * h) - 1.0);
     double radial_w = (radial_r + c) * radial_r * radial_r * h;
 
-    radial_atom_grid_r_bohr_.push_back(radial_r);
-    radial_atom_grid_w_.push_back(radial_w);
-    num_radial_grid_points_++;
+    g->radial_r_bohr.push_back(radial_r);
+    g->radial_w.push_back(radial_w);
+  }
+
+  // The other schemes take the fewest shells that integrate the spherical atom and the tightest and most diffuse
+  // basis functions as well as the logarithmic grid does for this precision, so the precision keeps its meaning.
+  const int scheme = radial == RADIAL_AUTO ? default_radial_scheme(proton_charge) : radial;
+  if (scheme != RADIAL_LOG && num_radial > 0) {
+    const spherical_density_spline& atom = get_spherical_density_spline(proton_charge);
+    const double electrons = atom.valid() ? spherical_atom_electrons(atom) : 0.0;
+    const double target = std::max(radial_quadrature_error(g->radial_r_bohr, g->radial_w, atom, electrons, alpha_max, max_l_quantum_number, alpha_min), 1E-14);
+    vec r, w;
+    bool found = false;
+    for (int n = std::min(10, num_radial); n <= 2 * num_radial && !found; n++) {
+      radial_quadrature(scheme, n, proton_charge, r, w);
+      found = radial_quadrature_error(r, w, atom, electrons, alpha_max, max_l_quantum_number, alpha_min) <= target;
+    }
+    if (found) {
+      g->radial_r_bohr.swap(r);
+      g->radial_w.swap(w);
+    }
+    else {
+#pragma omp critical
+      file << "WARNING: " << radial_scheme_name(scheme) << " radial grid of " << atnr2letter(proton_charge)
+           << " does not reach the accuracy of the logarithmic grid with " << 2 * num_radial
+           << " shells, keeping the logarithmic grid" << std::endl;
+    }
+  }
+
+  for (int irad = 0; irad < (int)g->radial_r_bohr.size(); irad++) {
+    const double radial_r = g->radial_r_bohr[irad];
+    const double radial_w = g->radial_w[irad];
 
     int num_angular = max_num_angular_points_closest;
-    if (radial_r < rb) {
+    if (pruning == PRUNING_SG)
+      num_angular = sg_num_angular(radial_r / bragg_bohr, proton_charge, min_num_angular_points_closest, max_num_angular_points_closest);
+    else if (radial_r < rb) {
       num_angular = static_cast<int>(max_num_angular_points_closest *
         (radial_r / rb));
       num_angular = get_closest_num_angular(num_angular);
@@ -122,33 +434,35 @@ AtomGrid::AtomGrid(const double radial_precision,
         num_angular = min_num_angular_points_closest;
     }
 
-    angular_off = get_angular_order(num_angular) * constants::MAG;
-    err_checkf(angular_off != -constants::MAG, "Invalid angular order!", file);
-    const int start = (int) atom_grid_x_bohr_.size();
-    angular_off -= start;
+    const int order = get_angular_order(num_angular);
+    err_checkf(order != -1, "Invalid angular order!", file);
+    const lebedev_rule& rule = lebedev_rules(order);
+    const int start = (int) g->x_bohr.size();
     const int size = start + num_angular;
-    int p = 0;
-    atom_grid_x_bohr_.resize(size);
-    atom_grid_y_bohr_.resize(size);
-    atom_grid_z_bohr_.resize(size);
-    atom_grid_w_.resize(size);
-#pragma omp parallel for private(p)
-    for (int iang = start; iang < size; iang++) {
-      p = angular_off + iang;
-      atom_grid_x_bohr_[iang] = angular_x[p] * radial_r;
-      atom_grid_y_bohr_[iang] = angular_y[p] * radial_r;
-      atom_grid_z_bohr_[iang] = angular_z[p] * radial_r;
-
-      atom_grid_w_[iang] = constants::FOUR_PI * angular_w[p] * radial_w;
+    g->x_bohr.resize(size);
+    g->y_bohr.resize(size);
+    g->z_bohr.resize(size);
+    g->w.resize(size);
+    g->partner.resize(size);
+#pragma omp parallel for
+    for (int p = 0; p < num_angular; p++) {
+      const int iang = start + p;
+      g->partner[iang] = rule.partner[p] < 0 ? -1 : start + rule.partner[p];
+      g->x_bohr[iang] = rule.x[p] * radial_r;
+      g->y_bohr[iang] = rule.y[p] * radial_r;
+      g->z_bohr[iang] = rule.z[p] * radial_r;
+
+      g->w[iang] = constants::FOUR_PI * rule.w[p] * radial_w;
     }
   }
+  points_ = g;
 }
 
 AtomGrid::~AtomGrid() {}
 
-int AtomGrid::get_num_grid_points() const { return (int) atom_grid_x_bohr_.size(); }
+int AtomGrid::get_num_grid_points() const { return (int) points_->x_bohr.size(); }
 
-int AtomGrid::get_num_radial_grid_points() const { return num_radial_grid_points_; }
+int AtomGrid::get_num_radial_grid_points() const { return (int) points_->radial_r_bohr.size(); }
 
 void AtomGrid::get_grid(const int num_centers,
   const int center_index,
@@ -160,29 +474,68 @@ void AtomGrid::get_grid(const int num_centers,
   double grid_y_bohr[],
   double grid_z_bohr[],
   double grid_aw[],
-  double grid_mw[]) const
+  double grid_mw[],
+  const atom_cell_list* neighbors,
+  const int partition) const
 {
   if (num_centers > 1) {
+    // SSF screening radius, taken from the nearest neighbour of the own center
+    double nearest = 1E300;
+    if (partition == PARTITION_SSF)
+      for (int a = 0; a < num_centers; a++) {
+        if (a == center_index)
+          continue;
+        const double vx = x_coordinates_bohr[a] - x_coordinates_bohr[center_index];
+        const double vy = y_coordinates_bohr[a] - y_coordinates_bohr[center_index];
+        const double vz = z_coordinates_bohr[a] - z_coordinates_bohr[center_index];
+        nearest = std::min(nearest, std::sqrt(vx * vx + vy * vy + vz * vz));
+      }
 #pragma omp parallel
     {
       vec pa(num_centers);
+      ivec sites;
+      if (neighbors == NULL) {
+        sites.resize(num_centers);
+        std::iota(sites.begin(), sites.end(), 0);
+      }
       double temp;
 #pragma omp for schedule(dynamic)
       for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-        grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-        grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-        grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-        temp = atom_grid_w_[ipoint];
-        grid_mw[ipoint] = temp * get_becke_w(num_centers,
-          proton_charges,
-          x_coordinates_bohr,
-          y_coordinates_bohr,
-          z_coordinates_bohr,
-          center_index,
-          grid_x_bohr[ipoint],
-          grid_y_bohr[ipoint],
-          grid_z_bohr[ipoint],
-          pa);
+        grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+        grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+        grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+        if (neighbors != NULL) {
+          neighbors->get_neighbors(grid_x_bohr[ipoint], grid_y_bohr[ipoint], grid_z_bohr[ipoint], sites);
+          // the own center is always part of the partition, even beyond the cutoff
+          ivec::iterator own = std::lower_bound(sites.begin(), sites.end(), center_index);
+          if (own == sites.end() || *own != center_index)
+            sites.insert(own, center_index);
+        }
+        temp = points_->w[ipoint];
+        if (partition == PARTITION_SSF)
+          grid_mw[ipoint] = temp * get_ssf_w((int)sites.size(),
+            sites.data(),
+            x_coordinates_bohr,
+            y_coordinates_bohr,
+            z_coordinates_bohr,
+            center_index,
+            nearest,
+            grid_x_bohr[ipoint],
+            grid_y_bohr[ipoint],
+            grid_z_bohr[ipoint],
+            pa);
+        else
+          grid_mw[ipoint] = temp * get_becke_w((int)sites.size(),
+            sites.data(),
+            proton_charges,
+            x_coordinates_bohr,
+            y_coordinates_bohr,
+            z_coordinates_bohr,
+            center_index,
+            grid_x_bohr[ipoint],
+            grid_y_bohr[ipoint],
+            grid_z_bohr[ipoint],
+            pa);
         grid_aw[ipoint] = temp;
       }
     }
@@ -190,11 +543,11 @@ void AtomGrid::get_grid(const int num_centers,
   else
 #pragma omp parallel for schedule(dynamic)
     for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-      grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-      grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-      grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-      grid_mw[ipoint] = atom_grid_w_[ipoint];
-      grid_aw[ipoint] = atom_grid_w_[ipoint];
+      grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+      grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+      grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+      grid_mw[ipoint] = points_->w[ipoint];
+      grid_aw[ipoint] = points_->w[ipoint];
     }
 }
 
@@ -210,10 +563,10 @@ void AtomGrid::get_atomic_grid(
 {
 #pragma omp parallel for schedule(dynamic)
   for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-    grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-    grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-    grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-    grid_aw[ipoint] = atom_grid_w_[ipoint];
+    grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+    grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+    grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+    grid_aw[ipoint] = points_->w[ipoint];
   }
 }
 
@@ -231,10 +584,10 @@ void AtomGrid::get_grid(const int num_centers,
   vec pa(num_centers);
   if (num_centers > 1)
     for (size_t ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-      grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-      grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-      grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-      grid_w[ipoint] = atom_grid_w_[ipoint] * get_becke_w(num_centers,
+      grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+      grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+      grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+      grid_w[ipoint] = points_->w[ipoint] * get_becke_w(num_centers,
         proton_charges,
         x_coordinates_bohr,
         y_coordinates_bohr,
@@ -247,10 +600,10 @@ void AtomGrid::get_grid(const int num_centers,
     }
   else
     for (size_t ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-      grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-      grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-      grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-      grid_w[ipoint] = atom_grid_w_[ipoint];
+      grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+      grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+      grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+      grid_w[ipoint] = points_->w[ipoint];
     }
 }
 
@@ -269,10 +622,10 @@ void AtomGrid::get_grid_omp(const int num_centers,
     vec pa(num_centers);
 #pragma omp parallel for private(pa)
     for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-      grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-      grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-      grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-      grid_w[ipoint] = atom_grid_w_[ipoint] * get_becke_w(num_centers,
+      grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+      grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+      grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+      grid_w[ipoint] = points_->w[ipoint] * get_becke_w(num_centers,
         proton_charges,
         x_coordinates_bohr,
         y_coordinates_bohr,
@@ -287,10 +640,10 @@ void AtomGrid::get_grid_omp(const int num_centers,
   else
 #pragma omp parallel for
     for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-      grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint] + x_coordinates_bohr[center_index];
-      grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint] + y_coordinates_bohr[center_index];
-      grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint] + z_coordinates_bohr[center_index];
-      grid_w[ipoint] = atom_grid_w_[ipoint];
+      grid_x_bohr[ipoint] = points_->x_bohr[ipoint] + x_coordinates_bohr[center_index];
+      grid_y_bohr[ipoint] = points_->y_bohr[ipoint] + y_coordinates_bohr[center_index];
+      grid_z_bohr[ipoint] = points_->z_bohr[ipoint] + z_coordinates_bohr[center_index];
+      grid_w[ipoint] = points_->w[ipoint];
     }
 
 }
@@ -303,42 +656,118 @@ void AtomGrid::get_atom_grid_omp(
 {
 #pragma omp parallel for
   for (int ipoint = 0; ipoint < get_num_grid_points(); ipoint++) {
-    grid_x_bohr[ipoint] = atom_grid_x_bohr_[ipoint];
-    grid_y_bohr[ipoint] = atom_grid_y_bohr_[ipoint];
-    grid_z_bohr[ipoint] = atom_grid_z_bohr_[ipoint];
-    grid_w[ipoint] = atom_grid_w_[ipoint];
+    grid_x_bohr[ipoint] = points_->x_bohr[ipoint];
+    grid_y_bohr[ipoint] = points_->y_bohr[ipoint];
+    grid_z_bohr[ipoint] = points_->z_bohr[ipoint];
+    grid_w[ipoint] = points_->w[ipoint];
   }
 
 }
 
 void AtomGrid::get_radial_grid(double grid_r_bohr[], double grid_w[]) const
 {
-  for (size_t ipoint = 0; ipoint < num_radial_grid_points_; ipoint++) {
-    grid_r_bohr[ipoint] = radial_atom_grid_r_bohr_[ipoint];
-    grid_w[ipoint] = radial_atom_grid_w_[ipoint];
+  for (int ipoint = 0; ipoint < get_num_radial_grid_points(); ipoint++) {
+    grid_r_bohr[ipoint] = points_->radial_r_bohr[ipoint];
+    grid_w[ipoint] = points_->radial_w[ipoint];
   }
 }
 
 void AtomGrid::get_radial_distances(double grid_r_bohr[]) const
 {
-  for (size_t ipoint = 0; ipoint < num_radial_grid_points_; ipoint++)
-    grid_r_bohr[ipoint] = radial_atom_grid_r_bohr_[ipoint];
+  for (int ipoint = 0; ipoint < get_num_radial_grid_points(); ipoint++)
+    grid_r_bohr[ipoint] = points_->radial_r_bohr[ipoint];
 }
 
 void AtomGrid::get_radial_grid_omp(double grid_r_bohr[], double grid_w[]) const
 {
 #pragma omp parallel for
-  for (int ipoint = 0; ipoint < num_radial_grid_points_; ipoint++) {
-    grid_r_bohr[ipoint] = radial_atom_grid_r_bohr_[ipoint];
-    grid_w[ipoint] = radial_atom_grid_w_[ipoint];
+  for (int ipoint = 0; ipoint < get_num_radial_grid_points(); ipoint++) {
+    grid_r_bohr[ipoint] = points_->radial_r_bohr[ipoint];
+    grid_w[ipoint] = points_->radial_w[ipoint];
   }
 }
 
 void AtomGrid::get_radial_distances_omp(double grid_r_bohr[]) const
 {
 #pragma omp parallel for
-  for (int ipoint = 0; ipoint < num_radial_grid_points_; ipoint++)
-    grid_r_bohr[ipoint] = radial_atom_grid_r_bohr_[ipoint];
+  for (int ipoint = 0; ipoint < get_num_radial_grid_points(); ipoint++)
+    grid_r_bohr[ipoint] = points_->radial_r_bohr[ipoint];
+}
+
+atom_cell_list::atom_cell_list(const int num_sites,
+  const double* x_coordinates_bohr,
+  const double* y_coordinates_bohr,
+  const double* z_coordinates_bohr,
+  const vec& radius)
+{
+  x_.assign(x_coordinates_bohr, x_coordinates_bohr + num_sites);
+  y_.assign(y_coordinates_bohr, y_coordinates_bohr + num_sites);
+  z_.assign(z_coordinates_bohr, z_coordinates_bohr + num_sites);
+  radius2_.resize(num_sites);
+  double lo[3] = { 1E300, 1E300, 1E300 }, hi[3] = { -1E300, -1E300, -1E300 };
+  double max_radius = 0.0;
+  int used = 0;
+  for (int s = 0; s < num_sites; s++) {
+    radius2_[s] = radius[s] * radius[s];
+    if (radius[s] < 0)
+      continue;
+    used++;
+    const double r[3] = { x_[s], y_[s], z_[s] };
+    for (int k = 0; k < 3; k++) {
+      lo[k] = std::min(lo[k], r[k]);
+      hi[k] = std::max(hi[k], r[k]);
+    }
+    max_radius = std::max(max_radius, radius[s]);
+  }
+  if (used == 0)
+    return;
+  cell_size_ = std::max(max_radius, 1E-3);
+  for (int k = 0; k < 3; k++) {
+    origin_[k] = lo[k];
+    num_cells_[k] = int((hi[k] - lo[k]) / cell_size_) + 1;
+  }
+  // counting sort of the sites into the cells, which keeps them in ascending order within every cell
+  ivec cell_of(num_sites, -1);
+  cell_start_.assign(num_cells_[0] * num_cells_[1] * num_cells_[2] + 1, 0);
+  for (int s = 0; s < num_sites; s++) {
+    if (radius[s] < 0)
+      continue;
+    const int cx = std::min(int((x_[s] - origin_[0]) / cell_size_), num_cells_[0] - 1);
+    const int cy = std::min(int((y_[s] - origin_[1]) / cell_size_), num_cells_[1] - 1);
+    const int cz = std::min(int((z_[s] - origin_[2]) / cell_size_), num_cells_[2] - 1);
+    cell_of[s] = (cx * num_cells_[1] + cy) * num_cells_[2] + cz;
+    cell_start_[cell_of[s] + 1]++;
+  }
+  for (size_t c = 0; c + 1 < cell_start_.size(); c++)
+    cell_start_[c + 1] += cell_start_[c];
+  cell_sites_.resize(used);
+  ivec fill(cell_start_.begin(), cell_start_.end() - 1);
+  for (int s = 0; s < num_sites; s++)
+    if (cell_of[s] >= 0)
+      cell_sites_[fill[cell_of[s]]++] = s;
+}
+
+bool atom_cell_list::cell_range(const double x, const double y, const double z, int lo[3], int hi[3]) const
+{
+  if (cell_sites_.empty())
+    return false;
+  const double r[3] = { x, y, z };
+  for (int k = 0; k < 3; k++) {
+    // clamp before converting, points far outside the box would overflow the int
+    const double c = std::floor((r[k] - origin_[k]) / cell_size_);
+    if (c < -1.0 || c > num_cells_[k])
+      return false;
+    lo[k] = std::max(int(c) - 1, 0);
+    hi[k] = std::min(int(c) + 1, num_cells_[k] - 1);
+  }
+  return true;
+}
+
+void atom_cell_list::get_neighbors(const double x, const double y, const double z, ivec& list) const
+{
+  list.clear();
+  for_each(x, y, z, [&list](const int s, const double) { list.push_back(s); });
+  std::sort(list.begin(), list.end());
 }
 
 // JCP 88, 2547 (1988), eq. 20
@@ -350,8 +779,10 @@ constexpr double f3(const double& x)
   return f;
 }
 
-// JCP 88, 2547 (1988)
-double get_becke_w(const int& num_centers,
+// JCP 88, 2547 (1988), over the centers site(0) ... site(num_sites - 1)
+template <typename Site>
+static double becke_w(const int& num_sites,
+  Site site,
   const int proton_charges[],
   const double x_coordinates_bohr[],
   const double y_coordinates_bohr[],
@@ -367,36 +798,47 @@ double get_becke_w(const int& num_centers,
   double f, chi;
   double dist_a, dist_b, dist_ab;
   double vx, vy, vz;
+  int own = -1;
+  // distances of the point to the centers, needed for every pair
+  thread_local vec dist;
+  if (dist.size() < static_cast<size_t>(num_sites))
+    dist.resize(num_sites);
 
-  for (int a = 0; a < num_centers; a++)
+  for (int a = 0; a < num_sites; a++) {
     pa[a] = 1.0;
+    const int sa = site(a);
+    vx = x_coordinates_bohr[sa] - x;
+    vy = y_coordinates_bohr[sa] - y;
+    vz = z_coordinates_bohr[sa] - z;
+    dist[a] = std::sqrt(vx * vx + vy * vy + vz * vz);
+  }
 
-  for (int a = 0; a < num_centers; a++) {
-    vx = x_coordinates_bohr[a] - x;
-    vy = y_coordinates_bohr[a] - y;
-    vz = z_coordinates_bohr[a] - z;
-    dist_a = vx * vx + vy * vy + vz * vz;
-    dist_a = std::sqrt(dist_a);
+  for (int a = 0; a < num_sites; a++) {
+    const int sa = site(a);
+    if (sa == center_index)
+      own = a;
+    dist_a = dist[a];
 
-    if (a != center_index && dist_a > 15) {
+    if (sa != center_index && dist_a > becke_neighbor_radius) {
       pa[a] = 0.0;
       continue;
     }
 
-    R_a = constants::bragg_angstrom[proton_charges[a]];
+    R_a = constants::bragg_angstrom[proton_charges[sa]];
 
     for (int b = 0; b < a; b++) {
-      vx = x_coordinates_bohr[b] - x;
-      vy = y_coordinates_bohr[b] - y;
-      vz = z_coordinates_bohr[b] - z;
-      dist_b = vx * vx + vy * vy + vz * vz;
-      dist_b = std::sqrt(dist_b);
+      // a pair can only scale the cell functions, once both are zero it changes nothing; with periodic images most
+      // distant sites end up there
+      if (pa[a] == 0.0 && pa[b] == 0.0)
+        continue;
+      const int sb = site(b);
+      dist_b = dist[b];
 
-      R_b = constants::bragg_angstrom[proton_charges[b]];
+      R_b = constants::bragg_angstrom[proton_charges[sb]];
 
-      vx = x_coordinates_bohr[b] - x_coordinates_bohr[a];
-      vy = y_coordinates_bohr[b] - y_coordinates_bohr[a];
-      vz = z_coordinates_bohr[b] - z_coordinates_bohr[a];
+      vx = x_coordinates_bohr[sb] - x_coordinates_bohr[sa];
+      vy = y_coordinates_bohr[sb] - y_coordinates_bohr[sa];
+      vz = z_coordinates_bohr[sb] - z_coordinates_bohr[sa];
       dist_ab = vx * vx + vy * vy + vz * vz;
       dist_ab = std::sqrt(dist_ab);
 
@@ -437,15 +879,124 @@ double get_becke_w(const int& num_centers,
   }
 
   double w = 0.0;
-  for (int a = 0; a < num_centers; a++)
+  for (int a = 0; a < num_sites; a++)
     w += pa[a];
 
-  if (std::abs(w) > constants::cutoff)
-    return pa[center_index] / w;
+  if (std::abs(w) > constants::cutoff && own >= 0)
+    return pa[own] / w;
   else
     return 1.0;
 }
 
+double get_becke_w(const int& num_centers,
+  const int proton_charges[],
+  const double x_coordinates_bohr[],
+  const double y_coordinates_bohr[],
+  const double z_coordinates_bohr[],
+  const int& center_index,
+  const double& x,
+  const double& y,
+  const double& z,
+  vec& pa)
+{
+  return becke_w(num_centers, [](const int a) { return a; }, proton_charges,
+    x_coordinates_bohr, y_coordinates_bohr, z_coordinates_bohr, center_index, x, y, z, pa);
+}
+
+double get_becke_w(const int& num_sites,
+  const int sites[],
+  const int proton_charges[],
+  const double x_coordinates_bohr[],
+  const double y_coordinates_bohr[],
+  const double z_coordinates_bohr[],
+  const int& center_index,
+  const double& x,
+  const double& y,
+  const double& z,
+  vec& pa)
+{
+  return becke_w(num_sites, [sites](const int a) { return sites[a]; }, proton_charges,
+    x_coordinates_bohr, y_coordinates_bohr, z_coordinates_bohr, center_index, x, y, z, pa);
+}
+
+// CPL 257, 213 (1996), eq. 14
+constexpr double ssf_a = 0.64;
+
+// CPL 257, 213 (1996), eqs. 11 and 14, zero for mu >= a and one for mu <= -a
+static inline double ssf_s(const double mu)
+{
+  if (mu <= -ssf_a)
+    return 1.0;
+  if (mu >= ssf_a)
+    return 0.0;
+  const double x = mu / ssf_a;
+  const double x2 = x * x;
+  return 0.5 - x * (35.0 + x2 * (-35.0 + x2 * (21.0 - 5.0 * x2))) / 32.0;
+}
+
+// CPL 257, 213 (1996)
+double get_ssf_w(const int& num_sites,
+  const int sites[],
+  const double x_coordinates_bohr[],
+  const double y_coordinates_bohr[],
+  const double z_coordinates_bohr[],
+  const int& center_index,
+  const double& nearest,
+  const double& x,
+  const double& y,
+  const double& z,
+  vec& pa)
+{
+  double vx = x_coordinates_bohr[center_index] - x;
+  double vy = y_coordinates_bohr[center_index] - y;
+  double vz = z_coordinates_bohr[center_index] - z;
+  // eq. 15: close to its own center every other cell function vanishes
+  if (std::sqrt(vx * vx + vy * vy + vz * vz) <= 0.5 * (1.0 - ssf_a) * nearest)
+    return 1.0;
+
+  // pa holds the distances of the point to the centers, far centers are left out like in get_becke_w
+  int own = -1;
+  for (int a = 0; a < num_sites; a++) {
+    const int sa = sites[a];
+    vx = x_coordinates_bohr[sa] - x;
+    vy = y_coordinates_bohr[sa] - y;
+    vz = z_coordinates_bohr[sa] - z;
+    pa[a] = std::sqrt(vx * vx + vy * vy + vz * vz);
+    if (sa == center_index)
+      own = a;
+    else if (pa[a] > becke_neighbor_radius)
+      pa[a] = -1.0;
+  }
+  if (own < 0)
+    return 1.0;
+
+  // cell function of center a, stops at the first vanishing factor
+  auto cell_function = [&](const int a) {
+    const int sa = sites[a];
+    double P = 1.0;
+    for (int b = 0; b < num_sites && P != 0.0; b++) {
+      if (b == a || pa[b] < 0)
+        continue;
+      const int sb = sites[b];
+      const double dx = x_coordinates_bohr[sb] - x_coordinates_bohr[sa];
+      const double dy = y_coordinates_bohr[sb] - y_coordinates_bohr[sa];
+      const double dz = z_coordinates_bohr[sb] - z_coordinates_bohr[sa];
+      P *= ssf_s((pa[a] - pa[b]) / std::sqrt(dx * dx + dy * dy + dz * dz));
+    }
+    return P;
+  };
+
+  // the own cell function first, most points far from their center end here
+  const double P_own = cell_function(own);
+  if (P_own == 0.0)
+    return 0.0;
+  double w = P_own;
+  for (int a = 0; a < num_sites; a++)
+    if (a != own && pa[a] >= 0)
+      w += cell_function(a);
+  return P_own / w;
+}
+
 // TCA 106, 178 (2001), eq. 25
 // we evaluate r_inner for s functions
 double get_r_inner(const double& max_error, const double& alpha_inner)
@@ -529,3 +1080,172 @@ double get_h(const double& max_error, const int& l, const double& guess)
 
   return h;
 }
+
+// error of the radial grid of grid, see radial_quadrature_error
+static double radial_test_error(const AtomGrid& grid,
+  const spherical_density_spline& atom,
+  const double electrons,
+  const double alpha_max,
+  const int max_l_quantum_number,
+  const double alpha_min[])
+{
+  const int n = grid.get_num_radial_grid_points();
+  vec r(n), w(n);
+  grid.get_radial_grid(r.data(), w.data());
+  return radial_quadrature_error(r, w, atom, electrons, alpha_max, max_l_quantum_number, alpha_min);
+}
+
+/**
+ * @brief Dimer of the atom at the origin and a partner, whose Becke part of the promolecule is used to test grids.
+ */
+struct grid_test_dimer
+{
+  int charges[2];
+  double x[2], y[2], z[2];
+  const spherical_density_spline* partner;
+};
+
+// tetrahedral directions off the axes of the Lebedev rules
+static const double grid_test_directions[4][3] = { { 0.4629860220421327, 0.7152073823967723, 0.5235669427673593 },
+                                                   { 0.5604558547657947, -0.2511519421709775, -0.7891843490607811 },
+                                                   { -0.8866541817844431, 0.3385249547737685, -0.3150320887141152 },
+                                                   { -0.1367876950234843, -0.8025803949995632, 0.5806494950075369 } };
+
+// the partner at the sum of the Bragg radii along grid_test_directions[direction % 4]
+static grid_test_dimer make_test_dimer(const int proton_charge, const int partner, const int direction)
+{
+  const double* d = grid_test_directions[direction % 4];
+  const double distance = constants::ang2bohr(constants::bragg_angstrom[proton_charge] + constants::bragg_angstrom[partner]);
+  return grid_test_dimer{ { proton_charge, partner }, { 0.0, distance * d[0] }, { 0.0, distance * d[1] }, { 0.0, distance * d[2] }, &get_spherical_density_spline(partner) };
+}
+
+// sin(theta)/lambda in 1/Angstrom up to which the test structure factors go
+const double grid_test_stol = 0.7;
+
+// Fourier components of the Becke part of the dimer promolecule at the scattering vectors k (2 pi h, in 1/bohr)
+static cvec dimer_structure_factors(AtomGrid& grid,
+  const spherical_density_spline& atom,
+  const grid_test_dimer& dimer,
+  const std::vector<std::array<double, 3>>& k)
+{
+  const double* gx = grid.get_gridx_ptr(), * gy = grid.get_gridy_ptr(), * gz = grid.get_gridz_ptr(), * gw = grid.get_gridw_ptr();
+  const int n = grid.get_num_grid_points(), nk = (int)k.size();
+  cvec result(nk, 0.0);
+#pragma omp parallel
+  {
+    vec pa(2);
+    cvec local(nk, 0.0);
+#pragma omp for
+    for (int p = 0; p < n; p++) {
+      const double dx = gx[p] - dimer.x[1], dy = gy[p] - dimer.y[1], dz = gz[p] - dimer.z[1];
+      const double rho = atom.get(std::sqrt(gx[p] * gx[p] + gy[p] * gy[p] + gz[p] * gz[p])) + dimer.partner->get(std::sqrt(dx * dx + dy * dy + dz * dz));
+      const double weight = gw[p] * rho * get_becke_w(2, dimer.charges, dimer.x, dimer.y, dimer.z, 0, gx[p], gy[p], gz[p], pa);
+      for (int i = 0; i < nk; i++) {
+        const double phase = k[i][0] * gx[p] + k[i][1] * gy[p] + k[i][2] * gz[p];
+        local[i] += weight * cdouble(std::cos(phase), std::sin(phase));
+      }
+    }
+#pragma omp critical(dimer_structure_factors)
+    for (int i = 0; i < nk; i++)
+      result[i] += local[i];
+  }
+  return result;
+}
+
+atom_grid_settings select_atom_grid(const double target_error,
+  const int proton_charge,
+  const double alpha_max,
+  const int max_l_quantum_number,
+  const double alpha_min[],
+  const std::vector<int>& partners,
+  std::ostream& file,
+  const int pruning,
+  const int radial)
+{
+  const spherical_density_spline& atom = get_spherical_density_spline(proton_charge);
+  const double electrons = atom.valid() ? spherical_atom_electrons(atom) : 0.0;
+  atom_grid_settings settings{ 1E-3, constants::lebedev_table[0], constants::lebedev_table[0], 0, 0.0 };
+
+  // coarsest radial precision from 1E-3 to 1E-10, the angular grid does not matter for spherical test functions
+  int first_precision = 3;
+  for (; first_precision < 10; first_precision++) {
+    const AtomGrid grid(std::pow(10.0, -first_precision), settings.min_num_angular_points, settings.max_num_angular_points,
+      proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial, false);
+    if (radial_test_error(grid, atom, electrons, alpha_max, max_l_quantum_number, alpha_min) <= 0.25 * target_error)
+      break;
+  }
+  settings.radial_precision = std::pow(10.0, -first_precision);
+  if (!atom.valid()) {
+    const AtomGrid grid(settings.radial_precision, settings.min_num_angular_points, settings.max_num_angular_points,
+      proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial, false);
+    settings.num_points = grid.get_num_grid_points();
+    return settings;
+  }
+
+  // one dimer per partner element, and scattering vectors along the directions of the dimers at 0, half and full
+  // grid_test_stol
+  std::vector<grid_test_dimer> dimers;
+  for (const int partner : partners)
+    if (get_spherical_density_spline(partner).valid())
+      dimers.push_back(make_test_dimer(proton_charge, partner, (int)dimers.size()));
+  std::vector<std::array<double, 3>> k(1, std::array<double, 3>{ 0.0, 0.0, 0.0 });
+  const double k_max = 4.0 * constants::PI * grid_test_stol * 0.529177249;
+  for (const double f : { 0.5, 1.0 })
+    for (int d = 0; d < 4; d++)
+      k.push_back(std::array<double, 3>{ f * k_max * grid_test_directions[d][0], f * k_max * grid_test_directions[d][1], f * k_max * grid_test_directions[d][2] });
+
+  // reference values on a grid finer than any of the candidates, neither it nor the trial grids below are cached,
+  // only the settings that are finally used are built through the cache by the caller
+  std::vector<cvec> reference(dimers.size());
+  {
+    AtomGrid fine(1E-12, constants::lebedev_table[20], constants::lebedev_table[24], proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial, false);
+    for (size_t i = 0; i < dimers.size(); i++)
+      reference[i] = dimer_structure_factors(fine, atom, dimers[i], k);
+  }
+
+  // For every radial precision the angular orders are raised until the target is met, the error stops falling or the
+  // grid gets larger than the best one found. The radial precision is tightened once more after the first grid that
+  // meets the target, since the partner densities may need it. The inner angular grid trails the outer one by four
+  // orders, like the levels of -acc.
+  atom_grid_settings closest = settings;
+  closest.error = (std::numeric_limits<double>::max)();
+  int found_at = -1;
+  for (int e = first_precision; e <= 10 && (found_at == -1 || e == found_at + 1); e++) {
+    double row_min = (std::numeric_limits<double>::max)();
+    int stalled = 0;
+    for (int o = 0; o <= 19 && stalled < 4; o++) {
+      atom_grid_settings trial{ std::pow(10.0, -e), constants::lebedev_table[std::max(0, o - 4)], constants::lebedev_table[o], 0, 0.0 };
+      AtomGrid grid(trial.radial_precision, trial.min_num_angular_points, trial.max_num_angular_points,
+        proton_charge, alpha_max, max_l_quantum_number, alpha_min, file, pruning, radial, false);
+      trial.num_points = grid.get_num_grid_points();
+      if (found_at != -1 && trial.num_points >= settings.num_points)
+        break;
+      trial.error = radial_test_error(grid, atom, electrons, alpha_max, max_l_quantum_number, alpha_min);
+      for (size_t i = 0; i < dimers.size(); i++) {
+        const cvec f = dimer_structure_factors(grid, atom, dimers[i], k);
+        for (size_t j = 0; j < k.size(); j++)
+          trial.error = std::max(trial.error, std::abs(f[j] - reference[i][j]));
+      }
+      if (trial.error <= target_error) {
+        settings = trial;
+        if (found_at == -1)
+          found_at = e;
+        break;
+      }
+      if (trial.error < closest.error)
+        closest = trial;
+      stalled = trial.error < 0.5 * row_min ? 0 : stalled + 1;
+      row_min = std::min(row_min, trial.error);
+    }
+  }
+  return found_at == -1 ? closest : settings;
+}
+
+double dimer_share_electrons(AtomGrid& grid, const int proton_charge, const int partner)
+{
+  const spherical_density_spline& atom = get_spherical_density_spline(proton_charge);
+  if (!atom.valid() || !get_spherical_density_spline(partner).valid())
+    return 0.0;
+  const std::vector<std::array<double, 3>> k(1, std::array<double, 3>{ 0.0, 0.0, 0.0 });
+  return dimer_structure_factors(grid, atom, make_test_dimer(proton_charge, partner, 0), k)[0].real();
+}
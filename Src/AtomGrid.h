@@ -1,10 +1,174 @@
 #pragma once
 
+#include <cmath>
+#include <cstdint>
+#include <memory>
+#include <string>
 #include <vector>
 
+/**
+ * @brief Atoms further than this from a grid point (in bohr) get no Becke weight at it.
+ */
+const double becke_neighbor_radius = 15.0;
+
+/**
+ * @brief Partitions of the molecular grid into atomic contributions, selected by -partition.
+ */
+enum partition_scheme
+{
+    PARTITION_BECKE = 0, ///< Becke, JCP 88, 2547 (1988), iterated f3 with Bragg radius size adjustment
+    PARTITION_SSF = 1,   ///< Stratmann, Scuseria, Frisch, CPL 257, 213 (1996), compact switching function with screening
+};
+
+/**
+ * @brief Name of a partition_scheme for the log.
+ */
+inline const char* partition_name(const int partition)
+{
+    return partition == PARTITION_SSF ? "Stratmann-Scuseria" : "Becke";
+}
+
+/**
+ * @brief Distributions of the angular orders of AtomGrid over its radial shells, selected by -pruning.
+ */
+enum angular_pruning
+{
+    PRUNING_LINEAR = 0, ///< order growing with r up to a fifth of the Bragg radius, the full order beyond
+    PRUNING_SG = 1,     ///< regions in r relative to the Bragg radius, as in SG-1, Gill, Johnson, Pople, CPL 209, 506 (1993),
+                        ///< but with the full order in the tail
+};
+
+/**
+ * @brief Name of an angular_pruning for the log.
+ */
+inline const char* pruning_name(const int pruning)
+{
+    return pruning == PRUNING_SG ? "SG" : "linear";
+}
+
+/**
+ * @brief Radial quadratures of AtomGrid, selected by -radial.
+ */
+enum radial_scheme
+{
+    RADIAL_LOG = 0,       ///< logarithmic grid with range and spacing from the radial precision and the basis (default)
+    RADIAL_TREUTLER = 1,  ///< Treutler, Ahlrichs, JCP 102, 346 (1995), M4 mapping with the xi of the element
+    RADIAL_MURA = 2,      ///< Mura, Knowles, JCP 104, 9848 (1996), log3 mapping
+    RADIAL_AUTO = 3,      ///< the scheme of default_radial_scheme for every element
+};
+
+/**
+ * @brief Name of a radial_scheme for the log.
+ */
+inline const char* radial_scheme_name(const int radial)
+{
+    return radial == RADIAL_TREUTLER ? "Treutler-Ahlrichs" : (radial == RADIAL_MURA ? "Mura-Knowles" : (radial == RADIAL_AUTO ? "per element" : "logarithmic"));
+}
+
+/**
+ * @brief Radial scheme RADIAL_AUTO uses for an element.
+ */
+int default_radial_scheme(const int proton_charge);
+
+/**
+ * @brief Id of the running process, makes the names of temporary cache and checkpoint files unique between runs.
+ */
+int atom_grid_process_id();
+
+/**
+ * @brief Cell list over atomic sites with individual cutoff radii, to find the sites within reach of a point without
+ * looping over all of them.
+ *
+ * The cell edge is the largest radius, so only the 27 cells around a point have to be searched and the work per
+ * point does not grow with the size of the system.
+ */
+class atom_cell_list
+{
+  public:
+    atom_cell_list() {}
+    /**
+     * @param num_sites Number of sites.
+     * @param radius Cutoff radius of every site in bohr, sites with a negative radius are left out.
+     */
+    atom_cell_list(const int num_sites,
+        const double* x_coordinates_bohr,
+        const double* y_coordinates_bohr,
+        const double* z_coordinates_bohr,
+        const std::vector<double>& radius);
+
+    /**
+     * @brief Calls f(site, distance) for every site that is at most its radius away from (x, y, z).
+     */
+    template <typename F>
+    void for_each(const double x, const double y, const double z, F f) const
+    {
+      int lo[3], hi[3];
+      if (!cell_range(x, y, z, lo, hi))
+        return;
+      for (int cx = lo[0]; cx <= hi[0]; cx++)
+        for (int cy = lo[1]; cy <= hi[1]; cy++)
+          for (int cz = lo[2]; cz <= hi[2]; cz++) {
+            const int c = (cx * num_cells_[1] + cy) * num_cells_[2] + cz;
+            for (int k = cell_start_[c]; k < cell_start_[c + 1]; k++) {
+              const int s = cell_sites_[k];
+              const double dx = x_[s] - x, dy = y_[s] - y, dz = z_[s] - z;
+              const double d2 = dx * dx + dy * dy + dz * dz;
+              if (d2 <= radius2_[s])
+                f(s, std::sqrt(d2));
+            }
+          }
+    }
+
+    /**
+     * @brief Replaces list by the sites within reach of (x, y, z), in ascending order.
+     */
+    void get_neighbors(const double x, const double y, const double z, std::vector<int>& list) const;
+
+  private:
+    bool cell_range(const double x, const double y, const double z, int lo[3], int hi[3]) const;
+
+    std::vector<double> x_, y_, z_, radius2_;
+    double origin_[3] = {0, 0, 0};
+    double cell_size_ = 1.0;
+    int num_cells_[3] = {0, 0, 0};
+    std::vector<int> cell_start_;
+    std::vector<int> cell_sites_;
+};
+
+/**
+ * @brief Version of the files of the prototype grid cache, files of other versions are rebuilt. Has to be increased
+ * whenever the construction of AtomGrid changes.
+ */
+const std::uint32_t atom_grid_cache_version = 3;
+
+/**
+ * @brief Points and weights of a built prototype grid. Shared by all copies of an AtomGrid and the prototype cache,
+ * never changed once built.
+ */
+struct atom_grid_points
+{
+    std::vector<double> x_bohr, y_bohr, z_bohr, w;
+    std::vector<int> partner;
+    std::vector<double> radial_r_bohr, radial_w;
+};
+
 class AtomGrid
 {
   public:
+    /**
+     * @brief Builds the prototype grid of an element, centered at the origin.
+     *
+     * Grids are cached by their exact arguments, within the process until clear_prototype_cache and, if a cache
+     * directory is set, on disk, so repeated runs with the same elements, basis and accuracy reuse them instead of
+     * rebuilding. Copies of a grid share its points.
+     * @param pruning Distribution of the angular orders between min_num_angular_points and max_num_angular_points
+     * over the radial shells, one of angular_pruning.
+     * @param radial Radial quadrature, one of radial_scheme. Schemes other than RADIAL_LOG take as many shells as
+     * they need to integrate the spherical atom and the tightest and most diffuse basis functions as accurately as the
+     * logarithmic grid of radial_precision.
+     * @param cached False builds the grid without looking it up in or adding it to either cache, for trial grids that
+     * are thrown away.
+     */
     AtomGrid(const double radial_precision,
         const int min_num_angular_points,
         const int max_num_angular_points,
@@ -12,10 +176,24 @@ class AtomGrid
         const double alpha_max,
         const int max_l_quantum_number,
         const double alpha_min[],
-        std::ostream& file);
+        std::ostream& file,
+        const int pruning = PRUNING_LINEAR,
+        const int radial = RADIAL_LOG,
+        const bool cached = true);
 
     ~AtomGrid();
 
+    /**
+     * @brief Directory of the on-disk prototype cache, set from -grid_cache. Empty (the default) keeps the cache in
+     * memory only.
+     */
+    static void set_cache_directory(const std::string& directory);
+
+    /**
+     * @brief Drops the in-process prototype cache, grids built so far keep their points.
+     */
+    static void clear_prototype_cache();
+
     int get_num_grid_points() const;
 
     int get_num_radial_grid_points() const;
@@ -30,7 +208,9 @@ class AtomGrid
         double grid_y_bohr[],
         double grid_z_bohr[],
         double grid_aw[],
-        double grid_mw[]) const;
+        double grid_mw[],
+        const atom_cell_list* neighbors = NULL,
+        const int partition = PARTITION_BECKE) const;
 
     void get_atomic_grid(
       const int center_index,
@@ -74,26 +254,47 @@ class AtomGrid
     void get_radial_grid_omp(double grid_r_bohr[], double grid_w[]) const;
     void get_radial_distances_omp(double grid_r_bohr[]) const;
 
-    double* get_gridx_ptr(void) { return atom_grid_x_bohr_.data(); };
-    double* get_gridy_ptr(void) { return atom_grid_y_bohr_.data(); };
-    double* get_gridz_ptr(void) { return atom_grid_z_bohr_.data(); };
-    double* get_gridw_ptr(void) { return atom_grid_w_.data(); };
+    const double* get_gridx_ptr(void) const { return points_->x_bohr.data(); };
+    const double* get_gridy_ptr(void) const { return points_->y_bohr.data(); };
+    const double* get_gridz_ptr(void) const { return points_->z_bohr.data(); };
+    const double* get_gridw_ptr(void) const { return points_->w.data(); };
 
-    double get_gridx(const int& i) { return atom_grid_x_bohr_[i]; };
-    double get_gridy(const int& i) { return atom_grid_y_bohr_[i]; };
-    double get_gridz(const int& i) { return atom_grid_z_bohr_[i]; };
+    double get_gridx(const int& i) const { return points_->x_bohr[i]; };
+    double get_gridy(const int& i) const { return points_->y_bohr[i]; };
+    double get_gridz(const int& i) const { return points_->z_bohr[i]; };
+    /**
+     * @brief Index of the point at -r on the same radial shell, which has the same weight, or -1 if there is none.
+     *
+     * Lebedev grids are centrosymmetric, so every point of the atomic grid has such a partner.
+     */
+    int get_inversion_partner(const int& i) const { return points_->partner[i]; };
 
   private:
+    void build(const double radial_precision,
+        const int min_num_angular_points,
+        const int max_num_angular_points,
+        const int proton_charge,
+        const double alpha_max,
+        const int max_l_quantum_number,
+        const double alpha_min[],
+        std::ostream& file,
+        const int pruning,
+        const int radial);
+
+    /**
+     * @brief Reads a cache file, false if it is missing, incomplete or was written for another key or version.
+     */
+    bool read_cache(const std::string& name, const std::vector<double>& key);
 
-    std::vector<double> atom_grid_x_bohr_;
-    std::vector<double> atom_grid_y_bohr_;
-    std::vector<double> atom_grid_z_bohr_;
-    std::vector<double> atom_grid_w_;
+    /**
+     * @brief Writes a cache file under a temporary name and renames it, so concurrent runs never read a partial file.
+     * Failures are reported to file.
+     */
+    bool write_cache(const std::string& name, const std::vector<double>& key, std::ostream& file) const;
 
-    int num_radial_grid_points_;
+    static std::string cache_directory_;
 
-    std::vector<double> radial_atom_grid_r_bohr_;
-    std::vector<double> radial_atom_grid_w_;
+    std::shared_ptr<const atom_grid_points> points_;
 };
 
 double get_becke_w(const int& num_centers,
@@ -107,6 +308,82 @@ double get_becke_w(const int& num_centers,
     const double& z,
     std::vector<double>& pa);
 
+/**
+ * @brief Becke weight of center_index at (x, y, z) taking only the centers in sites into account.
+ * @param sites Indices of the centers, ascending and including center_index.
+ */
+double get_becke_w(const int& num_sites,
+    const int sites[],
+    const int proton_charges[],
+    const double x_coordinates_bohr[],
+    const double y_coordinates_bohr[],
+    const double z_coordinates_bohr[],
+    const int& center_index,
+    const double& x,
+    const double& y,
+    const double& z,
+    std::vector<double>& pa);
+
+/**
+ * @brief Stratmann-Scuseria-Frisch weight of center_index at (x, y, z) taking only the centers in sites into account.
+ * @param sites Indices of the centers, including center_index.
+ * @param nearest Distance of center_index to its nearest neighbour, points closer than 0.18 of it to their center
+ * get the weight 1 without evaluating any cell function.
+ * @param pa Scratch space of at least num_sites entries.
+ */
+double get_ssf_w(const int& num_sites,
+    const int sites[],
+    const double x_coordinates_bohr[],
+    const double y_coordinates_bohr[],
+    const double z_coordinates_bohr[],
+    const int& center_index,
+    const double& nearest,
+    const double& x,
+    const double& y,
+    const double& z,
+    std::vector<double>& pa);
+
+/**
+ * @brief Prototype grid parameters of an element as chosen by select_atom_grid.
+ */
+struct atom_grid_settings
+{
+  double radial_precision;    ///< radial_precision of the AtomGrid
+  int min_num_angular_points; ///< Angular points close to the nucleus
+  int max_num_angular_points; ///< Angular points in the valence region
+  int num_points;             ///< Points of the prototype grid
+  double error;               ///< Estimated integration error of the test functions in electrons
+};
+
+/**
+ * @brief Chooses the smallest prototype grid of an element whose test integrations stay within target_error electrons.
+ *
+ * The spherical atom and the normalised tightest and most diffuse basis functions of every l have to be integrated
+ * on the radial grid to target_error / 4. The structure factors of the Becke part of the promolecule of a dimer with
+ * every partner element, up to sin(theta)/lambda = 0.7 / Angstrom, have to agree with those of a much finer grid to
+ * target_error, which also bounds the error in electrons (F000). Radial precision and angular orders are searched for
+ * the grid with the fewest points meeting both. If none does, the grid with the smallest error is returned. The errors
+ * are estimates from these model systems, the integration error of the whole molecule is logged with the partition.
+ * @param partners Atomic numbers of the elements next to which the atom may sit.
+ * @param pruning Angular pruning of the candidate grids, one of angular_pruning.
+ * @param radial Radial quadrature of the candidate grids, one of radial_scheme.
+ */
+atom_grid_settings select_atom_grid(const double target_error,
+    const int proton_charge,
+    const double alpha_max,
+    const int max_l_quantum_number,
+    const double alpha_min[],
+    const std::vector<int>& partners,
+    std::ostream& file,
+    const int pruning = PRUNING_LINEAR,
+    const int radial = RADIAL_LOG);
+
+/**
+ * @brief Electrons in the Becke part of the atom at the center of grid of the promolecule of a dimer with partner at
+ * the sum of their Bragg radii, the model system select_atom_grid tests with. Compares grids of one element.
+ */
+double dimer_share_electrons(AtomGrid& grid, const int proton_charge, const int partner);
+
 double get_r_inner(const double& max_error, const double& alpha_inner);
 
 double get_r_outer(const double& max_error,
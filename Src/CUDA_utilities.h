@@ -17,8 +17,6 @@ __constant__ int gpu_nex[1];
 __constant__ int gpu_nmo[1];
 __constant__ int gpu_ncen[1];
 __constant__ int gpu_MaxGrid[1];
-__constant__ float gpu_log_incr[1];
-__constant__ float gpu_start_radial_dens[1];
 __constant__ float gpu_bragg_angstrom[114]{
 0.00,
 	0.35, 0.35,
@@ -518,11 +516,13 @@ __global__ void gpu_make_grid(
 	grid_z_bohr[ipoint + offset] = z_bohr;
 }
 
-__global__ void gpu_linear_interpolate_spherical_density(
+// Same evaluation as spherical_density_spline::get, coef holds the coefficients of all intervals plus the zero padding interval
+__global__ void gpu_spline_spherical_density(
 	const int atom,
-	const float* radial_dens,
-	const float* spherical_dist,
-	const int size,
+	const float* coef,
+	const float inv_h,
+	const int intervals,
+	const float cutoff,
 	const bool match,
 	const int offset,
 	const float* gridx,
@@ -539,26 +539,14 @@ __global__ void gpu_linear_interpolate_spherical_density(
 	const int indice = blockIdx.x * blockDim.x + threadIdx.x;
 	if (indice >= num_points[atom]) return;
 	if (indice + offset >= gpu_MaxGrid[0]) return;
-	float dist[3] = { gridx[indice + offset] - posx[atom], gridy[indice + offset] - posy[atom], gridz[indice + offset] - posz[atom] };
-	//storing result in dist[0] to save memory
-	dist[0] = sqrt(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
-	float result;
-	if (dist[0] > spherical_dist[size - 1])
-		return;
-	else if (dist[0] < spherical_dist[0])
-		result = radial_dens[0];
-	else {
-		float step0 = dist[0] / gpu_start_radial_dens[0];
-		step0 = logf(step0);
-		step0 /= gpu_log_incr[0];
-		int step = floorf(step0);
-		if (step > size)
-			result = spherical_dist[size - 1];
-		else {
-			result = radial_dens[step] + (radial_dens[step + 1] - radial_dens[step]) / (spherical_dist[step] - spherical_dist[step - 1]) * (dist[0] - spherical_dist[step - 1]);
-			if (result < 1E-10) return;
-		}
-	}
+	const float dist[3] = { gridx[indice + offset] - posx[atom], gridy[indice + offset] - posy[atom], gridz[indice + offset] - posz[atom] };
+	const float r = sqrtf(dist[0] * dist[0] + dist[1] * dist[1] + dist[2] * dist[2]);
+	const float t = fminf(sqrtf(r) * inv_h, (float)intervals);
+	const int i = (int)t;
+	const float f = t - i;
+	const float* c = coef + 4 * i;
+	const float v = ((c[3] * f + c[2]) * f + c[1]) * f + c[0];
+	const float result = v >= cutoff ? v : 0.0f;
 	if (match) spherical_density[indice] = result;
 	Grids[indice + offset] += result;
 }
@@ -5,6 +5,7 @@
 #include "cube.h"
 #include "scattering_factors.h"
 #include "properties.h"
+#include "AtomGrid.h"
 
 using namespace std;
 
@@ -36,6 +37,8 @@ int main(int argc, char **argv)
         omp_set_num_threads(opt.threads);
 #endif
     }
+    if (!opt.grid_cache.empty())
+        AtomGrid::set_cache_directory(opt.grid_cache);
     log_file << NoSpherA2_message();
     if (!opt.no_date)
     {
@@ -188,6 +191,8 @@ int main(int argc, char **argv)
             }
         }
 
+        // the prototypes were shared by all wavefunctions
+        AtomGrid::clear_prototype_cache();
         known_scatterer = result.get_scatterers();
         log_file << "Final number of atoms in .tsc file: " << known_scatterer.size() << endl;
         time_point start = get_time();
@@ -16,6 +16,28 @@ string help_message()
     t.append("   -b              <FILENAME>               Read this basis set\n");
     t.append("   -d              <PATH>                   Path to basis_sets directory with basis_sets in tonto style\n");
     t.append("   -dmin		     <NUMBER>                   Minimum d-spacing to consider for scattering factors (repalaces hkl file)\n");
+    t.append("   -sf_kernel      0,1,2,3,4                Kernel used for the Fourier transform of atomic densities: 0 = scalar reference loop,\n");
+    t.append("                                            1 = cache-blocked vectorised loop (default, agrees with 0 to 1E-12 relative),\n");
+    t.append("                                            2 = non-uniform FFT for integer hkl, accuracy set by -nufft_precision,\n");
+    t.append("                                            3 = phase recurrence along l for integer hkl,\n");
+    t.append("                                            4 = mixed precision, reports its deviation from double precision\n");
+    t.append("   -nufft_precision <NUMBER>                Relative accuracy of the NUFFT kernel (default 1E-8)\n");
+    t.append("   -partition      0,1                      Atomic partition of the integration grids: 0 = Becke (default),\n");
+    t.append("                                            1 = Stratmann-Scuseria with screening, faster for larger molecules\n");
+    t.append("   -pruning        0,1                      Angular orders over the radial shells of the atomic grids: 0 = growing up to a fifth of\n");
+    t.append("                                            the Bragg radius (default), 1 = SG-1 regions relative to the Bragg radius, fewer points\n");
+    t.append("   -radial         0,1,2,3                  Radial quadrature of the atomic grids: 0 = logarithmic (default), 1 = Treutler-Ahlrichs M4,\n");
+    t.append("                                            2 = Mura-Knowles, 3 = Treutler-Ahlrichs up to Ar and logarithmic for heavier elements;\n");
+    t.append("                                            1-3 need fewer shells from -acc 2 on, -radial_benchmark <WFN> compares them\n");
+    t.append("   -grid_order     0,1                      Order of the points of the atomic grids: 0 = radial shells (default), 1 = Hilbert curve,\n");
+    t.append("                                            which evaluates the densities for spatially compact runs of points\n");
+    t.append("   -grid_checkpoint <FILENAME>              Read the Hirshfeld grids from this file if it matches wavefunction, CIF and -acc,\n");
+    t.append("                                            otherwise build them and write the file for later runs with other reflections\n");
+    t.append("   -grid_cache     <PATH>                   Existing directory to keep the atomic prototype grids in, later runs with the same\n");
+    t.append("                                            elements, basis and -acc read them instead of building them again\n");
+    t.append("   -grid_error     <NUMBER>                 Target error per atom in electrons and structure factors, replaces the levels of -acc by radial\n");
+    t.append("                                            precision and angular orders chosen per element on model dimers (e.g. 1E-3 ~ -acc 2)\n");
+    t.append("   -mem            <NUMBER>                 Memory limit in GB for the scattering factors, reflections are streamed to the tscb in chunks\n");
     t.append("   --help/-help/--h                         print this help\n");
     t.append("   -v                                       Turn on Verbose (debug) Mode (Slow and a LOT of output!)\n");
     t.append("   -v2                                      Even more stuff\n");
@@ -1287,6 +1309,44 @@ bool unsaved_files(vector<WFN> &wavy)
     return false;
 };
 
+mapped_file::mapped_file(const std::string &filename, std::ostream &file)
+{
+#ifdef _WIN32
+    ifstream in(filename.c_str(), ios::binary | ios::ate);
+    err_checkf(in.good(), "Could not open " + filename, file);
+    m_buffer.resize((size_t)in.tellg());
+    in.seekg(0, ios::beg);
+    if (m_buffer.size() > 0)
+        in.read(m_buffer.data(), m_buffer.size());
+    err_checkf(!in.bad(), "Error reading " + filename, file);
+    m_data = m_buffer.data();
+    m_size = m_buffer.size();
+#else
+    int fd = open(filename.c_str(), O_RDONLY);
+    err_checkf(fd >= 0, "Could not open " + filename, file);
+    struct stat st;
+    err_checkf(fstat(fd, &st) == 0, "Could not stat " + filename, file);
+    m_size = (size_t)st.st_size;
+    if (m_size > 0)
+    {
+        void *p = mmap(NULL, m_size, PROT_READ, MAP_PRIVATE, fd, 0);
+        err_checkf(p != MAP_FAILED, "Could not map " + filename, file);
+        madvise(p, m_size, MADV_SEQUENTIAL);
+        m_data = static_cast<const char *>(p);
+        m_mapped = true;
+    }
+    close(fd);
+#endif
+}
+
+mapped_file::~mapped_file()
+{
+#ifndef _WIN32
+    if (m_mapped)
+        munmap(const_cast<char *>(m_data), m_size);
+#endif
+}
+
 void progress_bar::write(double fraction)
 {
     // clamp fraction to valid range [0,1]
@@ -2714,6 +2774,47 @@ void options::digest_options()
                 ECP_mode = stoi(arguments[i + 1]);
             }
         }
+        else if (temp == "-sf_kernel")
+        {
+            sf_kernel = stoi(arguments[i + 1]);
+            err_checkf(sf_kernel >= 0 && sf_kernel <= 4, "Unknown structure factor kernel, use 0 (direct), 1 (blocked), 2 (NUFFT), 3 (phase recurrence) or 4 (mixed precision)", std::cout);
+        }
+        else if (temp == "-partition")
+        {
+            partition = stoi(arguments[i + 1]);
+            err_checkf(partition == 0 || partition == 1, "Unknown partition scheme, use 0 (Becke) or 1 (Stratmann-Scuseria)", std::cout);
+        }
+        else if (temp == "-pruning")
+        {
+            pruning = stoi(arguments[i + 1]);
+            err_checkf(pruning == 0 || pruning == 1, "Unknown angular pruning, use 0 (linear) or 1 (SG)", std::cout);
+        }
+        else if (temp == "-radial")
+        {
+            radial = stoi(arguments[i + 1]);
+            err_checkf(radial >= 0 && radial <= 3, "Unknown radial quadrature, use 0 (logarithmic), 1 (Treutler-Ahlrichs), 2 (Mura-Knowles) or 3 (per element)", std::cout);
+        }
+        else if (temp == "-grid_order")
+        {
+            grid_order = stoi(arguments[i + 1]);
+            err_checkf(grid_order == 0 || grid_order == 1, "Unknown grid order, use 0 (radial shells) or 1 (Hilbert curve)", std::cout);
+        }
+        else if (temp == "-nufft_precision")
+        {
+            nufft_precision = stod(arguments[i + 1]);
+            err_checkf(nufft_precision > 0 && nufft_precision < 1, "NUFFT precision has to be between 0 and 1", std::cout);
+        }
+        else if (temp == "-grid_checkpoint")
+            grid_checkpoint = arguments[i + 1];
+        else if (temp == "-grid_cache")
+            grid_cache = arguments[i + 1];
+        else if (temp == "-grid_error")
+        {
+            grid_error = stod(arguments[i + 1]);
+            err_checkf(grid_error > 0, "The target grid error has to be positive", std::cout);
+        }
+        else if (temp == "-mem")
+            mem = stod(arguments[i + 1]);
         else if (temp == "-set_ECPs")
         {
             set_ECPs = true;
@@ -2859,6 +2960,12 @@ void options::digest_options()
             test_timing();
             exit(0);
         }
+        else if (temp == "-radial_benchmark")
+        {
+            wfn = arguments[i + 1];
+            radial_grid_benchmark(*this, log_file);
+            exit(0);
+        }
         else if (temp == "-radius")
             radius = stod(arguments[i + 1]);
         else if (temp == "-resolution")
@@ -1,10 +1,12 @@
 #pragma once
 #define WIN32_LEAN_AND_MEAN
 #include <algorithm>
+#include <array>
 #include <chrono>
 #include <cmath>
 #include <complex>
 #ifdef __cplusplus__
+#include <cstdint>
 #include <cstdlib>
 #else
 #include <stdlib.h>
@@ -20,6 +22,7 @@
 #include <regex>
 #include <set>
 #include <map>
+#include <unordered_map>
 #include <string>
 #include <stdexcept>
 #include <sstream>
@@ -38,6 +41,9 @@
 #include <sys/wait.h>
 #include <termios.h>
 #include <cstring>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
 #endif
 
 // Pre-definition of classes included later
@@ -799,6 +805,54 @@ public:
 
     void write(double fraction);
 };
+
+/**
+ * @brief Read-only view of a whole file, memory mapped where the platform allows it.
+ *
+ * On POSIX systems the file is mapped with mmap, elsewhere it is read into an owned buffer. An empty file gives
+ * a valid object with size() == 0.
+ */
+class mapped_file
+{
+    const char *m_data = NULL;
+    size_t m_size = 0;
+    bool m_mapped = false;
+    std::vector<char> m_buffer;
+
+public:
+    /**
+     * @brief Opens and maps the file.
+     * @param filename Name of the file.
+     * @param file Stream for error messages if the file can not be opened.
+     */
+    mapped_file(const std::string &filename, std::ostream &file);
+    ~mapped_file();
+    // not copyable
+    mapped_file(const mapped_file &) = delete;
+    mapped_file &operator=(const mapped_file &) = delete;
+
+    const char *data() const { return m_data; }
+    size_t size() const { return m_size; }
+};
+
+/**
+ * @brief Incremental 64 bit FNV-1a hash.
+ */
+struct fnv1a
+{
+    std::uint64_t value = 14695981039346656037ULL;
+    void add(const void *data, const size_t size)
+    {
+        const unsigned char *c = static_cast<const unsigned char *>(data);
+        for (size_t i = 0; i < size; i++)
+        {
+            value ^= c[i];
+            value *= 1099511628211ULL;
+        }
+    }
+    template <typename T>
+    void add(const T &v) { add(&v, sizeof(T)); }
+};
 /*
 
 class cosinus_annaeherung
@@ -1013,8 +1067,152 @@ struct tonto_primitive
     }
 };
 
-typedef std::set<ivec> hkl_list;
-typedef std::set<ivec>::const_iterator hkl_list_it;
+/**
+ * @brief Sorted, duplicate free list of integer Miller indices.
+ *
+ * The indices are stored as packed int triplets in lexicographic order, which is the order a std::set<ivec> would
+ * give, so reflection s of the list is also entry s of every k-point and scattering factor vector. Entries can be
+ * accessed in O(1) and looked up through a hash index.
+ * New indices are collected with emplace/push_back and only become visible after finalize(), which sorts, removes
+ * duplicates and rebuilds the index.
+ */
+class hkl_list
+{
+    std::vector<int> m_hkl;
+    size_t m_size = 0;
+    std::unordered_map<long long int, size_t> m_index;
+
+public:
+    /**
+     * @brief Packs an index triplet into a single key with the same ordering as the triplet, |h|,|k|,|l| < 2^20.
+     */
+    static long long int pack(const int h, const int k, const int l)
+    {
+        return ((long long int)(h + 1048576) << 42) | ((long long int)(k + 1048576) << 21) | (long long int)(l + 1048576);
+    }
+    static void unpack(const long long int key, int *hkl)
+    {
+        hkl[0] = (int)(key >> 42) - 1048576;
+        hkl[1] = (int)((key >> 21) & 2097151) - 1048576;
+        hkl[2] = (int)(key & 2097151) - 1048576;
+    }
+
+    class const_iterator
+    {
+        const int *m_p;
+
+    public:
+        explicit const_iterator(const int *p) : m_p(p) {}
+        ivec operator*() const { return ivec{m_p[0], m_p[1], m_p[2]}; }
+        const_iterator &operator++()
+        {
+            m_p += 3;
+            return *this;
+        }
+        bool operator==(const const_iterator &o) const { return m_p == o.m_p; }
+        bool operator!=(const const_iterator &o) const { return m_p != o.m_p; }
+    };
+
+    hkl_list() {}
+    /**
+     * @brief Builds the list from packed keys (see pack), which may be unsorted and contain duplicates.
+     */
+    explicit hkl_list(std::vector<long long int> keys) { assign(keys); }
+
+    size_t size() const { return m_size; }
+    bool empty() const { return m_size == 0; }
+    const_iterator begin() const { return const_iterator(m_hkl.data()); }
+    const_iterator end() const { return const_iterator(m_hkl.data() + 3 * m_size); }
+
+    /**
+     * @brief Returns the s-th reflection.
+     */
+    ivec operator[](const size_t s) const { return ivec{m_hkl[3 * s], m_hkl[3 * s + 1], m_hkl[3 * s + 2]}; }
+    /**
+     * @brief Returns index i (0 = h, 1 = k, 2 = l) of the s-th reflection.
+     */
+    int operator()(const size_t s, const int i) const { return m_hkl[3 * s + i]; }
+    const int *data() const { return m_hkl.data(); }
+    long long int key(const size_t s) const { return pack(m_hkl[3 * s], m_hkl[3 * s + 1], m_hkl[3 * s + 2]); }
+
+    /**
+     * @brief Position of the reflection in the list, or -1 if it is not contained.
+     */
+    long long int find(const int h, const int k, const int l) const
+    {
+        auto it = m_index.find(pack(h, k, l));
+        return it == m_index.end() ? -1 : (long long int)it->second;
+    }
+    long long int find(const ivec &hkl) const { return find(hkl[0], hkl[1], hkl[2]); }
+    bool contains(const int h, const int k, const int l) const { return m_index.count(pack(h, k, l)) != 0; }
+    bool contains(const ivec &hkl) const { return contains(hkl[0], hkl[1], hkl[2]); }
+
+    /**
+     * @brief Appends a reflection, call finalize() before using the list again.
+     */
+    void push_back(const int h, const int k, const int l)
+    {
+        m_hkl.push_back(h);
+        m_hkl.push_back(k);
+        m_hkl.push_back(l);
+    }
+    void emplace(const ivec &hkl) { push_back(hkl[0], hkl[1], hkl[2]); }
+
+    /**
+     * @brief Sorts all appended reflections into the list, removes duplicates and rebuilds the hash index.
+     */
+    void finalize()
+    {
+        const size_t n = m_hkl.size() / 3;
+        std::vector<long long int> keys(n);
+        for (size_t s = 0; s < n; s++)
+            keys[s] = pack(m_hkl[3 * s], m_hkl[3 * s + 1], m_hkl[3 * s + 2]);
+        assign(keys);
+    }
+
+    /**
+     * @brief Replaces the content by the given packed keys, which may be unsorted and contain duplicates.
+     */
+    void assign(std::vector<long long int> &keys)
+    {
+        std::sort(keys.begin(), keys.end());
+        keys.erase(std::unique(keys.begin(), keys.end()), keys.end());
+        m_size = keys.size();
+        m_hkl.resize(3 * m_size);
+        m_hkl.shrink_to_fit();
+        m_index.clear();
+        m_index.reserve(m_size);
+        for (size_t s = 0; s < m_size; s++)
+        {
+            unpack(keys[s], &m_hkl[3 * s]);
+            m_index.emplace(keys[s], s);
+        }
+    }
+
+    /**
+     * @brief Removes a reflection, if present.
+     */
+    void erase(const ivec &hkl)
+    {
+        const long long int pos = find(hkl);
+        if (pos < 0)
+            return;
+        std::vector<long long int> keys;
+        keys.reserve(m_size - 1);
+        for (size_t s = 0; s < m_size; s++)
+            if (s != (size_t)pos)
+                keys.push_back(key(s));
+        assign(keys);
+    }
+
+    void clear()
+    {
+        m_hkl.clear();
+        m_size = 0;
+        m_index.clear();
+    }
+};
+typedef hkl_list::const_iterator hkl_list_it;
 
 typedef std::set<vec> hkl_list_d;
 typedef std::set<vec>::const_iterator hkl_list_it_d;
@@ -1039,6 +1237,11 @@ struct options
     double sfac_diffuse = 0.0;
     double dmin = 99.0;
     double mem = 0.0;
+    double nufft_precision = 1E-8;
+    double grid_error = 0.0;
+    int pruning = 0;
+    int radial = 0;
+    int grid_order = 0;
     double MinMax[6]{ 0, 0, 0, 0, 0, 0 };
     ivec MOs;
     std::vector<ivec> groups;
@@ -1062,6 +1265,8 @@ struct options
     std::string basis_set;
     std::string hkl;
     std::string cif;
+    std::string grid_checkpoint;
+    std::string grid_cache;
     std::string method;
     std::string xyz_file;
     std::string coef_file;
@@ -1109,6 +1314,8 @@ struct options
     int ncpus = 0;
     int charge = 0;
     int ECP_mode = 0;
+    int sf_kernel = 1;
+    int partition = 0;
     unsigned int mult = 0;
     hkl_list m_hkl_list;
 
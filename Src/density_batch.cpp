@@ -0,0 +1,255 @@
+/**
+ * @file density_batch.cpp
+ * @brief Contraction recovery, AO evaluation and blocked AO to MO product of the batched density engine.
+ */
+
+#include "density_batch.h"
+#include "wfn_class.h"
+
+#include <algorithm>
+#include <array>
+#include <map>
+
+// corresponds to cutoff of exp ~< 1E-20, as in WFN::compute_dens
+static const double density_batch_exp_cutoff = 46.0517;
+
+density_batch::density_batch(const wfn_snapshot &snapshot, const double tolerance)
+    : snap(snapshot), nmo(snapshot.get_nmo()), nmo_pad(snapshot.get_nmo_pad()), occ(snapshot.occupations())
+{
+    const int ncen = snap.get_ncen();
+    const int nex = snap.get_nex();
+    center_start.assign(ncen + 1, 0);
+    if (snap.is_spherical())
+        return;
+
+    // Merge every primitive into the first AO of its center and angular part whose coefficient row is proportional
+    std::vector<ivec> ao_prims;
+    ivec ao_ref, ao_cen;
+    vec scale(nex, 0.0);
+    std::map<std::array<int, 4>, ivec> aos_of;
+    for (int j = 0; j < nex; j++)
+    {
+        const double *row = snap.coef_row(j);
+        double largest = 0.0;
+        for (int m = 0; m < nmo; m++)
+            largest = std::max(largest, std::abs(row[m]));
+        if (largest == 0.0)
+            continue; // does not contribute to any MO
+        const int c = snap.prim_center(j);
+        const int *l = snap.prim_l(j);
+        ivec &candidates = aos_of[{c, l[0], l[1], l[2]}];
+        int found = -1;
+        for (const int a : candidates)
+        {
+            const double *ref = snap.coef_row(ao_ref[a]);
+            int pivot = 0;
+            for (int m = 0; m < nmo; m++)
+                if (std::abs(ref[m]) > std::abs(ref[pivot]))
+                    pivot = m;
+            const double ratio = row[pivot] / ref[pivot];
+            double deviation = 0.0;
+            for (int m = 0; m < nmo; m++)
+                deviation = std::max(deviation, std::abs(row[m] - ratio * ref[m]));
+            if (deviation <= tolerance * largest)
+            {
+                found = a;
+                scale[j] = ratio;
+                break;
+            }
+        }
+        if (found == -1)
+        {
+            found = (int)ao_ref.size();
+            ao_ref.push_back(j);
+            ao_cen.push_back(c);
+            ao_prims.emplace_back();
+            candidates.push_back(found);
+            scale[j] = 1.0;
+        }
+        ao_prims[found].push_back(j);
+    }
+
+    // Sort the AOs by center and pack their primitives in that order
+    ivec order(ao_ref.size());
+    for (int a = 0; a < (int)order.size(); a++)
+        order[a] = a;
+    std::stable_sort(order.begin(), order.end(), [&](const int a, const int b)
+                     { return ao_cen[a] < ao_cen[b]; });
+    const int nao = (int)order.size();
+    coef.resize(nao);
+    ao_center.resize(nao);
+    ao_l.resize(3 * nao);
+    ao_prim_start.assign(nao + 1, 0);
+    ao_min_exponent.resize(nao);
+    for (int a = 0; a < nao; a++)
+    {
+        const int o = order[a];
+        ao_center[a] = ao_cen[o];
+        center_start[ao_cen[o] + 1]++;
+        for (int k = 0; k < 3; k++)
+            ao_l[3 * a + k] = snap.prim_l(ao_ref[o])[k];
+        err_checkf(ao_l[3 * a] != -1, "Unknown primitive type in batched density!", std::cout);
+        coef[a] = snap.coef_row(ao_ref[o]);
+        ao_min_exponent[a] = snap.exponent(ao_prims[o][0]);
+        for (const int j : ao_prims[o])
+        {
+            prim_exponent.push_back(snap.exponent(j));
+            prim_scale.push_back(scale[j]);
+            ao_min_exponent[a] = std::min(ao_min_exponent[a], snap.exponent(j));
+        }
+        ao_prim_start[a + 1] = (int)prim_exponent.size();
+    }
+    for (int c = 0; c < ncen; c++)
+        center_start[c + 1] += center_start[c];
+}
+
+void density_batch::compute(const double *x, const double *y, const double *z, const int n, double *rho,
+                            density_batch_workspace &ws, const bool add_ECP_dens) const
+{
+    if (snap.is_spherical())
+    {
+        const WFN &wave = snap.get_wfn();
+        ws.d.resize(5);
+        for (vec &d : ws.d)
+            d.resize(wave.get_ncen());
+        ws.phi.resize(wave.get_nmo());
+        for (int p = 0; p < n; p++)
+            rho[p] = wave.compute_dens(x[p], y[p], z[p], ws.d, ws.phi, add_ECP_dens);
+        return;
+    }
+    ws.dist.resize(4 * density_batch_size);
+    ws.ao.resize((size_t)get_ao_count() * density_batch_size);
+    ws.phi.resize((size_t)nmo_pad * density_batch_size);
+    ws.active.resize(get_ao_count());
+    for (int start = 0; start < n; start += density_batch_size)
+    {
+        const int size = std::min(density_batch_size, n - start);
+        compute_block(x + start, y + start, z + start, size, rho + start, ws, add_ECP_dens);
+    }
+}
+
+void density_batch::compute_block(const double *x, const double *y, const double *z, const int n, double *rho,
+                                  density_batch_workspace &ws, const bool add_ECP_dens) const
+{
+    // Bounding sphere of the block, used to skip centers whose functions vanish on all of its points
+    double lo[3] = {x[0], y[0], z[0]}, hi[3] = {x[0], y[0], z[0]};
+    for (int p = 1; p < n; p++)
+    {
+        lo[0] = std::min(lo[0], x[p]), hi[0] = std::max(hi[0], x[p]);
+        lo[1] = std::min(lo[1], y[p]), hi[1] = std::max(hi[1], y[p]);
+        lo[2] = std::min(lo[2], z[p]), hi[2] = std::max(hi[2], z[p]);
+    }
+    const double mid[3] = {(lo[0] + hi[0]) / 2, (lo[1] + hi[1]) / 2, (lo[2] + hi[2]) / 2};
+    const double radius = sqrt(pow(hi[0] - mid[0], 2) + pow(hi[1] - mid[1], 2) + pow(hi[2] - mid[2], 2));
+
+    for (int p = 0; p < n; p++)
+        rho[p] = 0.0;
+    double *dx = ws.dist.data(), *dy = dx + density_batch_size, *dz = dy + density_batch_size, *r2 = dz + density_batch_size;
+    int nactive = 0;
+    for (int c = 0; c + 1 < (int)center_start.size(); c++)
+    {
+        const bool ecp = add_ECP_dens && snap.ecp_electrons(c) != 0.0;
+        if (center_start[c] == center_start[c + 1] && !ecp)
+            continue;
+        const double *pos = snap.center(c);
+        const double dmin = std::max(0.0, sqrt(pow(pos[0] - mid[0], 2) + pow(pos[1] - mid[1], 2) + pow(pos[2] - mid[2], 2)) - radius);
+        bool reached = ecp;
+        for (int a = center_start[c]; a < center_start[c + 1] && !reached; a++)
+            reached = ao_min_exponent[a] * dmin * dmin <= density_batch_exp_cutoff;
+        if (!reached)
+            continue;
+        for (int p = 0; p < n; p++)
+        {
+            dx[p] = x[p] - pos[0];
+            dy[p] = y[p] - pos[1];
+            dz[p] = z[p] - pos[2];
+            r2[p] = dx[p] * dx[p] + dy[p] * dy[p] + dz[p] * dz[p];
+        }
+        if (ecp) // a tight spherical gaussian standing in for the core electrons of the ECP
+            for (int p = 0; p < n; p++)
+                rho[p] += 8 * snap.ecp_electrons(c) * exp(-constants::FOUR_PI * r2[p]);
+        for (int a = center_start[c]; a < center_start[c + 1]; a++)
+        {
+            if (ao_min_exponent[a] * dmin * dmin > density_batch_exp_cutoff)
+                continue;
+            double *row = &ws.ao[(size_t)nactive * density_batch_size];
+            bool nonzero = false;
+            for (int p = 0; p < n; p++)
+            {
+                double radial = 0.0;
+                for (int k = ao_prim_start[a]; k < ao_prim_start[a + 1]; k++)
+                {
+                    const double ex = -prim_exponent[k] * r2[p];
+                    if (ex < -density_batch_exp_cutoff)
+                        continue;
+                    radial += prim_scale[k] * exp(ex);
+                }
+                if (radial != 0.0)
+                {
+                    for (int i = 0; i < ao_l[3 * a]; i++)
+                        radial *= dx[p];
+                    for (int i = 0; i < ao_l[3 * a + 1]; i++)
+                        radial *= dy[p];
+                    for (int i = 0; i < ao_l[3 * a + 2]; i++)
+                        radial *= dz[p];
+                    nonzero = true;
+                }
+                row[p] = radial;
+            }
+            if (nonzero)
+                ws.active[nactive++] = a;
+        }
+    }
+
+    // phi[p][mo] = sum_a A[a][p] C[a][mo], tiled over the AOs and four points at a time
+    double *phi = ws.phi.data();
+    std::fill(phi, phi + (size_t)n * nmo_pad, 0.0);
+    for (int a0 = 0; a0 < nactive; a0 += density_batch_ao_tile)
+    {
+        const int a1 = std::min(nactive, a0 + density_batch_ao_tile);
+        int p = 0;
+        for (; p + 4 <= n; p += 4)
+        {
+            double *__restrict f0 = phi + (size_t)p * nmo_pad, *__restrict f1 = f0 + nmo_pad,
+                               *__restrict f2 = f1 + nmo_pad, *__restrict f3 = f2 + nmo_pad;
+            for (int a = a0; a < a1; a++)
+            {
+                const double *row = &ws.ao[(size_t)a * density_batch_size + p];
+                if (row[0] == 0.0 && row[1] == 0.0 && row[2] == 0.0 && row[3] == 0.0)
+                    continue;
+                const double v0 = row[0], v1 = row[1], v2 = row[2], v3 = row[3];
+                const double *__restrict cr = coef[ws.active[a]];
+                for (int m = 0; m < nmo_pad; m++)
+                {
+                    const double cm = cr[m];
+                    f0[m] += v0 * cm;
+                    f1[m] += v1 * cm;
+                    f2[m] += v2 * cm;
+                    f3[m] += v3 * cm;
+                }
+            }
+        }
+        for (; p < n; p++)
+        {
+            double *__restrict f0 = phi + (size_t)p * nmo_pad;
+            for (int a = a0; a < a1; a++)
+            {
+                const double v0 = ws.ao[(size_t)a * density_batch_size + p];
+                if (v0 == 0.0)
+                    continue;
+                const double *__restrict cr = coef[ws.active[a]];
+                for (int m = 0; m < nmo_pad; m++)
+                    f0[m] += v0 * cr[m];
+            }
+        }
+    }
+
+    for (int p = 0; p < n; p++)
+    {
+        const double *f = phi + (size_t)p * nmo_pad;
+        double sum = 0.0;
+        for (int m = 0; m < nmo_pad; m++)
+            sum += occ[m] * f[m] * f[m];
+        rho[p] += sum;
+    }
+}
@@ -0,0 +1,103 @@
+/**
+ * @file density_batch.h
+ * @brief Evaluation of the electron density of a wavefunction on batches of points.
+ *
+ * WFN::compute_dens evaluates one point at a time and loops over all primitives and all MOs for every primitive.
+ * The batch engine instead takes blocks of points and evaluates the contracted atomic orbitals (AOs) of the
+ * basis on the whole block first. The MO values are then formed by one blocked matrix product
+ * phi[p][mo] = sum_ao A[p][ao] C[ao][mo], and the density is the occupation weighted sum of their squares.
+ *
+ * The wavefunction files only store primitives, so the contractions are recovered when the engine is built:
+ * primitives on the same center with the same angular exponents whose coefficient rows over the occupied MOs
+ * are proportional belong to one contracted AO. The row of the first primitive of every AO in the wfn_snapshot
+ * serves as row of the AO to MO matrix.
+ */
+#pragma once
+
+#include "convenience.h"
+#include "wfn_snapshot.h"
+
+/**
+ * @brief Number of points evaluated together. The MO values of a batch (points x occupied MOs) stay in L2.
+ */
+const int density_batch_size = 128;
+
+/**
+ * @brief Number of AOs per tile of the matrix product, so the tile of the AO to MO matrix stays in L1.
+ */
+const int density_batch_ao_tile = 32;
+
+/**
+ * @brief Maximum deviation from proportionality of two primitive coefficient rows, relative to the largest
+ * coefficient of the row, below which both are merged into the same contracted AO.
+ *
+ * wfn and wfx files print the coefficients with 9 significant digits, so the rows of a contraction only agree
+ * to a few 1E-9. Merging them changes the density by less than the rounding of the file itself.
+ */
+const double density_batch_contraction_tolerance = 5E-8;
+
+/**
+ * @brief Scratch space of one thread evaluating batches. The buffers grow on first use and are reused afterwards.
+ */
+struct density_batch_workspace
+{
+    vec dist;         ///< dx, dy, dz and r^2 of the points of a batch relative to one center
+    vec ao;           ///< Values of the active AOs on the batch, one row of density_batch_size points per AO
+    vec phi;          ///< MO values on the batch, one row of padded MO count per point
+    ivec active;      ///< AOs with non zero values on the batch
+    std::vector<vec> d; ///< Scratch of WFN::compute_dens for the per point fallback
+};
+
+/**
+ * @brief Immutable batched density evaluator of the MOs of a wfn_snapshot.
+ *
+ * The engine refers to the coefficient rows of the snapshot, which has to outlive it. For spherical harmonic
+ * basis sets it falls back to WFN::compute_dens of the WFN the snapshot was built from.
+ */
+class density_batch
+{
+public:
+    /**
+     * @brief Collects the contracted AOs of the primitives of snapshot.
+     * @param snapshot Packed wavefunction to evaluate, usually of the occupied MOs only
+     * @param tolerance Relative tolerance of the proportionality test merging primitives into contracted AOs
+     */
+    density_batch(const wfn_snapshot &snapshot, const double tolerance = density_batch_contraction_tolerance);
+
+    /**
+     * @brief Evaluates the density at n points.
+     *
+     * Primitives with alpha * r^2 > 46.0517 are skipped per point as in WFN::compute_dens, so both agree up to
+     * the summation order and the contraction tolerance.
+     * @param x, y, z Coordinates of the points in bohr
+     * @param n Number of points
+     * @param rho Receives the n densities
+     * @param ws Scratch space of the calling thread
+     * @param add_ECP_dens Whether to add the core density replacing the electrons of ECPs
+     */
+    void compute(const double *x, const double *y, const double *z, const int n, double *rho,
+                 density_batch_workspace &ws, const bool add_ECP_dens = true) const;
+
+    int get_ao_count() const { return (int)ao_center.size(); };
+    int get_primitive_count() const { return (int)prim_exponent.size(); };
+    int get_mo_count() const { return nmo; };
+
+private:
+    void compute_block(const double *x, const double *y, const double *z, const int n, double *rho,
+                       density_batch_workspace &ws, const bool add_ECP_dens) const;
+
+    const wfn_snapshot &snap;
+    int nmo;     ///< Number of MOs
+    int nmo_pad; ///< Row length of the coefficients and of the MO values
+    const double *occ;
+    std::vector<const double *> coef; ///< Coefficient row of every AO
+
+    // AOs are sorted by center, the AOs of center c are center_start[c] to center_start[c + 1] - 1
+    ivec center_start;
+    ivec ao_center;
+    ivec ao_l;          ///< lx, ly, lz of every AO
+    ivec ao_prim_start; ///< The primitives of AO a are ao_prim_start[a] to ao_prim_start[a + 1] - 1
+    vec ao_min_exponent;
+    vec prim_exponent;
+    vec prim_scale; ///< Coefficient of the primitive relative to the row of its AO in coef
+};
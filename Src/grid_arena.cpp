@@ -0,0 +1,215 @@
+/**
+ * @file grid_arena.cpp
+ * @brief Allocation, compaction and shrinking of grid arenas.
+ */
+
+#include "grid_arena.h"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+
+static double *align_64(void *block)
+{
+    return reinterpret_cast<double *>((reinterpret_cast<std::uintptr_t>(block) + 63) / 64 * 64);
+}
+
+static long long int slot_size(const long long int points)
+{
+    return (points + 7) / 8 * 8;
+}
+
+void grid_arena::release()
+{
+    std::free(m_block);
+    m_block = NULL;
+    m_data = NULL;
+    m_columns = 0;
+    m_column_size = 0;
+    m_offset.clear();
+    m_capacity.clear();
+    m_points.clear();
+    m_pairs.clear();
+}
+
+void grid_arena::allocate(const ivec &capacity, const int columns)
+{
+    release();
+    const int atoms = static_cast<int>(capacity.size());
+    m_offset.resize(atoms);
+    m_capacity.resize(atoms);
+    m_points.resize(atoms);
+    m_pairs.assign(atoms, 0);
+    for (int i = 0; i < atoms; i++)
+    {
+        m_offset[i] = m_column_size;
+        m_capacity[i] = m_points[i] = capacity[i];
+        m_column_size += slot_size(capacity[i]);
+    }
+    m_columns = columns;
+    // zeroed in parallel, so the pages are first touched by all threads instead of one
+    m_block = std::malloc(bytes() + 64);
+    err_checkf(m_block != NULL, "Could not allocate " + std::to_string(bytes() / 1048576) + " MB for the grids", std::cout);
+    m_data = align_64(m_block);
+    const long long int total = m_columns * m_column_size;
+#pragma omp parallel for schedule(static)
+    for (long long int i = 0; i < total; i++)
+        m_data[i] = 0.0;
+}
+
+long long int grid_arena::total_points() const
+{
+    long long int total = 0;
+    for (const long long int p : m_points)
+        total += p;
+    return total;
+}
+
+void grid_arena::set_points(const int atom, const long long int points)
+{
+    err_checkf(points >= 0 && points <= m_capacity[atom], "Grid of atom " + std::to_string(atom) + " can not hold " + std::to_string(points) + " points", std::cout);
+    m_points[atom] = points;
+}
+
+long long int grid_arena::compact(const int atom, const char *keep)
+{
+    const long long int n = m_points[atom];
+    long long int run = 0;
+    for (int c = 0; c < m_columns; c++)
+    {
+        double *v = column(c, atom);
+        run = 0;
+        for (long long int p = 0; p < n; p++)
+            if (keep[p])
+                v[run++] = v[p];
+    }
+    set_points(atom, run);
+    return run;
+}
+
+void grid_arena::permute(const int atom, const ivec &order)
+{
+    const long long int n = m_points[atom];
+    err_checkf(static_cast<long long int>(order.size()) == n, "Permutation does not match the grid of atom " + std::to_string(atom), std::cout);
+    vec temp(n);
+    for (int c = 0; c < m_columns; c++)
+    {
+        double *v = column(c, atom);
+        for (long long int q = 0; q < n; q++)
+            temp[q] = v[order[q]];
+        std::copy(temp.begin(), temp.end(), v);
+    }
+}
+
+// Hilbert index of a point with 21 bit coordinates, J. Skilling, AIP Conf. Proc. 707, 381 (2004)
+static std::uint64_t hilbert_key(std::uint32_t c[3])
+{
+    const int bits = 21;
+    // inverse undo of the excess work, axes to transposed Hilbert index
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+    {
+        const std::uint32_t p = q - 1;
+        for (int i = 0; i < 3; i++)
+            if (c[i] & q)
+                c[0] ^= p;
+            else
+            {
+                const std::uint32_t t = (c[0] ^ c[i]) & p;
+                c[0] ^= t;
+                c[i] ^= t;
+            }
+    }
+    // Gray encode
+    for (int i = 1; i < 3; i++)
+        c[i] ^= c[i - 1];
+    std::uint32_t t = 0;
+    for (std::uint32_t q = 1u << (bits - 1); q > 1; q >>= 1)
+        if (c[2] & q)
+            t ^= q - 1;
+    for (int i = 0; i < 3; i++)
+        c[i] ^= t;
+    // interleave the transposed index, most significant bit first
+    std::uint64_t key = 0;
+    for (int b = bits - 1; b >= 0; b--)
+        for (int i = 0; i < 3; i++)
+            key = (key << 1) | ((c[i] >> b) & 1u);
+    return key;
+}
+
+ivec hilbert_order(const double *x, const double *y, const double *z, const int n)
+{
+    const double *axis[3] = {x, y, z};
+    double lo[3], scale[3];
+    for (int k = 0; k < 3; k++)
+    {
+        lo[k] = 1E300;
+        double hi = -1E300;
+        for (int p = 0; p < n; p++)
+        {
+            lo[k] = std::min(lo[k], axis[k][p]);
+            hi = std::max(hi, axis[k][p]);
+        }
+        scale[k] = hi > lo[k] ? ((1u << 21) - 1) / (hi - lo[k]) : 0.0;
+    }
+    std::vector<std::pair<std::uint64_t, int>> keys(n);
+    for (int p = 0; p < n; p++)
+    {
+        std::uint32_t c[3];
+        for (int k = 0; k < 3; k++)
+            c[k] = static_cast<std::uint32_t>((axis[k][p] - lo[k]) * scale[k]);
+        keys[p] = std::make_pair(hilbert_key(c), p);
+    }
+    std::sort(keys.begin(), keys.end());
+    ivec order(n);
+    for (int p = 0; p < n; p++)
+        order[p] = keys[p].second;
+    return order;
+}
+
+void grid_arena::shrink(const int columns)
+{
+    err_checkf(columns <= m_columns, "Can not shrink a grid arena to more columns than it has", std::cout);
+    const int atoms = this->atoms();
+    std::vector<long long int> offset(atoms);
+    long long int column_size = 0;
+    for (int i = 0; i < atoms; i++)
+    {
+        offset[i] = column_size;
+        column_size += slot_size(m_points[i]);
+    }
+    // new positions are never above the old ones, and the old slot of a later atom always starts after the new
+    // slot of an earlier one ends, so moving in order never overwrites data that is still needed
+    for (int c = 0; c < columns; c++)
+        for (int i = 0; i < atoms; i++)
+        {
+            double *target = m_data + c * column_size + offset[i];
+            const double *source = column(c, i);
+            if (target != source)
+                std::memmove(target, source, m_points[i] * sizeof(double));
+        }
+    m_offset = offset;
+    m_capacity = m_points;
+    m_columns = columns;
+    m_column_size = column_size;
+    if (m_block == NULL)
+        return;
+    const std::ptrdiff_t shift = reinterpret_cast<char *>(m_data) - static_cast<char *>(m_block);
+    void *block = std::realloc(m_block, bytes() + 64);
+    // a failed shrink leaves the old block, which still holds the data
+    if (block == NULL)
+        return;
+    m_block = block;
+    m_data = align_64(block);
+    const std::ptrdiff_t new_shift = reinterpret_cast<char *>(m_data) - static_cast<char *>(block);
+    if (new_shift != shift)
+        std::memmove(m_data, static_cast<char *>(block) + shift, bytes());
+}
+
+std::vector<sf_grid_view> grid_arena::views() const
+{
+    std::vector<sf_grid_view> v(atoms());
+    for (int i = 0; i < atoms(); i++)
+        v[i] = sf_grid_view{column(GRID_X, i), column(GRID_Y, i), column(GRID_Z, i), column(GRID_DENSITY, i), m_points[i], m_pairs[i]};
+    return v;
+}
@@ -0,0 +1,122 @@
+/**
+ * @file grid_arena.h
+ * @brief Storage of the per atom grids of the grid builders in a single aligned allocation.
+ *
+ * The arena holds a number of columns (x, y, z, weights, densities) as structure of arrays. Every column is cut
+ * into one slot per atom, each slot a multiple of 8 doubles long, so every slot starts on a 64 byte boundary.
+ * The builders write the atomic grids straight into their slots, prune and finalise them in place and hand the
+ * result to the kernels as sf_grid_view, without per atom vectors or copies.
+ */
+#pragma once
+
+#include "convenience.h"
+#include "sf_kernels.h"
+
+/**
+ * @brief Columns of a grid_arena.
+ *
+ * The columns needed by the kernels come first, so grid_arena::shrink can keep them and drop the rest.
+ */
+enum grid_column
+{
+    GRID_X = 0,            ///< x of the point, relative to the atom once the grid is final
+    GRID_Y,                ///< y of the point, relative to the atom once the grid is final
+    GRID_Z,                ///< z of the point, relative to the atom once the grid is final
+    GRID_DENSITY,          ///< Density at the point, the weighted atomic density once the grid is final
+    GRID_ATOMIC_WEIGHT,    ///< Quadrature weight times partition weight of the point
+    GRID_MOLECULAR_WEIGHT, ///< Quadrature weight of the point in the molecular grid
+    GRID_SPHERICAL,        ///< Promolecule density at the point
+    GRID_OWN_SPHERICAL,    ///< Spherical density of the atom owning the grid
+    GRID_COLUMNS
+};
+
+/**
+ * @brief Number of columns of a finished grid, as used by the kernels.
+ */
+const int grid_final_columns = GRID_DENSITY + 1;
+
+/**
+ * @brief Order of the points within every atomic grid, selected by -grid_order.
+ */
+enum grid_point_order
+{
+    GRID_ORDER_PROTOTYPE = 0, ///< radial shells from the nucleus outwards, angular points within a shell (default)
+    GRID_ORDER_HILBERT = 1,   ///< along a Hilbert curve through the bounding box of the grid
+};
+
+/**
+ * @brief Permutation that sorts n points along a Hilbert curve through their bounding box, 21 bits per axis.
+ *
+ * Consecutive points of the result are close in space, so every batch of them only sees the nearby atoms and
+ * basis functions.
+ * @return order[q] is the index of the point that goes to position q.
+ */
+ivec hilbert_order(const double *x, const double *y, const double *z, const int n);
+
+class grid_arena
+{
+    void *m_block = NULL;           ///< As returned by malloc
+    double *m_data = NULL;          ///< m_block rounded up to 64 bytes
+    int m_columns = 0;              ///< Number of columns
+    long long int m_column_size = 0; ///< Doubles per column
+    std::vector<long long int> m_offset, m_capacity, m_points, m_pairs;
+
+    void release();
+
+public:
+    grid_arena() {}
+    ~grid_arena() { release(); }
+    grid_arena(const grid_arena &) = delete;
+    grid_arena &operator=(const grid_arena &) = delete;
+
+    /**
+     * @brief Allocates the arena, all points of all atoms are live and zero.
+     * @param capacity Number of points of every atom.
+     * @param columns Number of columns, the first ones of grid_column.
+     */
+    void allocate(const ivec &capacity, const int columns);
+
+    int atoms() const { return static_cast<int>(m_points.size()); }
+    int columns() const { return m_columns; }
+    double *column(const int c, const int atom) { return m_data + c * m_column_size + m_offset[atom]; }
+    const double *column(const int c, const int atom) const { return m_data + c * m_column_size + m_offset[atom]; }
+    long long int points(const int atom) const { return m_points[atom]; }
+    long long int pairs(const int atom) const { return m_pairs[atom]; }
+    void set_pairs(const int atom, const long long int pairs) { m_pairs[atom] = pairs; }
+    long long int total_points() const;
+
+    /**
+     * @brief Shortens the grid of an atom, e.g. after it was compacted in place.
+     */
+    void set_points(const int atom, const long long int points);
+
+    /**
+     * @brief Removes the points of an atom where keep is zero from all columns, keeping the order of the others.
+     * @return The number of points left.
+     */
+    long long int compact(const int atom, const char *keep);
+
+    /**
+     * @brief Reorders the live points of an atom in all columns, point order[q] moves to position q.
+     */
+    void permute(const int atom, const ivec &order);
+
+    /**
+     * @brief Moves the first columns of every atom's live points together and returns the rest of the memory.
+     *
+     * Slots only ever move to lower addresses, so this works in place and the allocation is only shrunk, never
+     * copied to a second one.
+     * @param columns Number of columns to keep.
+     */
+    void shrink(const int columns);
+
+    /**
+     * @brief Allocated memory in bytes.
+     */
+    size_t bytes() const { return m_columns * m_column_size * sizeof(double); }
+
+    /**
+     * @brief Views of the final grids (GRID_X, GRID_Y, GRID_Z and GRID_DENSITY), valid until the arena changes.
+     */
+    std::vector<sf_grid_view> views() const;
+};
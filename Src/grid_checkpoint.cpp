@@ -0,0 +1,197 @@
+/**
+ * @file grid_checkpoint.cpp
+ * @brief Writing, mapping and validation of Hirshfeld grid checkpoints.
+ */
+
+#include "grid_checkpoint.h"
+#include "AtomGrid.h"
+#include "wfn_class.h"
+
+#include <atomic>
+#include <cstdio>
+
+static const char grid_checkpoint_magic[8] = "NSA2GRD";
+
+std::uint64_t grid_checkpoint_hash(const WFN &wave, const std::string &cif, const int accuracy, const int pbc, const int partition, const double grid_error, const int pruning, const int radial, const int grid_order, const ivec &asym_atom_list)
+{
+    fnv1a h;
+    h.add(grid_checkpoint_version);
+    h.add(accuracy);
+    h.add(pbc);
+    h.add(partition);
+    h.add(grid_error);
+    h.add(pruning);
+    h.add(radial);
+    h.add(grid_order);
+    for (const int a : asym_atom_list)
+        h.add(a);
+    const int ncen = wave.get_ncen();
+    h.add(ncen);
+    for (int i = 0; i < ncen; i++)
+    {
+        h.add(wave.atoms[i].x);
+        h.add(wave.atoms[i].y);
+        h.add(wave.atoms[i].z);
+        h.add(wave.atoms[i].charge);
+        h.add(wave.atoms[i].ECP_electrons);
+        h.add(wave.atoms[i].label.data(), wave.atoms[i].label.size());
+    }
+    const int nex = wave.get_nex(), nmo = wave.get_nmo();
+    h.add(nex);
+    h.add(nmo);
+    for (int j = 0; j < nex; j++)
+    {
+        h.add(wave.get_center(j));
+        h.add(wave.get_type(j));
+        h.add(wave.get_exponent(j));
+    }
+    for (int m = 0; m < nmo; m++)
+    {
+        h.add(wave.get_MO_occ(m));
+        for (int j = 0; j < nex; j++)
+            h.add(wave.get_MO_coef(m, j));
+    }
+    mapped_file cif_file(cif, std::cout);
+    h.add(cif_file.data(), cif_file.size());
+    return h.value;
+}
+
+bool grid_checkpoint::load(const std::string &name, const std::uint64_t hash, const int accuracy, const int pbc, const std::vector<std::string> &labels, std::ostream &file)
+{
+    m_grids.clear();
+    m_labels.clear();
+    m_points = 0;
+    m_file.reset();
+    if (!exists(name))
+        return false;
+    std::unique_ptr<mapped_file> mapped(new mapped_file(name, file));
+    const char *base = mapped->data();
+    const size_t size = mapped->size();
+    grid_checkpoint_header head;
+    if (size < sizeof(head))
+    {
+        file << "Grid checkpoint " << name << " is truncated, rebuilding the grids" << std::endl;
+        return false;
+    }
+    std::memcpy(&head, base, sizeof(head));
+    if (std::memcmp(head.magic, grid_checkpoint_magic, sizeof(head.magic)) != 0 || head.version != grid_checkpoint_version)
+    {
+        file << "Grid checkpoint " << name << " has an unknown format, rebuilding the grids" << std::endl;
+        return false;
+    }
+    if (head.hash != hash || head.accuracy != accuracy || head.pbc != pbc || head.atoms != labels.size())
+    {
+        file << "Grid checkpoint " << name << " was made for another wavefunction, CIF or grid setting, rebuilding the grids" << std::endl;
+        return false;
+    }
+    if (size < sizeof(head) + head.atoms * sizeof(grid_checkpoint_atom) || head.data_offset % 64 != 0 || head.data_offset > size)
+    {
+        file << "Grid checkpoint " << name << " is truncated, rebuilding the grids" << std::endl;
+        return false;
+    }
+    const char *data = base + head.data_offset;
+    for (std::uint32_t i = 0; i < head.atoms; i++)
+    {
+        grid_checkpoint_atom atom;
+        std::memcpy(&atom, base + sizeof(head) + i * sizeof(atom), sizeof(atom));
+        atom.label[sizeof(atom.label) - 1] = '\0';
+        // write() starts every atom on a 64 byte boundary and pads its columns to the stride, anything else is corrupt
+        const bool layout_ok = atom.points <= atom.stride && 2 * atom.pairs <= atom.points && atom.offset % 64 == 0 &&
+                               atom.stride <= size / (4 * sizeof(double)) && atom.offset <= size &&
+                               head.data_offset + atom.offset + 4 * atom.stride * sizeof(double) <= size;
+        if (labels[i] != atom.label || !layout_ok)
+        {
+            if (layout_ok)
+                file << "Grid checkpoint " << name << " does not match the atoms of the CIF, rebuilding the grids" << std::endl;
+            else
+                file << "Grid checkpoint " << name << " is corrupt, rebuilding the grids" << std::endl;
+            m_grids.clear();
+            m_labels.clear();
+            m_points = 0;
+            return false;
+        }
+        const double *d1 = reinterpret_cast<const double *>(data + atom.offset);
+        m_grids.push_back(sf_grid_view{d1, d1 + atom.stride, d1 + 2 * atom.stride, d1 + 3 * atom.stride,
+                                       static_cast<long long int>(atom.points), static_cast<long long int>(atom.pairs)});
+        m_labels.push_back(atom.label);
+        m_points += atom.points;
+    }
+    m_file = std::move(mapped);
+    return true;
+}
+
+bool grid_checkpoint::write(const std::string &name, const std::uint64_t hash, const int accuracy, const int pbc,
+                            const std::vector<sf_grid_view> &grids, const std::vector<std::string> &labels, std::ostream &file)
+{
+    grid_checkpoint_header head;
+    std::memset(&head, 0, sizeof(head));
+    std::memcpy(head.magic, grid_checkpoint_magic, sizeof(head.magic));
+    head.version = grid_checkpoint_version;
+    head.atoms = static_cast<std::uint32_t>(grids.size());
+    head.accuracy = accuracy;
+    head.pbc = pbc;
+    head.hash = hash;
+    const size_t table_end = sizeof(head) + grids.size() * sizeof(grid_checkpoint_atom);
+    head.data_offset = (table_end + 63) / 64 * 64;
+
+    std::vector<grid_checkpoint_atom> atoms(grids.size());
+    std::uint64_t offset = 0;
+    for (size_t i = 0; i < grids.size(); i++)
+    {
+        if (labels[i].size() >= sizeof(atoms[i].label))
+        {
+            file << "Label " << labels[i] << " is too long for a grid checkpoint, not writing " << name << std::endl;
+            return false;
+        }
+        std::memset(&atoms[i], 0, sizeof(grid_checkpoint_atom));
+        atoms[i].points = grids[i].points;
+        atoms[i].pairs = grids[i].pairs;
+        atoms[i].stride = (grids[i].points + 7) / 8 * 8;
+        atoms[i].offset = offset;
+        std::memcpy(atoms[i].label, labels[i].c_str(), labels[i].size());
+        offset += 4 * atoms[i].stride * sizeof(double);
+        head.total_points += grids[i].points;
+    }
+
+    // write under a name unique to this process and rename, so concurrent runs never read a partial file
+    static std::atomic<unsigned int> temp_counter(0);
+    const std::string temp_name = name + ".tmp" + std::to_string(atom_grid_process_id()) + "_" + std::to_string(temp_counter++);
+    {
+        std::ofstream out(temp_name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+        if (!out.good())
+        {
+            file << "Could not write grid checkpoint " << name << std::endl;
+            return false;
+        }
+        out.write(reinterpret_cast<const char *>(&head), sizeof(head));
+        out.write(reinterpret_cast<const char *>(atoms.data()), atoms.size() * sizeof(grid_checkpoint_atom));
+        const std::vector<char> padding(64, 0);
+        out.write(padding.data(), head.data_offset - table_end);
+        for (size_t i = 0; i < grids.size(); i++)
+            for (const double *column : {grids[i].d1, grids[i].d2, grids[i].d3, grids[i].dens})
+            {
+                out.write(reinterpret_cast<const char *>(column), grids[i].points * sizeof(double));
+                out.write(padding.data(), (atoms[i].stride - grids[i].points) * sizeof(double));
+            }
+        out.flush();
+        if (out.bad())
+        {
+            out.close();
+            std::remove(temp_name.c_str());
+            file << "Error writing grid checkpoint " << name << std::endl;
+            return false;
+        }
+    }
+    if (std::rename(temp_name.c_str(), name.c_str()) != 0)
+    {
+        // Windows does not replace existing files on rename
+        std::remove(name.c_str());
+        if (std::rename(temp_name.c_str(), name.c_str()) != 0)
+        {
+            std::remove(temp_name.c_str());
+            file << "Could not write grid checkpoint " << name << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
@@ -0,0 +1,95 @@
+/**
+ * @file grid_checkpoint.h
+ * @brief Binary checkpoint of the final pruned Hirshfeld grids, so runs that only change the reflections
+ * (hkl file, twin law, dmin) can skip the grid generation.
+ *
+ * Layout (native endianness): a grid_checkpoint_header, one grid_checkpoint_atom per atom and the data section,
+ * starting at header.data_offset. Every atom stores d1, d2, d3 and dens as consecutive arrays of atom.stride doubles,
+ * all of them starting on a 64 byte boundary, so the mapped file can be handed to the kernels as sf_grid_view
+ * without copying.
+ */
+#pragma once
+
+#include "convenience.h"
+#include "sf_kernels.h"
+
+#include <cstdint>
+#include <memory>
+
+class WFN;
+
+/**
+ * @brief Version of the checkpoint layout, files of other versions are rebuilt.
+ */
+const std::uint32_t grid_checkpoint_version = 1;
+
+struct grid_checkpoint_header
+{
+    char magic[8];               ///< "NSA2GRD" and a terminating zero
+    std::uint32_t version;       ///< grid_checkpoint_version
+    std::uint32_t atoms;         ///< Number of atoms with grids
+    std::int32_t accuracy;       ///< Grid accuracy the file was made with
+    std::int32_t pbc;            ///< Number of periodic images the file was made with
+    std::uint64_t hash;          ///< Content hash of wavefunction, CIF and grid options, see grid_checkpoint_hash
+    std::uint64_t total_points;  ///< Number of grid points over all atoms
+    std::uint64_t data_offset;   ///< Start of the data section in bytes
+};
+
+struct grid_checkpoint_atom
+{
+    std::uint64_t points; ///< Number of grid points
+    std::uint64_t pairs;  ///< Number of inversion pairs at the start of the grid
+    std::uint64_t offset; ///< Position of d1 in bytes from the start of the data section
+    std::uint64_t stride; ///< Distance between d1, d2, d3 and dens in doubles
+    char label[64];       ///< Atom label, zero terminated
+};
+
+/**
+ * @brief FNV-1a hash over the wavefunction as used for the grids (atoms, primitives, MO occupations and
+ * coefficients), the bytes of the CIF and the grid options (accuracy, periodic images, partition_scheme, grid_error,
+ * angular_pruning, radial_scheme, grid_point_order).
+ */
+std::uint64_t grid_checkpoint_hash(const WFN &wave, const std::string &cif, const int accuracy, const int pbc, const int partition, const double grid_error, const int pruning, const int radial, const int grid_order, const ivec &asym_atom_list);
+
+/**
+ * @brief Read-only, memory mapped grid checkpoint.
+ */
+class grid_checkpoint
+{
+    std::unique_ptr<mapped_file> m_file;
+    std::vector<sf_grid_view> m_grids;
+    std::vector<std::string> m_labels;
+    long long int m_points = 0;
+
+public:
+    grid_checkpoint() {}
+
+    /**
+     * @brief Maps the file and checks it against the current run.
+     * @param name File name.
+     * @param hash Expected content hash.
+     * @param accuracy Expected grid accuracy.
+     * @param pbc Expected number of periodic images.
+     * @param labels Expected labels of the atoms, in order.
+     * @param file Stream for the reason a file is rejected.
+     * @return False if the file does not exist, has another version or does not match, the grids are then empty.
+     */
+    bool load(const std::string &name, const std::uint64_t hash, const int accuracy, const int pbc, const std::vector<std::string> &labels, std::ostream &file);
+
+    /**
+     * @brief Views of the mapped grids, valid as long as the checkpoint exists.
+     */
+    const std::vector<sf_grid_view> &grids() const { return m_grids; }
+    long long int points() const { return m_points; }
+
+    /**
+     * @brief Writes the grids to a checkpoint file.
+     * @param name File name, the file is written under a temporary name and renamed, so concurrent readers never
+     * see a partial file.
+     * @param grids Grid of every atom.
+     * @param labels Label of every atom.
+     * @return False if the file could not be written.
+     */
+    static bool write(const std::string &name, const std::uint64_t hash, const int accuracy, const int pbc,
+                      const std::vector<sf_grid_view> &grids, const std::vector<std::string> &labels, std::ostream &file);
+};
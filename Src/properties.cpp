@@ -3,6 +3,8 @@
 #include "spherical_density.h"
 #include "cell.h"
 #include "cube.h"
+#include "density_batch.h"
+#include "wfn_snapshot.h"
 
 using namespace std;
 
@@ -26,9 +28,9 @@ void Calc_Spherical_Dens(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Spherical Density"};
     const int step = (int)max(floor(3 * CubeSpher.get_size(0) / 20.0), 1.0);
 
-    vector<Thakkar> atoms;
+    vector<const spherical_density_spline *> atoms;
     for (int a = 0; a < wavy.get_ncen(); a++)
-        atoms.push_back(Thakkar(wavy.get_atom_charge(a)));
+        atoms.push_back(&get_spherical_density_spline(wavy.get_atom_charge(a)));
 
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeSpher.get_size(0); i < 2 * CubeSpher.get_size(0); i++)
@@ -55,7 +57,7 @@ void Calc_Spherical_Dens(
                 for (int a = 0; a < wavy.get_ncen(); a++)
                 {
                     dist = sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2));
-                    dens_all += atoms[a].get_radial_density(dist);
+                    dens_all += atoms[a]->get(dist);
                     ;
                 }
 
@@ -122,9 +124,9 @@ void Calc_Static_Def(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Deformation Density"};
     const int step = (int)max(floor(3 * CubeDEF.get_size(0) / 20.0), 1.0);
 
-    vector<Thakkar> atoms;
+    vector<const spherical_density_spline *> atoms;
     for (int a = 0; a < wavy.get_ncen(); a++)
-        atoms.push_back(Thakkar(wavy.get_atom_charge(a)));
+        atoms.push_back(&get_spherical_density_spline(wavy.get_atom_charge(a)));
 
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeDEF.get_size(0); i < 2 * CubeDEF.get_size(0); i++)
@@ -149,7 +151,7 @@ void Calc_Static_Def(
                 for (int a = 0; a < wavy.get_ncen(); a++)
                 {
                     dist = sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2));
-                    dens_all += atoms[a].get_radial_density(dist);
+                    dens_all += atoms[a]->get(dist);
                 }
 
                 int temp_i, temp_j, temp_k;
@@ -302,9 +304,9 @@ void Calc_Hirshfeld(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(3 * CubeHDEF.get_size(0) / 20.0), 1.0);
 
-    vector<Thakkar> atoms;
+    vector<const spherical_density_spline *> atoms;
     for (int a = 0; a < wavy.get_ncen(); a++)
-        atoms.push_back(Thakkar(wavy.get_atom_charge(a)));
+        atoms.push_back(&get_spherical_density_spline(wavy.get_atom_charge(a)));
 
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeHDEF.get_size(0); i < 2 * CubeHDEF.get_size(0); i++)
@@ -329,7 +331,7 @@ void Calc_Hirshfeld(
                 for (int a = 0; a < wavy.get_ncen(); a++)
                 {
                     dist = sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2));
-                    temp = atoms[a].get_radial_density(dist);
+                    temp = atoms[a]->get(dist);
                     if (ignore_atom == a)
                         dens_choice = temp;
                     dens_all += temp;
@@ -401,7 +403,7 @@ void Calc_Hirshfeld(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(3 * CubeHDEF.get_size(0) / 20.0), 1.0);
 
-    Thakkar atom(wavy.get_atom_charge(ignore_atom));
+    const spherical_density_spline &atom = get_spherical_density_spline(wavy.get_atom_charge(ignore_atom));
 
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeHDEF.get_size(0); i < 2 * CubeHDEF.get_size(0); i++)
@@ -421,7 +423,7 @@ void Calc_Hirshfeld(
                 if (skip)
                     continue;
 
-                double dens_choice = atom.get_radial_density(dist);
+                double dens_choice = atom.get(dist);
                 int temp_i, temp_j, temp_k;
                 if (i < 0)
                     temp_i = i + CubeHDEF.get_size(0);
@@ -486,7 +488,7 @@ void Calc_Hirshfeld_atom(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(3 * CubeHirsh.get_size(0) / 20.0), 1.0);
 
-    Thakkar atom(wavy.get_atom_charge(ignore_atom));
+    const spherical_density_spline &atom = get_spherical_density_spline(wavy.get_atom_charge(ignore_atom));
 
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeHirsh.get_size(0); i < 2 * CubeHirsh.get_size(0); i++)
@@ -506,7 +508,7 @@ void Calc_Hirshfeld_atom(
                 if (skip)
                     continue;
 
-                double dens_choice = atom.get_radial_density(dist);
+                double dens_choice = atom.get(dist);
                 int temp_i, temp_j, temp_k;
                 if (i < 0)
                     temp_i = i + CubeHirsh.get_size(0);
@@ -550,7 +552,7 @@ void Calc_Hirshfeld_atom(
 
 void Calc_Rho(
     cube &CubeRho,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     ostream &file)
@@ -563,32 +565,45 @@ void Calc_Rho(
     }
 #endif
 
+    const WFN &wavy = snapshot.get_wfn();
     time_point start = get_time();
 
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(CubeRho.get_size(0) * 3 / 20.0), 1.0);
 
-#pragma omp parallel for schedule(dynamic)
-    for (int i = -CubeRho.get_size(0); i < 2 * CubeRho.get_size(0); i++)
+    const density_batch engine(snapshot);
+#pragma omp parallel
     {
-        for (int j = -CubeRho.get_size(1); j < 2 * CubeRho.get_size(1); j++)
-            for (int k = -CubeRho.get_size(2); k < 2 * CubeRho.get_size(2); k++)
+        density_batch_workspace ws;
+        const int row = 3 * CubeRho.get_size(2);
+        vec px(row), py(row), pz(row), rho(row);
+        ivec pk(row);
+#pragma omp for schedule(dynamic)
+        for (int i = -CubeRho.get_size(0); i < 2 * CubeRho.get_size(0); i++)
+        {
+            for (int j = -CubeRho.get_size(1); j < 2 * CubeRho.get_size(1); j++)
             {
+                // collect the points of this row within reach of an atom and evaluate them as one batch
+                int n = 0;
+                for (int k = -CubeRho.get_size(2); k < 2 * CubeRho.get_size(2); k++)
+                {
+                    double PosGrid[3]{
+                        i * CubeRho.get_vector(0, 0) + j * CubeRho.get_vector(0, 1) + k * CubeRho.get_vector(0, 2) + CubeRho.get_origin(0),
+                        i * CubeRho.get_vector(1, 0) + j * CubeRho.get_vector(1, 1) + k * CubeRho.get_vector(1, 2) + CubeRho.get_origin(1),
+                        i * CubeRho.get_vector(2, 0) + j * CubeRho.get_vector(2, 1) + k * CubeRho.get_vector(2, 2) + CubeRho.get_origin(2)};
 
-                double PosGrid[3]{
-                    i * CubeRho.get_vector(0, 0) + j * CubeRho.get_vector(0, 1) + k * CubeRho.get_vector(0, 2) + CubeRho.get_origin(0),
-                    i * CubeRho.get_vector(1, 0) + j * CubeRho.get_vector(1, 1) + k * CubeRho.get_vector(1, 2) + CubeRho.get_origin(1),
-                    i * CubeRho.get_vector(2, 0) + j * CubeRho.get_vector(2, 1) + k * CubeRho.get_vector(2, 2) + CubeRho.get_origin(2)},
-                    Rho = 0;
-
-                bool skip = true;
-                for (int a = 0; a < wavy.get_ncen(); a++)
-                    if (sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2)) < radius / 0.52)
-                        skip = false;
-                if (skip)
+                    bool skip = true;
+                    for (int a = 0; a < wavy.get_ncen(); a++)
+                        if (sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2)) < radius / 0.52)
+                            skip = false;
+                    if (skip)
+                        continue;
+                    px[n] = PosGrid[0], py[n] = PosGrid[1], pz[n] = PosGrid[2], pk[n] = k;
+                    n++;
+                }
+                if (n == 0)
                     continue;
-
-                Rho = wavy.compute_dens(PosGrid[0], PosGrid[1], PosGrid[2]);
+                engine.compute(px.data(), py.data(), pz.data(), n, rho.data(), ws);
 
                 int temp_i, temp_j, temp_k;
                 if (i < 0)
@@ -605,17 +620,22 @@ void Calc_Rho(
                 else
                     temp_j = j - CubeRho.get_size(1);
 
-                if (k < 0)
-                    temp_k = k + CubeRho.get_size(2);
-                else if (k < CubeRho.get_size(2))
-                    temp_k = k;
-                else
-                    temp_k = k - CubeRho.get_size(2);
-
-                CubeRho.set_value(temp_i, temp_j, temp_k, CubeRho.get_value(temp_i, temp_j, temp_k) + Rho);
+                for (int p = 0; p < n; p++)
+                {
+                    const int k = pk[p];
+                    if (k < 0)
+                        temp_k = k + CubeRho.get_size(2);
+                    else if (k < CubeRho.get_size(2))
+                        temp_k = k;
+                    else
+                        temp_k = k - CubeRho.get_size(2);
+
+                    CubeRho.set_value(temp_i, temp_j, temp_k, CubeRho.get_value(temp_i, temp_j, temp_k) + rho[p]);
+                }
             }
-        if (i != 0 && i % step == 0)
-            progress->write((i + CubeRho.get_size(0)) / static_cast<double>(CubeRho.get_size(0) * 3));
+            if (i != 0 && i % step == 0)
+                progress->write((i + CubeRho.get_size(0)) / static_cast<double>(CubeRho.get_size(0) * 3));
+        }
     }
     delete (progress);
 
@@ -628,6 +648,17 @@ void Calc_Rho(
         file << "Time to calculate Values: " << fixed << setprecision(0) << get_sec(start, end) / 3600 << " h " << (get_sec(start, end) % 3600) / 60 << " m" << endl;
 };
 
+void Calc_Rho(
+    cube &CubeRho,
+    WFN &wavy,
+    int cpus,
+    double radius,
+    ostream &file)
+{
+    const wfn_snapshot snapshot(wavy);
+    Calc_Rho(CubeRho, snapshot, cpus, radius, file);
+}
+
 void Calc_Rho_no_trans(
     cube &CubeRho,
     WFN &wavy,
@@ -648,32 +679,45 @@ void Calc_Rho_no_trans(
     progress_bar *progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(CubeRho.get_size(0) * 3 / 20.0), 1.0);
 
-#pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < CubeRho.get_size(0); i++)
+    const wfn_snapshot snapshot(wavy);
+    const density_batch engine(snapshot);
+#pragma omp parallel
     {
-        for (int j = 0; j < CubeRho.get_size(1); j++)
-            for (int k = 0; k < CubeRho.get_size(2); k++)
+        density_batch_workspace ws;
+        const int row = CubeRho.get_size(2);
+        vec px(row), py(row), pz(row), rho(row);
+        ivec pk(row);
+#pragma omp for schedule(dynamic)
+        for (int i = 0; i < CubeRho.get_size(0); i++)
+        {
+            for (int j = 0; j < CubeRho.get_size(1); j++)
             {
+                int n = 0;
+                for (int k = 0; k < CubeRho.get_size(2); k++)
+                {
+                    double PosGrid[3]{
+                        i * CubeRho.get_vector(0, 0) + j * CubeRho.get_vector(0, 1) + k * CubeRho.get_vector(0, 2) + CubeRho.get_origin(0),
+                        i * CubeRho.get_vector(1, 0) + j * CubeRho.get_vector(1, 1) + k * CubeRho.get_vector(1, 2) + CubeRho.get_origin(1),
+                        i * CubeRho.get_vector(2, 0) + j * CubeRho.get_vector(2, 1) + k * CubeRho.get_vector(2, 2) + CubeRho.get_origin(2)};
 
-                double PosGrid[3]{
-                    i * CubeRho.get_vector(0, 0) + j * CubeRho.get_vector(0, 1) + k * CubeRho.get_vector(0, 2) + CubeRho.get_origin(0),
-                    i * CubeRho.get_vector(1, 0) + j * CubeRho.get_vector(1, 1) + k * CubeRho.get_vector(1, 2) + CubeRho.get_origin(1),
-                    i * CubeRho.get_vector(2, 0) + j * CubeRho.get_vector(2, 1) + k * CubeRho.get_vector(2, 2) + CubeRho.get_origin(2)},
-                    Rho = 0;
-
-                bool skip = true;
-                for (int a = 0; a < wavy.get_ncen(); a++)
-                    if (sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2)) < radius / 0.52)
-                        skip = false;
-                if (skip)
+                    bool skip = true;
+                    for (int a = 0; a < wavy.get_ncen(); a++)
+                        if (sqrt(pow(PosGrid[0] - wavy.atoms[a].x, 2) + pow(PosGrid[1] - wavy.atoms[a].y, 2) + pow(PosGrid[2] - wavy.atoms[a].z, 2)) < radius / 0.52)
+                            skip = false;
+                    if (skip)
+                        continue;
+                    px[n] = PosGrid[0], py[n] = PosGrid[1], pz[n] = PosGrid[2], pk[n] = k;
+                    n++;
+                }
+                if (n == 0)
                     continue;
-
-                Rho = wavy.compute_dens(PosGrid[0], PosGrid[1], PosGrid[2]);
-
-                CubeRho.set_value(i, j, k, Rho);
+                engine.compute(px.data(), py.data(), pz.data(), n, rho.data(), ws);
+                for (int p = 0; p < n; p++)
+                    CubeRho.set_value(i, j, pk[p], rho[p]);
             }
-        if (i != 0 && i % step == 0)
-            progress->write((i + CubeRho.get_size(0)) / static_cast<double>(CubeRho.get_size(0) * 3));
+            if (i != 0 && i % step == 0)
+                progress->write((i + CubeRho.get_size(0)) / static_cast<double>(CubeRho.get_size(0) * 3));
+        }
     }
     delete (progress);
 
@@ -787,7 +831,7 @@ void Calc_MO_spherical_harmonics(
 
 void Calc_S_Rho(
     cube &Cube_S_Rho,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     ostream &file,
     bool &nodate)
@@ -808,10 +852,7 @@ void Calc_S_Rho(
 #pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < Cube_S_Rho.get_size(0); i++)
     {
-        vector<vec> d(16);
-        vec phi(wavy.get_nmo(), 0.0);
-        for (int p = 0; p < 16; p++)
-            d[p].resize(wavy.get_ncen());
+        vec phi(snapshot.get_nmo_pad(), 0.0);
         for (int j = 0; j < Cube_S_Rho.get_size(1); j++)
             for (int k = 0; k < Cube_S_Rho.get_size(2); k++)
             {
@@ -821,7 +862,7 @@ void Calc_S_Rho(
                     i * Cube_S_Rho.get_vector(1, 0) + j * Cube_S_Rho.get_vector(1, 1) + k * Cube_S_Rho.get_vector(1, 2) + Cube_S_Rho.get_origin(1),
                     i * Cube_S_Rho.get_vector(2, 0) + j * Cube_S_Rho.get_vector(2, 1) + k * Cube_S_Rho.get_vector(2, 2) + Cube_S_Rho.get_origin(2)};
 
-                Cube_S_Rho.set_value(i, j, k, wavy.compute_spin_dens(PosGrid[0], PosGrid[1], PosGrid[2], d, phi));
+                Cube_S_Rho.set_value(i, j, k, snapshot.compute_spin_dens(PosGrid, phi.data()));
             }
         if (i != 0 && i % step == 0)
             progress->write((i) / static_cast<double>(Cube_S_Rho.get_size(0)));
@@ -844,7 +885,7 @@ void Calc_Prop(
     cube &CubeEli,
     cube &CubeLap,
     cube &CubeESP,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     ostream &file,
@@ -858,6 +899,7 @@ void Calc_Prop(
     }
 #endif
 
+    const WFN &wavy = snapshot.get_wfn();
     time_point start = get_time();
 
     progress_bar *progress = NULL;
@@ -865,9 +907,13 @@ void Calc_Prop(
         progress = new progress_bar{file, 50u, "Calculating Values"};
     const int step = (int)max(floor(CubeRho.get_size(0) * 3 / 20.0), 1.0);
 
+    // ELF and ELI only need the gradient, the Laplacian and the signed density of RDG also the Hessian
+    const int order = (CubeLap.get_loaded() || CubeRDG.get_loaded()) ? 2 : 1;
+
 #pragma omp parallel for schedule(dynamic)
     for (int i = -CubeRho.get_size(0); i < 2 * CubeRho.get_size(0); i++)
     {
+        vec phi(10 * snapshot.get_nmo_pad());
         for (int j = -CubeRho.get_size(1); j < 2 * CubeRho.get_size(1); j++)
             for (int k = -CubeRho.get_size(2); k < 2 * CubeRho.get_size(2); k++)
             {
@@ -890,52 +936,7 @@ void Calc_Prop(
                 if (skip)
                     continue;
 
-                if (CubeESP.get_loaded() && !CubeRDG.get_loaded())
-                    Rho = wavy.compute_dens(
-                        PosGrid[0], PosGrid[1], PosGrid[2]);
-
-                if (CubeRDG.get_loaded() && CubeLap.get_loaded() && (CubeElf.get_loaded() || CubeEli.get_loaded()))
-                    wavy.computeValues(
-                        PosGrid,
-                        Rho,
-                        Grad,
-                        Hess,
-                        Elf,
-                        Eli,
-                        Lap);
-                else if ((CubeElf.get_loaded() && CubeEli.get_loaded()) && !CubeRDG.get_loaded() && !CubeLap.get_loaded())
-                    wavy.computeELIELF(
-                        PosGrid,
-                        Elf,
-                        Eli);
-                else if (CubeElf.get_loaded() && !CubeEli.get_loaded() && !CubeRDG.get_loaded() && !CubeLap.get_loaded())
-                    wavy.computeELF(
-                        PosGrid,
-                        Elf);
-                else if (!CubeElf.get_loaded() && CubeEli.get_loaded() && !CubeRDG.get_loaded() && !CubeLap.get_loaded())
-                    wavy.computeELI(
-                        PosGrid,
-                        Eli);
-                else if (CubeElf.get_loaded() && CubeEli.get_loaded() && CubeLap.get_loaded() && !CubeRDG.get_loaded())
-                    wavy.computeLapELIELF(
-                        PosGrid,
-                        Elf,
-                        Eli,
-                        Lap);
-                else if (!CubeElf.get_loaded() && CubeEli.get_loaded() && CubeLap.get_loaded() && !CubeRDG.get_loaded())
-                    wavy.computeLapELI(
-                        PosGrid,
-                        Eli,
-                        Lap);
-                else
-                    wavy.computeValues(
-                        PosGrid,
-                        Rho,
-                        Grad,
-                        Hess,
-                        Elf,
-                        Eli,
-                        Lap);
+                snapshot.compute_values(PosGrid, order, Rho, Grad, Hess, Elf, Eli, Lap, phi.data());
 
                 if (CubeRDG.get_loaded())
                     Rho = get_lambda_1(Hess) < 0 ? -Rho : Rho;
@@ -1017,12 +1018,13 @@ void Calc_Prop(
 
 void Calc_ESP(
     cube &CubeESP,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     bool no_date,
     ostream &file)
 {
+    const WFN &wavy = snapshot.get_wfn();
 #ifdef _OPENMP
     if (cpus != -1)
     {
@@ -1095,7 +1097,7 @@ void Calc_ESP(
                 else
                     temp_k = k - CubeESP.get_size(2);
 
-                temp = wavy.computeESP(PosGrid, d2);
+                temp = snapshot.compute_ESP(PosGrid, d2);
                 CubeESP.set_value(temp_i, temp_j, temp_k, CubeESP.get_value(temp_i, temp_j, temp_k) + temp);
                 // CubeESP.set_value(i, j, k, computeESP(PosGrid, d2, wavy));
             }
@@ -1122,11 +1124,13 @@ void Calc_ESP(
 void Calc_MO(
     cube &CubeMO,
     int mo,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     ostream &file)
 {
+    const WFN &wavy = snapshot.get_wfn();
+    err_checkf(snapshot.get_nmo() == wavy.get_nmo(), "The snapshot for MO cubes has to keep all MOs!", file);
     err_checkf(mo <= wavy.get_nmo(), to_string(mo) + " bigger MO selected than " + to_string(wavy.get_nmo()) + " contained in the wavefunctions!", file);
 #ifdef _OPENMP
     if (cpus != -1)
@@ -1160,9 +1164,7 @@ void Calc_MO(
                 if (skip)
                     continue;
 
-                MO = wavy.computeMO(
-                    PosGrid,
-                    mo);
+                MO = snapshot.compute_MO(PosGrid, mo);
 
                 int temp_i, temp_j, temp_k;
                 if (i < 0)
@@ -1202,6 +1204,18 @@ void Calc_MO(
         file << "Time to calculate Values: " << fixed << setprecision(0) << get_sec(start, end) / 3600 << " h " << (get_sec(start, end) % 3600) / 60 << " m" << endl;
 };
 
+void Calc_MO(
+    cube &CubeMO,
+    int mo,
+    WFN &wavy,
+    int cpus,
+    double radius,
+    ostream &file)
+{
+    const wfn_snapshot snapshot(wavy, false);
+    Calc_MO(CubeMO, mo, snapshot, cpus, radius, file);
+}
+
 void properties_calculation(options &opt)
 {
     ofstream log2("NoSpherA2_cube.log", ios::out);
@@ -1216,6 +1230,10 @@ void properties_calculation(options &opt)
     err_checkf(opt.wfn != "", "Error, no wfn file specified!", log2);
     WFN wavy(0);
     wavy.read_known_wavefunction_format(opt.wfn, log2, opt.debug);
+    if (opt.ECP)
+        wavy.set_has_ECPs(true, true, opt.ECP_mode);
+    if (opt.set_ECPs)
+        wavy.set_ECPs(opt.ECP_nrs, opt.ECP_elcounts);
     if (opt.debug)
         log2 << "Starting calculation of properties" << endl;
     if (opt.all_mos)
@@ -1345,19 +1363,25 @@ void properties_calculation(options &opt)
     log2 << "Calculating for " << fixed << setprecision(0) << opt.NbSteps[0] * opt.NbSteps[1] * opt.NbSteps[2] << " Gridpoints." << endl;
 
     if (opt.MOs.size() != 0)
+    {
+        // MO cubes index all MOs, the other properties only need the occupied ones
+        const wfn_snapshot mo_snapshot(wavy, false);
         for (int i = 0; i < opt.MOs.size(); i++)
         {
             log2 << "Calcualting MO: " << opt.MOs[i] << endl;
             MO.set_zero();
             MO.path = get_basename_without_ending(wavy.get_path()) + "_MO_" + to_string(opt.MOs[i]) + ".cube";
-            Calc_MO(MO, opt.MOs[i], wavy, opt.threads, opt.radius, log2);
+            Calc_MO(MO, opt.MOs[i], mo_snapshot, opt.threads, opt.radius, log2);
             MO.write_file(true);
         }
+    }
+
+    const wfn_snapshot snapshot(wavy);
 
     if (opt.hdef || opt.def || opt.hirsh)
     {
         log2 << "Calcualting Rho...";
-        Calc_Rho(Rho, wavy, opt.threads, opt.radius, log2);
+        Calc_Rho(Rho, snapshot, opt.threads, opt.radius, log2);
         log2 << " ...done!" << endl;
         cube temp(opt.NbSteps[0], opt.NbSteps[1], opt.NbSteps[2], wavy.get_ncen(), opt.hdef || opt.hirsh);
         for (int i = 0; i < 3; i++)
@@ -1404,10 +1428,10 @@ void properties_calculation(options &opt)
     }
 
     if (opt.lap || opt.eli || opt.elf || opt.rdg || opt.esp)
-        Calc_Prop(Rho, RDG, Elf, Eli, Lap, ESP, wavy, opt.threads, opt.radius, log2, opt.no_date);
+        Calc_Prop(Rho, RDG, Elf, Eli, Lap, ESP, snapshot, opt.threads, opt.radius, log2, opt.no_date);
 
     if (opt.s_rho)
-        Calc_S_Rho(S_Rho, wavy, opt.threads, log2, opt.no_date);
+        Calc_S_Rho(S_Rho, snapshot, opt.threads, log2, opt.no_date);
 
     log2 << "Writing cubes to Disk..." << flush;
     if (opt.rdg)
@@ -1442,9 +1466,7 @@ void properties_calculation(options &opt)
     if (opt.esp)
     {
         log2 << "Calculating ESP..." << flush;
-        WFN temp = wavy;
-        temp.delete_unoccupied_MOs();
-        Calc_ESP(ESP, temp, opt.threads, opt.radius, opt.no_date, log2);
+        Calc_ESP(ESP, snapshot, opt.threads, opt.radius, opt.no_date, log2);
         log2 << "Writing cube to Disk..." << flush;
         ESP.write_file(true);
         log2 << "  done!" << endl;
@@ -6,6 +6,7 @@
 
 class WFN;
 class cell;
+class wfn_snapshot;
 /**
  * Calculates the static deflection using the given parameters.
  *
@@ -61,14 +62,23 @@ void Calc_Spherical_Dens(
     double radius,
     std::ostream &file);
 /**
- * Calculates the density (Rho) for a given cube and WFN object.
+ * Calculates the density (Rho) for a given cube and wavefunction snapshot.
  *
  * @param CubeRho The cube object to store the calculated density.
- * @param wavy The WFN object containing the wavefunction information.
+ * @param snapshot The snapshot of the wavefunction, with the occupied MOs.
  * @param cpus The number of CPUs to use for the calculation.
  * @param radius The radius parameter for the calculation.
  * @param file The output stream to write the results to.
  */
+void Calc_Rho(
+    cube &CubeRho,
+    const wfn_snapshot &snapshot,
+    int cpus,
+    double radius,
+    std::ostream &file);
+/**
+ * Calculates the density (Rho) for a given cube and WFN object, through a snapshot built for this call.
+ */
 void Calc_Rho(
     cube &CubeRho,
     WFN &wavy,
@@ -119,7 +129,7 @@ void Calc_MO_spherical_harmonics(
     int MO,
     std::ostream &file);
 /**
- * Calculates the properties of the given cubes and WFN object.
+ * Calculates the properties of the given cubes and wavefunction snapshot.
  *
  * @param CubeRho The cube object representing the electron density.
  * @param CubeRDG The cube object representing the reduced density gradient.
@@ -127,7 +137,7 @@ void Calc_MO_spherical_harmonics(
  * @param CubeEli The cube object representing the electron localization index.
  * @param CubeLap The cube object representing the Laplacian of the electron density.
  * @param CubeESP The cube object representing the electrostatic potential.
- * @param wavy The WFN object representing the wavefunction.
+ * @param snapshot The snapshot of the wavefunction, with the occupied MOs.
  * @param cpus The number of CPUs to be used for the calculation.
  * @param radius The radius parameter for the calculation.
  * @param file The output stream to write the results to.
@@ -140,16 +150,16 @@ void Calc_Prop(
     cube &CubeEli,
     cube &CubeLap,
     cube &CubeESP,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     std::ostream &file,
     bool test);
 /**
- * Calculates the Electrostatic Potential (ESP) for a given cube and WFN object.
+ * Calculates the Electrostatic Potential (ESP) for a given cube and wavefunction snapshot.
  *
  * @param CubeESP The cube object to store the calculated ESP.
- * @param wavy The WFN object containing the wavefunction information.
+ * @param snapshot The snapshot of the wavefunction, with the occupied MOs.
  * @param cpus The number of CPUs to use for the calculation.
  * @param radius The radius parameter for the ESP calculation.
  * @param no_date A flag indicating whether to include the date in the output.
@@ -157,7 +167,7 @@ void Calc_Prop(
  */
 void Calc_ESP(
     cube &CubeESP,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     double radius,
     bool no_date,
@@ -167,11 +177,21 @@ void Calc_ESP(
  *
  * @param CubeMO The cube object to store the calculated MO.
  * @param mo The index of the MO to calculate.
- * @param wavy The WFN object containing the wavefunction data.
+ * @param snapshot The snapshot of the wavefunction, built with all MOs so mo indexes the MOs of the WFN.
  * @param cpus The number of CPUs to use for the calculation.
  * @param radius The radius for the calculation.
  * @param file The output stream to write the calculated MO.
  */
+void Calc_MO(
+    cube &CubeMO,
+    int mo,
+    const wfn_snapshot &snapshot,
+    int cpus,
+    double radius,
+    std::ostream &file);
+/**
+ * Calculates the molecular orbital (MO) for a given cube and WFN object, through a snapshot built for this call.
+ */
 void Calc_MO(
     cube &CubeMO,
     int mo,
@@ -180,17 +200,17 @@ void Calc_MO(
     double radius,
     std::ostream &file);
 /**
- * Calculates the Spin density cube using the provided WFN object.
+ * Calculates the Spin density cube using the provided wavefunction snapshot.
  *
  * @param Cube_S_Rho The cube object to store the calculated S_Rho cube.
- * @param wavy The WFN object used for the calculation.
+ * @param snapshot The snapshot of the wavefunction, with the occupied MOs.
  * @param cpus The number of CPUs to use for the calculation.
  * @param file The output stream to write the results to.
  * @param nodate A boolean flag indicating whether to include the date in the output.
  */
 void Calc_S_Rho(
     cube &Cube_S_Rho,
-    WFN &wavy,
+    const wfn_snapshot &snapshot,
     int cpus,
     std::ostream &file,
     bool nodate);
@@ -12,6 +12,9 @@
 #include "spherical_density.h"
 #include "AtomGrid.h"
 #include "npy.h"
+#include "grid_checkpoint.h"
+#include "grid_arena.h"
+#include "density_batch.h"
 using namespace std;
 
 #ifdef PEOJECT_NAME
@@ -61,6 +64,7 @@ void read_k_points(vector<vec> &k_pt, hkl_list &hkl, ostream &file)
         }
         hkl.emplace(hkl_);
     }
+    hkl.finalize();
     err_checkf(!k_points_file.bad(), "Error reading k-points file!", file);
     file << " done!" << endl
          << "Size of k_points: " << k_pt[0].size() << endl;
@@ -84,25 +88,179 @@ void save_k_points(vector<vec> &k_pt, hkl_list &hkl)
     k_points_file.write((char *)&nr, sizeof(nr));
     double temp[1]{0.0};
     int hkl_temp[1]{0};
-    hkl_list_it hkl_ = hkl.begin();
     for (int run = 0; run < nr[0]; run++)
     {
         for (int i = 0; i < 3; i++)
         {
             temp[0] = k_pt[i][run];
             k_points_file.write((char *)&temp, sizeof(temp));
-            hkl_temp[0] = (*hkl_)[i];
+            hkl_temp[0] = hkl(run, i);
             k_points_file.write((char *)&hkl_temp, sizeof(hkl_temp));
         }
-        hkl_ = next(hkl_);
     }
     k_points_file.flush();
     k_points_file.close();
 }
 
+/**
+ * Adds the twin related indices of all reflections to the list.
+ *
+ * Indices created by a twin law are themselves twinned again if they sort behind the reflection they were
+ * generated from, as the list is processed in ascending order.
+ *
+ * @param hkl The list of reflections to extend.
+ * @param twin_law The vector of twin laws, 3x3 matrices stored row-wise.
+ */
+static void apply_twin_laws(hkl_list &hkl, const vector<vec> &twin_law)
+{
+    set<long long int> keys;
+    for (size_t s = 0; s < hkl.size(); s++)
+        keys.emplace_hint(keys.end(), hkl.key(s));
+    int hkl_[3];
+    for (auto it = keys.begin(); it != keys.end(); ++it)
+    {
+        hkl_list::unpack(*it, hkl_);
+        for (int i = 0; i < twin_law.size(); i++)
+            keys.emplace(hkl_list::pack(
+                int(twin_law[i][0] * hkl_[0] + twin_law[i][1] * hkl_[1] + twin_law[i][2] * hkl_[2]),
+                int(twin_law[i][3] * hkl_[0] + twin_law[i][4] * hkl_[1] + twin_law[i][5] * hkl_[2]),
+                int(twin_law[i][6] * hkl_[0] + twin_law[i][7] * hkl_[1] + twin_law[i][8] * hkl_[2])));
+    }
+    vector<long long int> sorted(keys.begin(), keys.end());
+    hkl.assign(sorted);
+}
+
+/**
+ * Returns the reflections together with their images under all non-identity symmetry operations.
+ *
+ * @param hkl The list of reflections.
+ * @param sym The symmetry operations as returned by cell::get_sym().
+ */
+static hkl_list expand_by_symmetry(const hkl_list &hkl, const vector<vector<ivec>> &sym)
+{
+    vector<long long int> keys;
+    keys.reserve(hkl.size() * sym[0][0].size());
+    for (size_t r = 0; r < hkl.size(); r++)
+        keys.push_back(hkl.key(r));
+    for (int s = 0; s < sym[0][0].size(); s++)
+    {
+        if (sym[0][0][s] == 1 && sym[1][1][s] == 1 && sym[2][2][s] == 1 &&
+            sym[0][1][s] == 0 && sym[0][2][s] == 0 && sym[1][2][s] == 0 &&
+            sym[1][0][s] == 0 && sym[2][0][s] == 0 && sym[2][1][s] == 0)
+        {
+            continue;
+        }
+        for (size_t r = 0; r < hkl.size(); r++)
+        {
+            int tempv[3]{0, 0, 0};
+            for (int h = 0; h < 3; h++)
+            {
+                for (int j = 0; j < 3; j++)
+                    tempv[j] += hkl(r, h) * sym[j][h][s];
+            }
+            keys.push_back(hkl_list::pack(tempv[0], tempv[1], tempv[2]));
+        }
+    }
+    return hkl_list(keys);
+}
+
+/**
+ * Computes the largest index along each reciprocal axis that can belong to a reflection with d >= dmin.
+ *
+ * The extreme of h on the ellipsoid h^T G* h = 1/dmin^2 is a/dmin, since the inverse of the reciprocal metric
+ * tensor G* is the direct one; accordingly for k and l.
+ *
+ * @param unit_cell The unit cell.
+ * @param dmin The minimum d-spacing in Angstrom.
+ * @param stepsize Spacing of the generated indices, 1 for integer hkl.
+ * @param lim Resulting limits in units of stepsize.
+ */
+static void hkl_index_limits(const cell &unit_cell, const double dmin, const double stepsize, int lim[3])
+{
+    const double axes[3] = {unit_cell.get_a(), unit_cell.get_b(), unit_cell.get_c()};
+    for (int i = 0; i < 3; i++)
+    {
+        const double l = floor(axes[i] / dmin / stepsize) + 1;
+        err_checkf(l < 1048575, "Too many hkl indices requested, increase dmin or stepsize!", std::cout);
+        lim[i] = (int)l;
+    }
+}
+
+/**
+ * Concatenates per-thread lists of packed hkl keys into one sorted list without duplicates.
+ */
+static vector<long long int> merge_thread_keys(vector<vector<long long int>> &found)
+{
+    size_t total = 0;
+    for (const vector<long long int> &f : found)
+        total += f.size();
+    vector<long long int> keys;
+    keys.reserve(total);
+    for (vector<long long int> &f : found)
+    {
+        keys.insert(keys.end(), f.begin(), f.end());
+        vector<long long int>().swap(f);
+    }
+    sort(keys.begin(), keys.end());
+    keys.erase(unique(keys.begin(), keys.end()), keys.end());
+    return keys;
+}
+
+/**
+ * Parses one integer field of a fixed-column line: optional blanks, an optional sign, digits, optional blanks.
+ *
+ * @return false if the field is empty or contains anything else.
+ */
+static bool parse_hkl_field(const char *b, const char *e, int &value)
+{
+    while (b < e && (*b == ' ' || *b == '\t'))
+        b++;
+    bool negative = false;
+    if (b < e && (*b == '-' || *b == '+'))
+        negative = *(b++) == '-';
+    if (b == e || *b < '0' || *b > '9')
+        return false;
+    int v = 0;
+    while (b < e && *b >= '0' && *b <= '9')
+        v = 10 * v + (*(b++) - '0');
+    while (b < e && (*b == ' ' || *b == '\t' || *b == '\r'))
+        b++;
+    value = negative ? -v : v;
+    return b == e;
+}
+
+/**
+ * Parses the Miller indices of one line of a SHELX HKLF 4 or 5 file (3I4 followed by the intensity columns).
+ *
+ * Lines shorter than 2 characters and lines containing letters or brackets (titles, CELL cards and the like) are
+ * ignored, as the previous regex based reader did.
+ *
+ * @return 1 if hkl was read, 0 if the line is ignored and -1 if the line is malformed.
+ */
+static int parse_hkl_line(const char *b, const char *e, int hkl[3])
+{
+    if (e - b < 2)
+        return 0;
+    for (const char *c = b; c < e; c++)
+        if ((*c >= 'a' && *c <= 'z') || (*c >= 'A' && *c <= 'W') || *c == '(' || *c == ')')
+            return 0;
+    for (int i = 0; i < 3; i++)
+    {
+        const char *fb = b + 4 * i;
+        if (fb >= e)
+            return -1;
+        if (!parse_hkl_field(fb, min(fb + 4, e), hkl[i]))
+            return -1;
+    }
+    return 1;
+}
+
 /**
  * Reads the hkl data from the specified file and populates the hkl_list with the data.
  *
+ * The file is memory mapped and split at line breaks into chunks that are parsed in parallel. Malformed lines are
+ * skipped and reported.
+ *
  * @param hkl_filename The filename of the hkl file to read.
  * @param hkl The hkl_list to populate with the read data.
  * @param twin_law The vector of twin laws to apply to the hkl data.
@@ -118,54 +276,74 @@ void read_hkl(const string &hkl_filename,
               bool debug = false)
 {
     file << "Reading: " << setw(44) << hkl_filename << flush;
-    ivec hkl_(3);
     err_checkf(exists(hkl_filename), "HKL file does not exists!", file);
-    ifstream hkl_input(hkl_filename.c_str(), ios::in);
-    hkl_input.seekg(0, hkl_input.beg);
-    regex r{R"([abcdefghijklmnopqrstuvwxyz\(\)ABCDEFGHIJKLMNOPQRSTUVW])"};
-    string line, temp;
-    while (!hkl_input.eof())
-    {
-        getline(hkl_input, line);
-        if (hkl_input.eof())
-            break;
-        if (line.size() < 2)
-            continue;
-        cmatch result;
-        if (regex_search(line.c_str(), result, r))
-            continue;
-        // if (debug) file << "hkl: ";
-        for (int i = 0; i < 3; i++)
-        {
-            temp = line.substr(4 * size_t(i) + 1, 3);
-            temp.erase(remove_if(temp.begin(), temp.end(), ::isspace), temp.end());
-            hkl_[i] = stoi(temp);
-            // if (debug) file << setw(4) << temp;
-        }
-        // if (debug) file << endl;
-        hkl.emplace(hkl_);
-    }
-    hkl_list_it found = hkl.find(ivec{0, 0, 0});
-    if (found != hkl.end())
+    long long int nr_malformed = 0, first_line = 0;
+    {
+        mapped_file input(hkl_filename, file);
+        const char *data = input.data();
+        const size_t size = input.size();
+        // chunk boundaries are moved behind the next line break
+        const size_t nr_chunks = size < 65536 ? 1 : 4 * (size_t)omp_get_max_threads();
+        vector<size_t> bounds(nr_chunks + 1, size);
+        bounds[0] = 0;
+        for (size_t c = 1; c < nr_chunks; c++)
+        {
+            size_t pos = max(bounds[c - 1], size / nr_chunks * c);
+            while (pos < size && data[pos - 1] != '\n')
+                pos++;
+            bounds[c] = pos;
+        }
+        vector<vector<long long int>> keys(nr_chunks);
+        vector<long long int> lines(nr_chunks, 0);
+        vector<vector<long long int>> malformed(nr_chunks);
+#pragma omp parallel for schedule(dynamic)
+        for (long long int c = 0; c < (long long int)nr_chunks; c++)
+        {
+            const char *p = data + bounds[c];
+            const char *chunk_end = data + bounds[c + 1];
+            int hkl_[3];
+            keys[c].reserve((chunk_end - p) / 28 + 1);
+            while (p < chunk_end)
+            {
+                const char *eol = static_cast<const char *>(memchr(p, '\n', chunk_end - p));
+                if (eol == NULL)
+                    eol = chunk_end;
+                const int res = parse_hkl_line(p, eol, hkl_);
+                if (res == 1)
+                    keys[c].push_back(hkl_list::pack(hkl_[0], hkl_[1], hkl_[2]));
+                else if (res == -1)
+                    malformed[c].push_back(lines[c]);
+                lines[c]++;
+                p = eol + 1;
+            }
+        }
+        long long int line_offset = 0;
+        for (size_t c = 0; c < nr_chunks; c++)
+        {
+            if (nr_malformed == 0 && malformed[c].size() != 0)
+                first_line = line_offset + malformed[c][0] + 1;
+            nr_malformed += malformed[c].size();
+            line_offset += lines[c];
+        }
+        for (size_t s = 0; s < hkl.size(); s++)
+            keys[0].push_back(hkl.key(s));
+        vector<long long int> all = merge_thread_keys(keys);
+        hkl.assign(all);
+    }
+    if (hkl.contains(0, 0, 0))
     {
         if (debug)
             file << "popping back 0 0 0" << endl;
         hkl.erase(ivec{0, 0, 0});
     }
-    hkl_input.close();
     file << " done!\nNr of reflections read from file: " << hkl.size() << endl;
+    if (nr_malformed != 0)
+        file << "WARNING: skipped " << nr_malformed << " malformed lines, first at line " << first_line << endl;
 
     if (debug)
         file << "Number of reflections before twin: " << hkl.size() << endl;
     if (twin_law.size() > 0)
-    {
-        for (const ivec &hkl__ : hkl)
-            for (int i = 0; i < twin_law.size(); i++)
-                hkl.emplace(ivec{
-                    static_cast<int>(twin_law[i][0] * hkl__[0] + twin_law[i][1] * hkl__[1] + twin_law[i][2] * hkl__[2]),
-                    static_cast<int>(twin_law[i][3] * hkl__[0] + twin_law[i][4] * hkl__[1] + twin_law[i][5] * hkl__[2]),
-                    static_cast<int>(twin_law[i][6] * hkl__[0] + twin_law[i][7] * hkl__[1] + twin_law[i][8] * hkl__[2])});
-    }
+        apply_twin_laws(hkl, twin_law);
     if (debug)
         file << "Number of reflections after twin: " << hkl.size() << endl;
 
@@ -191,40 +369,18 @@ void read_hkl(const string &hkl_filename,
     else
         file << "Number of symmetry operations: " << sym[0][0].size() << endl;
 
-    ivec tempv(3);
-    hkl_list hkl_enlarged = hkl;
-    for (int s = 0; s < sym[0][0].size(); s++)
-    {
-        if (sym[0][0][s] == 1 && sym[1][1][s] == 1 && sym[2][2][s] == 1 &&
-            sym[0][1][s] == 0 && sym[0][2][s] == 0 && sym[1][2][s] == 0 &&
-            sym[1][0][s] == 0 && sym[2][0][s] == 0 && sym[2][1][s] == 0)
-        {
-            continue;
-        }
-        for (const ivec &hkl__ : hkl)
-        {
-            tempv = {0, 0, 0};
-            for (int h = 0; h < 3; h++)
-            {
-                for (int j = 0; j < 3; j++)
-                    tempv[j] += hkl__[h] * sym[j][h][s];
-            }
-            hkl_enlarged.emplace(tempv);
-        }
-    }
+    hkl_list hkl_enlarged = expand_by_symmetry(hkl, sym);
 
-    for (const ivec &hkl__ : hkl_enlarged)
+    // keep only the first of every Friedel pair
+    vector<long long int> keys;
+    keys.reserve(hkl_enlarged.size());
+    for (size_t s = 0; s < hkl_enlarged.size(); s++)
     {
-        tempv = hkl__;
-        tempv[0] *= -1;
-        tempv[1] *= -1;
-        tempv[2] *= -1;
-        if (hkl_enlarged.find(tempv) != hkl_enlarged.end())
-        {
-            hkl_enlarged.erase(tempv);
-        }
+        const long long int mate = hkl_enlarged.find(-hkl_enlarged(s, 0), -hkl_enlarged(s, 1), -hkl_enlarged(s, 2));
+        if (mate < 0 || mate >= (long long int)s)
+            keys.push_back(hkl_enlarged.key(s));
     }
-    hkl = hkl_enlarged;
+    hkl.assign(keys);
     file << "Nr of reflections to be used: " << hkl.size() << endl;
 }
 
@@ -246,38 +402,39 @@ void generate_hkl(const double &dmin,
                   bool debug)
 {
     file << "Generating hkl indices up to d=: " << fixed << setw(17) << setprecision(2) << dmin << flush;
-    ivec hkl_(3);
-    string line, temp;
-    const int extreme = 201;
     double dmin_l = 0.9 * dmin;
-    for (int h = -extreme; h < extreme; h++)
+    int lim[3];
+    hkl_index_limits(unit_cell, dmin_l, 1.0, lim);
+    vector<vector<long long int>> found(omp_get_max_threads());
+#pragma omp parallel
     {
-        for (int k = -extreme; k < extreme; k++)
+        vector<long long int> &own = found[omp_get_thread_num()];
+        ivec hkl_(3);
+#pragma omp for schedule(dynamic)
+        for (int h = -lim[0]; h <= lim[0]; h++)
         {
-            // only need 0 to extreme, since we have no DISP signal
-            for (int l = 0; l < extreme; l++)
+            for (int k = -lim[1]; k <= lim[1]; k++)
             {
-                hkl_ = {h, k, l};
-                if (unit_cell.get_d_of_hkl(hkl_) >= dmin_l)
-                    hkl.emplace(hkl_);
-                else
-                    break;
+                // only need 0 to extreme, since we have no DISP signal
+                for (int l = 0; l <= lim[2]; l++)
+                {
+                    hkl_ = {h, k, l};
+                    if (unit_cell.get_d_of_hkl(hkl_) >= dmin_l)
+                        own.push_back(hkl_list::pack(h, k, l));
+                    else
+                        break;
+                }
             }
         }
     }
+    vector<long long int> keys = merge_thread_keys(found);
+    hkl.assign(keys);
     file << "... done!\nNr of reflections generated: " << setw(21) << hkl.size() << endl;
 
     if (debug)
         file << "Number of reflections before twin: " << hkl.size() << endl;
     if (twin_law.size() > 0)
-    {
-        for (const ivec &hkl__ : hkl)
-            for (int i = 0; i < twin_law.size(); i++)
-                hkl.emplace(ivec{
-                    int(twin_law[i][0] * hkl__[0] + twin_law[i][1] * hkl__[1] + twin_law[i][2] * hkl__[2]),
-                    int(twin_law[i][3] * hkl__[0] + twin_law[i][4] * hkl__[1] + twin_law[i][5] * hkl__[2]),
-                    int(twin_law[i][6] * hkl__[0] + twin_law[i][7] * hkl__[1] + twin_law[i][8] * hkl__[2])});
-    }
+        apply_twin_laws(hkl, twin_law);
     if (debug)
         file << "Number of reflections after twin: " << hkl.size() << endl;
 
@@ -303,39 +460,13 @@ void generate_hkl(const double &dmin,
     else
         file << "Number of symmetry operations: " << setw(19) << sym[0][0].size() << endl;
 
-    ivec tempv(3);
-    hkl_list hkl_enlarged = hkl;
-    for (int s = 0; s < sym[0][0].size(); s++)
-    {
-        if (sym[0][0][s] == 1 && sym[1][1][s] == 1 && sym[2][2][s] == 1 &&
-            sym[0][1][s] == 0 && sym[0][2][s] == 0 && sym[1][2][s] == 0 &&
-            sym[1][0][s] == 0 && sym[2][0][s] == 0 && sym[2][1][s] == 0)
-        {
-            continue;
-        }
-        for (const ivec &hkl__ : hkl)
-        {
-            tempv = {0, 0, 0};
-            for (int h = 0; h < 3; h++)
-            {
-                for (int j = 0; j < 3; j++)
-                    tempv[j] += hkl__[h] * sym[j][h][s];
-            }
-            hkl_enlarged.emplace(tempv);
-        }
-    }
+    hkl_list hkl_enlarged = expand_by_symmetry(hkl, sym);
 
-    for (const ivec &hkl__ : hkl_enlarged)
-    {
-        tempv = hkl__;
-        tempv[0] *= -1;
-        tempv[1] *= -1;
-        tempv[2] *= -1;
-        if (hkl.find(tempv) != hkl.end() && hkl.find(hkl__) == hkl.end())
-        {
-            hkl.emplace(hkl__);
-        }
-    }
+    // add the symmetry equivalents whose Friedel mate is in the list
+    for (size_t s = 0; s < hkl_enlarged.size(); s++)
+        if (hkl.contains(-hkl_enlarged(s, 0), -hkl_enlarged(s, 1), -hkl_enlarged(s, 2)))
+            hkl.push_back(hkl_enlarged(s, 0), hkl_enlarged(s, 1), hkl_enlarged(s, 2));
+    hkl.finalize();
     file << "Nr of reflections to be used: " << setw(20) << hkl.size() << endl;
 }
 
@@ -359,31 +490,39 @@ void generate_fractional_hkl(const double &dmin,
                              bool debug)
 {
     file << "Generating hkl indices up to d=: " << fixed << setw(17) << setprecision(2) << dmin << flush;
-    vec hkl_(3);
-    string line, temp;
-    const int extreme = 201;
     double dmin_l = 0.9 * dmin;
-    const int lim = extreme / stepsize;
-#pragma omp parallel for private(hkl_)
-    for (int h = -lim; h < lim; h ++)
+    int lim[3];
+    hkl_index_limits(unit_cell, dmin_l, stepsize, lim);
+    // the indices are generated as integer multiples of stepsize, packed like integer hkl
+    vector<vector<long long int>> found(omp_get_max_threads());
+#pragma omp parallel
     {
-			double _h = h * stepsize;
-        for (double k = -extreme; k < extreme; k += stepsize)
+        vector<long long int> &own = found[omp_get_thread_num()];
+        vec hkl_(3);
+#pragma omp for schedule(dynamic)
+        for (int h = -lim[0]; h <= lim[0]; h++)
         {
-            // only need 0 to extreme, since we have no DISP signal
-            for (int l = 0; l < lim; l++)
+            for (int k = -lim[1]; k <= lim[1]; k++)
             {
-                hkl_ = {_h, k, l * stepsize};
-                if (unit_cell.get_d_of_hkl(hkl_) >= dmin_l)
+                // only need 0 to extreme, since we have no DISP signal
+                for (int l = 0; l <= lim[2]; l++)
                 {
-#pragma omp critical
-                  hkl.emplace(hkl_);
+                    hkl_ = {h * stepsize, k * stepsize, l * stepsize};
+                    if (unit_cell.get_d_of_hkl(hkl_) >= dmin_l)
+                        own.push_back(hkl_list::pack(h, k, l));
+                    else
+                        break;
                 }
-                else
-                    break;
             }
         }
     }
+    vector<long long int> keys = merge_thread_keys(found);
+    int step[3];
+    for (size_t i = 0; i < keys.size(); i++)
+    {
+        hkl_list::unpack(keys[i], step);
+        hkl.emplace_hint(hkl.end(), vec{step[0] * stepsize, step[1] * stepsize, step[2] * stepsize});
+    }
     file << "... done!\nNr of reflections generated: " << setw(21) << hkl.size() << endl;
 
     if (debug)
@@ -699,6 +838,426 @@ void read_atoms_from_CIF(ifstream &cif_input,
     }
 }
 
+/**
+ * @brief Moves the inversion pairs of an atomic grid to its front, partners next to each other.
+ *
+ * @param source Prototype grid index of every point.
+ * @param partner Inversion partner of every prototype grid point, -1 if there is none.
+ * @param grids Arena holding the final grid, all of its columns are reordered.
+ * @param atom Grid to reorder.
+ * @return The number of pairs, which occupy the first 2 * pairs points.
+ */
+static int pair_inversion_partners(const ivec &source, const ivec &partner, grid_arena &grids, const int atom)
+{
+    const int n = (int)source.size();
+    ivec slot(partner.size(), -1);
+    for (int q = 0; q < n; q++)
+        slot[source[q]] = q;
+    ivec order;
+    order.reserve(n);
+    vector<bool> used(n, false);
+    int pairs = 0;
+    for (int q = 0; q < n; q++)
+    {
+        const int b = partner[source[q]];
+        if (used[q] || b < 0 || slot[b] < 0 || slot[b] == q)
+            continue;
+        order.push_back(q);
+        order.push_back(slot[b]);
+        used[q] = used[slot[b]] = true;
+        pairs++;
+    }
+    for (int q = 0; q < n; q++)
+        if (!used[q])
+            order.push_back(q);
+    vec temp(n);
+    for (int c = 0; c < grid_final_columns; c++)
+    {
+        double *v = grids.column(c, atom);
+        for (int q = 0; q < n; q++)
+            temp[q] = v[order[q]];
+        std::copy(temp.begin(), temp.end(), v);
+    }
+    return pairs;
+}
+
+/**
+ * @brief Runs select_atom_grid for every element of atom_type_list and logs the chosen settings with the number of
+ * prototype points they predict for the atoms that need grids, before any pruning.
+ *
+ * @return The settings per entry of atom_type_list, empty if grid_error is not set.
+ */
+static vector<atom_grid_settings> select_grid_settings(const double grid_error,
+                                                       const int pruning,
+                                                       const int radial,
+                                                       const WFN &wave,
+                                                       const ivec &atom_type_list,
+                                                       const vector<bool> &needs_grid,
+                                                       const vec &alpha_max,
+                                                       const ivec &max_l,
+                                                       const vector<vec> &alpha_min,
+                                                       ostream &file)
+{
+    vector<atom_grid_settings> settings;
+    if (grid_error <= 0)
+        return settings;
+    file << "\nGrid settings for a target error of " << scientific << setprecision(1) << grid_error << " electrons per atom and structure factor:\n"
+         << "   Z  radial prec.    angular  points/atom  atoms  predicted points  test error" << endl;
+    long long int total = 0;
+    for (int i = 0; i < atom_type_list.size(); i++)
+    {
+        int first = -1, atoms = 0;
+        for (int j = 0; j < wave.get_ncen(); j++)
+        {
+            if (wave.get_atom_charge(j) == 119)
+                continue;
+            if (wave.get_atom_charge(j) == atom_type_list[i])
+            {
+                if (first == -1)
+                    first = j;
+                if (needs_grid[j])
+                    atoms++;
+            }
+        }
+        err_checkf(first != -1, "No atom of atomic number " + to_string(atom_type_list[i]) + " in the wavefunction", file);
+        settings.push_back(select_atom_grid(grid_error, atom_type_list[i], alpha_max[first], max_l[first] - 1, alpha_min[first].data(), atom_type_list, file, pruning, radial));
+        const atom_grid_settings &s = settings.back();
+        total += (long long int)s.num_points * atoms;
+        file << setw(4) << atom_type_list[i] << setw(14) << scientific << setprecision(1) << s.radial_precision
+             << setw(6) << s.min_num_angular_points << "-" << setw(4) << s.max_num_angular_points
+             << setw(13) << s.num_points << setw(7) << atoms << setw(18) << (long long int)s.num_points * atoms
+             << setw(12) << scientific << setprecision(1) << s.error;
+        if (s.error > grid_error)
+            file << " (target not reached)";
+        file << endl;
+    }
+    file << "Predicted points before pruning: " << total << defaultfloat << endl;
+    return settings;
+}
+
+/**
+ * @brief Logs, for a pruning other than PRUNING_LINEAR, the prototype points of every element against those of
+ * linear pruning and how much the electrons of the Becke part of the atom change in the model dimers of
+ * select_atom_grid with every element of atom_type_list, the largest change is shown.
+ *
+ * @param linear The prototypes of prototypes with linear pruning.
+ */
+static void log_pruning(const int pruning,
+                        const WFN &wave,
+                        const ivec &atom_type_list,
+                        const vector<bool> &needs_grid,
+                        vector<AtomGrid> &prototypes,
+                        vector<AtomGrid> &linear,
+                        ostream &file)
+{
+    if (pruning == PRUNING_LINEAR)
+        return;
+    file << "\nAngular pruning: " << pruning_name(pruning) << "\n"
+         << "   Z  points/atom  linear  change  dimer electron change" << endl;
+    long long int total = 0, total_linear = 0;
+    for (int i = 0; i < atom_type_list.size(); i++)
+    {
+        int atoms = 0;
+        for (int j = 0; j < wave.get_ncen(); j++)
+            if (wave.get_atom_charge(j) == atom_type_list[i] && needs_grid[j])
+                atoms++;
+        const int points = prototypes[i].get_num_grid_points(), points_linear = linear[i].get_num_grid_points();
+        total += (long long int)points * atoms;
+        total_linear += (long long int)points_linear * atoms;
+        double change = 0.0;
+        for (const int partner : atom_type_list)
+        {
+            const double d = dimer_share_electrons(prototypes[i], atom_type_list[i], partner) - dimer_share_electrons(linear[i], atom_type_list[i], partner);
+            if (abs(d) > abs(change))
+                change = d;
+        }
+        file << setw(4) << atom_type_list[i] << setw(13) << points << setw(8) << points_linear
+             << setw(7) << fixed << setprecision(1) << 100.0 * (points - points_linear) / points_linear << "%"
+             << setw(23) << scientific << setprecision(2) << change << defaultfloat << endl;
+    }
+    file << "Prototype points of all atoms: " << total << " instead of " << total_linear << " ("
+         << fixed << setprecision(1) << 100.0 * (total - total_linear) / max(total_linear, 1LL) << "%)" << defaultfloat << endl;
+}
+
+/**
+ * @brief Logs the partition of a molecular grid, the deviation of its integrated electron count from the
+ * wavefunction and, unless no_date, the time spent on the partition weights.
+ *
+ * @param all_atoms Whether the grids cover the whole molecule, only then the electron count can be compared.
+ */
+static void log_partition(const int partition,
+                          const double electrons,
+                          const WFN &wave,
+                          const bool all_atoms,
+                          const time_point &begin,
+                          const time_point &end,
+                          const bool no_date,
+                          ostream &file)
+{
+    file << "Partition: " << partition_name(partition);
+    if (all_atoms)
+    {
+        double occupied = 0.0;
+        for (int m = 0; m < wave.get_nmo(); m++)
+            occupied += wave.get_MO_occ(m);
+        file << ", integration error: " << scientific << setprecision(3) << electrons - occupied << " electrons";
+    }
+    if (!no_date)
+        file << ", weights took " << get_msec(begin, end) << " ms";
+    file << defaultfloat << endl;
+}
+
+/**
+ * @brief Appends the periodic images of the wavefunction atoms within -pbc cells that can reach a grid to x, y, z and
+ * atom_z, which hold the atoms of the home cell.
+ *
+ * Images are kept or dropped as whole cells, so site s stays atom s % ncen. A cell is kept if one of its atoms is
+ * closer to a grid atom than the extent of that grid plus reach; farther sites neither enter the partition nor add
+ * spherical density to any point, so the results are the same as with all (2 pbc + 1)^3 cells.
+ *
+ * @param grid_radius Extent of the grid of every atom in bohr, negative for atoms without a grid.
+ * @param reach Largest distance in bohr at which a site still affects a grid point.
+ * @param shift Receives the translation in bohr of every kept cell but the home cell, three values per cell.
+ * @return Number of sites in x, y and z.
+ */
+static int add_periodic_images(const int pbc,
+                               const cell &unit_cell,
+                               const WFN &wave,
+                               const vec &grid_radius,
+                               const double reach,
+                               vec &x,
+                               vec &y,
+                               vec &z,
+                               ivec &atom_z,
+                               vec &shift,
+                               const bool debug,
+                               ostream &file)
+{
+    const int ncen = wave.get_ncen();
+    int cells = 0;
+    for (int pbc_x = -pbc; pbc_x < pbc + 1; pbc_x++)
+        for (int pbc_y = -pbc; pbc_y < pbc + 1; pbc_y++)
+            for (int pbc_z = -pbc; pbc_z < pbc + 1; pbc_z++)
+            {
+                if (pbc_x == 0 && pbc_y == 0 && pbc_z == 0)
+                    continue;
+                cells++;
+                double t[3];
+                for (int k = 0; k < 3; k++)
+                    t[k] = pbc_x * unit_cell.get_cm(k, 0) + pbc_y * unit_cell.get_cm(k, 1) + pbc_z * unit_cell.get_cm(k, 2);
+                bool needed = false;
+                for (int g = 0; g < ncen && !needed; g++)
+                {
+                    if (grid_radius[g] < 0)
+                        continue;
+                    const double cutoff = grid_radius[g] + reach;
+                    for (int i = 0; i < ncen && !needed; i++)
+                    {
+                        const double dx = x[i] + t[0] - x[g], dy = y[i] + t[1] - y[g], dz = z[i] + t[2] - z[g];
+                        needed = dx * dx + dy * dy + dz * dz <= cutoff * cutoff;
+                    }
+                }
+                if (!needed)
+                    continue;
+                shift.insert(shift.end(), t, t + 3);
+                for (int i = 0; i < ncen; i++)
+                {
+                    x.push_back(x[i] + t[0]);
+                    y.push_back(y[i] + t[1]);
+                    z.push_back(z[i] + t[2]);
+                    atom_z.push_back(atom_z[i]);
+                    if (debug)
+                        file << "xyz= " << pbc_x << pbc_y << pbc_z << " j = " << shift.size() / 3 << " position: " << x.back() << " " << y.back() << " " << z.back() << " Charge: " << atom_z.back() << endl;
+                }
+            }
+    if (debug)
+        file << "Periodic images: " << shift.size() / 3 << " of " << cells << " neighbouring cells reach the grids" << endl;
+    return (int)x.size();
+}
+
+/**
+ * @brief Adds the spherical densities of all sites near a grid point to GRID_SPHERICAL and stores the density of the
+ * atom owning the grid in GRID_OWN_SPHERICAL.
+ *
+ * Site s is atom s % ncen or one of its periodic images. Every site only reaches as far as the spline of its
+ * element, beyond which the density is zero, so a cell list gives the same sums as looping over all sites.
+ *
+ * @param sites Number of sites in x, y and z.
+ * @param splines Spherical density spline per entry of atom_type_list.
+ */
+static void sum_promolecule_density(const WFN &wave,
+                                    const int sites,
+                                    const vec &x,
+                                    const vec &y,
+                                    const vec &z,
+                                    const ivec &atom_type_list,
+                                    const ivec &asym_atom_list,
+                                    const vector<const spherical_density_spline *> &splines,
+                                    grid_arena &grids,
+                                    const bool debug,
+                                    ostream &file)
+{
+    const int ncen = wave.get_ncen();
+    ivec site_type(sites, -1);
+    vec radius(sites, -1.0);
+    for (int s = 0; s < sites; s++)
+    {
+        // Determine which type in the type list of sphericals to use
+        for (int j = 0; j < atom_type_list.size(); j++)
+            if (wave.get_atom_charge(s % ncen) == atom_type_list[j])
+                site_type[s] = j;
+        if (site_type[s] == -1)
+        {
+            if (s < ncen)
+                file << "I skipped an atom! make sure this is okay!" << endl;
+            continue;
+        }
+        if (debug && s < ncen)
+            file << site_type[s] << " Atom type: " << atom_type_list[site_type[s]] << endl;
+        radius[s] = splines[site_type[s]]->get_radius();
+    }
+    const atom_cell_list cells(sites, x.data(), y.data(), z.data(), radius);
+#pragma omp parallel
+    for (int g = 0; g < grids.atoms(); g++)
+    {
+        const int own = asym_atom_list[g];
+        const double *gx = grids.column(GRID_X, g), *gy = grids.column(GRID_Y, g), *gz = grids.column(GRID_Z, g);
+        double *spherical = grids.column(GRID_SPHERICAL, g), *own_spherical = grids.column(GRID_OWN_SPHERICAL, g);
+#pragma omp for schedule(dynamic, 64)
+        for (int p = 0; p < grids.points(g); p++)
+        {
+            double sum = 0.0;
+            cells.for_each(gx[p], gy[p], gz[p], [&](const int s, const double dist)
+                           {
+                               const double temp = splines[site_type[s]]->get(dist);
+                               if (s == own)
+                                   own_spherical[p] = temp;
+                               sum += temp; });
+            spherical[p] += sum;
+        }
+    }
+}
+
+/**
+ * @brief Result of marking the points of per atom grids for a stream compaction.
+ *
+ * The grids are cut into blocks of at most grid_compaction_block points, so both passes parallelise within
+ * atoms as well as over them.
+ */
+struct grid_compaction
+{
+    vector<vector<char>> mask; ///< Per atom, 1 for every point that is kept
+    ivec item_atom, item_begin; ///< Atom and first point of every block
+    ivec item_offset;           ///< Position of the first kept point of every block in the compacted grid
+    ivec new_size;              ///< Kept points per atom
+    ivec atom_offset;           ///< Position of the first kept point of every atom in the compacted grid
+    int total = 0;              ///< Kept points over all atoms
+};
+
+const int grid_compaction_block = 4096;
+
+/**
+ * @brief First pass of the grid compaction: evaluates keep(atom, point) for all points in parallel and gives every
+ * block its output position by an exclusive prefix sum over the block counts.
+ *
+ * @param num_points Number of points per atom.
+ * @param keep Predicate deciding whether a point survives.
+ * @return The mask and output positions, to be handed to scatter_grid_points.
+ */
+template <typename Keep>
+static grid_compaction mark_grid_points(const ivec &num_points, Keep keep)
+{
+    grid_compaction c;
+    const int atoms = (int)num_points.size();
+    c.mask.resize(atoms);
+    for (int i = 0; i < atoms; i++)
+    {
+        c.mask[i].resize(num_points[i]);
+        for (int b = 0; b < num_points[i]; b += grid_compaction_block)
+        {
+            c.item_atom.push_back(i);
+            c.item_begin.push_back(b);
+        }
+    }
+    const int items = (int)c.item_atom.size();
+    ivec item_count(items, 0);
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < items; t++)
+    {
+        const int i = c.item_atom[t];
+        const int end = std::min(num_points[i], c.item_begin[t] + grid_compaction_block);
+        int count = 0;
+        for (int p = c.item_begin[t]; p < end; p++)
+        {
+            c.mask[i][p] = keep(i, p) ? 1 : 0;
+            count += c.mask[i][p];
+        }
+        item_count[t] = count;
+    }
+    c.item_offset.resize(items);
+    c.new_size.assign(atoms, 0);
+    c.atom_offset.assign(atoms, 0);
+    for (int t = 0; t < items; t++)
+    {
+        c.item_offset[t] = c.total;
+        c.new_size[c.item_atom[t]] += item_count[t];
+        c.total += item_count[t];
+    }
+    for (int i = 1; i < atoms; i++)
+        c.atom_offset[i] = c.atom_offset[i - 1] + c.new_size[i - 1];
+    return c;
+}
+
+/**
+ * @brief Second pass of the grid compaction: calls move(atom, point, position, position within the atom) for every
+ * kept point, in parallel over blocks. Positions are those of an ordered compaction, so the result is the same as
+ * erasing the rejected points one by one.
+ */
+template <typename Move>
+static void scatter_grid_points(const grid_compaction &c, const ivec &num_points, Move move)
+{
+    const int items = (int)c.item_atom.size();
+#pragma omp parallel for schedule(dynamic)
+    for (int t = 0; t < items; t++)
+    {
+        const int i = c.item_atom[t];
+        const int end = std::min(num_points[i], c.item_begin[t] + grid_compaction_block);
+        int pos = c.item_offset[t];
+        for (int p = c.item_begin[t]; p < end; p++)
+            if (c.mask[i][p])
+            {
+                move(i, p, pos, pos - c.atom_offset[i]);
+                pos++;
+            }
+    }
+}
+
+/**
+ * @brief Prunes the grids of an arena in place to the points where keep(atom, point) holds, keeping their order.
+ *
+ * @param num_points Number of points per atom, updated.
+ * @param kept If not empty, receives the index before pruning of every kept point per atom.
+ */
+template <typename Keep>
+static void prune_grid_arena(grid_arena &grids, ivec &num_points, vector<ivec> &kept, Keep keep)
+{
+    const grid_compaction pruned = mark_grid_points(num_points, keep);
+#pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < grids.atoms(); i++)
+    {
+        if (!kept.empty())
+        {
+            kept[i].clear();
+            kept[i].reserve(pruned.new_size[i]);
+            for (int p = 0; p < num_points[i]; p++)
+                if (pruned.mask[i][p])
+                    kept[i].push_back(p);
+        }
+        grids.compact(i, pruned.mask[i].data());
+    }
+    num_points = pruned.new_size;
+}
+
 /**
  * Generates Hirshfeld grids based on the specified parameters.
  *
@@ -706,13 +1265,12 @@ void read_atoms_from_CIF(ifstream &cif_input,
  * @param accuracy The accuracy level for grid generation.
  * @param unit_cell The cell object representing the unit cell.
  * @param wave The WFN object containing wavefunction information.
+ * @param snapshot Snapshot of wave, built once by the caller, that evaluates the molecular density.
  * @param atom_type_list The list of atom types.
  * @param asym_atom_list The list of asymmetric atoms.
  * @param needs_grid The vector indicating whether each atom needs a grid.
- * @param d1 The vector of grid vectors in the x-direction.
- * @param d2 The vector of grid vectors in the y-direction.
- * @param d3 The vector of grid vectors in the z-direction.
- * @param dens The vector of density vectors.
+ * @param grids Receives the final grid of every atom of asym_atom_list, the atomic grids are built, pruned and
+ * weighted in place, so the arena is the only copy of the grids.
  * @param file The output stream for writing the grid data.
  * @param start The start time point for timing measurements.
  * @param end_becke The end time point for the Becke grid generation.
@@ -722,6 +1280,13 @@ void read_atoms_from_CIF(ifstream &cif_input,
  * @param end_aspherical The end time point for the aspherical grid generation.
  * @param debug Flag indicating whether to enable debug mode.
  * @param no_date Flag indicating whether to exclude the date in the output.
+ * @param pair_inversions Whether the inversion pairs of every atomic grid are moved to its front and counted in grids.
+ * @param partition Atomic partition of the molecular grid, one of partition_scheme.
+ * @param grid_error Target integration error per atom in electrons for select_atom_grid, 0 keeps the levels of accuracy.
+ * @param pruning Angular pruning of the atomic grids, one of angular_pruning.
+ * @param radial Radial quadrature of the atomic grids, one of radial_scheme.
+ * @param grid_order Order of the points within every final atomic grid, one of grid_point_order. The Hilbert order
+ * is applied after the pruning, so the densities are evaluated for spatially compact runs of points.
  *
  * @return The number of grid points in the final total grid.
  */
@@ -729,13 +1294,11 @@ int make_hirshfeld_grids(const int &pbc,
                          const int &accuracy,
                          cell &unit_cell,
                          const WFN &wave,
+                         const wfn_snapshot &snapshot,
                          const ivec &atom_type_list,
                          const ivec &asym_atom_list,
                          vector<bool> &needs_grid,
-                         vector<vec> &d1,
-                         vector<vec> &d2,
-                         vector<vec> &d3,
-                         vector<vec> &dens,
+                         grid_arena &grids,
                          ostream &file,
                          time_point &start,
                          time_point &end_becke,
@@ -744,8 +1307,17 @@ int make_hirshfeld_grids(const int &pbc,
                          time_point &end_prune,
                          time_point &end_aspherical,
                          bool debug,
-                         bool no_date)
+                         bool no_date,
+                         const bool pair_inversions,
+                         const int partition,
+                         const double grid_error,
+                         const int pruning,
+                         const int radial,
+                         const int grid_order)
 {
+#ifdef FLO_CUDA
+    err_checkf(partition == PARTITION_BECKE, "The CUDA grids only support Becke partitioning", file);
+#endif
     int atoms_with_grids = 0;
     for (int i = 0; i < needs_grid.size(); i++)
     {
@@ -753,21 +1325,19 @@ int make_hirshfeld_grids(const int &pbc,
             atoms_with_grids++;
     }
     ivec num_points(atoms_with_grids);
-    vector<vector<vec>> grid(atoms_with_grids);
-    const int nr_of_atoms = (wave.get_ncen() * (int)pow(pbc * 2 + 1, 3));
+    // inversion partner of every prototype grid point and the prototype index of every point surviving the pruning
+    vector<ivec> partner(pair_inversions ? atoms_with_grids : 0);
+    vector<ivec> kept(partner.size());
+    // the periodic images are appended once the extent of the grids is known
+    int nr_of_atoms = wave.get_ncen();
     vec x(nr_of_atoms), y(nr_of_atoms), z(nr_of_atoms);
     ivec atom_z(nr_of_atoms);
+    vec image_shift;
     vec alpha_max(wave.get_ncen());
     ivec max_l(wave.get_ncen());
     int max_l_overall = 0;
-#pragma omp parallel for
-    for (int i = 0; i < atoms_with_grids; i++)
-        grid[i].resize(6);
-        // GRID COORDINATES for [a][c][p] a = atom [0,ncen],
-        // c = coordinate [0=x, 1=y, 2=z, 3=atomic becke weight, 4= molecular becke weight, 5=total spherical density],
-        // p = point in this grid
 
-        // Accumulate vectors with information about all atoms
+    // Accumulate vectors with information about all atoms
 #pragma omp parallel for
     for (int i = 0; i < wave.get_ncen(); i++)
     {
@@ -777,27 +1347,6 @@ int make_hirshfeld_grids(const int &pbc,
         z[i] = wave.atoms[i].z;
         // if(debug)
         //     file << "xyz= 000 position: " << x[i] << " " << y[i] << " " << z[i] << " Charge: " << atom_z[i] << endl;
-        if (pbc != 0)
-        {
-            int j = 0;
-            for (int pbc_x = -pbc; pbc_x < pbc + 1; pbc_x++)
-                for (int pbc_y = -pbc; pbc_y < pbc + 1; pbc_y++)
-                    for (int pbc_z = -pbc; pbc_z < pbc + 1; pbc_z++)
-                    {
-                        if (pbc_x == 0 && pbc_y == 0 && pbc_z == 0)
-                            continue;
-                        else
-                        {
-                            j++;
-                            atom_z[i + j * wave.get_ncen()] = wave.get_atom_charge(i);
-                            x[i + j * wave.get_ncen()] = wave.atoms[i].x + pbc_x * unit_cell.get_cm(0, 0) + pbc_y * unit_cell.get_cm(0, 1) + pbc_z * unit_cell.get_cm(0, 2);
-                            y[i + j * wave.get_ncen()] = wave.atoms[i].y + pbc_x * unit_cell.get_cm(1, 0) + pbc_y * unit_cell.get_cm(1, 1) + pbc_z * unit_cell.get_cm(1, 2);
-                            z[i + j * wave.get_ncen()] = wave.atoms[i].z + pbc_x * unit_cell.get_cm(2, 0) + pbc_y * unit_cell.get_cm(2, 1) + pbc_z * unit_cell.get_cm(2, 2);
-                            if (debug)
-                                file << "xyz= " << pbc_x << pbc_y << pbc_z << " j = " << j << " position: " << x[i + j * wave.get_ncen()] << " " << y[i + j * wave.get_ncen()] << " " << z[i + j * wave.get_ncen()] << " Charge: " << atom_z[i + j * wave.get_ncen()] << endl;
-                        }
-                    }
-        }
         alpha_max[i] = 0.0;
         max_l[i] = 0;
         for (int b = 0; b < wave.get_nex(); b++)
@@ -908,6 +1457,8 @@ int make_hirshfeld_grids(const int &pbc,
     gpuErrchk(cudaSetDeviceFlags(cudaDeviceScheduleBlockingSync));
 #endif
 
+    const vector<atom_grid_settings> grid_settings = select_grid_settings(grid_error, pruning, radial, wave, atom_type_list, needs_grid, alpha_max, max_l, alpha_min, file);
+
     if (no_date)
         file << "\nMaking Becke Grids..." << flush;
     else
@@ -921,7 +1472,7 @@ int make_hirshfeld_grids(const int &pbc,
     }
 
     // Make Prototype grids with only single atom weights for all elements
-    vector<AtomGrid> Prototype_grids;
+    vector<AtomGrid> Prototype_grids, linear_grids;
 
     for (int i = 0; i < atom_type_list.size(); i++)
     {
@@ -1053,6 +1604,12 @@ int make_hirshfeld_grids(const int &pbc,
                 radial_acc = 1e-15;
             }
         }
+        if (!grid_settings.empty())
+        {
+            radial_acc = grid_settings[i].radial_precision;
+            lebedev_low = grid_settings[i].min_num_angular_points;
+            lebedev_high = grid_settings[i].max_num_angular_points;
+        }
         Prototype_grids.push_back(AtomGrid(radial_acc,
                                            lebedev_low,
                                            lebedev_high,
@@ -1060,8 +1617,24 @@ int make_hirshfeld_grids(const int &pbc,
                                            alpha_max_temp,
                                            max_l_temp,
                                            alpha_min_temp.data(),
-                                           file));
+                                           file,
+                                           pruning,
+                                           radial));
+        if (pruning != PRUNING_LINEAR)
+            linear_grids.push_back(AtomGrid(radial_acc,
+                                            lebedev_low,
+                                            lebedev_high,
+                                            atom_type_list[i],
+                                            alpha_max_temp,
+                                            max_l_temp,
+                                            alpha_min_temp.data(),
+                                            file,
+                                            PRUNING_LINEAR,
+                                            radial));
     }
+    // written after the grids are done, so it does not split their progress line
+    stringstream pruning_log;
+    log_pruning(pruning, wave, atom_type_list, needs_grid, Prototype_grids, linear_grids, pruning_log);
 
     end_prototypes = get_time();
     if (debug)
@@ -1079,85 +1652,25 @@ int make_hirshfeld_grids(const int &pbc,
     }
 
 #ifdef FLO_CUDA
-    vector<vector<double>> radial_density;
-    vector<vector<double>> radial_dist;
-
-    radial_density.resize(atom_type_list.size());
-    radial_dist.resize(atom_type_list.size());
+    // the GPU evaluates the same shared splines as the CPU path, in single precision
+    vector<vector<float>> spline_coef(atom_type_list.size());
+    vector<float> spline_inv_h(atom_type_list.size()), spline_cutoff(atom_type_list.size());
+    ivec spline_intervals(atom_type_list.size());
+    for (int i = 0; i < atom_type_list.size(); i++)
+    {
+        const spherical_density_spline &spline = get_spherical_density_spline(atom_type_list[i], 0, spherical_density_cutoff_for(accuracy));
+        spline_coef[i].assign(spline.get_coefficients().begin(), spline.get_coefficients().end());
+        spline_inv_h[i] = static_cast<float>(spline.get_inv_h());
+        spline_cutoff[i] = static_cast<float>(spline.get_cutoff());
+        spline_intervals[i] = spline.get_intervals();
+        if (debug)
+            file << "Spline intervals for atomic number " << atom_type_list[i] << ": " << spline_intervals[i] << endl;
+    }
     vector<vector<double>> spherical_density(atoms_with_grids);
     spherical_density.resize(asym_atom_list.size());
     for (int i = 0; i < asym_atom_list.size(); i++)
         spherical_density[i].resize(num_points[i]);
 
-    const double incr = pow(1.005, max(1, accuracy - 1));
-    const double lincr = log(incr);
-    const double min_dist = 0.0000001;
-    vector<Thakkar> sphericals;
-    for (int i = 0; i < atom_type_list.size(); i++)
-        sphericals.push_back(Thakkar(atom_type_list[i]));
-    // Make radial grids
-    if (debug)
-    {
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            file << "Calculating for atomic number " << atom_type_list[i] << endl;
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy > 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            file << "Number of radial density points for atomic number " << atom_type_list[i] << ": " << radial_density[i].size() << endl;
-            // for (int j = 0; j < radial_density[i].size(); j++) {
-            //	if (radial_density[i][j] < 0.1)
-            //		break;
-            //	file << scientific << setprecision(8) << radial_density[i][j] << endl;
-            // }
-        }
-    }
-    else
-    {
-#pragma omp parallel for
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy > 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-        }
-    }
-    sphericals.clear();
-
     float **gpu_PosAtomsx = NULL,
           **gpu_PosAtomsy = NULL,
           **gpu_PosAtomsz = NULL,
@@ -1283,8 +1796,6 @@ int make_hirshfeld_grids(const int &pbc,
     gpuErrchk(cudaMemcpyToSymbol(gpu_nmo, &nmo_temp, sizeof(int)));
     gpuErrchk(cudaMemcpyToSymbol(gpu_ncen, &ncen_temp, sizeof(int)));
     gpuErrchk(cudaMemcpyToSymbol(gpu_MaxGrid, &MaxGrid, sizeof(int)));
-    gpuErrchk(cudaMemcpyToSymbol(gpu_start_radial_dens, &min_dist, sizeof(float)));
-    gpuErrchk(cudaMemcpyToSymbol(gpu_log_incr, &lincr, sizeof(float)));
     gpuErrchk(cudaMemcpy(gpu_PosAtomsx[0], PosAtoms[0].data(), sizeof(float) * wave.get_ncen(), cudaMemcpyHostToDevice));
     gpuErrchk(cudaMemcpy(gpu_PosAtomsy[0], PosAtoms[1].data(), sizeof(float) * wave.get_ncen(), cudaMemcpyHostToDevice));
     gpuErrchk(cudaMemcpy(gpu_PosAtomsz[0], PosAtoms[2].data(), sizeof(float) * wave.get_ncen(), cudaMemcpyHostToDevice));
@@ -1355,53 +1866,75 @@ int make_hirshfeld_grids(const int &pbc,
         gpuErrchk(cudaFree(gpu_atomgrid_z[0][i]));
     }
 #else
-    vector<vector<double>> radial_density(atom_type_list.size());
-    vector<vector<double>> radial_dist(atom_type_list.size());
     if (!debug)
     {
         file << " ...  " << flush;
     }
-    // get_grid is parallelized, therefore not parallel here
-    for (int i = 0; i < wave.get_ncen(); i++)
+    if (pbc != 0)
+    {
+        // sites affect a point through the partition or their spherical density, whichever reaches farther
+        double reach = becke_neighbor_radius;
+        for (int i = 0; i < atom_type_list.size(); i++)
+            reach = std::max(reach, get_spherical_density_spline(atom_type_list[i], 0, spherical_density_cutoff_for(accuracy)).get_radius());
+        vec grid_radius(wave.get_ncen(), -1.0);
+        for (int i = 0; i < wave.get_ncen(); i++)
+        {
+            if (!needs_grid[i])
+                continue;
+            for (int j = 0; j < atom_type_list.size(); j++)
+                if (atom_type_list[j] == wave.get_atom_charge(i))
+                {
+                    vec r(Prototype_grids[j].get_num_radial_grid_points());
+                    Prototype_grids[j].get_radial_distances(r.data());
+                    grid_radius[i] = r.empty() ? 0.0 : *std::max_element(r.begin(), r.end());
+                }
+        }
+        nr_of_atoms = add_periodic_images(pbc, unit_cell, wave, grid_radius, reach, x, y, z, atom_z, image_shift, debug, file);
+    }
+    // cell list so the partition of every point only sees the atoms close to it
+    const atom_cell_list becke_sites(nr_of_atoms, x.data(), y.data(), z.data(), vec(nr_of_atoms, becke_neighbor_radius));
+    // prototype of every grid, so the arena can be allocated at once
+    ivec grid_type(atoms_with_grids, 0), grid_atom(atoms_with_grids);
+    for (int i = 0, grid_number = 0; i < wave.get_ncen(); i++)
     {
         // skip atoms, that do not need a grid
         if (!needs_grid[i])
-        {
             continue;
-        }
-        if (debug)
-        {
-            file << "Making grid for atom " << i << endl;
-        }
-        int type = 0;
         for (int j = 0; j < atom_type_list.size(); j++)
             if (atom_type_list[j] == wave.get_atom_charge(i))
-                type = j;
-
-        int grid_number = 0;
-        for (int j = 0; j < i; j++)
+                grid_type[grid_number] = j;
+        grid_atom[grid_number] = i;
+        num_points[grid_number] = Prototype_grids[grid_type[grid_number]].get_num_grid_points();
+        grid_number++;
+    }
+    grids.allocate(num_points, GRID_COLUMNS);
+    // get_grid is parallelized, therefore not parallel here
+    for (int grid_number = 0; grid_number < atoms_with_grids; grid_number++)
+    {
+        const int i = grid_atom[grid_number], type = grid_type[grid_number];
+        if (debug)
         {
-            if (needs_grid[j])
-            {
-                grid_number++;
-            }
+            file << "Making grid for atom " << i << endl;
         }
-        num_points[grid_number] = Prototype_grids[type].get_num_grid_points();
-
-        for (int n = 0; n < 6; n++)
-            grid[grid_number][n].resize(num_points[grid_number], 0.0);
-
-        Prototype_grids[type].get_grid(int(wave.get_ncen() * pow(pbc * 2 + 1, 3)),
+        Prototype_grids[type].get_grid(nr_of_atoms,
                                        i,
                                        &x[0],
                                        &y[0],
                                        &z[0],
                                        &atom_z[0],
-                                       grid[grid_number][0].data(),
-                                       grid[grid_number][1].data(),
-                                       grid[grid_number][2].data(),
-                                       grid[grid_number][3].data(),
-                                       grid[grid_number][5].data());
+                                       grids.column(GRID_X, grid_number),
+                                       grids.column(GRID_Y, grid_number),
+                                       grids.column(GRID_Z, grid_number),
+                                       grids.column(GRID_ATOMIC_WEIGHT, grid_number),
+                                       grids.column(GRID_MOLECULAR_WEIGHT, grid_number),
+                                       &becke_sites,
+                                       partition);
+        if (!partner.empty())
+        {
+            partner[grid_number].resize(num_points[grid_number]);
+            for (int p = 0; p < num_points[grid_number]; p++)
+                partner[grid_number][p] = Prototype_grids[type].get_inversion_partner(p);
+        }
     }
     if (debug)
     {
@@ -1432,6 +1965,7 @@ int make_hirshfeld_grids(const int &pbc,
         file << "Becke Grid exists" << endl;
     else
         file << "                           done! Number of gridpoints: " << defaultfloat << points << endl;
+    file << pruning_log.str();
 
     if (debug)
     {
@@ -1448,15 +1982,12 @@ int make_hirshfeld_grids(const int &pbc,
 #ifdef FLO_CUDA
     vector<vector<float>> total_grid(7);
     float ***gpu_spherical_density = NULL,
-          ***gpu_radial_density = NULL,
-          ***gpu_radial_dist = NULL,
+          ***gpu_spline_coef = NULL,
           **gpu_Grids = NULL;
-    gpu_radial_density = (float ***)malloc(sizeof(float **));
-    gpu_radial_dist = (float ***)malloc(sizeof(float **));
+    gpu_spline_coef = (float ***)malloc(sizeof(float **));
     gpu_spherical_density = (float ***)malloc(sizeof(float **));
 
-    gpu_radial_density[0] = (float **)malloc(sizeof(float *) * atom_type_list.size());
-    gpu_radial_dist[0] = (float **)malloc(sizeof(float *) * atom_type_list.size());
+    gpu_spline_coef[0] = (float **)malloc(sizeof(float *) * atom_type_list.size());
     gpu_spherical_density[0] = (float **)malloc(sizeof(float *) * asym_atom_list.size());
     gpu_Grids = (float **)malloc(sizeof(float *));
 
@@ -1467,10 +1998,8 @@ int make_hirshfeld_grids(const int &pbc,
 
     for (int i = 0; i < atom_type_list.size(); i++)
     {
-        gpuErrchk(cudaMalloc((void **)&gpu_radial_density[0][i], sizeof(float) * radial_density[i].size()));
-        gpuErrchk(cudaMalloc((void **)&gpu_radial_dist[0][i], sizeof(float) * radial_dist[i].size()));
-        gpuErrchk(cudaMemcpy(gpu_radial_density[0][i], radial_density[i].data(), sizeof(float) * radial_density[i].size(), cudaMemcpyHostToDevice));
-        gpuErrchk(cudaMemcpy(gpu_radial_dist[0][i], radial_dist[i].data(), sizeof(float) * radial_dist[i].size(), cudaMemcpyHostToDevice));
+        gpuErrchk(cudaMalloc((void **)&gpu_spline_coef[0][i], sizeof(float) * spline_coef[i].size()));
+        gpuErrchk(cudaMemcpy(gpu_spline_coef[0][i], spline_coef[i].data(), sizeof(float) * spline_coef[i].size(), cudaMemcpyHostToDevice));
     }
     gpuErrchk(cudaDeviceSynchronize());
     gpuErrchk(cudaPeekAtLastError());
@@ -1489,7 +2018,7 @@ int make_hirshfeld_grids(const int &pbc,
                 gpuErrchk(cudaOccupancyMaxPotentialBlockSize(
                     &numBlocks,
                     &blocks,
-                    (void *)gpu_linear_interpolate_spherical_density,
+                    (void *)gpu_spline_spherical_density,
                     0,
                     num_points[i]));
 
@@ -1497,11 +2026,12 @@ int make_hirshfeld_grids(const int &pbc,
                 // file << i << "/" << g << ": blocks: " << gridSize << " threads: " << blocks << endl;
             }
             bool match = (all_atom_list[i] == asym_atom_list[g]);
-            gpu_linear_interpolate_spherical_density<<<gridSize, blocks>>>(
+            gpu_spline_spherical_density<<<gridSize, blocks>>>(
                 i,
-                gpu_radial_density[0][type_list_number],
-                gpu_radial_dist[0][type_list_number],
-                radial_density[type_list_number].size(),
+                gpu_spline_coef[0][type_list_number],
+                spline_inv_h[type_list_number],
+                spline_intervals[type_list_number],
+                spline_cutoff[type_list_number],
                 match,
                 offset,
                 gpu_Gridx[0],
@@ -1535,186 +2065,46 @@ int make_hirshfeld_grids(const int &pbc,
         gpuErrchk(cudaMemcpy(total_grid[6].data(), gpu_Gridmw[0], sizeof(float) * MaxGrid, cudaMemcpyDeviceToHost));
         gpuErrchk(cudaMemcpy(total_grid[4].data(), gpu_Grids[0], sizeof(float) * MaxGrid, cudaMemcpyDeviceToHost));
 
-        gpuErrchk(cudaDeviceSynchronize());
-        gpuErrchk(cudaPeekAtLastError());
-
-        ofstream grid0("grid0.file", ios::out);
-        for (int i = 0; i < MaxGrid; i++)
-        {
-            for (int j = 0; j < 7; j++)
-                grid0 << setw(16) << scientific << setprecision(8) << total_grid[j][i];
-            grid0 << "\n";
-        }
-        grid0.flush();
-        grid0.close();
-    }
-
-    for (int i = 0; i < atom_type_list.size(); i++)
-    {
-        gpuErrchk(cudaFree(gpu_radial_density[0][i]));
-        gpuErrchk(cudaFree(gpu_radial_dist[0][i]));
-    }
-
-#else
-    vector<vector<double>> total_grid(7);
-    // density of spherical atom at each
-    // Dimensions: [a] [d]
-    // a = atom number in atom type list for which the weight is calcualted
-    // d = distance to look at obtained from point_to_distance_map
-    vector<vector<double>> spherical_density(atoms_with_grids);
-
-    const double incr = pow(1.005, max(1, accuracy - 1));
-    const double lincr = log(incr);
-    const double min_dist = 0.0000001;
-    vector<Thakkar> sphericals;
-    for (int i = 0; i < atom_type_list.size(); i++)
-        sphericals.push_back(Thakkar(atom_type_list[i]));
-    // Make radial grids
-    if (debug)
-    {
-        file << "\nSize of atom_type_list:" << setw(5) << atom_type_list.size() << endl;
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            file << "\nCalculating for atomic number " << atom_type_list[i] << endl;
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy < 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            file << "Number of radial density points for atomic number " << atom_type_list[i] << ": " << radial_density[i].size() << endl;
-        }
-    }
-    else
-    {
-#pragma omp parallel for
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy < 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-        }
-    }
-    // sphericals.clear();
-    int type_list_number = -1;
-    if (debug)
-    {
-        file << "Cleared the sphericals!" << endl;
-    }
-#pragma omp parallel
-    {
-#pragma omp for
-        for (int g = 0; g < atoms_with_grids; g++)
-        {
-            spherical_density[g].resize(num_points[g]);
-        }
-        for (int i = 0; i < wave.get_ncen(); i++)
-        {
-#pragma omp single
-            {
-                type_list_number = -1;
-                // Determine which type in the type list of sphericals to use
-                for (int j = 0; j < atom_type_list.size(); j++)
-                    if (wave.get_atom_charge(i) == atom_type_list[j])
-                        type_list_number = j;
-                if (debug && type_list_number != -1)
-                {
-                    file << type_list_number << " Atom type: " << atom_type_list[type_list_number] << endl;
-                }
-            }
-            if (type_list_number == -1)
-            {
-#pragma omp single
-                {
-                    file << "I skipped an atom! make sure this is okay!" << endl;
-                }
-                continue;
-            }
-#pragma omp for
-            for (int g = 0; g < atoms_with_grids; g++)
-            {
-                for (int p = 0; p < num_points[g]; p++)
-                {
-                    double temp =
-                        linear_interpolate_spherical_density(radial_density[type_list_number], radial_dist[type_list_number], sqrt(pow(grid[g][0][p] - wave.atoms[i].x, 2) + pow(grid[g][1][p] - wave.atoms[i].y, 2) + pow(grid[g][2][p] - wave.atoms[i].z, 2)), lincr, min_dist);
-                    if (i == asym_atom_list[g])
-                        spherical_density[g][p] = temp;
-                    grid[g][4][p] += temp;
-                }
-            }
+        gpuErrchk(cudaDeviceSynchronize());
+        gpuErrchk(cudaPeekAtLastError());
+
+        ofstream grid0("grid0.file", ios::out);
+        for (int i = 0; i < MaxGrid; i++)
+        {
+            for (int j = 0; j < 7; j++)
+                grid0 << setw(16) << scientific << setprecision(8) << total_grid[j][i];
+            grid0 << "\n";
         }
+        grid0.flush();
+        grid0.close();
     }
-    // fill out with priodic information
-    if (pbc != 0)
+
+    for (int i = 0; i < atom_type_list.size(); i++)
+        gpuErrchk(cudaFree(gpu_spline_coef[0][i]));
+    free(gpu_spline_coef[0]);
+#else
+    vector<Thakkar> sphericals;
+    for (int i = 0; i < atom_type_list.size(); i++)
+        sphericals.push_back(Thakkar(atom_type_list[i]));
+    vector<const spherical_density_spline *> radial_splines(atom_type_list.size());
+    if (debug)
+        file << "\nSize of atom_type_list:" << setw(5) << atom_type_list.size() << endl;
+    for (int i = 0; i < atom_type_list.size(); i++)
     {
-        for (int _x = -pbc; _x < pbc + 1; _x++)
-            for (int _y = -pbc; _y < pbc + 1; _y++)
-                for (int _z = -pbc; _z < pbc + 1; _z++)
-                {
-                    if (_x == 0 && _y == 0 && _z == 0)
-                        continue;
-                    for (int i = 0; i < wave.get_ncen(); i++)
-                    {
-                        type_list_number = -1;
-                        // int nr = all_atom_list[i];
-                        for (int j = 0; j < atom_type_list.size(); j++)
-                            if (wave.get_atom_charge(i) == atom_type_list[j])
-                                type_list_number = j;
-                        for (int g = 0; g < atoms_with_grids; g++)
-                        {
-#pragma omp parallel for
-                            for (int p = 0; p < num_points[g]; p++)
-                                grid[g][4][p] += linear_interpolate_spherical_density(
-                                    radial_density[type_list_number],
-                                    radial_dist[type_list_number],
-                                    sqrt(
-                                        pow(grid[g][0][p] - (wave.atoms[i].x + _x * unit_cell.get_cm(0, 0) + _y * unit_cell.get_cm(0, 1) + _z * unit_cell.get_cm(0, 2)), 2) + pow(grid[g][1][p] - (wave.atoms[i].y + _x * unit_cell.get_cm(1, 0) + _y * unit_cell.get_cm(1, 1) + _z * unit_cell.get_cm(1, 2)), 2) + pow(grid[g][2][p] - (wave.atoms[i].z + _x * unit_cell.get_cm(2, 0) + _y * unit_cell.get_cm(2, 1) + _z * unit_cell.get_cm(2, 2)), 2)),
-                                    lincr,
-                                    min_dist);
-                        }
-                    }
-                }
+        radial_splines[i] = &get_spherical_density_spline(atom_type_list[i], 0, spherical_density_cutoff_for(accuracy));
+        if (debug)
+        {
+            if (!radial_splines[i]->valid())
+                return false;
+            file << "Spherical density of atomic number " << atom_type_list[i] << " reaches " << radial_splines[i]->get_radius() << " bohr" << endl;
+        }
     }
-    for (int i = 0; i < atoms_with_grids; i++)
-        err_checkf(num_points[i] == spherical_density[i].size(), "mismatch in number of spherical density points! i=" + toString(i), file);
+    // includes the periodic images, which are part of x, y and z
+    sum_promolecule_density(wave, nr_of_atoms, x, y, z, atom_type_list, asym_atom_list, radial_splines, grids, debug, file);
 #endif
 
     file << "                    done!" << endl;
 
-    shrink_vector<vec>(radial_density);
-    shrink_vector<vec>(radial_dist);
-
     if (debug)
     {
         file << "Taking time..." << endl;
@@ -1729,74 +2119,44 @@ int make_hirshfeld_grids(const int &pbc,
     else
         _cutoff = 1E-30;
 #ifndef FLO_CUDA
-    ivec new_gridsize(atoms_with_grids, 0);
-    ivec reductions(atoms_with_grids, 0);
-    int final_size = 0;
     bool prune = true;
     if (prune)
     {
         file << "Pruning Grid..." << flush;
-#pragma omp parallel for reduction(+ : final_size)
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (grid[i][4][p] != 0.0 && abs(grid[i][3][p] * spherical_density[i][p] / grid[i][4][p]) > _cutoff)
-                {
-                    new_gridsize[i]++;
-                }
-            }
-            reductions[i] = num_points[i] - new_gridsize[i];
-            final_size += new_gridsize[i];
-        }
-        for (int k = 0; k < 7; k++)
-            total_grid[k].resize(final_size);
-#pragma omp parallel for
-        for (int i = 0; i < atoms_with_grids; i++)
+        prune_grid_arena(grids, num_points, kept, [&](const int i, const int p)
+                         {
+                             const double sph = grids.column(GRID_SPHERICAL, i)[p];
+                             return sph != 0.0 && abs(grids.column(GRID_ATOMIC_WEIGHT, i)[p] * grids.column(GRID_OWN_SPHERICAL, i)[p] / sph) > _cutoff; });
+    }
+    else
+    {
+        for (int i = 0; i < kept.size(); i++)
         {
-            int offset = 0;
-            for (int j = 0; j < i; j++)
-            {
-                offset += new_gridsize[j];
-            }
-            int reduction = 0;
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (grid[i][4][p] != 0.0 && abs(grid[i][3][p] * spherical_density[i][p - reduction] / grid[i][4][p]) > _cutoff)
-                {
-                    for (int k = 0; k < 5; k++)
-                        total_grid[k][p + offset - reduction] = grid[i][k][p];
-                    total_grid[6][p + offset - reduction] = grid[i][5][p];
-                }
-                else
-                {
-                    spherical_density[i].erase(spherical_density[i].begin() + (p - reduction));
-                    reduction++;
-                }
-            }
-            num_points[i] -= reduction;
-            shrink_vector<vec>(grid[i]);
+            kept[i].resize(num_points[i]);
+            std::iota(kept[i].begin(), kept[i].end(), 0);
         }
     }
-    else
+    if (grid_order == GRID_ORDER_HILBERT)
     {
-        for (int i = 0; i < atoms_with_grids; i++)
+        // kept carries the permutation, so the inversion partners are still found afterwards
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < grids.atoms(); i++)
         {
-            for (int p = 0; p < num_points[i]; p++)
+            const ivec order = hilbert_order(grids.column(GRID_X, i), grids.column(GRID_Y, i), grids.column(GRID_Z, i), num_points[i]);
+            grids.permute(i, order);
+            if (!kept.empty())
             {
-                for (int k = 0; k < 5; k++)
-                    total_grid[k].push_back(grid[i][k][p]);
-                total_grid[6].push_back(grid[i][5][p]);
+                ivec source(num_points[i]);
+                for (int q = 0; q < num_points[i]; q++)
+                    source[q] = kept[i][order[q]];
+                kept[i].swap(source);
             }
-            shrink_vector<vec>(grid[i]);
         }
     }
-    shrink_vector<vector<vec>>(grid);
     points = 0;
     for (int i = 0; i < asym_atom_list.size(); i++)
         points += num_points[i];
 
-    // total_grid[5].resize(total_grid[0].size());
     if (debug)
         file << "sphericals done!" << endl;
     else
@@ -1810,7 +2170,6 @@ int make_hirshfeld_grids(const int &pbc,
     end_prune = get_time();
 
     file << "Calculating non-spherical densities..." << flush;
-    vector<vector<double>> periodic_grid;
 
 #ifdef FLO_CUDA
     // Vector containing integrated numbers of electrons
@@ -2056,98 +2415,90 @@ int make_hirshfeld_grids(const int &pbc,
     file << "Number of points evaluated: " << MaxGrid;
 #else
     {
-        WFN temp = wave;
-        temp.delete_unoccupied_MOs();
-        const int nr_atoms = (int)total_grid[0].size();
-        const int nr_mos = temp.get_nmo(true);
-        const int nr_cen = temp.get_ncen();
+        const int nr_cen = snapshot.get_ncen();
         if (debug)
         {
             file << endl
-                 << "Using " << temp.get_nmo() << " MOs in temporary wavefunction" << endl;
+                 << "Using " << snapshot.get_nmo() << " occupied MOs" << endl;
+            WFN temp = wave;
+            temp.delete_unoccupied_MOs();
             temp.write_wfn("temp_wavefunction.wfn", false, true);
         }
+        const density_batch engine(snapshot);
+        if (debug)
+            file << "Batched density from " << engine.get_primitive_count() << " primitives in " << engine.get_ao_count() << " contracted AOs" << endl;
 #pragma omp parallel
         {
-            vector<vec> d_temp(16);
-            for (int i = 0; i < 16; i++)
+            density_batch_workspace ws;
+            for (int a = 0; a < atoms_with_grids; a++)
             {
-                d_temp[i].resize(nr_cen);
-            }
-            vec phi_temp(nr_mos);
-#pragma omp for
-            for (int i = 0; i < nr_atoms; i++)
-            {
-                total_grid[5][i] = temp.compute_dens(
-                    total_grid[0][i],
-                    total_grid[1][i],
-                    total_grid[2][i],
-                    d_temp,
-                    phi_temp,
-                    false);
+                const double *gx = grids.column(GRID_X, a), *gy = grids.column(GRID_Y, a), *gz = grids.column(GRID_Z, a);
+                double *rho = grids.column(GRID_DENSITY, a);
+                const int batches = (num_points[a] + density_batch_size - 1) / density_batch_size;
+#pragma omp for schedule(dynamic)
+                for (int b = 0; b < batches; b++)
+                {
+                    const int i = b * density_batch_size;
+                    engine.compute(gx + i, gy + i, gz + i, min(density_batch_size, num_points[a] - i), rho + i, ws, false);
+                }
             }
-            for (int i = 0; i < 4; i++)
-                shrink_vector<double>(d_temp[i]);
-            shrink_vector<vec>(d_temp);
-            shrink_vector<double>(phi_temp);
         }
-        // if (debug) {
-        //	//Copy grid from GPU to print:
-        //	// Dimensions: [c] [p]
-        //	// p = the number of gridpoint
-        //	// c = coordinate, which is 0=x, 1=y, 2=z, 3=atomic becke weight, 4=spherical density, 5=wavefunction density, 6=molecular becke weight
-        //	ofstream grid("grid.file", ios::out);
-        //	for (int i = 0; i < total_grid[0].size(); i++) {
-        //		for (int j = 0; j < 7; j++)
-        //			grid << setw(16) << scientific << setprecision(8) << total_grid[j][i];
-        //		grid << "\n";
-        //	}
-        //	grid.flush();
-        //	grid.close();
-        // }
-        if (pbc != 0)
+        if (pbc != 0 && debug)
         {
-            periodic_grid.resize((int)pow(pbc * 2 + 1, 3));
-            int j = 0;
-            for (int d = 0; d < (int)pow(pbc * 2 + 1, 3); d++)
-                periodic_grid[d].resize(total_grid[5].size());
-            for (int _x = -pbc; _x < pbc + 1; _x++)
-                for (int _y = -pbc; _y < pbc + 1; _y++)
-                    for (int _z = -pbc; _z < pbc + 1; _z++)
-                    {
-                        if (_x == 0 && _y == 0 && _z == 0)
-                            continue;
-#pragma omp parallel for
-                        for (int i = 0; i < total_grid[0].size(); i++)
-                        {
-                            periodic_grid[j][i] = temp.compute_dens(total_grid[0][i] + _x * unit_cell.get_cm(0, 0) + _y * unit_cell.get_cm(0, 1) + _z * unit_cell.get_cm(0, 2),
-                                                                    total_grid[1][i] + _x * unit_cell.get_cm(1, 0) + _y * unit_cell.get_cm(1, 1) + _z * unit_cell.get_cm(1, 2),
-                                                                    total_grid[2][i] + _x * unit_cell.get_cm(2, 0) + _y * unit_cell.get_cm(2, 1) + _z * unit_cell.get_cm(2, 2), true);
-                        }
-                        j++;
-                    }
-            if (debug)
+            // The wavefunction densities of the neighbouring cells are only added in debug runs. Every point only
+            // evaluates the cells whose shifted position is within reach of a wavefunction atom.
+            vec wfn_radius(nr_cen);
+            for (int i = 0; i < nr_cen; i++)
+                wfn_radius[i] = get_spherical_density_spline(wave.get_atom_charge(i)).get_radius();
+            const atom_cell_list wfn_atoms(nr_cen, x.data(), y.data(), z.data(), wfn_radius);
+            const int images = (int)image_shift.size() / 3;
+            // every 1000th point is logged with its contributions
+            vector<vec> logged((grids.total_points() + 999) / 1000, vec(images + 1, 0.0));
+#pragma omp parallel
             {
-                for (int i = 0; i < total_grid[0].size(); i++)
+                density_batch_workspace ws;
+                for (int a = 0, start_p = 0; a < atoms_with_grids; start_p += num_points[a], a++)
                 {
-                    if (i % 1000 == 0)
-                        file << "Old dens: " << total_grid[5][i] << " contributions of neighbour-cells:";
-                    for (int _j = 0; _j < pow(pbc * 2 + 1, 3) - 1; _j++)
+                    const double *gx = grids.column(GRID_X, a), *gy = grids.column(GRID_Y, a), *gz = grids.column(GRID_Z, a);
+                    double *rho = grids.column(GRID_DENSITY, a);
+#pragma omp for schedule(dynamic, 64)
+                    for (int i = 0; i < num_points[a]; i++)
                     {
-                        if (i % 1000 == 0)
-                            file << " " << periodic_grid[_j][i];
-                        total_grid[5][i] += periodic_grid[_j][i];
+                        const bool log_point = (start_p + i) % 1000 == 0;
+                        if (log_point)
+                            logged[(start_p + i) / 1000][0] = rho[i];
+                        double sum = 0.0;
+                        for (int t = 0; t < images; t++)
+                        {
+                            const double px = gx[i] - image_shift[3 * t], py = gy[i] - image_shift[3 * t + 1], pz = gz[i] - image_shift[3 * t + 2];
+                            bool reached = false;
+                            wfn_atoms.for_each(px, py, pz, [&](const int, const double)
+                                               { reached = true; });
+                            if (!reached)
+                                continue;
+                            double dens;
+                            engine.compute(&px, &py, &pz, 1, &dens, ws, true);
+                            if (log_point)
+                                logged[(start_p + i) / 1000][t + 1] = dens;
+                            sum += dens;
+                        }
+                        rho[i] += sum;
                     }
-                    if (i % 1000 == 0)
-                        file << endl;
                 }
             }
+            for (const vec &l : logged)
+            {
+                file << "Old dens: " << scientific << setprecision(6) << l[0] << " contributions of neighbour-cells:";
+                for (int t = 1; t <= images; t++)
+                    file << " " << l[t];
+                file << defaultfloat << endl;
+            }
         }
     }
 
     if (debug)
         file << endl
-             << "with total number of points: " << total_grid[0].size() << endl;
+             << "with total number of points: " << grids.total_points() << endl;
     else
         file << "                done!" << endl;
 
@@ -2170,20 +2521,18 @@ int make_hirshfeld_grids(const int &pbc,
 #pragma omp parallel for reduction(+ : el_sum_becke, el_sum_hirshfeld) //, el_sum_spherical)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        // if (debug) file << "i=" << i << endl;
-        int start_p = 0;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, i), *mw = grids.column(GRID_MOLECULAR_WEIGHT, i);
+        const double *sph = grids.column(GRID_SPHERICAL, i), *own = grids.column(GRID_OWN_SPHERICAL, i), *rho = grids.column(GRID_DENSITY, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            if (abs(total_grid[6][p]) > _cutoff)
+            if (abs(mw[p]) > _cutoff)
             {
-                atom_els[0][i] += total_grid[6][p] * total_grid[5][p];
-                atom_els[1][i] += total_grid[6][p] * total_grid[4][p];
+                atom_els[0][i] += mw[p] * rho[p];
+                atom_els[1][i] += mw[p] * sph[p];
             }
-            if (total_grid[4][p] != 0)
+            if (sph[p] != 0)
             {
-                atom_els[2][i] += total_grid[5][p] * total_grid[3][p] * spherical_density[i][p - start_p] / total_grid[4][p];
+                atom_els[2][i] += rho[p] * aw[p] * own[p] / sph[p];
             }
         }
         el_sum_becke += atom_els[0][i];
@@ -2209,15 +2558,21 @@ int make_hirshfeld_grids(const int &pbc,
         file << endl;
     }
 
-#pragma omp parallel for
-    for (int p = 0; p < total_grid[0].size(); p++)
-        total_grid[5][p] *= total_grid[3][p];
+#pragma omp parallel for schedule(dynamic)
+    for (int a = 0; a < atoms_with_grids; a++)
+    {
+        double *rho = grids.column(GRID_DENSITY, a);
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, a);
+        for (int p = 0; p < num_points[a]; p++)
+            rho[p] *= aw[p];
+    }
     file << " done!" << endl;
-    file << "Number of points evaluated: " << total_grid[0].size();
+    file << "Number of points evaluated: " << grids.total_points();
 #endif
 
-    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_becke << " electrons in Becke Grid in total." << endl
-         << endl;
+    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_becke << " electrons in Becke Grid in total." << endl;
+    log_partition(partition, el_sum_becke, wave, pbc == 0 && atoms_with_grids == wave.get_ncen(), end_prototypes, end_becke, no_date, file);
+    file << endl;
 
     file << "Table of Charges in electrons" << endl
          << endl
@@ -2248,15 +2603,8 @@ int make_hirshfeld_grids(const int &pbc,
     }
     end_aspherical = get_time();
 
-    dens.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer dens" << endl;
-    d1.resize(asym_atom_list.size());
-    d2.resize(asym_atom_list.size());
-    d3.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer d1-3" << endl;
 #ifdef FLO_CUDA
+    vector<vec> d1(asym_atom_list.size()), d2(asym_atom_list.size()), d3(asym_atom_list.size()), dens(asym_atom_list.size());
     points = 0;
 #pragma omp parallel for
     for (int i = 0; i < asym_atom_list.size(); i++)
@@ -2318,8 +2666,7 @@ int make_hirshfeld_grids(const int &pbc,
     free(gpu_atom_type_list);
     free(gpu_numpoints);
     free(gpu_atom_z);
-    free(gpu_radial_density);
-    free(gpu_radial_dist);
+    free(gpu_spline_coef);
     free(gpu_spherical_density);
     free(gpu_atomgrid_x);
     free(gpu_atomgrid_y);
@@ -2327,78 +2674,140 @@ int make_hirshfeld_grids(const int &pbc,
     free(gpu_atomgrid_w);
     cudaDeviceReset();
     file << "CUDA device resetted!" << endl;
-#else
-    points = 0;
-#pragma omp parallel for
+    for (int i = 0; i < asym_atom_list.size(); i++)
+        num_points[i] = (int)dens[i].size();
+    grids.allocate(num_points, grid_final_columns);
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        dens[i].resize(num_points[i]);
-        d1[i].resize(num_points[i]);
-        d2[i].resize(num_points[i]);
-        d3[i].resize(num_points[i]);
+        std::copy(d1[i].begin(), d1[i].end(), grids.column(GRID_X, i));
+        std::copy(d2[i].begin(), d2[i].end(), grids.column(GRID_Y, i));
+        std::copy(d3[i].begin(), d3[i].end(), grids.column(GRID_Z, i));
+        std::copy(dens[i].begin(), dens[i].end(), grids.column(GRID_DENSITY, i));
     }
+#else
+    points = 0;
     double upper = 0, diffs = 0, avg = 0, lower = 0;
+    // the weighted densities and relative positions overwrite the grids in place, point p only ever moves to run <= p
 #pragma omp parallel for reduction(+ : points, upper, avg, diffs, lower)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        int start_p = 0;
         int run = 0;
         double res;
         double diff;
         double dist = 0;
         double densy;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
+        ivec source;
+        double *gx = grids.column(GRID_X, i), *gy = grids.column(GRID_Y, i), *gz = grids.column(GRID_Z, i), *rho = grids.column(GRID_DENSITY, i);
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, i), *sph = grids.column(GRID_SPHERICAL, i), *own = grids.column(GRID_OWN_SPHERICAL, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            res = total_grid[5][p] * spherical_density[i][p - start_p] / total_grid[4][p];
+            const double weighted = rho[p];
+            res = weighted * own[p] / sph[p];
             if (abs(res) > _cutoff)
             {
                 densy = 0;
-                dens[i][run] = (res);
-                d1[i][run] = (total_grid[0][p] - wave.atoms[asym_atom_list[i]].x);
-                d2[i][run] = (total_grid[1][p] - wave.atoms[asym_atom_list[i]].y);
-                d3[i][run] = (total_grid[2][p] - wave.atoms[asym_atom_list[i]].z);
-                diff = total_grid[5][p] - total_grid[4][p] * total_grid[3][p];
+                rho[run] = (res);
+                gx[run] = (gx[p] - wave.atoms[asym_atom_list[i]].x);
+                gy[run] = (gy[p] - wave.atoms[asym_atom_list[i]].y);
+                gz[run] = (gz[p] - wave.atoms[asym_atom_list[i]].z);
+                diff = weighted - sph[p] * aw[p];
                 if (wave.atoms[asym_atom_list[i]].ECP_electrons != 0)
                 {
-                    dist = sqrt(pow(d1[i][run], 2) + pow(d2[i][run], 2) + pow(d3[i][run], 2));
+                    dist = sqrt(pow(gx[run], 2) + pow(gy[run], 2) + pow(gz[run], 2));
                     int type_list_number = -1;
                     // Determine which type in the type list of sphericals to use
                     for (int j = 0; j < atom_type_list.size(); j++)
                         if (wave.get_atom_charge(i) == atom_type_list[j])
                             type_list_number = j;
-                    densy = sphericals[type_list_number].get_core_density(dist, wave.atoms[asym_atom_list[i]].ECP_electrons) * total_grid[3][p];
+                    densy = sphericals[type_list_number].get_core_density(dist, wave.atoms[asym_atom_list[i]].ECP_electrons) * aw[p];
                     diff += densy;
                 }
                 diffs += pow(diff, 2);
-                upper += abs(abs(total_grid[5][p]) - abs(total_grid[4][p] * total_grid[3][p]) + densy);
-                lower += abs(total_grid[5][p] + densy);
+                upper += abs(abs(weighted) - abs(sph[p] * aw[p]) + densy);
+                lower += abs(weighted + densy);
                 avg += diff;
+                if (!kept.empty())
+                    source.push_back(kept[i][p]);
                 run++;
             }
         }
         points += run;
-        shrink_vector<double>(spherical_density[i]);
-        dens[i].resize(run);
-        d1[i].resize(run);
-        d2[i].resize(run);
-        d3[i].resize(run);
+        grids.set_points(i, run);
+        if (pair_inversions)
+            grids.set_pairs(i, pair_inversion_partners(source, partner[i], grids, i));
     }
     if (no_date == false)
     {
         file << "NRMSD value of density =              " << setw(9) << setprecision(4) << fixed << sqrt(diffs / points) / (avg / points);
         file << "\nR value of sph. vs non-sph. density = " << setw(9) << setprecision(4) << fixed << upper / lower * 100 << " %" << endl;
     }
-    shrink_vector<vec>(spherical_density);
-#pragma omp parallel for
-    for (int _grid = 0; _grid < total_grid.size(); _grid++)
-        shrink_vector<double>(total_grid[_grid]);
-    shrink_vector<vec>(total_grid);
+    grids.shrink(grid_final_columns);
 #endif
     return points;
 }
 
+/**
+ * Generates Hirshfeld grids into per atom vectors, for callers that modify the grids.
+ *
+ * @param d1 The vector of grid vectors in the x-direction.
+ * @param d2 The vector of grid vectors in the y-direction.
+ * @param d3 The vector of grid vectors in the z-direction.
+ * @param dens The vector of density vectors.
+ * @param inversion_pairs If given, the inversion pairs of every atomic grid are moved to its front and counted here.
+ *
+ * All other parameters and the return value are those of the grid_arena version.
+ */
+int make_hirshfeld_grids(const int &pbc,
+                         const int &accuracy,
+                         cell &unit_cell,
+                         const WFN &wave,
+                         const ivec &atom_type_list,
+                         const ivec &asym_atom_list,
+                         vector<bool> &needs_grid,
+                         vector<vec> &d1,
+                         vector<vec> &d2,
+                         vector<vec> &d3,
+                         vector<vec> &dens,
+                         ostream &file,
+                         time_point &start,
+                         time_point &end_becke,
+                         time_point &end_prototypes,
+                         time_point &end_spherical,
+                         time_point &end_prune,
+                         time_point &end_aspherical,
+                         bool debug,
+                         bool no_date,
+                         ivec *inversion_pairs,
+                         const int partition,
+                         const double grid_error,
+                         const int pruning,
+                         const int radial,
+                         const int grid_order)
+{
+    grid_arena grids;
+    const wfn_snapshot snapshot(wave);
+    const int points = make_hirshfeld_grids(pbc, accuracy, unit_cell, wave, snapshot, atom_type_list, asym_atom_list, needs_grid, grids, file, start,
+                                            end_becke, end_prototypes, end_spherical, end_prune, end_aspherical, debug, no_date,
+                                            inversion_pairs != NULL, partition, grid_error, pruning, radial, grid_order);
+    const int atoms = grids.atoms();
+    d1.resize(atoms);
+    d2.resize(atoms);
+    d3.resize(atoms);
+    dens.resize(atoms);
+    if (inversion_pairs != NULL)
+        inversion_pairs->assign(atoms, 0);
+    for (int i = 0; i < atoms; i++)
+    {
+        d1[i].assign(grids.column(GRID_X, i), grids.column(GRID_X, i) + grids.points(i));
+        d2[i].assign(grids.column(GRID_Y, i), grids.column(GRID_Y, i) + grids.points(i));
+        d3[i].assign(grids.column(GRID_Z, i), grids.column(GRID_Z, i) + grids.points(i));
+        dens[i].assign(grids.column(GRID_DENSITY, i), grids.column(GRID_DENSITY, i) + grids.points(i));
+        if (inversion_pairs != NULL)
+            (*inversion_pairs)[i] = (int)grids.pairs(i);
+    }
+    return points;
+}
+
 /**
  * @brief Generates Hirshfeld grids for the RI method.
  *
@@ -2414,10 +2823,7 @@ int make_hirshfeld_grids(const int &pbc,
  * @param atom_type_list The list of atom types.
  * @param asym_atom_list The list of asymmetric atoms.
  * @param needs_grid The vector indicating if a grid is needed for each atom.
- * @param d1 The displacement vector d1.
- * @param d2 The displacement vector d2.
- * @param d3 The displacement vector d3.
- * @param dens The density vector.
+ * @param grids Receives the final grid of every asymmetric unit atom, built and weighted in place.
  * @param exp_coefs The number of expansion coefficients.
  * @param file The output file stream.
  * @param start The start time point.
@@ -2438,10 +2844,7 @@ static int make_hirshfeld_grids_RI(
     const vector<int> &atom_type_list,
     const vector<int> &asym_atom_list,
     vector<bool> &needs_grid,
-    vector<vec> &d1,
-    vector<vec> &d2,
-    vector<vec> &d3,
-    vector<vec> &dens,
+    grid_arena &grids,
     const int exp_coefs,
     ostream &file,
     time_point &start,
@@ -2451,7 +2854,11 @@ static int make_hirshfeld_grids_RI(
     time_point &end_prune,
     time_point &end_aspherical,
     bool debug,
-    bool no_date)
+    bool no_date,
+    const int partition,
+    const double grid_error,
+    const int pruning,
+    const int radial)
 {
     int atoms_with_grids = 0;
     for (int i = 0; i < needs_grid.size(); i++)
@@ -2460,21 +2867,14 @@ static int make_hirshfeld_grids_RI(
             atoms_with_grids++;
     }
     ivec num_points(atoms_with_grids);
-    // GRID COORDINATES for [a][c][p] a = atom [0,ncen],
-    // c = coordinate [0=x, 1=y, 2=z, 3=atomic becke weight, 4=total spherical density, 5=molecular becke weight],
-    // p = point in this grid
-    vector<vector<vec>> grid(atoms_with_grids);
     const int nr_of_atoms = (wave.get_ncen());
     vec x(nr_of_atoms), y(nr_of_atoms), z(nr_of_atoms);
     ivec atom_z(nr_of_atoms);
     vec alpha_max(wave.get_ncen());
     ivec max_l(wave.get_ncen());
     int max_l_overall = 0;
-#pragma omp parallel for
-    for (int i = 0; i < atoms_with_grids; i++)
-        grid[i].resize(6);
 
-        // Accumulate vectors with information about all atoms
+    // Accumulate vectors with information about all atoms
 #pragma omp parallel for
     for (int i = 0; i < wave.get_ncen(); i++)
     {
@@ -2511,7 +2911,7 @@ static int make_hirshfeld_grids_RI(
 
     vector<vec> alpha_min(wave.get_ncen());
     for (int i = 0; i < wave.get_ncen(); i++)
-        alpha_min[i].resize(max_l_overall, 100000000.0);
+        alpha_min[i].resize(max_l_overall + 1, 100000000.0);
 
 #pragma omp parallel for
     for (int i = 0; i < wave.get_ncen(); i++)
@@ -2552,6 +2952,8 @@ static int make_hirshfeld_grids_RI(
              //<< setw(4) << all_atom_list.size() << " will be used for grid setup and\n"
              << setw(4) << asym_atom_list.size() << " are identified as asymmetric unit atoms!" << endl;
 
+    const vector<atom_grid_settings> grid_settings = select_grid_settings(grid_error, pruning, radial, wave, atom_type_list, needs_grid, alpha_max, max_l, alpha_min, file);
+
     if (no_date)
         file << "\nMaking Becke Grids..." << flush;
     else
@@ -2565,7 +2967,7 @@ static int make_hirshfeld_grids_RI(
     }
 
     // Make Prototype grids with only single atom weights for all elements
-    vector<AtomGrid> Prototype_grids;
+    vector<AtomGrid> Prototype_grids, linear_grids;
 
     for (int i = 0; i < atom_type_list.size(); i++)
     {
@@ -2573,7 +2975,7 @@ static int make_hirshfeld_grids_RI(
             file << "Atom Type " << i << ": " << atom_type_list[i] << endl;
         double alpha_max_temp(0);
         int max_l_temp(0);
-        vec alpha_min_temp(max_l_overall);
+        vec alpha_min_temp(max_l_overall + 1);
         for (int j = 0; j < wave.get_ncen(); j++)
         {
             if (wave.get_atom_charge(j) == 119)
@@ -2697,6 +3099,12 @@ static int make_hirshfeld_grids_RI(
                 radial_acc = 1e-15;
             }
         }
+        if (!grid_settings.empty())
+        {
+            radial_acc = grid_settings[i].radial_precision;
+            lebedev_low = grid_settings[i].min_num_angular_points;
+            lebedev_high = grid_settings[i].max_num_angular_points;
+        }
         Prototype_grids.push_back(AtomGrid(radial_acc,
                                            lebedev_low,
                                            lebedev_high,
@@ -2704,8 +3112,24 @@ static int make_hirshfeld_grids_RI(
                                            alpha_max_temp,
                                            max_l_temp,
                                            alpha_min_temp.data(),
-                                           file));
+                                           file,
+                                           pruning,
+                                           radial));
+        if (pruning != PRUNING_LINEAR)
+            linear_grids.push_back(AtomGrid(radial_acc,
+                                            lebedev_low,
+                                            lebedev_high,
+                                            atom_type_list[i],
+                                            alpha_max_temp,
+                                            max_l_temp,
+                                            alpha_min_temp.data(),
+                                            file,
+                                            PRUNING_LINEAR,
+                                            radial));
     }
+    // written after the grids are done, so it does not split their progress line
+    stringstream pruning_log;
+    log_pruning(pruning, wave, atom_type_list, needs_grid, Prototype_grids, linear_grids, pruning_log);
 
     end_prototypes = get_time();
     if (debug)
@@ -2721,53 +3145,48 @@ static int make_hirshfeld_grids_RI(
             file << "Time until prototypes are done: " << fixed << setprecision(0) << dur << " s" << endl;
     }
 
-    vector<vec> radial_density(atom_type_list.size());
-    vector<vec> radial_dist(atom_type_list.size());
     if (!debug)
     {
         file << " ...  " << flush;
     }
-    // get_grid is parallelized, therefore not parallel here
-    for (int i = 0; i < wave.get_ncen(); i++)
+    // cell list so the partition of every point only sees the atoms close to it
+    const atom_cell_list becke_sites(nr_of_atoms, x.data(), y.data(), z.data(), vec(nr_of_atoms, becke_neighbor_radius));
+    // prototype of every grid, so the arena can be allocated at once
+    ivec grid_type(atoms_with_grids, 0), grid_atom(atoms_with_grids);
+    for (int i = 0, grid_number = 0; i < wave.get_ncen(); i++)
     {
         // skip atoms, that do not need a grid
         if (!needs_grid[i])
-        {
             continue;
-        }
-        if (debug)
-        {
-            file << "Making grid for atom " << i << endl;
-        }
-        int type = 0;
         for (int j = 0; j < atom_type_list.size(); j++)
             if (atom_type_list[j] == wave.get_atom_charge(i))
-                type = j;
-
-        int grid_number = 0;
-        for (int j = 0; j < i; j++)
+                grid_type[grid_number] = j;
+        grid_atom[grid_number] = i;
+        num_points[grid_number] = Prototype_grids[grid_type[grid_number]].get_num_grid_points();
+        grid_number++;
+    }
+    grids.allocate(num_points, GRID_COLUMNS);
+    // get_grid is parallelized, therefore not parallel here
+    for (int grid_number = 0; grid_number < atoms_with_grids; grid_number++)
+    {
+        const int i = grid_atom[grid_number], type = grid_type[grid_number];
+        if (debug)
         {
-            if (needs_grid[j])
-            {
-                grid_number++;
-            }
+            file << "Making grid for atom " << i << endl;
         }
-        num_points[grid_number] = Prototype_grids[type].get_num_grid_points();
-
-        for (int n = 0; n < 6; n++)
-            grid[grid_number][n].resize(num_points[grid_number], 0.0);
-
         Prototype_grids[type].get_grid(int(wave.get_ncen()),
                                        i,
                                        &x[0],
                                        &y[0],
                                        &z[0],
                                        &atom_z[0],
-                                       grid[grid_number][0].data(),
-                                       grid[grid_number][1].data(),
-                                       grid[grid_number][2].data(),
-                                       grid[grid_number][3].data(),
-                                       grid[grid_number][5].data());
+                                       grids.column(GRID_X, grid_number),
+                                       grids.column(GRID_Y, grid_number),
+                                       grids.column(GRID_Z, grid_number),
+                                       grids.column(GRID_ATOMIC_WEIGHT, grid_number),
+                                       grids.column(GRID_MOLECULAR_WEIGHT, grid_number),
+                                       &becke_sites,
+                                       partition);
     }
     if (debug)
     {
@@ -2797,6 +3216,7 @@ static int make_hirshfeld_grids_RI(
         file << "Becke Grid exists" << endl;
     else
         file << "                           done! Number of gridpoints: " << defaultfloat << points << endl;
+    file << pruning_log.str();
 
     if (debug)
     {
@@ -2806,137 +3226,27 @@ static int make_hirshfeld_grids_RI(
 
     file << "Calculating spherical densities..." << flush;
 
-    // Total grid as a sum of all atomic grids.
-    // Dimensions: [c] [p]
-    // p = the number of gridpoint
-    // c = coordinate, which is 0=x, 1=y, 2=z, 3=atomic becke weight, 4=spherical density, 5=wavefunction density, 6=molecular becke weight
-    vector<vec> total_grid(7);
-    // density of spherical atom at each
-    // Dimensions: [a] [d]
-    // a = atom number in atom type list for which the weight is calcualted
-    // d = distance to look at obtained from point_to_distance_map
-    vector<vec> spherical_density(atoms_with_grids);
-
-    const double incr = pow(1.005, max(1, accuracy - 1));
-    const double lincr = log(incr);
-    const double min_dist = 0.0000001;
+    // the ECP core densities further down still need the atoms themselves
     vector<Thakkar> sphericals;
     for (int i = 0; i < atom_type_list.size(); i++)
         sphericals.push_back(Thakkar(atom_type_list[i]));
-    // Make radial grids
+    vector<const spherical_density_spline *> radial_splines(atom_type_list.size());
     if (debug)
-    {
         file << "\nSize of atom_type_list:" << setw(5) << atom_type_list.size() << endl;
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            file << "\nCalculating for atomic number " << atom_type_list[i] << endl;
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy > 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    if (current == -20)
-                        return false;
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            file << "Number of radial density points for atomic number " << atom_type_list[i] << ": " << radial_density[i].size() << endl;
-        }
-    }
-    else
-    {
-#pragma omp parallel for
-        for (int i = 0; i < atom_type_list.size(); i++)
-        {
-            double current = 1;
-            double dist = min_dist;
-            if (accuracy > 3)
-                while (current > 1E-10)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-            else
-                while (current > 1E-12)
-                {
-                    radial_dist[i].push_back(dist);
-                    current = sphericals[i].get_radial_density(dist);
-                    radial_density[i].push_back(current);
-                    dist *= incr;
-                }
-        }
-    }
-    sphericals.clear();
-    int type_list_number = -1;
-    if (debug)
-    {
-        file << "Cleared the sphericals!" << endl;
-    }
-#pragma omp parallel
+    for (int i = 0; i < atom_type_list.size(); i++)
     {
-#pragma omp for
-        for (int g = 0; g < atoms_with_grids; g++)
-        {
-            spherical_density[g].resize(num_points[g]);
-        }
-        for (int i = 0; i < wave.get_ncen(); i++)
+        radial_splines[i] = &get_spherical_density_spline(atom_type_list[i], 0, spherical_density_cutoff_for(accuracy));
+        if (debug)
         {
-#pragma omp single
-            {
-                type_list_number = -1;
-                // Determine which type in the type list of sphericals to use
-                for (int j = 0; j < atom_type_list.size(); j++)
-                    if (wave.get_atom_charge(i) == atom_type_list[j])
-                        type_list_number = j;
-                if (debug && type_list_number != -1)
-                {
-                    file << type_list_number << " Atom type: " << atom_type_list[type_list_number] << endl;
-                }
-            }
-            if (type_list_number == -1)
-            {
-#pragma omp single
-                {
-                    file << "I skipped an atom! make sure this is okay!" << endl;
-                }
-                continue;
-            }
-#pragma omp for
-            for (int g = 0; g < atoms_with_grids; g++)
-            {
-                for (int p = 0; p < num_points[g]; p++)
-                {
-                    double temp =
-                        linear_interpolate_spherical_density(radial_density[type_list_number], radial_dist[type_list_number], sqrt(pow(grid[g][0][p] - wave.atoms[i].x, 2) + pow(grid[g][1][p] - wave.atoms[i].y, 2) + pow(grid[g][2][p] - wave.atoms[i].z, 2)), lincr, min_dist);
-                    if (i == asym_atom_list[g])
-                        spherical_density[g][p] = temp;
-                    grid[g][4][p] += temp;
-                }
-            }
+            if (!radial_splines[i]->valid())
+                return false;
+            file << "Spherical density of atomic number " << atom_type_list[i] << " reaches " << radial_splines[i]->get_radius() << " bohr" << endl;
         }
     }
-    for (int i = 0; i < atoms_with_grids; i++)
-        err_checkf(num_points[i] == spherical_density[i].size(), "mismatch in number of spherical density points! i=" + toString(i), file);
+    sum_promolecule_density(wave, nr_of_atoms, x, y, z, atom_type_list, asym_atom_list, radial_splines, grids, debug, file);
 
     file << "                    done!" << endl;
 
-    shrink_vector<vec>(radial_density);
-    shrink_vector<vec>(radial_dist);
-
     if (debug)
     {
         file << "Taking time..." << endl;
@@ -2951,74 +3261,20 @@ static int make_hirshfeld_grids_RI(
     else
         _cutoff = 1E-30;
 #ifndef FLO_CUDA
-    ivec new_gridsize(atoms_with_grids, 0);
-    ivec reductions(atoms_with_grids, 0);
-    int final_size = 0;
     bool prune = true;
     if (prune)
     {
         file << "Pruning Grid..." << flush;
-#pragma omp parallel for reduction(+ : final_size)
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (grid[i][4][p] != 0.0 && abs(grid[i][3][p] * spherical_density[i][p] / grid[i][4][p]) > _cutoff)
-                {
-                    new_gridsize[i]++;
-                }
-            }
-            reductions[i] = num_points[i] - new_gridsize[i];
-            final_size += new_gridsize[i];
-        }
-        for (int k = 0; k < 7; k++)
-            total_grid[k].resize(final_size);
-#pragma omp parallel for
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            int offset = 0;
-            for (int j = 0; j < i; j++)
-            {
-                offset += new_gridsize[j];
-            }
-            int reduction = 0;
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (grid[i][4][p] != 0.0 && abs(grid[i][3][p] * spherical_density[i][p - reduction] / grid[i][4][p]) > _cutoff)
-                {
-                    for (int k = 0; k < 5; k++)
-                        total_grid[k][p + offset - reduction] = grid[i][k][p];
-                    total_grid[6][p + offset - reduction] = grid[i][5][p];
-                }
-                else
-                {
-                    spherical_density[i].erase(spherical_density[i].begin() + (p - reduction));
-                    reduction++;
-                }
-            }
-            num_points[i] -= reduction;
-            shrink_vector<vec>(grid[i]);
-        }
+        vector<ivec> kept;
+        prune_grid_arena(grids, num_points, kept, [&](const int i, const int p)
+                         {
+                             const double sph = grids.column(GRID_SPHERICAL, i)[p];
+                             return sph != 0.0 && abs(grids.column(GRID_ATOMIC_WEIGHT, i)[p] * grids.column(GRID_OWN_SPHERICAL, i)[p] / sph) > _cutoff; });
     }
-    else
-    {
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                for (int k = 0; k < 5; k++)
-                    total_grid[k].push_back(grid[i][k][p]);
-                total_grid[6].push_back(grid[i][5][p]);
-            }
-            shrink_vector<vec>(grid[i]);
-        }
-    }
-    shrink_vector<vector<vec>>(grid);
     points = 0;
     for (int i = 0; i < asym_atom_list.size(); i++)
         points += num_points[i];
 
-    // total_grid[5].resize(total_grid[0].size());
     if (debug)
         file << "sphericals done!" << endl;
     else
@@ -3036,7 +3292,6 @@ static int make_hirshfeld_grids_RI(
 
     {
         WFN temp = wave;
-        const int nr_pts = (int)total_grid[0].size();
         vector<unsigned long> shape{};
         bool fortran_order;
         vec data{};
@@ -3044,23 +3299,29 @@ static int make_hirshfeld_grids_RI(
         string path{coef_filename};
         npy::LoadArrayFromNumpy(path, shape, fortran_order, data);
 
-#pragma omp parallel for
-        for (int i = 0; i < nr_pts; i++)
+#pragma omp parallel
+        for (int a = 0; a < atoms_with_grids; a++)
         {
-            total_grid[5][i] = calc_density_ML(
-                total_grid[0][i],
-                total_grid[1][i],
-                total_grid[2][i],
-                data,
-                temp.atoms,
-                exp_coefs);
+            double *gx = grids.column(GRID_X, a), *gy = grids.column(GRID_Y, a), *gz = grids.column(GRID_Z, a);
+            double *rho = grids.column(GRID_DENSITY, a);
+#pragma omp for
+            for (int i = 0; i < num_points[a]; i++)
+            {
+                rho[i] = calc_density_ML(
+                    gx[i],
+                    gy[i],
+                    gz[i],
+                    data,
+                    temp.atoms,
+                    exp_coefs);
+            }
         }
         shrink_vector<double>(data);
     }
 
     if (debug)
         file << endl
-             << "with total number of points: " << total_grid[0].size() << endl;
+             << "with total number of points: " << grids.total_points() << endl;
     else
         file << "                done!" << endl;
 
@@ -3083,21 +3344,19 @@ static int make_hirshfeld_grids_RI(
 #pragma omp parallel for reduction(+ : el_sum_becke, el_sum_hirshfeld) // el_sum_spherical)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        // if (debug) file << "i=" << i << endl;
-        int start_p = 0;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, i), *mw = grids.column(GRID_MOLECULAR_WEIGHT, i);
+        const double *sph = grids.column(GRID_SPHERICAL, i), *own = grids.column(GRID_OWN_SPHERICAL, i), *rho = grids.column(GRID_DENSITY, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            if (abs(total_grid[6][p]) > _cutoff)
+            if (abs(mw[p]) > _cutoff)
             {
-                atom_els[0][i] += total_grid[6][p] * total_grid[5][p]; // Molecular grid * WFN rho
-                atom_els[1][i] += total_grid[6][p] * total_grid[4][p]; // Molecular grid * spheircal rho
+                atom_els[0][i] += mw[p] * rho[p]; // Molecular grid * WFN rho
+                atom_els[1][i] += mw[p] * sph[p]; // Molecular grid * spheircal rho
             }
-            if (total_grid[4][p] != 0)
+            if (sph[p] != 0)
             {
                 // WFN rho * atomic weight * hirshfeld weight
-                atom_els[2][i] += total_grid[5][p] * total_grid[3][p] * spherical_density[i][p - start_p] / total_grid[4][p];
+                atom_els[2][i] += rho[p] * aw[p] * own[p] / sph[p];
             }
         }
         el_sum_becke += atom_els[0][i];
@@ -3123,14 +3382,20 @@ static int make_hirshfeld_grids_RI(
         file << endl;
     }
 
-#pragma omp parallel for
-    for (int p = 0; p < total_grid[0].size(); p++)
-        total_grid[5][p] *= total_grid[3][p];
+#pragma omp parallel for schedule(dynamic)
+    for (int a = 0; a < atoms_with_grids; a++)
+    {
+        double *rho = grids.column(GRID_DENSITY, a);
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, a);
+        for (int p = 0; p < num_points[a]; p++)
+            rho[p] *= aw[p];
+    }
     file << " done!" << endl;
-    file << "Number of points evaluated: " << total_grid[0].size();
+    file << "Number of points evaluated: " << grids.total_points();
 
-    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_becke << " electrons in Becke Grid in total." << endl
-         << endl;
+    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_becke << " electrons in Becke Grid in total." << endl;
+    log_partition(partition, el_sum_becke, wave, atoms_with_grids == wave.get_ncen(), end_prototypes, end_becke, no_date, file);
+    file << endl;
 
     file << "Table of Charges in electrons" << endl
          << endl
@@ -3161,49 +3426,34 @@ static int make_hirshfeld_grids_RI(
     }
     end_aspherical = get_time();
 
-    dens.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer dens" << endl;
-    d1.resize(asym_atom_list.size());
-    d2.resize(asym_atom_list.size());
-    d3.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer d1-3" << endl;
     points = 0;
-#pragma omp parallel for
-    for (int i = 0; i < asym_atom_list.size(); i++)
-    {
-        dens[i].resize(num_points[i]);
-        d1[i].resize(num_points[i]);
-        d2[i].resize(num_points[i]);
-        d3[i].resize(num_points[i]);
-    }
     double upper = 0, diffs = 0, avg = 0, lower = 0;
+    // the weighted densities and relative positions overwrite the grids in place, point p only ever moves to run <= p
 #pragma omp parallel for reduction(+ : points, upper, avg, diffs, lower)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        int start_p = 0;
         int run = 0;
         double res;
         double diff;
         double dist = 0;
         double densy;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
+        double *gx = grids.column(GRID_X, i), *gy = grids.column(GRID_Y, i), *gz = grids.column(GRID_Z, i), *rho = grids.column(GRID_DENSITY, i);
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, i), *sph = grids.column(GRID_SPHERICAL, i), *own = grids.column(GRID_OWN_SPHERICAL, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            res = total_grid[5][p] * spherical_density[i][p - start_p] / total_grid[4][p];
+            const double weighted = rho[p];
+            res = weighted * own[p] / sph[p];
             if (abs(res) > _cutoff)
             {
                 densy = 0;
-                dens[i][run] = (res);
-                d1[i][run] = (total_grid[0][p] - wave.atoms[asym_atom_list[i]].x);
-                d2[i][run] = (total_grid[1][p] - wave.atoms[asym_atom_list[i]].y);
-                d3[i][run] = (total_grid[2][p] - wave.atoms[asym_atom_list[i]].z);
-                diff = total_grid[5][p] - total_grid[4][p] * total_grid[3][p];
+                rho[run] = (res);
+                gx[run] = (gx[p] - wave.atoms[asym_atom_list[i]].x);
+                gy[run] = (gy[p] - wave.atoms[asym_atom_list[i]].y);
+                gz[run] = (gz[p] - wave.atoms[asym_atom_list[i]].z);
+                diff = weighted - sph[p] * aw[p];
                 if (wave.atoms[asym_atom_list[i]].ECP_electrons != 0)
                 {
-                    dist = sqrt(pow(d1[i][run], 2) + pow(d2[i][run], 2) + pow(d3[i][run], 2));
+                    dist = sqrt(pow(gx[run], 2) + pow(gy[run], 2) + pow(gz[run], 2));
                     int type_list_number = -1;
                     // Determine which type in the type list of sphericals to use
                     for (int j = 0; j < atom_type_list.size(); j++)
@@ -3213,29 +3463,21 @@ static int make_hirshfeld_grids_RI(
                     diff += densy;
                 }
                 diffs += pow(diff, 2);
-                upper += abs(abs(total_grid[5][p]) - abs(total_grid[4][p] * total_grid[3][p]) + densy);
-                lower += abs(total_grid[5][p] + densy);
+                upper += abs(abs(weighted) - abs(sph[p] * aw[p]) + densy);
+                lower += abs(weighted + densy);
                 avg += diff;
                 run++;
             }
         }
         points += run;
-        shrink_vector<double>(spherical_density[i]);
-        dens[i].resize(run);
-        d1[i].resize(run);
-        d2[i].resize(run);
-        d3[i].resize(run);
+        grids.set_points(i, run);
     }
     if (no_date == false)
     {
         file << "NRMSD value of density =              " << setw(9) << setprecision(4) << fixed << sqrt(diffs / points) / (avg / points);
         file << "\nR value of sph. vs non-sph. density = " << setw(9) << setprecision(4) << fixed << upper / lower * 100 << " %" << endl;
     }
-    shrink_vector<vec>(spherical_density);
-#pragma omp parallel for
-    for (int _grid = 0; _grid < total_grid.size(); _grid++)
-        shrink_vector<double>(total_grid[_grid]);
-    shrink_vector<vec>(total_grid);
+    grids.shrink(grid_final_columns);
     return points;
 }
 
@@ -3251,10 +3493,7 @@ static int make_hirshfeld_grids_RI(
  * @param atom_type_list The list of atom types.
  * @param asym_atom_list The list of asymmetric atoms.
  * @param needs_grid The vector indicating whether each atom needs a grid.
- * @param d1 The vector to store the first integration grid.
- * @param d2 The vector to store the second integration grid.
- * @param d3 The vector to store the third integration grid.
- * @param dens The vector to store the density.
+ * @param grids Receives the final integration grid of every asymmetric unit atom, built and weighted in place.
  * @param exp_coefs The number of expansion coefficients.
  * @param file The output stream to write the integration grids.
  * @param start The start time point for measuring execution time.
@@ -3276,10 +3515,7 @@ static int make_integration_grids(
     const vector<int> &atom_type_list,
     const vector<int> &asym_atom_list,
     vector<bool> &needs_grid,
-    vector<vec> &d1,
-    vector<vec> &d2,
-    vector<vec> &d3,
-    vector<vec> &dens,
+    grid_arena &grids,
     const int exp_coefs,
     ostream &file,
     time_point &start,
@@ -3289,7 +3525,11 @@ static int make_integration_grids(
     time_point &end_prune,
     time_point &end_aspherical,
     bool debug,
-    bool no_date)
+    bool no_date,
+    const int partition,
+    const double grid_error,
+    const int pruning,
+    const int radial)
 {
     int atoms_with_grids = 0;
     for (int i = 0; i < needs_grid.size(); i++)
@@ -3299,14 +3539,6 @@ static int make_integration_grids(
     }
     // counts number of points inside each atomic grid
     ivec num_points(atoms_with_grids);
-    // GRID COORDINATES for [a][c][p]
-    // a = atom [0,ncen],
-    // c = coordinate [0=x, 1=y, 2=z, 3=atomic becke weight, 4=molecular weight],
-    // p = point in this grid
-    vector<vector<vec>> grid(atoms_with_grids);
-#pragma omp parallel for
-    for (int i = 0; i < atoms_with_grids; i++)
-        grid[i].resize(5);
 
     const int nr_of_atoms = (wave.get_ncen());
     // positions
@@ -3354,7 +3586,7 @@ static int make_integration_grids(
 
     vector<vec> alpha_min(wave.get_ncen());
     for (int i = 0; i < wave.get_ncen(); i++)
-        alpha_min[i].resize(max_l_overall, 100000000.0);
+        alpha_min[i].resize(max_l_overall + 1, 100000000.0);
 
 #pragma omp parallel for
     for (int i = 0; i < wave.get_ncen(); i++)
@@ -3395,6 +3627,8 @@ static int make_integration_grids(
              //<< setw(4) << all_atom_list.size() << " will be used for grid setup and\n"
              << setw(4) << asym_atom_list.size() << " are identified as asymmetric unit atoms!" << endl;
 
+    const vector<atom_grid_settings> grid_settings = select_grid_settings(grid_error, pruning, radial, wave, atom_type_list, needs_grid, alpha_max, max_l, alpha_min, file);
+
     if (no_date)
         file << "\nMaking Becke Grids..." << flush;
     else
@@ -3408,7 +3642,7 @@ static int make_integration_grids(
     }
 
     // Make Prototype grids with only single atom weights for all elements
-    vector<AtomGrid> Prototype_grids;
+    vector<AtomGrid> Prototype_grids, linear_grids;
 
     for (int i = 0; i < atom_type_list.size(); i++)
     {
@@ -3416,7 +3650,7 @@ static int make_integration_grids(
             file << "Atom Type " << i << ": " << atom_type_list[i] << endl;
         double alpha_max_temp(0);
         int max_l_temp(0);
-        vec alpha_min_temp(max_l_overall);
+        vec alpha_min_temp(max_l_overall + 1);
         for (int j = 0; j < wave.get_ncen(); j++)
         {
             if (wave.get_atom_charge(j) == 119)
@@ -3540,6 +3774,12 @@ static int make_integration_grids(
                 radial_acc = 1e-15;
             }
         }
+        if (!grid_settings.empty())
+        {
+            radial_acc = grid_settings[i].radial_precision;
+            lebedev_low = grid_settings[i].min_num_angular_points;
+            lebedev_high = grid_settings[i].max_num_angular_points;
+        }
         Prototype_grids.push_back(AtomGrid(radial_acc,
                                            lebedev_low,
                                            lebedev_high,
@@ -3547,8 +3787,24 @@ static int make_integration_grids(
                                            alpha_max_temp,
                                            max_l_temp,
                                            alpha_min_temp.data(),
-                                           file));
+                                           file,
+                                           pruning,
+                                           radial));
+        if (pruning != PRUNING_LINEAR)
+            linear_grids.push_back(AtomGrid(radial_acc,
+                                            lebedev_low,
+                                            lebedev_high,
+                                            atom_type_list[i],
+                                            alpha_max_temp,
+                                            max_l_temp,
+                                            alpha_min_temp.data(),
+                                            file,
+                                            PRUNING_LINEAR,
+                                            radial));
     }
+    // written after the grids are done, so it does not split their progress line
+    stringstream pruning_log;
+    log_pruning(pruning, wave, atom_type_list, needs_grid, Prototype_grids, linear_grids, pruning_log);
 
     end_prototypes = get_time();
     if (debug)
@@ -3568,47 +3824,45 @@ static int make_integration_grids(
     {
         file << " ...  " << flush;
     }
-    // get_grid is parallelized, therefore not parallel here
-    for (int i = 0; i < wave.get_ncen(); i++)
+    // cell list so the partition of every point only sees the atoms close to it
+    const atom_cell_list becke_sites(nr_of_atoms, x.data(), y.data(), z.data(), vec(nr_of_atoms, becke_neighbor_radius));
+    // prototype of every grid, so the arena can be allocated at once
+    ivec grid_type(atoms_with_grids, 0), grid_atom(atoms_with_grids);
+    for (int i = 0, grid_number = 0; i < wave.get_ncen(); i++)
     {
         // skip atoms, that do not need a grid
         if (!needs_grid[i])
-        {
             continue;
-        }
-        if (debug)
-        {
-            file << "Making grid for atom " << i << endl;
-        }
-        int type = 0;
         for (int j = 0; j < atom_type_list.size(); j++)
             if (atom_type_list[j] == wave.get_atom_charge(i))
-                type = j;
-
-        int grid_number = 0;
-        for (int j = 0; j < i; j++)
+                grid_type[grid_number] = j;
+        grid_atom[grid_number] = i;
+        num_points[grid_number] = Prototype_grids[grid_type[grid_number]].get_num_grid_points();
+        grid_number++;
+    }
+    // no spherical densities, so only the columns up to the molecular weight
+    grids.allocate(num_points, GRID_MOLECULAR_WEIGHT + 1);
+    // get_grid is parallelized, therefore not parallel here
+    for (int grid_number = 0; grid_number < atoms_with_grids; grid_number++)
+    {
+        const int i = grid_atom[grid_number], type = grid_type[grid_number];
+        if (debug)
         {
-            if (needs_grid[j])
-            {
-                grid_number++;
-            }
+            file << "Making grid for atom " << i << endl;
         }
-        num_points[grid_number] = Prototype_grids[type].get_num_grid_points();
-
-        for (int n = 0; n < grid[grid_number].size(); n++)
-            grid[grid_number][n].resize(num_points[grid_number], 0.0);
-
         Prototype_grids[type].get_grid(wave.get_ncen(),
                                        i,
                                        &x[0],
                                        &y[0],
                                        &z[0],
                                        &atom_z[0],
-                                       grid[grid_number][0].data(),
-                                       grid[grid_number][1].data(),
-                                       grid[grid_number][2].data(),
-                                       grid[grid_number][3].data(),
-                                       grid[grid_number][4].data());
+                                       grids.column(GRID_X, grid_number),
+                                       grids.column(GRID_Y, grid_number),
+                                       grids.column(GRID_Z, grid_number),
+                                       grids.column(GRID_ATOMIC_WEIGHT, grid_number),
+                                       grids.column(GRID_MOLECULAR_WEIGHT, grid_number),
+                                       &becke_sites,
+                                       partition);
     }
     if (debug)
     {
@@ -3638,17 +3892,13 @@ static int make_integration_grids(
         file << "Becke Grid exists" << endl;
     else
         file << "                           done! Number of gridpoints: " << defaultfloat << points << endl;
+    file << pruning_log.str();
 
     if (debug)
     {
         file << "Taking time..." << endl;
     }
     end_becke = get_time();
-    // Total grid as a sum of all atomic grids.
-    // Dimensions: [c] [p]
-    // p = the number of gridpoint
-    // c = coordinate, which is 0=x, 1=y, 2=z, 3=atomic becke weight, 4=wavefunction density, 5=MW
-    vector<vec> total_grid(6);
 
     //int type_list_number = -1;
 
@@ -3665,68 +3915,14 @@ static int make_integration_grids(
         _cutoff = 1E-14;
     else
         _cutoff = 1E-30;
-    ivec new_gridsize(atoms_with_grids, 0);
-    ivec reductions(atoms_with_grids, 0);
-    int final_size = 0;
     bool prune = true;
     if (prune)
     {
         file << "Pruning Grid..." << flush;
-#pragma omp parallel for reduction(+ : final_size)
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (abs(grid[i][4][p]) > _cutoff)
-                {
-                    new_gridsize[i]++;
-                }
-            }
-            reductions[i] = num_points[i] - new_gridsize[i];
-            final_size += new_gridsize[i];
-        }
-        for (int k = 0; k < total_grid.size(); k++)
-            total_grid[k].resize(final_size);
-#pragma omp parallel for
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            int offset = 0;
-            for (int j = 0; j < i; j++)
-            {
-                offset += new_gridsize[j];
-            }
-            int reduction = 0;
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (abs(grid[i][4][p]) > _cutoff)
-                {
-                    for (int k = 0; k < 4; k++)
-                        total_grid[k][p + offset - reduction] = grid[i][k][p];
-                    total_grid[5][p + offset - reduction] = grid[i][4][p];
-                }
-                else
-                {
-                    reduction++;
-                }
-            }
-            num_points[i] -= reduction;
-            shrink_vector<vec>(grid[i]);
-        }
-    }
-    else
-    {
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                for (int k = 0; k < 4; k++)
-                    total_grid[k].push_back(grid[i][k][p]);
-                total_grid[5].push_back(grid[i][4][p]);
-            }
-            shrink_vector<vec>(grid[i]);
-        }
+        vector<ivec> kept;
+        prune_grid_arena(grids, num_points, kept, [&](const int i, const int p)
+                         { return abs(grids.column(GRID_MOLECULAR_WEIGHT, i)[p]) > _cutoff; });
     }
-    shrink_vector<vector<vec>>(grid);
     points = 0;
     for (int i = 0; i < asym_atom_list.size(); i++)
         points += num_points[i];
@@ -3742,7 +3938,6 @@ static int make_integration_grids(
     file << "Calculating non-spherical densities..." << flush;
 
     WFN temp = wave;
-    const int nr_pts = (int)total_grid[0].size();
     vector<unsigned long> shape{};
     bool fortran_order;
     vec data{};
@@ -3750,22 +3945,28 @@ static int make_integration_grids(
     string path{coef_filename};
     npy::LoadArrayFromNumpy(path, shape, fortran_order, data);
 
-#pragma omp parallel for
-    for (int i = 0; i < nr_pts; i++)
+#pragma omp parallel
+    for (int a = 0; a < atoms_with_grids; a++)
     {
-        total_grid[4][i] = calc_density_ML(
-            total_grid[0][i],
-            total_grid[1][i],
-            total_grid[2][i],
-            data,
-            temp.atoms,
-            exp_coefs);
+        double *gx = grids.column(GRID_X, a), *gy = grids.column(GRID_Y, a), *gz = grids.column(GRID_Z, a);
+        double *rho = grids.column(GRID_DENSITY, a);
+#pragma omp for
+        for (int i = 0; i < num_points[a]; i++)
+        {
+            rho[i] = calc_density_ML(
+                gx[i],
+                gy[i],
+                gz[i],
+                data,
+                temp.atoms,
+                exp_coefs);
+        }
     }
     shrink_vector<double>(data);
 
     if (debug)
         file << endl
-             << "with total number of points: " << total_grid[0].size() << endl;
+             << "with total number of points: " << grids.total_points() << endl;
     else
         file << "                done!" << endl;
 
@@ -3786,12 +3987,10 @@ static int make_integration_grids(
 #pragma omp parallel for reduction(+ : el_sum_SALTED)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        int start_p = 0;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
+        const double *rho = grids.column(GRID_DENSITY, i), *mw = grids.column(GRID_MOLECULAR_WEIGHT, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            atom_els[2][i] += total_grid[4][p] * total_grid[5][p];
+            atom_els[2][i] += rho[p] * mw[p];
         }
         el_sum_SALTED += atom_els[2][i];
         if (wave.get_has_ECPs())
@@ -3811,14 +4010,20 @@ static int make_integration_grids(
         file << endl;
     }
 
-#pragma omp parallel for
-    for (int p = 0; p < total_grid[0].size(); p++)
-        total_grid[4][p] *= total_grid[5][p];
+#pragma omp parallel for schedule(dynamic)
+    for (int a = 0; a < atoms_with_grids; a++)
+    {
+        double *rho = grids.column(GRID_DENSITY, a);
+        const double *mw = grids.column(GRID_MOLECULAR_WEIGHT, a);
+        for (int p = 0; p < num_points[a]; p++)
+            rho[p] *= mw[p];
+    }
     file << " done!" << endl;
-    file << "Number of points evaluated: " << total_grid[0].size();
+    file << "Number of points evaluated: " << grids.total_points();
 
-    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_SALTED << " electrons in Becke Grid in total." << endl
-         << endl;
+    file << " with " << fixed << setw(10) << setprecision(6) << el_sum_SALTED << " electrons in Becke Grid in total." << endl;
+    log_partition(partition, el_sum_SALTED, wave, atoms_with_grids == wave.get_ncen(), end_prototypes, end_becke, no_date, file);
+    file << endl;
 
     file << "Table of Charges in electrons" << endl
          << endl
@@ -3842,51 +4047,28 @@ static int make_integration_grids(
     }
     end_aspherical = get_time();
 
-    dens.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer dens" << endl;
-    d1.resize(asym_atom_list.size());
-    d2.resize(asym_atom_list.size());
-    d3.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer d1-3" << endl;
-
     points = 0;
-#pragma omp parallel
+    // the relative positions overwrite the grids in place, point p only ever moves to run <= p
+#pragma omp parallel for reduction(+ : points)
+    for (int i = 0; i < asym_atom_list.size(); i++)
     {
-#pragma omp for reduction(+ : points)
-        for (int i = 0; i < asym_atom_list.size(); i++)
+        int run = 0;
+        double *gx = grids.column(GRID_X, i), *gy = grids.column(GRID_Y, i), *gz = grids.column(GRID_Z, i), *rho = grids.column(GRID_DENSITY, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            dens[i].resize(num_points[i]);
-            d1[i].resize(num_points[i]);
-            d2[i].resize(num_points[i]);
-            d3[i].resize(num_points[i]);
-            int start_p = 0;
-            int run = 0;
-            for (int a = 0; a < i; a++)
-                start_p += num_points[a];
-            for (int p = start_p; p < start_p + num_points[i]; p++)
+            if (abs(rho[p]) > _cutoff)
             {
-                if (abs(total_grid[4][p]) > _cutoff)
-                {
-                    dens[i][run] = (total_grid[4][p]);
-                    d1[i][run] = (total_grid[0][p] - wave.atoms[asym_atom_list[i]].x);
-                    d2[i][run] = (total_grid[1][p] - wave.atoms[asym_atom_list[i]].y);
-                    d3[i][run] = (total_grid[2][p] - wave.atoms[asym_atom_list[i]].z);
-                    run++;
-                }
+                rho[run] = (rho[p]);
+                gx[run] = (gx[p] - wave.atoms[asym_atom_list[i]].x);
+                gy[run] = (gy[p] - wave.atoms[asym_atom_list[i]].y);
+                gz[run] = (gz[p] - wave.atoms[asym_atom_list[i]].z);
+                run++;
             }
-            points += run;
-            dens[i].resize(run);
-            d1[i].resize(run);
-            d2[i].resize(run);
-            d3[i].resize(run);
         }
-#pragma omp for
-        for (int _grid = 0; _grid < total_grid.size(); _grid++)
-            shrink_vector<double>(total_grid[_grid]);
+        points += run;
+        grids.set_points(i, run);
     }
-    shrink_vector<vec>(total_grid);
+    grids.shrink(grid_final_columns);
     return points;
 }
 
@@ -3926,10 +4108,7 @@ static int make_integration_grids_SALTED(
     const vector<int> &atom_type_list,
     const vector<int> &asym_atom_list,
     vector<bool> &needs_grid,
-    vector<vec> &d1,
-    vector<vec> &d2,
-    vector<vec> &d3,
-    vector<vec> &dens,
+    grid_arena &grids,
     const int exp_coefs,
     ostream &file,
     time_point &start,
@@ -3938,7 +4117,10 @@ static int make_integration_grids_SALTED(
     time_point &end_prune,
     time_point &end_aspherical,
     bool debug,
-    bool no_date)
+    bool no_date,
+    const double grid_error,
+    const int pruning,
+    const int radial)
 {
     int atoms_with_grids = 0;
     for (int i = 0; i < needs_grid.size(); i++)
@@ -3948,14 +4130,6 @@ static int make_integration_grids_SALTED(
     }
     // counts number of points inside each atomic grid
     ivec num_points(atoms_with_grids);
-    // GRID COORDINATES for [a][c][p]
-    // a = atom [0,ncen],
-    // c = coordinate [0=x, 1=y, 2=z, 3=atomic weight],
-    // p = point in this grid
-    vector<vector<vec>> grid(atoms_with_grids);
-#pragma omp parallel for
-    for (int i = 0; i < atoms_with_grids; i++)
-        grid[i].resize(4);
 
     const int nr_of_atoms = (wave.get_ncen());
     // positions
@@ -4003,7 +4177,7 @@ static int make_integration_grids_SALTED(
 
     vector<vec> alpha_min(wave.get_ncen());
     for (int i = 0; i < wave.get_ncen(); i++)
-        alpha_min[i].resize(max_l_overall, 100000000.0);
+        alpha_min[i].resize(max_l_overall + 1, 100000000.0);
 
 #pragma omp parallel for
     for (int i = 0; i < wave.get_ncen(); i++)
@@ -4044,6 +4218,8 @@ static int make_integration_grids_SALTED(
              //<< setw(4) << all_atom_list.size() << " will be used for grid setup and\n"
              << setw(4) << asym_atom_list.size() << " are identified as asymmetric unit atoms!" << endl;
 
+    const vector<atom_grid_settings> grid_settings = select_grid_settings(grid_error, pruning, radial, wave, atom_type_list, needs_grid, alpha_max, max_l, alpha_min, file);
+
     if (no_date)
         file << "\nMaking Becke Grids..." << flush;
     else
@@ -4057,7 +4233,7 @@ static int make_integration_grids_SALTED(
     }
 
     // Make Prototype grids with only single atom weights for all elements
-    vector<AtomGrid> Prototype_grids;
+    vector<AtomGrid> Prototype_grids, linear_grids;
 
     for (int i = 0; i < atom_type_list.size(); i++)
     {
@@ -4065,7 +4241,7 @@ static int make_integration_grids_SALTED(
             file << "Atom Type " << i << ": " << atom_type_list[i] << endl;
         double alpha_max_temp(0);
         int max_l_temp(0);
-        vec alpha_min_temp(max_l_overall);
+        vec alpha_min_temp(max_l_overall + 1);
         for (int j = 0; j < wave.get_ncen(); j++)
         {
             if (wave.get_atom_charge(j) == 119)
@@ -4189,6 +4365,12 @@ static int make_integration_grids_SALTED(
                 radial_acc = 1e-15;
             }
         }
+        if (!grid_settings.empty())
+        {
+            radial_acc = grid_settings[i].radial_precision;
+            lebedev_low = grid_settings[i].min_num_angular_points;
+            lebedev_high = grid_settings[i].max_num_angular_points;
+        }
         Prototype_grids.push_back(AtomGrid(radial_acc,
                                            lebedev_low,
                                            lebedev_high,
@@ -4196,8 +4378,24 @@ static int make_integration_grids_SALTED(
                                            alpha_max_temp,
                                            max_l_temp,
                                            alpha_min_temp.data(),
-                                           file));
+                                           file,
+                                           pruning,
+                                           radial));
+        if (pruning != PRUNING_LINEAR)
+            linear_grids.push_back(AtomGrid(radial_acc,
+                                            lebedev_low,
+                                            lebedev_high,
+                                            atom_type_list[i],
+                                            alpha_max_temp,
+                                            max_l_temp,
+                                            alpha_min_temp.data(),
+                                            file,
+                                            PRUNING_LINEAR,
+                                            radial));
     }
+    // written after the grids are done, so it does not split their progress line
+    stringstream pruning_log;
+    log_pruning(pruning, wave, atom_type_list, needs_grid, Prototype_grids, linear_grids, pruning_log);
 
     end_prototypes = get_time();
     if (debug)
@@ -4216,45 +4414,39 @@ static int make_integration_grids_SALTED(
     {
         file << " ...  " << flush;
     }
-    // get_grid is parallelized, therefore not parallel here
-    for (int i = 0; i < wave.get_ncen(); i++)
+    // prototype of every grid, so the arena can be allocated at once
+    ivec grid_type(atoms_with_grids, 0), grid_atom(atoms_with_grids);
+    for (int i = 0, grid_number = 0; i < wave.get_ncen(); i++)
     {
         // skip atoms, that do not need a grid
         if (!needs_grid[i])
-        {
             continue;
-        }
-        if (debug)
-        {
-            file << "Making grid for atom " << i << endl;
-        }
-        int type = 0;
         for (int j = 0; j < atom_type_list.size(); j++)
             if (atom_type_list[j] == wave.get_atom_charge(i))
-                type = j;
-
-        int grid_number = 0;
-        for (int j = 0; j < i; j++)
+                grid_type[grid_number] = j;
+        grid_atom[grid_number] = i;
+        num_points[grid_number] = Prototype_grids[grid_type[grid_number]].get_num_grid_points();
+        grid_number++;
+    }
+    // atomic grids without a molecular partition, so only the columns up to the atomic weight
+    grids.allocate(num_points, GRID_ATOMIC_WEIGHT + 1);
+    // get_grid is parallelized, therefore not parallel here
+    for (int grid_number = 0; grid_number < atoms_with_grids; grid_number++)
+    {
+        const int i = grid_atom[grid_number], type = grid_type[grid_number];
+        if (debug)
         {
-            if (needs_grid[j])
-            {
-                grid_number++;
-            }
+            file << "Making grid for atom " << i << endl;
         }
-        num_points[grid_number] = Prototype_grids[type].get_num_grid_points();
-
-        for (int n = 0; n < grid[grid_number].size(); n++)
-            grid[grid_number][n].resize(num_points[grid_number], 0.0);
-
         Prototype_grids[type].get_atomic_grid(
             i,
             &x[0],
             &y[0],
             &z[0],
-            grid[grid_number][0].data(),
-            grid[grid_number][1].data(),
-            grid[grid_number][2].data(),
-            grid[grid_number][3].data());
+            grids.column(GRID_X, grid_number),
+            grids.column(GRID_Y, grid_number),
+            grids.column(GRID_Z, grid_number),
+            grids.column(GRID_ATOMIC_WEIGHT, grid_number));
     }
     if (debug)
     {
@@ -4284,6 +4476,7 @@ static int make_integration_grids_SALTED(
         file << "Becke Grid exists" << endl;
     else
         file << "                           done! Number of gridpoints: " << defaultfloat << points << endl;
+    file << pruning_log.str();
 
     if (debug)
     {
@@ -4291,12 +4484,6 @@ static int make_integration_grids_SALTED(
     }
     end_becke = get_time();
 
-    // Total grid as a sum of all atomic grids.
-    // Dimensions: [c] [p]
-    // p = the number of gridpoint
-    // c = coordinate, which is 0=x, 1=y, 2=z, 3=atomic becke weight, 4=atomic density
-    vector<vec> total_grid(5);
-
     //int type_list_number = -1;
 
     double _cutoff;
@@ -4306,65 +4493,14 @@ static int make_integration_grids_SALTED(
         _cutoff = 1E-14;
     else
         _cutoff = 1E-30;
-    ivec new_gridsize(atoms_with_grids, 0);
-    int final_size = 0;
     bool prune = false;
     if (prune)
     {
         file << "Pruning Grid..." << flush;
-#pragma omp parallel for reduction(+ : final_size)
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (abs(grid[i][3][p]) > _cutoff)
-                {
-                    new_gridsize[i]++;
-                }
-            }
-            final_size += new_gridsize[i];
-        }
-        for (int k = 0; k < total_grid.size(); k++)
-            total_grid[k].resize(final_size, 0.0);
-#pragma omp parallel for
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            int offset = 0;
-            for (int j = 0; j < i; j++)
-            {
-                offset += new_gridsize[j];
-            }
-            int reduction = 0;
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                if (abs(grid[i][3][p]) > _cutoff)
-                {
-                    for (int k = 0; k < 4; k++)
-                        total_grid[k][p + offset - reduction] = grid[i][k][p];
-                }
-                else
-                {
-                    reduction++;
-                }
-            }
-            num_points[i] -= reduction;
-            shrink_vector<vec>(grid[i]);
-        }
-    }
-    else
-    {
-        for (int i = 0; i < atoms_with_grids; i++)
-        {
-            for (int p = 0; p < num_points[i]; p++)
-            {
-                for (int k = 0; k < 4; k++)
-                    total_grid[k].push_back(grid[i][k][p]);
-                total_grid[4].push_back(0);
-            }
-            shrink_vector<vec>(grid[i]);
-        }
+        vector<ivec> kept;
+        prune_grid_arena(grids, num_points, kept, [&](const int i, const int p)
+                         { return abs(grids.column(GRID_ATOMIC_WEIGHT, i)[p]) > _cutoff; });
     }
-    shrink_vector<vector<vec>>(grid);
     points = 0;
     for (int i = 0; i < atoms_with_grids; i++)
         points += num_points[i];
@@ -4380,7 +4516,7 @@ static int make_integration_grids_SALTED(
     file << "Calculating non-spherical densities..." << flush;
 
     WFN temp = wave;
-    const int nr_pts = (int)total_grid[0].size();
+    const int nr_pts = (int)grids.total_points();
     vector<unsigned long> shape{};
     bool fortran_order;
     vec data{};
@@ -4421,21 +4557,22 @@ static int make_integration_grids_SALTED(
 #pragma omp parallel for reduction(+ : el_sum_SALTED)
     for (int i = 0; i < asym_atom_list.size(); i++)
     {
-        int start_p = 0;
-        for (int a = 0; a < i; a++)
-            start_p += num_points[a];
-        for (int p = start_p; p < start_p + num_points[i]; p++)
-        {
-            total_grid[4][p] = calc_density_ML(
-                                   total_grid[0][i],
-                                   total_grid[1][i],
-                                   total_grid[2][i],
-                                   data,
-                                   temp.atoms,
-                                   exp_coefs,
-                                   asym_atom_list[i]) *
-                               total_grid[3][p];
-            atom_els[i] += total_grid[4][p];
+        const double *aw = grids.column(GRID_ATOMIC_WEIGHT, i);
+        double *rho = grids.column(GRID_DENSITY, i);
+        // the density is evaluated at point i of the combined grid of all atoms, i.e. in the grid of the first atom
+        double *gx = grids.column(GRID_X, 0), *gy = grids.column(GRID_Y, 0), *gz = grids.column(GRID_Z, 0);
+        for (int p = 0; p < num_points[i]; p++)
+        {
+            rho[p] = calc_density_ML(
+                         gx[i],
+                         gy[i],
+                         gz[i],
+                         data,
+                         temp.atoms,
+                         exp_coefs,
+                         asym_atom_list[i]) *
+                     aw[p];
+            atom_els[i] += rho[p];
         }
         el_sum_SALTED += atom_els[i];
         if (wave.get_has_ECPs())
@@ -4456,7 +4593,7 @@ static int make_integration_grids_SALTED(
         file << endl;
     }
 
-    file << " done!\nNumber of points evaluated: " << total_grid[0].size();
+    file << " done!\nNumber of points evaluated: " << grids.total_points();
 
     file << " with " << fixed << setw(10) << setprecision(6) << el_sum_SALTED << " electrons in Becke Grid in total.\n\n";
 
@@ -4480,51 +4617,28 @@ static int make_integration_grids_SALTED(
     }
     end_aspherical = get_time();
 
-    dens.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer dens" << endl;
-    d1.resize(asym_atom_list.size());
-    d2.resize(asym_atom_list.size());
-    d3.resize(asym_atom_list.size());
-    if (debug)
-        file << "resized outer d1-3" << endl;
-
     points = 0;
-#pragma omp parallel
+    // the relative positions overwrite the grids in place, point p only ever moves to run <= p
+#pragma omp parallel for reduction(+ : points)
+    for (int i = 0; i < asym_atom_list.size(); i++)
     {
-#pragma omp for reduction(+ : points)
-        for (int i = 0; i < asym_atom_list.size(); i++)
+        int run = 0;
+        double *gx = grids.column(GRID_X, i), *gy = grids.column(GRID_Y, i), *gz = grids.column(GRID_Z, i), *rho = grids.column(GRID_DENSITY, i);
+        for (int p = 0; p < num_points[i]; p++)
         {
-            dens[i].resize(num_points[i]);
-            d1[i].resize(num_points[i]);
-            d2[i].resize(num_points[i]);
-            d3[i].resize(num_points[i]);
-            int start_p = 0;
-            int run = 0;
-            for (int a = 0; a < i; a++)
-                start_p += num_points[a];
-            for (int p = start_p; p < start_p + num_points[i]; p++)
+            if (abs(rho[p]) > _cutoff)
             {
-                if (abs(total_grid[4][p]) > _cutoff)
-                {
-                    dens[i][run] = (total_grid[4][p]);
-                    d1[i][run] = (total_grid[0][p] - wave.atoms[asym_atom_list[i]].x);
-                    d2[i][run] = (total_grid[1][p] - wave.atoms[asym_atom_list[i]].y);
-                    d3[i][run] = (total_grid[2][p] - wave.atoms[asym_atom_list[i]].z);
-                    run++;
-                }
+                rho[run] = (rho[p]);
+                gx[run] = (gx[p] - wave.atoms[asym_atom_list[i]].x);
+                gy[run] = (gy[p] - wave.atoms[asym_atom_list[i]].y);
+                gz[run] = (gz[p] - wave.atoms[asym_atom_list[i]].z);
+                run++;
             }
-            points += run;
-            dens[i].resize(run);
-            d1[i].resize(run);
-            d2[i].resize(run);
-            d3[i].resize(run);
         }
-#pragma omp for
-        for (int _grid = 0; _grid < total_grid.size(); _grid++)
-            shrink_vector<double>(total_grid[_grid]);
+        points += run;
+        grids.set_points(i, run);
     }
-    shrink_vector<vec>(total_grid);
+    grids.shrink(grid_final_columns);
     return points;
 }
 
@@ -4563,12 +4677,11 @@ void make_k_pts(const bool &read_k_pts,
 #pragma omp parallel for
         for (int ref = 0; ref < size; ref++)
         {
-            hkl_list_it hkl_ = next(hkl.begin(), ref);
             for (int x = 0; x < 3; x++)
             {
                 for (int j = 0; j < 3; j++)
                 {
-                    k_pt[x][ref] += unit_cell.get_rcm(x, j) * (*(hkl_))[j];
+                    k_pt[x][ref] += unit_cell.get_rcm(x, j) * hkl(ref, j);
                 }
             }
         }
@@ -4586,6 +4699,54 @@ void make_k_pts(const bool &read_k_pts,
     }
 }
 
+/**
+ * Evaluates the Fourier sums of all atoms with the requested kernel, falling back to the blocked kernel
+ * if the k-points are not on the reciprocal lattice.
+ *
+ * @param kernel The kernel used for the Fourier sums, one of sf_kernel_type.
+ * @param unit_cell The unit cell the k-points were built from, needed by the NUFFT and recurrence kernels.
+ * @param nufft_precision Requested relative accuracy of the NUFFT kernel.
+ * @param grids The grid of every atom.
+ * @param k_pt The vector of k points.
+ * @param sf The vector of scattering factors.
+ * @param report Stream for the reports of the kernels, written while the progress bar is shown.
+ * @param no_date Flag indicating whether to exclude timings from the reports.
+ * @param progress Optional progress bar to update.
+ */
+static void run_sf_kernel(const int kernel,
+                          const cell *unit_cell,
+                          const double nufft_precision,
+                          const vector<sf_grid_view> &grids,
+                          const vector<vec> &k_pt,
+                          vector<cvec> &sf,
+                          ostream &report,
+                          const bool no_date,
+                          progress_bar *progress)
+{
+    bool done = false;
+    if (kernel == SF_NUFFT || kernel == SF_RECURRENCE)
+    {
+        err_checkf(unit_cell != NULL, "The NUFFT and recurrence kernels need the unit cell!", report);
+        double rcm[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                rcm[i][j] = unit_cell->get_rcm(i, j);
+        if (kernel == SF_NUFFT)
+            done = calc_sf_nufft(rcm, nufft_precision, grids, k_pt, sf, report, no_date, progress);
+        else
+            done = calc_sf_recurrence(rcm, grids, k_pt, sf, progress);
+        if (!done)
+            report << "k-points are not on the reciprocal lattice, using the blocked kernel instead" << endl;
+    }
+    else if (kernel == SF_MIXED)
+    {
+        calc_sf_mixed(grids, k_pt, sf, report, no_date, progress);
+        done = true;
+    }
+    if (!done)
+        calc_sf_scheduled(kernel, grids, k_pt, sf, progress);
+}
+
 /**
  * Calculates the scattering factors for a given set of parameters.
  *
@@ -4601,6 +4762,10 @@ void make_k_pts(const bool &read_k_pts,
  * @param end1 The end time of the calculation.
  * @param debug Flag indicating whether to enable debug mode.
  * @param no_date Flag indicating whether to exclude the date in the output.
+ * @param kernel The kernel used for the Fourier sums, one of sf_kernel_type.
+ * @param unit_cell The unit cell the k-points were built from, needed by the NUFFT and recurrence kernels.
+ * @param nufft_precision Requested relative accuracy of the NUFFT kernel.
+ * @param inversion_pairs Optional number of inversion pairs at the start of every atom's grid.
  */
 void calc_SF(const int &points,
              vector<vec> &k_pt,
@@ -4613,10 +4778,48 @@ void calc_SF(const int &points,
              time_point &start,
              time_point &end1,
              bool debug,
-             bool no_date = false)
+             bool no_date,
+             const int kernel,
+             const cell *unit_cell,
+             const double nufft_precision,
+             const ivec *inversion_pairs)
+{
+    // grid builders that do not pair the points (e.g. the CUDA path) leave the list empty
+    if (inversion_pairs != NULL && inversion_pairs->size() != dens.size())
+        inversion_pairs = NULL;
+    calc_SF(points, k_pt, make_sf_grid_views(d1, d2, d3, dens, inversion_pairs), sf, file, start, end1, debug, no_date, kernel, unit_cell, nufft_precision);
+}
+
+/**
+ * Calculates the scattering factors for grids given as views, e.g. into a memory mapped grid checkpoint.
+ *
+ * @param points The number of points.
+ * @param k_pt The vector of k points.
+ * @param grids The grid of every atom.
+ * @param sf The vector of scattering factors.
+ * @param file The output stream to write the results.
+ * @param start The start time of the calculation.
+ * @param end1 The end time of the calculation.
+ * @param debug Flag indicating whether to enable debug mode.
+ * @param no_date Flag indicating whether to exclude the date in the output.
+ * @param kernel The kernel used for the Fourier sums, one of sf_kernel_type.
+ * @param unit_cell The unit cell the k-points were built from, needed by the NUFFT and recurrence kernels.
+ * @param nufft_precision Requested relative accuracy of the NUFFT kernel.
+ */
+void calc_SF(const int &points,
+             vector<vec> &k_pt,
+             const vector<sf_grid_view> &grids,
+             vector<cvec> &sf,
+             ostream &file,
+             time_point &start,
+             time_point &end1,
+             bool debug,
+             bool no_date,
+             const int kernel,
+             const cell *unit_cell,
+             const double nufft_precision)
 {
-    const long long int imax = static_cast<long long int>(dens.size());
-    const long long int step = std::max(static_cast<long long int>(std::floor(imax / 20)), 1LL);
+    const long long int imax = static_cast<long long int>(grids.size());
     const long long int smax = static_cast<long long int>(k_pt[0].size());
     sf.reserve(imax * smax);
     sf.resize(imax);
@@ -4667,44 +4870,10 @@ void calc_SF(const int &points,
 #else
 
     progress_bar *progress = new progress_bar{file, 60u, "Calculating scattering factors"};
-    long long int pmax;
-    double *dens_local, *d1_local, *d2_local, *d3_local;
-    complex<double> *sf_local;
-    const double *k1_local = k_pt[0].data();
-    const double *k2_local = k_pt[1].data();
-    const double *k3_local = k_pt[2].data();
-    double work, rho;
-    for (int i = 0; i < imax; i++)
-    {
-        pmax = static_cast<long long int>(dens[i].size());
-        dens_local = dens[i].data();
-        d1_local = d1[i].data();
-        d2_local = d2[i].data();
-        d3_local = d3[i].data();
-        sf_local = sf[i].data();
-#pragma omp parallel for private(work, rho)
-        for (long long int s = 0; s < smax; s++)
-        {
-            for (long long int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
-        if (i != 0 && i % step == 0)
-            progress->write(i / static_cast<double>(imax));
-    }
+    ostringstream nufft_report;
+    run_sf_kernel(kernel, unit_cell, nufft_precision, grids, k_pt, sf, nufft_report, no_date, progress);
     delete (progress);
+    file << nufft_report.str();
 
 #endif
 }
@@ -4731,7 +4900,6 @@ static void add_ECP_contribution(const vector<int> &asym_atom_list,
                                  const bool debug)
 {
     double k = 1.0;
-    hkl_list_it it = hkl.begin();
     if (mode == 0)
     { // Using a gaussian tight core function
         if (debug)
@@ -4746,11 +4914,10 @@ static void add_ECP_contribution(const vector<int> &asym_atom_list,
                          << " and at 1 angstrom: " << exp(-pow(constants::bohr2ang(k), 2) / 16.0 / constants::PI) * wave.atoms[asym_atom_list[i]].ECP_electrons << endl;
             }
         }
-#pragma omp parallel for private(it, k)
+#pragma omp parallel for private(k)
         for (int s = 0; s < sf[0].size(); s++)
         {
-            it = next(hkl.begin(), s);
-            k = constants::FOUR_PI * cell.get_stl_of_hkl(*it);
+            k = constants::FOUR_PI * cell.get_stl_of_hkl(hkl[s]);
             for (int i = 0; i < asym_atom_list.size(); i++)
             {
                 sf[i][s] += wave.atoms[asym_atom_list[i]].ECP_electrons * exp(-k / 16.0 / constants::PI);
@@ -4774,11 +4941,10 @@ static void add_ECP_contribution(const vector<int> &asym_atom_list,
             }
         }
 
-#pragma omp parallel for private(it, k)
+#pragma omp parallel for private(k)
         for (int s = 0; s < sf[0].size(); s++)
         {
-            it = next(hkl.begin(), s);
-            k = constants::FOUR_PI * constants::bohr2ang(cell.get_stl_of_hkl(*it));
+            k = constants::FOUR_PI * constants::bohr2ang(cell.get_stl_of_hkl(hkl[s]));
             for (int i = 0; i < asym_atom_list.size(); i++)
             {
                 if (wave.atoms[asym_atom_list[i]].ECP_electrons != 0)
@@ -4809,12 +4975,10 @@ void convert_to_ED(const std::vector<int> &asym_atom_list,
                    const hkl_list &hkl)
 {
     double h2;
-    hkl_list_it it;
-#pragma omp parallel for private(h2, it)
+#pragma omp parallel for private(h2)
     for (int s = 0; s < hkl.size(); s++)
     {
-        it = next(hkl.begin(), s);
-        h2 = pow(unit_cell.get_stl_of_hkl(*it), 2);
+        h2 = pow(unit_cell.get_stl_of_hkl(hkl[s]), 2);
         for (int i = 0; i < asym_atom_list.size(); i++)
             sf[i][s] = std::complex<double>(constants::ED_fact * (wave.get_atom_charge(asym_atom_list[i]) - sf[i][s].real()) / h2, -constants::ED_fact * sf[i][s].imag() / h2);
     }
@@ -5017,12 +5181,10 @@ bool thakkar_sfac(
     for (int i = 0; i < asym_atom_list.size(); i++)
         sf[i].resize(hkl.size());
 
-    hkl_list_it it = hkl.begin();
-#pragma omp parallel for private(it)
+#pragma omp parallel for
     for (int s = 0; s < hkl.size(); s++)
     {
-        it = next(hkl.begin(), s);
-        double k = constants::bohr2ang(constants::FOUR_PI * unit_cell.get_stl_of_hkl(*it));
+        double k = constants::bohr2ang(constants::FOUR_PI * unit_cell.get_stl_of_hkl(hkl[s]));
         for (int i = 0; i < imax; i++)
             sf[i][s] = spherical_atoms[asym_atom_to_type_list[i]].get_form_factor(k);
     }
@@ -5030,11 +5192,10 @@ bool thakkar_sfac(
     if (opt.electron_diffraction)
     {
         double h2;
-#pragma omp parallel for private(h2, it)
+#pragma omp parallel for private(h2)
         for (int s = 0; s < hkl.size(); s++)
         {
-            it = next(hkl.begin(), s);
-            h2 = pow(unit_cell.get_stl_of_hkl(*it), 2);
+            h2 = pow(unit_cell.get_stl_of_hkl(hkl[s]), 2);
             for (int i = 0; i < imax; i++)
                 sf[i][s] = constants::ED_fact * (atom_type_list[asym_atom_to_type_list[i]] - sf[i][s]) / h2;
         }
@@ -5151,12 +5312,10 @@ tsc_block<int, cdouble> MTC_thakkar_sfac(
     for (int i = 0; i < asym_atom_list.size(); i++)
         sf[i].resize(hkl.size());
 
-    hkl_list_it it = hkl.begin();
-#pragma omp parallel for private(it)
+#pragma omp parallel for
     for (int s = 0; s < hkl.size(); s++)
     {
-        it = next(hkl.begin(), s);
-        double k = constants::bohr2ang(constants::FOUR_PI * unit_cell.get_stl_of_hkl(*it));
+        double k = constants::bohr2ang(constants::FOUR_PI * unit_cell.get_stl_of_hkl(hkl[s]));
         for (int i = 0; i < imax; i++)
             sf[i][s] = spherical_atoms[asym_atom_to_type_list[i]].get_form_factor(k);
     }
@@ -5164,11 +5323,10 @@ tsc_block<int, cdouble> MTC_thakkar_sfac(
     if (opt.electron_diffraction)
     {
         double h2;
-#pragma omp parallel for private(h2, it)
+#pragma omp parallel for private(h2)
         for (int s = 0; s < hkl.size(); s++)
         {
-            it = next(hkl.begin(), s);
-            h2 = pow(unit_cell.get_stl_of_hkl(*it), 2);
+            h2 = pow(unit_cell.get_stl_of_hkl(hkl[s]), 2);
             for (int i = 0; i < imax; i++)
                 sf[i][s] = constants::ED_fact * ((cdouble)atom_type_list[i] - sf[i][s]) / h2;
         }
@@ -5192,6 +5350,117 @@ tsc_block<int, cdouble> MTC_thakkar_sfac(
     return blocky;
 }
 
+/**
+ * Number of reflections per chunk so that the streamed structure factor calculation stays within a memory budget.
+ *
+ * Per reflection a chunk holds its k-vector, the factors of all atoms, their copy in the write buffer, the
+ * chunk's hkl list and the scratch of the kernel; the grid of all atoms, the full hkl list and the setup of the
+ * kernel plan are held for the whole run.
+ *
+ * @param mem Memory budget in GB, 0 for no limit.
+ * @param points Total number of grid points.
+ * @param atoms Number of atoms with scattering factors.
+ * @param reflections Total number of reflections.
+ * @param kernel_fixed Bytes of the kernel plan, see sf_kernel_plan::memory.
+ * @param kernel_per_reflection Bytes of kernel scratch per reflection, see sf_kernel_plan::memory.
+ * @param file The output stream to write a warning to if the budget cannot be met.
+ * @return The chunk size, equal to the number of reflections if everything fits.
+ */
+static long long int tscb_chunk_size(const double mem, const long long int points, const long long int atoms, const long long int reflections,
+                                     const double kernel_fixed, const double kernel_per_reflection, ostream &file)
+{
+    if (mem <= 0.0)
+        return reflections;
+    const double per_hkl = 3 * sizeof(int) + 64;
+    const double budget = mem * 1024.0 * 1024.0 * 1024.0 - 4.0 * sizeof(double) * points - per_hkl * reflections - kernel_fixed;
+    const double per_reflection = 3 * sizeof(double) + 2 * atoms * sizeof(cdouble) + per_hkl + kernel_per_reflection;
+    const long long int chunk = budget > 0.0 ? static_cast<long long int>(budget / per_reflection) : 0;
+    if (chunk < sf_tile_size && chunk < reflections)
+        file << "WARNING: memory limit of " << defaultfloat << mem << " GB does not hold the grids, hkl list and kernel setup ("
+             << fixed << setprecision(1) << (4.0 * sizeof(double) * points + per_hkl * reflections + kernel_fixed) / (1024.0 * 1024.0)
+             << defaultfloat << " MB), using chunks of " << std::min(reflections, sf_tile_size) << " reflections" << endl;
+    return std::min(reflections, std::max(chunk, sf_tile_size));
+}
+
+/**
+ * Calculates the scattering factors in chunks of reflections and writes every chunk to the tscb file as soon as it is
+ * finished, so peak memory is bounded by the chunk size instead of the number of reflections.
+ * The setup of the kernel is done once for all chunks, ECP and electron diffraction corrections are applied per chunk.
+ * The file is identical to the one written from a tsc_block holding all reflections once the writer is closed.
+ *
+ * @param opt The options for the calculation.
+ * @param wave The wavefunction, for the ECP and electron diffraction corrections.
+ * @param unit_cell The unit cell.
+ * @param hkl All reflections, in the order of the file.
+ * @param asym_atom_list The atoms to calculate scattering factors for.
+ * @param points The total number of grid points.
+ * @param grids The grid of every atom.
+ * @param max_index Largest |h|, |k| and |l| of all reflections.
+ * @param chunk Number of reflections per chunk.
+ * @param writer The tscb file the chunks are appended to.
+ * @param file The output stream to write the log to.
+ */
+static void stream_scattering_factors(const options &opt,
+                                      const WFN &wave,
+                                      const cell &unit_cell,
+                                      const hkl_list &hkl,
+                                      const ivec &asym_atom_list,
+                                      const int points,
+                                      const vector<sf_grid_view> &grids,
+                                      const long long int max_index[3],
+                                      const long long int chunk,
+                                      tscb_stream_writer &writer,
+                                      ostream &file)
+{
+    const long long int smax = static_cast<long long int>(hkl.size());
+    const long long int chunks = (smax + chunk - 1) / chunk;
+    file << endl
+         << "Number of k-points to evaluate: " << smax << " for " << points << " gridpoints." << endl
+         << "Streaming " << chunks << " chunks of up to " << chunk << " reflections to the tscb file (memory limit " << defaultfloat << opt.mem << " GB)" << endl;
+    double rcm[3][3];
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            rcm[i][j] = unit_cell.get_rcm(i, j);
+    sf_kernel_plan plan(opt.sf_kernel, rcm, opt.nufft_precision, grids, max_index);
+    bool fallback = false;
+    ostringstream report;
+    progress_bar *progress = new progress_bar{file, 60u, "Calculating scattering factors"};
+    for (long long int c = 0; c < chunks; c++)
+    {
+        const long long int s_begin = c * chunk, s_end = std::min(smax, s_begin + chunk);
+        vector<long long int> keys(s_end - s_begin);
+        for (long long int s = s_begin; s < s_end; s++)
+            keys[s - s_begin] = hkl.key(s);
+        hkl_list part(keys);
+        vector<vec> k_pt(3, vec(s_end - s_begin, 0.0));
+#pragma omp parallel for
+        for (long long int ref = 0; ref < s_end - s_begin; ref++)
+            for (int x = 0; x < 3; x++)
+                for (int j = 0; j < 3; j++)
+                    k_pt[x][ref] += unit_cell.get_rcm(x, j) * part(ref, j);
+
+        vector<cvec> sf;
+        if (fallback || !plan.run(k_pt, sf))
+        {
+            fallback = true;
+            calc_sf_scheduled(SF_BLOCKED, grids, k_pt, sf);
+        }
+        shrink_vector<vec>(k_pt);
+        if (wave.get_has_ECPs())
+            add_ECP_contribution(asym_atom_list, wave, sf, unit_cell, part, report, opt.ECP_mode, opt.debug && c == 0);
+        if (opt.electron_diffraction)
+            convert_to_ED(asym_atom_list, wave, sf, unit_cell, part);
+        writer.write_chunk(part, sf);
+        progress->write((c + 1) / static_cast<double>(chunks));
+    }
+    delete (progress);
+    if (fallback)
+        file << "k-points are not on the reciprocal lattice, using the blocked kernel instead" << endl;
+    else
+        plan.report(file, opt.no_date);
+    file << report.str();
+}
+
 /**
  * Calculates the scattering factors for Hirshfeld partitioned molecules.
  *
@@ -5262,16 +5531,34 @@ bool calculate_scattering_factors_HF(
 
     if (opt.debug)
         file << "made it post CIF, now make grids!" << endl;
-    vector<vec> d1, d2, d3, dens;
+    grid_arena arena;
+    vector<sf_grid_view> grids;
+    grid_checkpoint checkpoint;
+    vector<string> labels;
+    for (int i = 0; i < asym_atom_list.size(); i++)
+        labels.push_back(wave.atoms[asym_atom_list[i]].label);
+    int points = 0;
+    const std::uint64_t grid_hash = opt.grid_checkpoint.empty() ? 0 : grid_checkpoint_hash(wave, opt.cif, opt.accuracy, opt.pbc, opt.partition, opt.grid_error, opt.pruning, opt.radial, opt.grid_order, asym_atom_list);
 
-    int points = make_hirshfeld_grids(opt.pbc,
+    if (!opt.grid_checkpoint.empty() && checkpoint.load(opt.grid_checkpoint, grid_hash, opt.accuracy, opt.pbc, labels, file))
+    {
+        grids = checkpoint.grids();
+        points = static_cast<int>(checkpoint.points());
+        end_becke = end_prototypes = end_spherical = end_prune = end_aspherical = get_time();
+        file << "Read Hirshfeld grids of " << grids.size() << " atoms with " << points << " points from " << opt.grid_checkpoint << endl;
+    }
+    else
+    {
+        const wfn_snapshot snapshot(wave);
+        points = make_hirshfeld_grids(opt.pbc,
                                       opt.accuracy,
                                       unit_cell,
                                       wave,
+                                      snapshot,
                                       atom_type_list,
                                       asym_atom_list,
                                       needs_grid,
-                                      d1, d2, d3, dens,
+                                      arena,
                                       file,
                                       start,
                                       end_becke,
@@ -5280,10 +5567,52 @@ bool calculate_scattering_factors_HF(
                                       end_prune,
                                       end_aspherical,
                                       opt.debug,
-                                      opt.no_date);
-
+                                      opt.no_date,
+                                      true,
+                                      opt.partition,
+                                      opt.grid_error,
+                                      opt.pruning,
+                                      opt.radial,
+                                      opt.grid_order);
+        grids = arena.views();
+        if (!opt.grid_checkpoint.empty() && grid_checkpoint::write(opt.grid_checkpoint, grid_hash, opt.accuracy, opt.pbc, grids, labels, file))
+            file << "Wrote Hirshfeld grids to " << opt.grid_checkpoint << endl;
+    }
+
+    // the prototypes are only reused within one calculation
+    AtomGrid::clear_prototype_cache();
     time_point before_kpts = get_time();
 
+    long long int max_index[3] = {0, 0, 0};
+    for (size_t s = 0; s < hkl.size(); s++)
+        for (int j = 0; j < 3; j++)
+            max_index[j] = std::max(max_index[j], static_cast<long long int>(std::abs(hkl(s, j))));
+    double kernel_fixed = 0.0, kernel_per_reflection = 0.0;
+    sf_kernel_plan::memory(opt.sf_kernel, opt.nufft_precision, grids, max_index, kernel_fixed, kernel_per_reflection);
+    const long long int chunk = tscb_chunk_size(opt.mem, points, asym_atom_list.size(), hkl.size(), kernel_fixed, kernel_per_reflection, file);
+    if (chunk < (long long int)hkl.size() && !opt.read_k_pts && !opt.save_k_pts && !opt.old_tsc)
+    {
+        tscb_stream_writer writer("experimental.tscb", "", labels, static_cast<int>(hkl.size()));
+        stream_scattering_factors(opt, wave, unit_cell, hkl, asym_atom_list, points, grids, max_index, chunk, writer, file);
+        time_point end = get_time();
+        if (!opt.no_date)
+            write_timing_to_file(file,
+                                 start,
+                                 end,
+                                 end_prototypes,
+                                 end_becke,
+                                 end_spherical,
+                                 end_prune,
+                                 end_aspherical,
+                                 before_kpts,
+                                 before_kpts,
+                                 before_kpts);
+        file << "Writing tsc file... " << flush;
+        writer.close();
+        file << " ... done!" << endl;
+        return true;
+    }
+
     vector<vec> k_pt;
     make_k_pts(
         opt.read_k_pts,
@@ -5300,13 +5629,16 @@ bool calculate_scattering_factors_HF(
     vector<cvec> sf;
     calc_SF(points,
             k_pt,
-            d1, d2, d3, dens,
+            grids,
             sf,
             file,
             start,
             end1,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.sf_kernel,
+            &unit_cell,
+            opt.nufft_precision);
 
     if (wave.get_has_ECPs())
     {
@@ -5330,10 +5662,6 @@ bool calculate_scattering_factors_HF(
                       hkl);
     }
 
-    vector<string> labels;
-    for (int i = 0; i < asym_atom_list.size(); i++)
-        labels.push_back(wave.atoms[asym_atom_list[i]].label);
-
     tsc_block<int, cdouble> blocky(
         sf,
         labels,
@@ -5432,7 +5760,7 @@ bool calculate_scattering_factors_RI(
 
     if (opt.debug)
         file << "made it post CIF, now make grids!" << endl;
-    vector<vec> d1, d2, d3, dens;
+    grid_arena grids;
 
     int points = make_hirshfeld_grids_RI(
         opt.accuracy,
@@ -5441,7 +5769,7 @@ bool calculate_scattering_factors_RI(
         atom_type_list,
         asym_atom_list,
         needs_grid,
-        d1, d2, d3, dens,
+        grids,
         exp_coefs,
         file,
         start,
@@ -5451,8 +5779,13 @@ bool calculate_scattering_factors_RI(
         end_prune,
         end_aspherical,
         opt.debug,
-        opt.no_date);
+        opt.no_date,
+        opt.partition,
+        opt.grid_error,
+        opt.pruning,
+        opt.radial);
 
+    AtomGrid::clear_prototype_cache();
     time_point before_kpts = get_time();
 
     vector<vec> k_pt;
@@ -5471,13 +5804,16 @@ bool calculate_scattering_factors_RI(
     vector<cvec> sf;
     calc_SF(points,
             k_pt,
-            d1, d2, d3, dens,
+            grids.views(),
             sf,
             file,
             start,
             end1,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.sf_kernel,
+            &unit_cell,
+            opt.nufft_precision);
 
     if (wave.get_has_ECPs())
     {
@@ -5594,7 +5930,7 @@ bool calculate_scattering_factors_RI_No_H(
 
     if (opt.debug)
         file << "made it post CIF, now make grids!" << endl;
-    vector<vec> d1, d2, d3, dens;
+    grid_arena grids;
     int points = 0;
     if (opt.SALTED)
     {
@@ -5607,7 +5943,7 @@ bool calculate_scattering_factors_RI_No_H(
             atom_type_list,
             asym_atom_list,
             needs_grid,
-            d1, d2, d3, dens,
+            grids,
             exp_coefs,
             file,
             start,
@@ -5616,7 +5952,10 @@ bool calculate_scattering_factors_RI_No_H(
             end_prune,
             end_aspherical,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.grid_error,
+            opt.pruning,
+            opt.radial);
     }
     else if (opt.SALTED_BECKE)
     {
@@ -5629,7 +5968,7 @@ bool calculate_scattering_factors_RI_No_H(
             atom_type_list,
             asym_atom_list,
             needs_grid,
-            d1, d2, d3, dens,
+            grids,
             exp_coefs,
             file,
             start,
@@ -5639,11 +5978,16 @@ bool calculate_scattering_factors_RI_No_H(
             end_prune,
             end_aspherical,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.partition,
+            opt.grid_error,
+            opt.pruning,
+            opt.radial);
     }
     else
         err_not_impl_f("No implementation of neither SALTED nor SALTED_BECKE", file);
 
+    AtomGrid::clear_prototype_cache();
     time_point before_kpts = get_time();
 
     vector<vec> k_pt;
@@ -5662,13 +6006,16 @@ bool calculate_scattering_factors_RI_No_H(
     vector<vector<complex<double>>> sf;
     calc_SF(points,
             k_pt,
-            d1, d2, d3, dens,
+            grids.views(),
             sf,
             file,
             start,
             end1,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.sf_kernel,
+            &unit_cell,
+            opt.nufft_precision);
 
     if (wave.get_has_ECPs())
     {
@@ -5810,16 +6157,18 @@ tsc_block<int, cdouble> calculate_scattering_factors_MTC(
 
     if (opt.debug)
         file << "made it post CIF now make grids!" << endl;
-    vector<vec> d1, d2, d3, dens;
+    grid_arena grids;
 
+    const wfn_snapshot snapshot(wave[nr]);
     const int points = make_hirshfeld_grids(opt.pbc,
                                             opt.accuracy,
                                             unit_cell,
                                             wave[nr],
+                                            snapshot,
                                             atom_type_list,
                                             asym_atom_list,
                                             needs_grid,
-                                            d1, d2, d3, dens,
+                                            grids,
                                             file,
                                             start,
                                             end_becke,
@@ -5828,7 +6177,13 @@ tsc_block<int, cdouble> calculate_scattering_factors_MTC(
                                             end_prune,
                                             end_aspherical,
                                             opt.debug,
-                                            opt.no_date);
+                                            opt.no_date,
+                                            true,
+                                            opt.partition,
+                                            opt.grid_error,
+                                            opt.pruning,
+                                            opt.radial,
+                                            opt.grid_order);
 
     time_point before_kpts = get_time();
 
@@ -5882,13 +6237,16 @@ tsc_block<int, cdouble> calculate_scattering_factors_MTC(
     vector<vector<complex<double>>> sf;
     calc_SF(points,
             k_pt,
-            d1, d2, d3, dens,
+            grids.views(),
             sf,
             file,
             start,
             end1,
             opt.debug,
-            opt.no_date);
+            opt.no_date,
+            opt.sf_kernel,
+            &unit_cell,
+            opt.nufft_precision);
 
     if (wave[nr].get_has_ECPs())
     {
@@ -5985,16 +6343,18 @@ void calc_sfac_diffuse(const options &opt, std::ostream &log_file)
                         opt.debug);
 
     cif_input.close();
-    vector<vec> d1, d2, d3, dens;
+    grid_arena grids;
 
+    const wfn_snapshot snapshot(wavy[0]);
     make_hirshfeld_grids(opt.pbc,
                          opt.accuracy,
                          unit_cell,
                          wavy[0],
+                         snapshot,
                          atom_type_list,
                          asym_atom_list,
                          needs_grid,
-                         d1, d2, d3, dens,
+                         grids,
                          std::cout,
                          start,
                          end_becke,
@@ -6003,7 +6363,14 @@ void calc_sfac_diffuse(const options &opt, std::ostream &log_file)
                          end_prune,
                          end_aspherical,
                          opt.debug,
-                         opt.no_date);
+                         opt.no_date,
+                         false,
+                         opt.partition,
+                         opt.grid_error,
+                         opt.pruning,
+                         opt.radial,
+                         opt.grid_order);
+    AtomGrid::clear_prototype_cache();
 
     hkl_list_d hkl;
     generate_fractional_hkl(opt.dmin, hkl, opt.twin_law, unit_cell, log_file, opt.sfac_diffuse, opt.debug);
@@ -6036,53 +6403,17 @@ void calc_sfac_diffuse(const options &opt, std::ostream &log_file)
     // below is a strip of Calc_SF without the file IO or progress bar
     vector<vector<complex<double>>> sf;
 
-    const int imax = static_cast<int>(dens.size());
+    const int imax = grids.atoms();
     const long long int smax = static_cast<long long int>(k_pt[0].size());
-    long long int pmax = static_cast<long long int>(dens[0].size());
-    const int step = max(static_cast<long long int>(floor(smax / 20)), 1LL);
+    long long int pmax = grids.points(0);
     std::cout << "Done with making k_pt " << smax << " " << imax << " " << pmax << endl;
 		sf.reserve(imax * smax);
     sf.resize(imax);
 #pragma omp parallel for
     for (int i = 0; i < imax; i++)
         sf[i].resize(smax);
-    double *dens_local, *d1_local, *d2_local, *d3_local;
-    complex<double> *sf_local;
-    const double *k1_local = k_pt[0].data();
-    const double *k2_local = k_pt[1].data();
-    const double *k3_local = k_pt[2].data();
-    double work, rho;
     progress_bar *progress = new progress_bar{std::cout, 60u, "Calculating scattering factors"};
-    for (int i = 0; i < imax; i++)
-    {
-        pmax = static_cast<long long int>(dens[i].size());
-        dens_local = dens[i].data();
-        d1_local = d1[i].data();
-        d2_local = d2[i].data();
-        d3_local = d3[i].data();
-        sf_local = sf[i].data();
-#pragma omp parallel for private(work, rho)
-        for (long long int s = 0; s < smax; s++)
-        {
-            for (long long int p = pmax - 1; p >= 0; p--)
-            {
-              rho = dens_local[p];
-              work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-              if (rho < 0)
-              {
-                rho = -rho;
-                work += M_PI;
-              }
-#endif
-#endif
-              sf_local[s] += polar(rho, work);
-            }
-            if (i != 0 && i % step == 0)
-                progress->write(i / static_cast<double>(imax));
-        }
-    }
+    calc_sf_scheduled(opt.sf_kernel, grids.views(), k_pt, sf, progress);
     delete (progress);
     vector<string> labels;
     for (int i = 0; i < asym_atom_list.size(); i++)
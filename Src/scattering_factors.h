@@ -9,12 +9,15 @@
 #include <vector>
 #include <fstream>
 #include "convenience.h"
+#include "sf_kernels.h"
+#include "grid_arena.h"
 
 /**
  * @class WFN
  * @brief Class representing the wavefunction.
  */
 class WFN;
+class wfn_snapshot;
 template class tsc_block<int, cdouble>;
 typedef tsc_block<int, cdouble> itsc_block;
 
@@ -171,9 +174,25 @@ void read_atoms_from_CIF(std::ifstream &cif_input, const std::vector<int> &input
  * @param end_aspherical The end time point for aspherical grid generation.
  * @param debug Flag indicating whether to enable debug mode.
  * @param no_date Flag indicating whether to exclude the date from the output.
+ * @param inversion_pairs If given, the inversion pairs of every atomic grid are moved to its front and counted here.
+ * @param partition Atomic partition of the molecular grid, one of partition_scheme.
+ * @param grid_error Target integration error per atom in electrons for select_atom_grid, 0 keeps the levels of accuracy.
+ * @param pruning Angular pruning of the atomic grids, one of angular_pruning.
+ * @param radial Radial quadrature of the atomic grids, one of radial_scheme.
+ * @param grid_order Order of the points within every final atomic grid, one of grid_point_order.
  * @return The number of Hirshfeld grids generated.
  */
-int make_hirshfeld_grids(const int &pbc, const int &accuracy, cell &unit_cell, const WFN &wave, const std::vector<int> &atom_type_list, const std::vector<int> &asym_atom_list, std::vector<bool> &needs_grid, std::vector<vec> &d1, std::vector<vec> &d2, std::vector<vec> &d3, std::vector<vec> &dens, std::ostream &file, time_point &start, time_point &end_becke, time_point &end_prototypes, time_point &end_spherical, time_point &end_prune, time_point &end_aspherical, bool debug = false, bool no_date = false);
+int make_hirshfeld_grids(const int &pbc, const int &accuracy, cell &unit_cell, const WFN &wave, const std::vector<int> &atom_type_list, const std::vector<int> &asym_atom_list, std::vector<bool> &needs_grid, std::vector<vec> &d1, std::vector<vec> &d2, std::vector<vec> &d3, std::vector<vec> &dens, std::ostream &file, time_point &start, time_point &end_becke, time_point &end_prototypes, time_point &end_spherical, time_point &end_prune, time_point &end_aspherical, bool debug = false, bool no_date = false, ivec *inversion_pairs = NULL, const int partition = 0, const double grid_error = 0.0, const int pruning = 0, const int radial = 0, const int grid_order = 0);
+
+/**
+ * @brief Generates the Hirshfeld grids straight into a grid arena, which is then the only copy of the grids.
+ * @param grids Receives the final grid of every asymmetric unit atom, see grid_arena::views.
+ * @param pair_inversions Whether the inversion pairs of every atomic grid are moved to its front and counted in grids.
+ * @param snapshot Snapshot of wave, built once by the caller, that evaluates the molecular density.
+ *
+ * All other parameters and the return value are those of the version above.
+ */
+int make_hirshfeld_grids(const int &pbc, const int &accuracy, cell &unit_cell, const WFN &wave, const wfn_snapshot &snapshot, const std::vector<int> &atom_type_list, const std::vector<int> &asym_atom_list, std::vector<bool> &needs_grid, grid_arena &grids, std::ostream &file, time_point &start, time_point &end_becke, time_point &end_prototypes, time_point &end_spherical, time_point &end_prune, time_point &end_aspherical, bool debug = false, bool no_date = false, const bool pair_inversions = false, const int partition = 0, const double grid_error = 0.0, const int pruning = 0, const int radial = 0, const int grid_order = 0);
 
 /**
  * @brief Adds ECP (Effective Core Potential) contribution to the scattering factors.
@@ -201,8 +220,19 @@ static void add_ECP_contribution(const ivec &asym_atom_list, const WFN &wave, st
  * @param start The start time point.
  * @param end1 The end time point.
  * @param debug Flag indicating whether to enable debug mode.
+ * @param no_date Flag indicating whether to exclude timings from the output.
+ * @param kernel The kernel used for the Fourier sums, one of sf_kernel_type (see sf_kernels.h).
+ * @param unit_cell The unit cell the k-points were built from, needed by the NUFFT kernel.
+ * @param nufft_precision Requested relative accuracy of the NUFFT kernel.
+ */
+void calc_SF(const int &points, std::vector<vec> &k_pt, std::vector<vec> &d1, std::vector<vec> &d2, std::vector<vec> &d3, std::vector<vec> &dens, std::vector<cvec> &sf, std::ostream &file, time_point &start, time_point &end1, bool debug = false, bool no_date = false, const int kernel = SF_BLOCKED, const cell *unit_cell = NULL, const double nufft_precision = 1E-8, const ivec *inversion_pairs = NULL);
+
+/**
+ * @brief Calculates the scattering factors for grids given as views, e.g. into a memory mapped grid checkpoint.
+ *
+ * Same as the overload taking the grid vectors, the inversion pairs are part of the views.
  */
-void calc_SF(const int &points, std::vector<vec> &k_pt, std::vector<vec> &d1, std::vector<vec> &d2, std::vector<vec> &d3, std::vector<vec> &dens, std::vector<cvec> &sf, std::ostream &file, time_point &start, time_point &end1, bool debug = false);
+void calc_SF(const int &points, std::vector<vec> &k_pt, const std::vector<sf_grid_view> &grids, std::vector<cvec> &sf, std::ostream &file, time_point &start, time_point &end1, bool debug = false, bool no_date = false, const int kernel = SF_BLOCKED, const cell *unit_cell = NULL, const double nufft_precision = 1E-8);
 
 /**
  * @brief Calculates the diffuse scattering factors.
@@ -0,0 +1,974 @@
+/**
+ * @file sf_kernels.cpp
+ * @brief Implementation of the atomic Fourier sum kernels used by calc_SF and friends.
+ */
+
+#include "sf_kernels.h"
+#include "convenience.h"
+
+#include <cstdint>
+#include <cstring>
+#ifdef __APPLE__
+#include "TargetConditionals.h"
+#endif
+
+static inline std::uint64_t double_bits(const double d)
+{
+    std::uint64_t u;
+    std::memcpy(&u, &d, sizeof(u));
+    return u;
+}
+
+static inline double bits_double(const std::uint64_t u)
+{
+    double d;
+    std::memcpy(&d, &u, sizeof(d));
+    return d;
+}
+
+/**
+ * @brief Branch free sine and cosine, written so the compiler can vectorise loops calling it.
+ *
+ * The argument is reduced to [-pi/4, pi/4] by a three part Cody-Waite subtraction of the nearest multiple of pi/2
+ * (exact for |x| < 2^20 * pi/2) and both functions are evaluated with the Cephes minimax polynomials.
+ * The quadrant is read from the mantissa of the rounded quotient, so no integer conversion is needed.
+ */
+static inline void sincos_poly(const double x, double &s, double &c)
+{
+    const double round_shift = 6755399441055744.0; // 1.5 * 2^52
+    const double t = x * 0.63661977236758134308 + round_shift;
+    const std::uint64_t quadrant = double_bits(t);
+    const double q = t - round_shift;
+    const double r = ((x - q * 1.57079632673412561417E+00) - q * 6.07710050630396597660E-11) - q * 2.02226624879595063154E-21;
+    const double z = r * r;
+    const double sp = r + r * z * (((((1.58962301576546568060E-10 * z - 2.50507477628578072866E-8) * z + 2.75573136213857245213E-6) * z - 1.98412698295895385996E-4) * z + 8.33333333332211858878E-3) * z - 1.66666666666666307295E-1);
+    const double cp = 1.0 - 0.5 * z + z * z * (((((-1.13585365213876817300E-11 * z + 2.08757008419747316778E-9) * z - 2.75573141792967388112E-7) * z + 2.48015872888517045348E-5) * z - 1.38888888888730564116E-3) * z + 4.16666666666665929218E-2);
+    const std::uint64_t swap = 0 - (quadrant & 1);
+    const std::uint64_t sp_bits = double_bits(sp), cp_bits = double_bits(cp);
+    s = bits_double(((sp_bits & ~swap) | (cp_bits & swap)) ^ ((quadrant & 2) << 62));
+    c = bits_double(((cp_bits & ~swap) | (sp_bits & swap)) ^ (((quadrant + 1) & 2) << 62));
+}
+
+void sf_direct_kernel(const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                      const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                      cdouble *sf)
+{
+    double work, rho;
+    for (long long int s = s_begin; s < s_end; s++)
+    {
+        cdouble result = constants::cnull;
+        for (long long int p = pmax - 1; p >= 0; p--)
+        {
+            rho = dens[p];
+            work = k1[s] * d1[p] + k2[s] * d2[p] + k3[s] * d3[p];
+#ifdef __APPLE__
+#if TARGET_OS_MAC
+            if (rho < 0)
+            {
+                rho = -rho;
+                work += M_PI;
+            }
+#endif
+#endif
+            result += std::polar(rho, work);
+        }
+        sf[s] = result;
+    }
+}
+
+void sf_blocked_kernel(const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                       const long long int npairs,
+                       const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                       cdouble *sf)
+{
+    alignas(64) double kx[sf_tile_size], ky[sf_tile_size], kz[sf_tile_size];
+    alignas(64) double re[sf_tile_size], im[sf_tile_size];
+    for (long long int s0 = s_begin; s0 < s_end; s0 += sf_tile_size)
+    {
+        const int n = static_cast<int>(std::min(sf_tile_size, s_end - s0));
+        for (int j = 0; j < n; j++)
+        {
+            kx[j] = k1[s0 + j];
+            ky[j] = k2[s0 + j];
+            kz[j] = k3[s0 + j];
+            re[j] = 0.0;
+            im[j] = 0.0;
+        }
+        // inversion pairs: rho_a exp(i k.r) + rho_b exp(-i k.r) = (rho_a + rho_b) cos(k.r) + i (rho_a - rho_b) sin(k.r)
+        for (long long int p = 0; p < 2 * npairs; p += 2)
+        {
+            const double rho_sum = dens[p] + dens[p + 1], rho_diff = dens[p] - dens[p + 1];
+            const double x = d1[p], y = d2[p], z = d3[p];
+#pragma omp simd aligned(kx, ky, kz, re, im : 64)
+            for (int j = 0; j < n; j++)
+            {
+                double s, c;
+                sincos_poly(kx[j] * x + ky[j] * y + kz[j] * z, s, c);
+                re[j] += rho_sum * c;
+                im[j] += rho_diff * s;
+            }
+        }
+        for (long long int p = 2 * npairs; p < pmax; p++)
+        {
+            const double rho = dens[p];
+            if (rho == 0.0)
+                continue;
+            const double x = d1[p], y = d2[p], z = d3[p];
+#pragma omp simd aligned(kx, ky, kz, re, im : 64)
+            for (int j = 0; j < n; j++)
+            {
+                double s, c;
+                sincos_poly(kx[j] * x + ky[j] * y + kz[j] * z, s, c);
+                re[j] += rho * c;
+                im[j] += rho * s;
+            }
+        }
+        for (int j = 0; j < n; j++)
+            sf[s0 + j] = cdouble(re[j], im[j]);
+    }
+}
+
+void sf_atom_range(const int kernel,
+                   const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                   const long long int npairs,
+                   const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                   cdouble *sf)
+{
+    switch (kernel)
+    {
+    case SF_DIRECT:
+        sf_direct_kernel(d1, d2, d3, dens, pmax, k1, k2, k3, s_begin, s_end, sf);
+        break;
+    case SF_BLOCKED:
+    case SF_NUFFT:      // the NUFFT and the recurrence need the Miller indices, ranges of plain k-vectors use the blocked kernel
+    case SF_RECURRENCE:
+    case SF_MIXED:      // single atom ranges are not worth converting to single precision
+        sf_blocked_kernel(d1, d2, d3, dens, pmax, npairs, k1, k2, k3, s_begin, s_end, sf);
+        break;
+    default:
+        err_checkf(false, "Unknown scattering factor kernel: " + std::to_string(kernel), std::cout);
+    }
+}
+
+void calc_atomic_sf(const int kernel, const sf_grid_view &grid, const std::vector<vec> &k_pt, cvec &sf)
+{
+    const long long int smax = static_cast<long long int>(k_pt[0].size());
+    const long long int tiles = (smax + sf_tile_size - 1) / sf_tile_size;
+    sf.resize(smax, constants::cnull);
+#pragma omp parallel for schedule(dynamic)
+    for (long long int t = 0; t < tiles; t++)
+        sf_atom_range(kernel,
+                      grid.d1, grid.d2, grid.d3, grid.dens, grid.points, grid.pairs,
+                      k_pt[0].data(), k_pt[1].data(), k_pt[2].data(),
+                      t * sf_tile_size, std::min(smax, (t + 1) * sf_tile_size),
+                      sf.data());
+}
+
+void calc_atomic_sf(const int kernel, const vec &d1, const vec &d2, const vec &d3, const vec &dens, const std::vector<vec> &k_pt, cvec &sf)
+{
+    calc_atomic_sf(kernel, sf_grid_view{d1.data(), d2.data(), d3.data(), dens.data(), static_cast<long long int>(dens.size()), 0}, k_pt, sf);
+}
+
+std::vector<sf_grid_view> make_sf_grid_views(const std::vector<vec> &d1, const std::vector<vec> &d2, const std::vector<vec> &d3, const std::vector<vec> &dens,
+                                             const ivec *pairs)
+{
+    std::vector<sf_grid_view> grids(dens.size());
+    for (size_t i = 0; i < dens.size(); i++)
+        grids[i] = sf_grid_view{d1[i].data(), d2[i].data(), d3[i].data(), dens[i].data(), static_cast<long long int>(dens[i].size()),
+                                pairs == NULL ? 0 : (*pairs)[i]};
+    return grids;
+}
+
+std::vector<sf_work_item> make_sf_schedule(const std::vector<long long int> &points, const long long int smax, const int threads)
+{
+    const long long int imax = static_cast<long long int>(points.size());
+    long long int range = 4 * sf_tile_size;
+    while (range > 32 && imax * ((smax + range - 1) / range) < 8LL * threads)
+        range /= 2;
+
+    std::vector<sf_work_item> items;
+    items.reserve(imax * ((smax + range - 1) / range));
+    for (int i = 0; i < imax; i++)
+        for (long long int s = 0; s < smax; s += range)
+        {
+            const long long int e = std::min(smax, s + range);
+            items.push_back({i, s, e, static_cast<double>(points[i]) * static_cast<double>(e - s)});
+        }
+    std::sort(items.begin(), items.end(), [](const sf_work_item &a, const sf_work_item &b)
+              {
+                  if (a.weight != b.weight)
+                      return a.weight > b.weight;
+                  if (a.atom != b.atom)
+                      return a.atom < b.atom;
+                  return a.s_begin < b.s_begin; });
+    return items;
+}
+
+/**
+ * @brief Runs the work items of all atoms dynamically over all threads and reports the progress in atom order.
+ * @param items Work items as given by make_sf_schedule.
+ * @param imax Number of atoms.
+ * @param progress Optional progress bar, updated like an atom by atom loop would do.
+ * @param work Callable evaluating one item.
+ */
+template <typename F>
+static void run_sf_schedule(const std::vector<sf_work_item> &items, const int imax, progress_bar *progress, F work)
+{
+    const int step = std::max(imax / 20, 1);
+    std::vector<long long int> open_items(imax, 0);
+    for (const sf_work_item &item : items)
+        open_items[item.atom]++;
+    int next_report = 0;
+
+#pragma omp parallel for schedule(dynamic, 1)
+    for (long long int w = 0; w < static_cast<long long int>(items.size()); w++)
+    {
+        const sf_work_item &item = items[w];
+        const int i = item.atom;
+        work(item);
+        long long int left;
+#pragma omp atomic capture
+        left = --open_items[i];
+        if (left == 0 && progress != NULL)
+        {
+#pragma omp critical(sf_progress)
+            {
+                while (next_report < imax)
+                {
+                    long long int open;
+#pragma omp atomic read
+                    open = open_items[next_report];
+                    if (open != 0)
+                        break;
+                    if (next_report != 0 && next_report % step == 0)
+                        progress->write(next_report / static_cast<double>(imax));
+                    next_report++;
+                }
+            }
+        }
+    }
+}
+
+static int sf_threads()
+{
+#ifdef _OPENMP
+    return omp_get_max_threads();
+#else
+    return 1;
+#endif
+}
+
+void calc_sf_scheduled(const int kernel, const std::vector<sf_grid_view> &grids,
+                       const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress)
+{
+    const int imax = static_cast<int>(grids.size());
+    const long long int smax = static_cast<long long int>(k_pt[0].size());
+    std::vector<long long int> points(imax);
+    for (int i = 0; i < imax; i++)
+        points[i] = grids[i].points;
+    const std::vector<sf_work_item> items = make_sf_schedule(points, smax, sf_threads());
+
+    sf.resize(imax);
+    for (int i = 0; i < imax; i++)
+        sf[i].resize(smax, constants::cnull);
+
+    run_sf_schedule(items, imax, progress, [&](const sf_work_item &item)
+                    {
+                        const sf_grid_view &g = grids[item.atom];
+                        sf_atom_range(kernel,
+                                      g.d1, g.d2, g.d3, g.dens, g.points, g.pairs,
+                                      k_pt[0].data(), k_pt[1].data(), k_pt[2].data(),
+                                      item.s_begin, item.s_end,
+                                      sf[item.atom].data()); });
+}
+
+static long long int next_smooth_size(long long int n)
+{
+    for (;; n++)
+    {
+        long long int m = n;
+        for (const long long int f : {2LL, 3LL, 5LL})
+            while (m % f == 0)
+                m /= f;
+        if (m == 1)
+            return n;
+    }
+}
+
+static inline long long int wrap_index(const long long int i, const long long int n)
+{
+    const long long int r = i % n;
+    return r < 0 ? r + n : r;
+}
+
+/**
+ * @brief Mixed radix decimation in time FFT of n = N / tw_step elements read with the given stride.
+ *
+ * twiddle holds exp(+2 pi i j / N), so this is the unnormalised backward transform. scratch needs n elements.
+ */
+static void fft_recursive(const cdouble *in, cdouble *out, const long long int n, const long long int stride,
+                          const cdouble *twiddle, const long long int tw_step, cdouble *scratch)
+{
+    if (n == 1)
+    {
+        out[0] = in[0];
+        return;
+    }
+    long long int p = n;
+    for (const long long int f : {2LL, 3LL, 5LL})
+        if (n % f == 0)
+        {
+            p = f;
+            break;
+        }
+    const long long int m = n / p;
+    for (long long int q = 0; q < p; q++)
+        fft_recursive(in + q * stride, out + q * m, m, stride * p, twiddle, tw_step * p, scratch);
+    for (long long int k = 0; k < m; k++)
+        for (long long int r = 0; r < p; r++)
+        {
+            const long long int idx = k + r * m;
+            cdouble sum = out[k];
+            for (long long int q = 1; q < p; q++)
+                sum += out[q * m + k] * twiddle[((q * idx) % n) * tw_step];
+            scratch[idx] = sum;
+        }
+    std::copy(scratch, scratch + n, out);
+}
+
+/**
+ * @brief In place backward 3D FFT of grid[x][y][z], only producing the output indices listed in keep.
+ */
+static void fft3d_backward_pruned(cvec &grid, const long long int n[3], const std::vector<cvec> &twiddle, const std::vector<std::vector<long long int>> &keep)
+{
+    const long long int strides[3] = {n[1] * n[2], n[2], 1};
+    for (int dim = 2; dim >= 0; dim--)
+    {
+        // lines along dim: the two other indices run over everything not yet transformed and over kept output indices otherwise
+        const int a = dim == 0 ? 1 : 0, b = dim == 2 ? 1 : 2;
+        const long long int na = a > dim ? static_cast<long long int>(keep[a].size()) : n[a];
+        const long long int nb = b > dim ? static_cast<long long int>(keep[b].size()) : n[b];
+        const long long int len = n[dim];
+#pragma omp parallel
+        {
+            cvec in(len), out(len), scratch(len);
+#pragma omp for schedule(static)
+            for (long long int line = 0; line < na * nb; line++)
+            {
+                const long long int ia = a > dim ? keep[a][line / nb] : line / nb;
+                const long long int ib = b > dim ? keep[b][line % nb] : line % nb;
+                const long long int base = ia * strides[a] + ib * strides[b];
+                for (long long int j = 0; j < len; j++)
+                    in[j] = grid[base + j * strides[dim]];
+                fft_recursive(in.data(), out.data(), len, 1, twiddle[dim].data(), 1, scratch.data());
+                for (long long int j = 0; j < len; j++)
+                    grid[base + j * strides[dim]] = out[j];
+            }
+        }
+    }
+}
+
+static void solve_3x3(const double m[3][3], const double rhs[3], double x[3])
+{
+    const double det = m[0][0] * (m[1][1] * m[2][2] - m[1][2] * m[2][1]) - m[0][1] * (m[1][0] * m[2][2] - m[1][2] * m[2][0]) + m[0][2] * (m[1][0] * m[2][1] - m[1][1] * m[2][0]);
+    for (int c = 0; c < 3; c++)
+    {
+        double t[3][3];
+        for (int i = 0; i < 3; i++)
+            for (int j = 0; j < 3; j++)
+                t[i][j] = j == c ? rhs[i] : m[i][j];
+        x[c] = (t[0][0] * (t[1][1] * t[2][2] - t[1][2] * t[2][1]) - t[0][1] * (t[1][0] * t[2][2] - t[1][2] * t[2][0]) + t[0][2] * (t[1][0] * t[2][1] - t[1][1] * t[2][0])) / det;
+    }
+}
+
+/**
+ * @brief Recovers the Miller indices of all k-points, k_x = sum_j rcm[x][j] h_j.
+ * @param hkl Output, hkl[j][s] is index j of reflection s.
+ * @return False if any k-point is not on the reciprocal lattice.
+ */
+static bool recover_hkl(const double rcm[3][3], const std::vector<vec> &k_pt, std::vector<ivec> &hkl)
+{
+    const long long int smax = static_cast<long long int>(k_pt[0].size());
+    hkl.assign(3, ivec(smax));
+    for (long long int s = 0; s < smax; s++)
+    {
+        const double k[3] = {k_pt[0][s], k_pt[1][s], k_pt[2][s]};
+        double h[3];
+        solve_3x3(rcm, k, h);
+        for (int j = 0; j < 3; j++)
+        {
+            if (std::abs(h[j] - std::round(h[j])) > 1E-6)
+                return false;
+            hkl[j][s] = static_cast<int>(std::round(h[j]));
+        }
+    }
+    return true;
+}
+
+/**
+ * @brief Phase recurrence kernel for the sorted reflections [s_begin, s_end) of one atom.
+ *
+ * The points are processed in tiles of sf_tile_size. For every tile the phases of the first reflection of a run are
+ * evaluated with sincos_poly, all following ones are obtained by multiplying with exp(i phi_l).
+ * @param hkl Miller indices in sorted order, 3 per reflection.
+ * @param order Original position of every sorted reflection.
+ */
+static void sf_recurrence_kernel(const double rcm[3][3],
+                                 const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                                 const long long int npairs, const int *hkl, const long long int *order, const long long int s_begin, const long long int s_end,
+                                 cdouble *sf)
+{
+    const long long int n_s = s_end - s_begin;
+    std::vector<char> seed(n_s);
+    for (long long int s = s_begin, since = 0; s < s_end; s++, since++)
+    {
+        const int *c = hkl + 3 * s, *p = c - 3;
+        const bool fresh = s == s_begin || c[0] != p[0] || c[1] != p[1] || c[2] != p[2] + 1 || since == sf_recurrence_reseed;
+        if (fresh)
+            since = 0;
+        seed[s - s_begin] = fresh;
+    }
+    vec acc_re(n_s, 0.0), acc_im(n_s, 0.0);
+    alignas(64) double ph0[sf_tile_size], ph1[sf_tile_size], ph2[sf_tile_size], rho[sf_tile_size], rho_diff[sf_tile_size];
+    alignas(64) double step_re[sf_tile_size], step_im[sf_tile_size], cr[sf_tile_size], ci[sf_tile_size];
+    // an inversion pair is one entry weighting cos with rho_a + rho_b and sin with rho_a - rho_b
+    const long long int entries = pmax - npairs;
+    for (long long int e0 = 0; e0 < entries; e0 += sf_tile_size)
+    {
+        // gather the points with non-zero density, phi_j = sum_x rcm[x][j] r_x
+        int n = 0;
+        for (long long int e = e0; e < std::min(entries, e0 + sf_tile_size); e++)
+        {
+            const long long int p = e < npairs ? 2 * e : e + npairs;
+            rho[n] = e < npairs ? dens[p] + dens[p + 1] : dens[p];
+            rho_diff[n] = e < npairs ? dens[p] - dens[p + 1] : dens[p];
+            if (rho[n] == 0.0 && rho_diff[n] == 0.0)
+                continue;
+            ph0[n] = rcm[0][0] * d1[p] + rcm[1][0] * d2[p] + rcm[2][0] * d3[p];
+            ph1[n] = rcm[0][1] * d1[p] + rcm[1][1] * d2[p] + rcm[2][1] * d3[p];
+            ph2[n] = rcm[0][2] * d1[p] + rcm[1][2] * d2[p] + rcm[2][2] * d3[p];
+            n++;
+        }
+        if (n == 0)
+            continue;
+#pragma omp simd aligned(ph2, step_re, step_im : 64)
+        for (int j = 0; j < n; j++)
+            sincos_poly(ph2[j], step_im[j], step_re[j]);
+        for (long long int s = s_begin; s < s_end; s++)
+        {
+            double re = 0.0, im = 0.0;
+            if (seed[s - s_begin])
+            {
+                const double h = hkl[3 * s], k = hkl[3 * s + 1], l = hkl[3 * s + 2];
+#pragma omp simd aligned(ph0, ph1, ph2, rho, rho_diff, cr, ci : 64) reduction(+ : re, im)
+                for (int j = 0; j < n; j++)
+                {
+                    sincos_poly(h * ph0[j] + k * ph1[j] + l * ph2[j], ci[j], cr[j]);
+                    re += rho[j] * cr[j];
+                    im += rho_diff[j] * ci[j];
+                }
+            }
+            else
+            {
+#pragma omp simd aligned(rho, rho_diff, cr, ci, step_re, step_im : 64) reduction(+ : re, im)
+                for (int j = 0; j < n; j++)
+                {
+                    const double t = cr[j] * step_re[j] - ci[j] * step_im[j];
+                    ci[j] = cr[j] * step_im[j] + ci[j] * step_re[j];
+                    cr[j] = t;
+                    re += rho[j] * cr[j];
+                    im += rho_diff[j] * ci[j];
+                }
+            }
+            acc_re[s - s_begin] += re;
+            acc_im[s - s_begin] += im;
+        }
+    }
+    for (long long int s = s_begin; s < s_end; s++)
+        sf[order[s]] = cdouble(acc_re[s - s_begin], acc_im[s - s_begin]);
+}
+
+bool calc_sf_recurrence(const double rcm[3][3], const std::vector<sf_grid_view> &grids,
+                        const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress)
+{
+    const int imax = static_cast<int>(grids.size());
+    const long long int smax = static_cast<long long int>(k_pt[0].size());
+    std::vector<ivec> hkl;
+    if (!recover_hkl(rcm, k_pt, hkl))
+        return false;
+
+    // sort the reflections into runs along l
+    std::vector<long long int> order(smax);
+    std::iota(order.begin(), order.end(), 0LL);
+    std::sort(order.begin(), order.end(), [&hkl](const long long int a, const long long int b)
+              {
+                  if (hkl[0][a] != hkl[0][b])
+                      return hkl[0][a] < hkl[0][b];
+                  if (hkl[1][a] != hkl[1][b])
+                      return hkl[1][a] < hkl[1][b];
+                  return hkl[2][a] < hkl[2][b]; });
+    ivec sorted_hkl(3 * smax);
+    for (long long int s = 0; s < smax; s++)
+        for (int j = 0; j < 3; j++)
+            sorted_hkl[3 * s + j] = hkl[j][order[s]];
+
+    std::vector<long long int> points(imax);
+    for (int i = 0; i < imax; i++)
+        points[i] = grids[i].points;
+    const std::vector<sf_work_item> items = make_sf_schedule(points, smax, sf_threads());
+
+    sf.resize(imax);
+    for (int i = 0; i < imax; i++)
+        sf[i].resize(smax, constants::cnull);
+
+    run_sf_schedule(items, imax, progress, [&](const sf_work_item &item)
+                    {
+                        const sf_grid_view &g = grids[item.atom];
+                        sf_recurrence_kernel(rcm, g.d1, g.d2, g.d3, g.dens, g.points,
+                                             g.pairs, sorted_hkl.data(), order.data(), item.s_begin, item.s_end,
+                                             sf[item.atom].data()); });
+    return true;
+}
+
+static inline std::uint32_t float_bits(const float f)
+{
+    std::uint32_t u;
+    std::memcpy(&u, &f, sizeof(u));
+    return u;
+}
+
+static inline float bits_float(const std::uint32_t u)
+{
+    float f;
+    std::memcpy(&f, &u, sizeof(f));
+    return f;
+}
+
+/**
+ * @brief Single precision version of sincos_poly, using the Cephes sinf/cosf polynomials.
+ *
+ * The three part reduction is exact for |x| < 2^14 * pi/2, far beyond the phases of grid points with density.
+ */
+static inline void sincos_poly_float(const float x, float &s, float &c)
+{
+    const float round_shift = 12582912.0f; // 1.5 * 2^23
+    const float t = x * 0.636619772f + round_shift;
+    const std::uint32_t quadrant = float_bits(t);
+    const float q = t - round_shift;
+    const float r = ((x - q * 1.5703125f) - q * 4.837512969970703125E-4f) - q * 7.54978995489188216E-8f;
+    const float z = r * r;
+    const float sp = r + r * z * ((-1.9515295891E-4f * z + 8.3321608736E-3f) * z - 1.6666654611E-1f);
+    const float cp = 1.0f - 0.5f * z + z * z * ((2.443315711809948E-5f * z - 1.388731625493765E-3f) * z + 4.166664568298827E-2f);
+    const std::uint32_t swap = 0 - (quadrant & 1);
+    const std::uint32_t sp_bits = float_bits(sp), cp_bits = float_bits(cp);
+    s = bits_float(((sp_bits & ~swap) | (cp_bits & swap)) ^ ((quadrant & 2) << 30));
+    c = bits_float(((cp_bits & ~swap) | (sp_bits & swap)) ^ (((quadrant + 1) & 2) << 30));
+}
+
+static sf_float_grid make_float_grid(const sf_grid_view &grid)
+{
+    sf_float_grid g;
+    const double *d1 = grid.d1, *d2 = grid.d2, *d3 = grid.d3, *dens = grid.dens;
+    const long long int npairs = grid.pairs;
+    const long long int entries = grid.points - npairs;
+    for (std::vector<float> *v : {&g.x, &g.y, &g.z, &g.rc, &g.rs})
+        v->reserve(entries);
+    for (long long int e = 0; e < entries; e++)
+    {
+        const long long int p = e < npairs ? 2 * e : e + npairs;
+        const double rc = e < npairs ? dens[p] + dens[p + 1] : dens[p];
+        const double rs = e < npairs ? dens[p] - dens[p + 1] : dens[p];
+        if (rc == 0.0 && rs == 0.0)
+            continue;
+        g.x.push_back(static_cast<float>(d1[p]));
+        g.y.push_back(static_cast<float>(d2[p]));
+        g.z.push_back(static_cast<float>(d3[p]));
+        g.rc.push_back(static_cast<float>(rc));
+        g.rs.push_back(static_cast<float>(rs));
+    }
+    return g;
+}
+
+/**
+ * @brief Mixed precision kernel for the reflections [s_begin, s_end) of one atom.
+ *
+ * Phases and products are evaluated in single precision and summed over blocks of sf_mixed_block entries,
+ * the block sums are accumulated in double precision.
+ */
+static void sf_mixed_kernel(const sf_float_grid &g, const std::vector<float> &k1, const std::vector<float> &k2, const std::vector<float> &k3,
+                            const long long int s_begin, const long long int s_end, cdouble *sf)
+{
+    alignas(64) float kx[sf_tile_size], ky[sf_tile_size], kz[sf_tile_size];
+    alignas(64) float re_f[sf_tile_size], im_f[sf_tile_size];
+    alignas(64) double re[sf_tile_size], im[sf_tile_size];
+    const long long int entries = static_cast<long long int>(g.rc.size());
+    const float *x = g.x.data(), *y = g.y.data(), *z = g.z.data(), *rc = g.rc.data(), *rs = g.rs.data();
+    for (long long int s0 = s_begin; s0 < s_end; s0 += sf_tile_size)
+    {
+        const int n = static_cast<int>(std::min(sf_tile_size, s_end - s0));
+        for (int j = 0; j < n; j++)
+        {
+            kx[j] = k1[s0 + j];
+            ky[j] = k2[s0 + j];
+            kz[j] = k3[s0 + j];
+            re[j] = 0.0;
+            im[j] = 0.0;
+        }
+        for (long long int e0 = 0; e0 < entries; e0 += sf_mixed_block)
+        {
+            for (int j = 0; j < n; j++)
+            {
+                re_f[j] = 0.0f;
+                im_f[j] = 0.0f;
+            }
+            for (long long int e = e0; e < std::min(entries, e0 + sf_mixed_block); e++)
+            {
+                const float px = x[e], py = y[e], pz = z[e], wc = rc[e], ws = rs[e];
+#pragma omp simd aligned(kx, ky, kz, re_f, im_f : 64)
+                for (int j = 0; j < n; j++)
+                {
+                    float s, c;
+                    sincos_poly_float(kx[j] * px + ky[j] * py + kz[j] * pz, s, c);
+                    re_f[j] += wc * c;
+                    im_f[j] += ws * s;
+                }
+            }
+#pragma omp simd aligned(re, im, re_f, im_f : 64)
+            for (int j = 0; j < n; j++)
+            {
+                re[j] += re_f[j];
+                im[j] += im_f[j];
+            }
+        }
+        for (int j = 0; j < n; j++)
+            sf[s0 + j] = cdouble(re[j], im[j]);
+    }
+}
+
+/**
+ * @brief Half width of the NUFFT Gaussian and the size of the oversampled grid for a precision and the largest indices.
+ */
+static void nufft_size(const double precision, const long long int max_index[3], int &w, long long int n[3])
+{
+    w = std::max(2, std::min(16, static_cast<int>(ceil(-log10(precision)))));
+    for (int j = 0; j < 3; j++)
+    {
+        const long long int m = 2 * max_index[j] + 1;
+        n[j] = next_smooth_size(std::max(2 * m, static_cast<long long int>(2 * w + 2)));
+    }
+}
+
+sf_kernel_plan::sf_kernel_plan(const int kernel, const double rcm[3][3], const double precision, const std::vector<sf_grid_view> &grids,
+                               const long long int max_index[3])
+    : kernel(kernel), precision(precision), grids(grids)
+{
+    using namespace std;
+    time_point t_start = get_time();
+    for (int i = 0; i < 3; i++)
+        for (int j = 0; j < 3; j++)
+            this->rcm[i][j] = rcm[i][j];
+    if (kernel == SF_NUFFT)
+    {
+        // Greengard & Lee parameters: half width of the Gaussian in grid cells, oversampled grid and Gaussian variance per direction
+        nufft_size(precision, max_index, w, n);
+        twiddle.resize(3);
+        for (int j = 0; j < 3; j++)
+        {
+            modes[j] = max_index[j];
+            const long long int m = 2 * modes[j] + 1;
+            const double R = static_cast<double>(n[j]) / m;
+            tau[j] = constants::PI * w / (static_cast<double>(m) * m * R * (R - 0.5));
+            cell_width[j] = constants::TWO_PI / n[j];
+            deconv_norm[j] = sqrt(constants::PI / tau[j]) / n[j];
+            twiddle[j].resize(n[j]);
+            for (long long int i = 0; i < n[j]; i++)
+                twiddle[j][i] = polar(1.0, constants::TWO_PI * i / n[j]);
+        }
+    }
+    else if (kernel == SF_MIXED)
+    {
+        const int imax = static_cast<int>(grids.size());
+        float_grids.resize(imax);
+        float_points.resize(imax);
+#pragma omp parallel for schedule(dynamic)
+        for (int i = 0; i < imax; i++)
+        {
+            float_grids[i] = make_float_grid(grids[i]);
+            float_points[i] = static_cast<long long int>(float_grids[i].rc.size());
+        }
+    }
+    kernel_ms = get_msec(t_start, get_time());
+}
+
+bool sf_kernel_plan::run(const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress)
+{
+    using namespace std;
+    const int imax = static_cast<int>(grids.size());
+    const long long int smax = static_cast<long long int>(k_pt[0].size());
+    time_point t_start = get_time();
+    if (fell_back)
+        calc_sf_scheduled(SF_BLOCKED, grids, k_pt, sf, progress);
+    else if (kernel == SF_NUFFT)
+    {
+        vector<ivec> hkl;
+        if (!recover_hkl(rcm, k_pt, hkl))
+            return false;
+        for (long long int s = 0; s < smax; s++)
+            for (int j = 0; j < 3; j++)
+                if (abs(hkl[j][s]) > modes[j])
+                    return false;
+        run_nufft(hkl, sf, progress);
+    }
+    else if (kernel == SF_RECURRENCE)
+    {
+        if (!calc_sf_recurrence(rcm, grids, k_pt, sf, progress))
+            return false;
+    }
+    else if (kernel == SF_MIXED)
+    {
+        vector<vector<float>> k_f(3, vector<float>(smax));
+        for (int x = 0; x < 3; x++)
+            for (long long int s = 0; s < smax; s++)
+                k_f[x][s] = static_cast<float>(k_pt[x][s]);
+        const vector<sf_work_item> items = make_sf_schedule(float_points, smax, sf_threads());
+        sf.resize(imax);
+        for (int i = 0; i < imax; i++)
+            sf[i].resize(smax, constants::cnull);
+        run_sf_schedule(items, imax, progress, [&](const sf_work_item &item)
+                        { sf_mixed_kernel(float_grids[item.atom], k_f[0], k_f[1], k_f[2], item.s_begin, item.s_end, sf[item.atom].data()); });
+    }
+    else
+        calc_sf_scheduled(kernel, grids, k_pt, sf, progress);
+    time_point t_kernel = get_time();
+    kernel_ms += get_msec(t_start, t_kernel);
+    reflections += smax;
+
+    // the approximate kernels are checked once against the double precision blocked kernel on a sample of reflections
+    if ((kernel == SF_NUFFT || kernel == SF_MIXED) && samples == 0 && smax > 0)
+    {
+        samples = min(smax, 256LL);
+        vector<vec> k_sample(3, vec(samples));
+        for (long long int j = 0; j < samples; j++)
+            for (int x = 0; x < 3; x++)
+                k_sample[x][j] = k_pt[x][j * smax / samples];
+        cvec reference;
+        for (int i = 0; i < imax; i++)
+        {
+            calc_atomic_sf(SF_BLOCKED, grids[i], k_sample, reference);
+            double norm = 0.0;
+            for (long long int p = 0; p < grids[i].points; p++)
+                norm += abs(grids[i].dens[p]);
+            for (long long int j = 0; j < samples; j++)
+            {
+                const double dev = abs(reference[j] - sf[i][j * smax / samples]);
+                max_dev = max(max_dev, dev);
+                max_f = max(max_f, abs(reference[j]));
+                if (norm > 0.0)
+                    max_rel = max(max_rel, dev / norm);
+            }
+        }
+        check_ms = get_msec(t_kernel, get_time());
+        // a NUFFT that misses the requested accuracy by far is not trusted, this and all further k-points use the blocked kernel
+        if (kernel == SF_NUFFT && max_dev > 100.0 * precision * max_f)
+        {
+            fell_back = true;
+            vector<cvec>().swap(twiddle);
+            calc_sf_scheduled(SF_BLOCKED, grids, k_pt, sf, progress);
+        }
+    }
+    return true;
+}
+
+void sf_kernel_plan::run_nufft(const std::vector<ivec> &hkl, std::vector<cvec> &sf, progress_bar *progress) const
+{
+    using namespace std;
+    const int imax = static_cast<int>(grids.size());
+    const long long int smax = static_cast<long long int>(hkl[0].size());
+    const int step = max(imax / 20, 1);
+    const int W = 2 * w;
+
+    // only the lines of the FFT leading to requested reflections are transformed
+    vector<vector<long long int>> keep(3);
+    for (int j = 0; j < 3; j++)
+    {
+        vector<char> used(n[j], 0);
+        for (long long int s = 0; s < smax; s++)
+            used[wrap_index(hkl[j][s], n[j])] = 1;
+        for (long long int i = 0; i < n[j]; i++)
+            if (used[i])
+                keep[j].push_back(i);
+    }
+    const long long int grid_size = n[0] * n[1] * n[2];
+    cvec grid(grid_size);
+
+    sf.resize(imax);
+    for (int i = 0; i < imax; i++)
+    {
+        const long long int pmax = grids[i].points;
+        const double *d1 = grids[i].d1, *d2 = grids[i].d2, *d3 = grids[i].d3, *dens = grids[i].dens;
+        // fractional coordinates times 2 pi, wrapped into [0, 2 pi), and the y/z stencils of every point
+        vector<long long int> base(3 * pmax);
+        vec phi_x(pmax), wy(pmax * W), wz(pmax * W);
+        for (long long int p = 0; p < pmax; p++)
+        {
+            const double r[3] = {d1[p], d2[p], d3[p]};
+            for (int j = 0; j < 3; j++)
+            {
+                double phi = rcm[0][j] * r[0] + rcm[1][j] * r[1] + rcm[2][j] * r[2];
+                phi -= constants::TWO_PI * floor(phi / constants::TWO_PI);
+                base[3 * p + j] = min(static_cast<long long int>(phi / cell_width[j]), n[j] - 1);
+                if (j == 0)
+                    phi_x[p] = phi;
+                else
+                {
+                    double *weights = (j == 1 ? wy.data() : wz.data()) + p * W;
+                    for (int o = 0; o < W; o++)
+                    {
+                        const double d = phi - (base[3 * p + j] - w + 1 + o) * cell_width[j];
+                        weights[o] = exp(-d * d / (4.0 * tau[j]));
+                    }
+                }
+            }
+        }
+        // bucket the points by their x cell, so every x plane of the grid can gather its contributions without races
+        vector<long long int> bucket_start(n[0] + 1, 0), order(pmax);
+        for (long long int p = 0; p < pmax; p++)
+            bucket_start[base[3 * p] + 1]++;
+        for (long long int b = 0; b < n[0]; b++)
+            bucket_start[b + 1] += bucket_start[b];
+        {
+            vector<long long int> fill(bucket_start.begin(), bucket_start.end() - 1);
+            for (long long int p = 0; p < pmax; p++)
+                order[fill[base[3 * p]]++] = p;
+        }
+        double *g = reinterpret_cast<double *>(grid.data());
+#pragma omp parallel for schedule(dynamic)
+        for (long long int mx = 0; mx < n[0]; mx++)
+        {
+            double *plane = g + 2 * mx * n[1] * n[2];
+            fill(plane, plane + 2 * n[1] * n[2], 0.0);
+            for (int o = -w + 1; o <= w; o++)
+            {
+                const long long int b = wrap_index(mx - o, n[0]);
+                for (long long int idx = bucket_start[b]; idx < bucket_start[b + 1]; idx++)
+                {
+                    const long long int p = order[idx];
+                    const double dx = phi_x[p] - (b + o) * cell_width[0];
+                    const double wx = dens[p] * exp(-dx * dx / (4.0 * tau[0]));
+                    const long long int z0 = base[3 * p + 2] - w + 1;
+                    const double *wzp = wz.data() + p * W;
+                    for (int oy = 0; oy < W; oy++)
+                    {
+                        double *row = plane + 2 * wrap_index(base[3 * p + 1] - w + 1 + oy, n[1]) * n[2];
+                        const double wxy = wx * wy[p * W + oy];
+                        if (z0 >= 0 && z0 + W <= n[2])
+                            for (int oz = 0; oz < W; oz++)
+                                row[2 * (z0 + oz)] += wxy * wzp[oz];
+                        else
+                            for (int oz = 0; oz < W; oz++)
+                                row[2 * wrap_index(z0 + oz, n[2])] += wxy * wzp[oz];
+                    }
+                }
+            }
+        }
+        fft3d_backward_pruned(grid, n, twiddle, keep);
+        sf[i].resize(smax);
+#pragma omp parallel for
+        for (long long int s = 0; s < smax; s++)
+        {
+            double factor = 1.0;
+            long long int idx = 0;
+            for (int j = 0; j < 3; j++)
+            {
+                factor *= deconv_norm[j] * exp(static_cast<double>(hkl[j][s]) * hkl[j][s] * tau[j]);
+                idx = idx * n[j] + wrap_index(hkl[j][s], n[j]);
+            }
+            sf[i][s] = factor * grid[idx];
+        }
+        if (progress != NULL && i != 0 && i % step == 0)
+            progress->write(i / static_cast<double>(imax));
+    }
+}
+
+void sf_kernel_plan::report(std::ostream &file, const bool no_date) const
+{
+    using namespace std;
+    if (kernel == SF_NUFFT)
+    {
+        file << "NUFFT grid: " << n[0] << "x" << n[1] << "x" << n[2] << " with Gaussian half width " << w << endl
+             << "NUFFT max deviation from direct sum on " << samples << " reflections per atom: " << scientific << setprecision(3)
+             << max_dev << " (max |F| " << max_f << ")" << defaultfloat << endl;
+        if (fell_back)
+            file << "WARNING: NUFFT deviation is far above the requested precision of " << scientific << setprecision(1) << precision
+                 << defaultfloat << ", used the blocked kernel instead" << endl;
+        else if (!no_date)
+        {
+            const double direct_estimate = samples == 0 ? 0.0 : check_ms * static_cast<double>(reflections) / samples;
+            file << "NUFFT time: " << fixed << setprecision(0) << kernel_ms << " ms, estimated direct kernel time: "
+                 << direct_estimate << " ms" << defaultfloat << endl;
+        }
+    }
+    else if (kernel == SF_MIXED)
+    {
+        file << "Mixed precision max deviation from double precision on " << samples << " reflections per atom: " << scientific << setprecision(3)
+             << max_dev << " (max |F| " << max_f << ", relative to sum |rho| " << max_rel << ")" << defaultfloat << endl;
+        if (!no_date)
+            file << "Mixed precision time: " << fixed << setprecision(0) << kernel_ms << " ms, reference check: "
+                 << check_ms << " ms" << defaultfloat << endl;
+    }
+}
+
+void sf_kernel_plan::memory(const int kernel, const double precision, const std::vector<sf_grid_view> &grids,
+                            const long long int max_index[3], double &fixed, double &per_reflection)
+{
+    fixed = 0.0;
+    per_reflection = 0.0;
+    if (kernel == SF_NUFFT)
+    {
+        int w;
+        long long int n[3];
+        nufft_size(precision, max_index, w, n);
+        long long int pmax = 0;
+        for (const sf_grid_view &g : grids)
+            pmax = std::max(pmax, g.points);
+        // oversampled grid, twiddles and line selection, plus the stencils and buckets of the largest atom
+        fixed = sizeof(cdouble) * static_cast<double>(n[0]) * n[1] * n[2] + (sizeof(cdouble) + sizeof(long long int) + 1) * static_cast<double>(n[0] + n[1] + n[2]) + (5 * sizeof(double) + 4 * w * sizeof(double)) * static_cast<double>(pmax) + 2 * sizeof(long long int) * static_cast<double>(n[0] + 1);
+        per_reflection = 3 * sizeof(int);
+    }
+    else if (kernel == SF_RECURRENCE)
+        // recovered, sorted and ordered Miller indices
+        per_reflection = 6 * sizeof(int) + sizeof(long long int);
+    else if (kernel == SF_MIXED)
+    {
+        for (const sf_grid_view &g : grids)
+            fixed += 5 * sizeof(float) * static_cast<double>(g.points - g.pairs) + sizeof(long long int);
+        per_reflection = 3 * sizeof(float);
+    }
+}
+
+bool calc_sf_nufft(const double rcm[3][3], const double precision, const std::vector<sf_grid_view> &grids,
+                   const std::vector<vec> &k_pt, std::vector<cvec> &sf, std::ostream &file, const bool no_date, progress_bar *progress)
+{
+    // the number of modes needed in every direction
+    std::vector<ivec> hkl;
+    if (!recover_hkl(rcm, k_pt, hkl))
+        return false;
+    long long int modes[3] = {0, 0, 0};
+    for (long long int s = 0; s < static_cast<long long int>(k_pt[0].size()); s++)
+        for (int j = 0; j < 3; j++)
+            modes[j] = std::max(modes[j], static_cast<long long int>(std::abs(hkl[j][s])));
+    sf_kernel_plan plan(SF_NUFFT, rcm, precision, grids, modes);
+    plan.run(k_pt, sf, progress);
+    plan.report(file, no_date);
+    return true;
+}
+
+void calc_sf_mixed(const std::vector<sf_grid_view> &grids,
+                   const std::vector<vec> &k_pt, std::vector<cvec> &sf, std::ostream &file, const bool no_date, progress_bar *progress)
+{
+    const double no_cell[3][3] = {{0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}, {0.0, 0.0, 0.0}};
+    const long long int no_index[3] = {0, 0, 0};
+    sf_kernel_plan plan(SF_MIXED, no_cell, 0.0, grids, no_index);
+    plan.run(k_pt, sf, progress);
+    plan.report(file, no_date);
+}
@@ -0,0 +1,312 @@
+/**
+ * @file sf_kernels.h
+ * @brief Kernels evaluating the Fourier sum of partitioned atomic densities on a set of reciprocal space vectors.
+ *
+ * All kernels compute F(k_s) = sum_p rho_p exp(i k_s . r_p) for a single atom, where r_p are the grid points
+ * relative to the atomic position and rho_p the Hirshfeld weighted densities times integration weights.
+ *
+ * Grids may start with npairs inversion pairs: points 2j and 2j+1 (j < npairs) sit at r and -r around the atom.
+ * Kernels aware of this evaluate one sincos per pair, all others treat the pairs as ordinary points.
+ */
+#pragma once
+
+#include "convenience.h"
+
+/**
+ * @brief Implementations available for the atomic Fourier sums, selected by -sf_kernel.
+ */
+enum sf_kernel_type
+{
+    SF_DIRECT = 0,     ///< Scalar reference loop using std::polar
+    SF_BLOCKED = 1,    ///< Cache-blocked real/imaginary SoA loop with vectorised sincos
+    SF_NUFFT = 2,      ///< Non-uniform FFT on the reciprocal lattice, integer hkl only
+    SF_RECURRENCE = 3, ///< Phase recurrence along runs of l, integer hkl only
+    SF_MIXED = 4,      ///< Blocked loop with single precision grid and phases, double precision accumulation
+};
+
+/**
+ * @brief Non-owning view of the grid of one atom, as consumed by the kernels evaluating all atoms.
+ *
+ * The arrays may live in vectors, in a shared arena or in a memory mapped grid checkpoint.
+ */
+struct sf_grid_view
+{
+    const double *d1, *d2, *d3; ///< Components of the grid points relative to the atom
+    const double *dens;         ///< Weighted densities of the grid points
+    long long int points;       ///< Number of grid points
+    long long int pairs;        ///< Number of inversion pairs at the start of the grid
+};
+
+/**
+ * @brief Number of reflections handled by one tile of the blocked kernel.
+ *
+ * A tile keeps 3 k-vector components and the real and imaginary accumulators of 256 reflections (10 kB) in L1,
+ * while the grid points of the atom are streamed through it.
+ */
+const long long int sf_tile_size = 256;
+
+/**
+ * @brief Maximum deviation of the blocked kernel from the direct one, relative to sum_p |rho_p|.
+ *
+ * The polynomial sincos is accurate to about 2 ulp for |k.r| < 1.6E6 and the summation order differs from
+ * the direct loop, so both kernels agree to this bound for all phases occurring in practice.
+ */
+const double sf_blocked_tolerance = 1E-12;
+
+/**
+ * @brief Number of complex multiplications after which the recurrence kernel evaluates the phases directly again.
+ *
+ * Every step of the recurrence adds about one rounding error to the phase factors, so the deviation from the
+ * blocked kernel stays a small multiple of sf_blocked_tolerance.
+ */
+const long long int sf_recurrence_reseed = 16;
+
+/**
+ * @brief Number of grid entries the mixed precision kernel sums in single precision before adding to the double sums.
+ *
+ * The single precision partial sums then carry a relative error of about 64 * 6E-8, independent of the grid size.
+ */
+const long long int sf_mixed_block = 64;
+
+/**
+ * @brief Scalar reference kernel for the reflections [s_begin, s_end).
+ * @param d1 x components of the grid points relative to the atom.
+ * @param d2 y components of the grid points relative to the atom.
+ * @param d3 z components of the grid points relative to the atom.
+ * @param dens Weighted densities of the grid points.
+ * @param pmax Number of grid points.
+ * @param k1 x components of the k-vectors.
+ * @param k2 y components of the k-vectors.
+ * @param k3 z components of the k-vectors.
+ * @param s_begin First reflection to evaluate.
+ * @param s_end One past the last reflection to evaluate.
+ * @param sf Output scattering factors, indexed like the k-vectors.
+ */
+void sf_direct_kernel(const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                      const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                      cdouble *sf);
+
+/**
+ * @brief Cache-blocked kernel for the reflections [s_begin, s_end), processed in tiles of sf_tile_size reflections.
+ *
+ * Parameters are the same as for sf_direct_kernel. Results agree with it within sf_blocked_tolerance.
+ * @param npairs Number of inversion pairs at the start of the grid.
+ */
+void sf_blocked_kernel(const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                       const long long int npairs,
+                       const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                       cdouble *sf);
+
+/**
+ * @brief Evaluates the reflections [s_begin, s_end) of one atom with the requested kernel, serially.
+ * @param kernel One of sf_kernel_type.
+ * @param npairs Number of inversion pairs at the start of the grid.
+ */
+void sf_atom_range(const int kernel,
+                   const double *d1, const double *d2, const double *d3, const double *dens, const long long int pmax,
+                   const long long int npairs,
+                   const double *k1, const double *k2, const double *k3, const long long int s_begin, const long long int s_end,
+                   cdouble *sf);
+
+/**
+ * @brief Evaluates all k-points for one atom, parallelised over tiles of reflections.
+ * @param kernel One of sf_kernel_type.
+ * @param d1 x components of the grid points relative to the atom.
+ * @param d2 y components of the grid points relative to the atom.
+ * @param d3 z components of the grid points relative to the atom.
+ * @param dens Weighted densities of the grid points.
+ * @param k_pt k-vectors, k_pt[0..2] hold the cartesian components.
+ * @param sf Output, resized to the number of k-points.
+ */
+void calc_atomic_sf(const int kernel, const vec &d1, const vec &d2, const vec &d3, const vec &dens, const std::vector<vec> &k_pt, cvec &sf);
+
+/**
+ * @brief Evaluates all k-points for one atom given as a view, parallelised over tiles of reflections.
+ */
+void calc_atomic_sf(const int kernel, const sf_grid_view &grid, const std::vector<vec> &k_pt, cvec &sf);
+
+/**
+ * @brief Builds the views of per atom grid vectors.
+ * @param pairs Optional number of inversion pairs at the start of every atom's grid.
+ */
+std::vector<sf_grid_view> make_sf_grid_views(const std::vector<vec> &d1, const std::vector<vec> &d2, const std::vector<vec> &d3, const std::vector<vec> &dens,
+                                             const ivec *pairs = NULL);
+
+/**
+ * @brief One unit of work of the scheduled Fourier sums: a range of reflections of a single atom.
+ */
+struct sf_work_item
+{
+    int atom;
+    long long int s_begin, s_end;
+    double weight; ///< Number of grid point x reflection pairs of the item
+};
+
+/**
+ * @brief Flattens the atom x reflection problem into weighted work items.
+ *
+ * Reflection ranges start at 4 kernel tiles and are halved (down to 32 reflections) until there are at least
+ * 8 items per thread. Items are sorted by decreasing weight (ties by atom and reflection), so heavy atoms start
+ * first and the small items fill up the end of the run.
+ * @param points Number of grid points per atom.
+ * @param smax Number of reflections.
+ * @param threads Number of threads that will process the items.
+ * @return The sorted list of work items.
+ */
+std::vector<sf_work_item> make_sf_schedule(const std::vector<long long int> &points, const long long int smax, const int threads);
+
+/**
+ * @brief Evaluates all atoms and k-points, dynamically scheduling (atom, reflection range) items over all threads.
+ *
+ * Every item writes a disjoint part of sf with a fixed summation order, so the result does not depend on the
+ * number of threads or the order of execution. The progress bar receives the same updates as an atom by atom
+ * loop would give, issued in atom order as soon as all items of an atom are finished.
+ * @param kernel One of sf_kernel_type.
+ * @param grids Grid of every atom.
+ * @param k_pt k-vectors, k_pt[0..2] hold the cartesian components.
+ * @param sf Output, sf[atom][reflection], resized as needed.
+ * @param progress Optional progress bar to update.
+ */
+void calc_sf_scheduled(const int kernel, const std::vector<sf_grid_view> &grids,
+                       const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress = NULL);
+
+/**
+ * @brief Evaluates the Fourier sums of all atoms with a non-uniform FFT.
+ *
+ * For integer Miller indices k.r = h.phi with phi_j = sum_x rcm[x][j] r_x, so the exponential is 2 pi periodic in
+ * every phi_j and the type-3 transform (non-uniform points to non-uniform k) reduces to a type-1 transform on the
+ * reciprocal lattice: the weighted densities are spread with a Gaussian onto an oversampled periodic grid in phi,
+ * transformed with a mixed radix (2, 3, 5) FFT and deconvolved at the requested reflections (Greengard and Lee,
+ * SIAM Rev. 46, 443 (2004)). The cost per atom is O(points * w^3 + N log N) instead of O(points * reflections),
+ * where w grows with -log10(precision).
+ * A sample of up to 256 reflections is recomputed with the blocked kernel and the deviation and timings are written
+ * to file once all atoms are done; callers showing a progress bar should buffer it.
+ * @param rcm Reciprocal cell matrix used to build k_pt (k_x = sum_j rcm[x][j] h_j).
+ * @param precision Requested relative accuracy of the transform, between 1E-14 and 1E-2.
+ * @param grids Grid of every atom.
+ * @param k_pt k-vectors, k_pt[0..2] hold the cartesian components.
+ * @param sf Output, sf[atom][reflection], resized as needed.
+ * @param file Stream for the accuracy and timing report.
+ * @param no_date Suppresses the timings in the report.
+ * @param progress Optional progress bar to update after every atom.
+ * @return False (and sf untouched) if the k-points are not on the lattice spanned by rcm.
+ */
+bool calc_sf_nufft(const double rcm[3][3], const double precision, const std::vector<sf_grid_view> &grids,
+                   const std::vector<vec> &k_pt, std::vector<cvec> &sf, std::ostream &file, const bool no_date, progress_bar *progress = NULL);
+
+/**
+ * @brief Evaluates the Fourier sums of all atoms with a phase recurrence along l.
+ *
+ * For integer Miller indices exp(i k.r) = exp(i h phi_h) exp(i k phi_k) exp(i l phi_l) with the fractional
+ * coordinates phi_j = sum_x rcm[x][j] r_x (times 2 pi). The reflections are sorted into runs of consecutive l at
+ * fixed h and k; the first reflection of every run is evaluated directly, each following one by a complex
+ * multiplication with exp(i phi_l). Runs are reseeded every sf_recurrence_reseed steps to bound the error.
+ * Scheduling and progress reporting are the same as in calc_sf_scheduled.
+ * @param rcm Reciprocal cell matrix used to build k_pt (k_x = sum_j rcm[x][j] h_j).
+ * @param grids Grid of every atom.
+ * @param k_pt k-vectors, k_pt[0..2] hold the cartesian components.
+ * @param sf Output, sf[atom][reflection], resized as needed.
+ * @param progress Optional progress bar to update.
+ * @return False (and sf untouched) if the k-points are not on the lattice spanned by rcm.
+ */
+bool calc_sf_recurrence(const double rcm[3][3], const std::vector<sf_grid_view> &grids,
+                        const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress = NULL);
+
+/**
+ * @brief Evaluates the Fourier sums of all atoms in mixed precision.
+ *
+ * The grid coordinates (relative to the atom) and densities are converted to single precision, inversion pairs are
+ * merged into one entry and points without density dropped. Phases, sincos and products are evaluated in single
+ * precision, which halves the memory traffic and doubles the SIMD width; partial sums over sf_mixed_block entries
+ * are accumulated in double precision. Scheduling and progress reporting are the same as in calc_sf_scheduled.
+ * A sample of up to 256 reflections per atom is recomputed with the double precision blocked kernel and the maximum
+ * deviation is written to file; callers showing a progress bar should buffer it.
+ * @param grids Grid of every atom.
+ * @param k_pt k-vectors, k_pt[0..2] hold the cartesian components.
+ * @param sf Output, sf[atom][reflection], resized as needed.
+ * @param file Stream for the accuracy and timing report.
+ * @param no_date Suppresses the timings in the report.
+ * @param progress Optional progress bar to update.
+ */
+void calc_sf_mixed(const std::vector<sf_grid_view> &grids,
+                   const std::vector<vec> &k_pt, std::vector<cvec> &sf, std::ostream &file, const bool no_date, progress_bar *progress = NULL);
+
+/**
+ * @brief Single precision grid of one atom for the mixed precision kernel.
+ *
+ * Every entry is either a single point (rc = rs = rho) or an inversion pair (rc = rho_a + rho_b, rs = rho_a - rho_b),
+ * entries without density are dropped.
+ */
+struct sf_float_grid
+{
+    std::vector<float> x, y, z, rc, rs;
+};
+
+/**
+ * @brief Setup of a kernel shared by several sets of k-points, e.g. the chunks of a streamed calculation.
+ *
+ * The NUFFT grid, Gaussian widths and twiddle factors only depend on the largest Miller indices and the single
+ * precision grids of the mixed kernel only on the atoms, so both are prepared once by the constructor. The sample
+ * check against the blocked kernel is done for the first set of k-points, the timings of all sets are summed.
+ */
+class sf_kernel_plan
+{
+public:
+    /**
+     * @param kernel One of sf_kernel_type.
+     * @param rcm Reciprocal cell matrix used to build the k-points, needed by the NUFFT and recurrence kernels.
+     * @param precision Requested relative accuracy of the NUFFT kernel.
+     * @param grids Grid of every atom, has to outlive the plan.
+     * @param max_index Largest |h|, |k| and |l| of all k-points the plan will be run on.
+     */
+    sf_kernel_plan(const int kernel, const double rcm[3][3], const double precision, const std::vector<sf_grid_view> &grids,
+                   const long long int max_index[3]);
+
+    /**
+     * @brief Evaluates all atoms at the k-points.
+     * @param sf Output, sf[atom][reflection], resized as needed.
+     * @param progress Optional progress bar to update.
+     * @return False (and sf untouched) if the NUFFT or recurrence kernel gets k-points that are not on the lattice
+     * spanned by rcm or, for the NUFFT, beyond max_index.
+     * If the sampled NUFFT deviation is more than 100 times the requested precision (relative to max |F|), the
+     * k-points of this and all later calls are evaluated by the blocked kernel instead.
+     */
+    bool run(const std::vector<vec> &k_pt, std::vector<cvec> &sf, progress_bar *progress = NULL);
+
+    /**
+     * @brief Writes the accuracy and timing report of the NUFFT and mixed precision kernels, nothing for the others.
+     */
+    void report(std::ostream &file, const bool no_date) const;
+
+    /**
+     * @brief Estimates the memory a plan needs besides the grids, k-points and scattering factors.
+     * @param fixed Output, bytes of the setup and scratch that do not depend on the number of k-points in a run,
+     * i.e. the NUFFT grid, twiddles and per atom stencils or the single precision copy of the grids.
+     * @param per_reflection Output, additional bytes per k-point of a run, e.g. the recovered Miller indices.
+     */
+    static void memory(const int kernel, const double precision, const std::vector<sf_grid_view> &grids,
+                       const long long int max_index[3], double &fixed, double &per_reflection);
+
+private:
+    void run_nufft(const std::vector<ivec> &hkl, std::vector<cvec> &sf, progress_bar *progress) const;
+
+    int kernel;
+    double precision;
+    double rcm[3][3];
+    const std::vector<sf_grid_view> &grids;
+
+    // NUFFT
+    int w = 0;
+    long long int modes[3] = {0, 0, 0}, n[3] = {0, 0, 0};
+    double tau[3], cell_width[3], deconv_norm[3];
+    std::vector<cvec> twiddle;
+    bool fell_back = false;
+
+    // mixed precision
+    std::vector<sf_float_grid> float_grids;
+    std::vector<long long int> float_points;
+
+    // report
+    long long int reflections = 0, samples = 0;
+    double max_dev = 0.0, max_f = 0.0, max_rel = 0.0, kernel_ms = 0.0, check_ms = 0.0;
+};
@@ -2741,4 +2741,63 @@ void lebedev_sphere::ld5810(double *x, double *y, double *z, double *w)
 
     return;
 }
-/******************************************************************************/
\ No newline at end of file
+/******************************************************************************/
+/**
+ * @brief Owner of all rules returned by lebedev_rules.
+ */
+struct lebedev_rule_storage
+{
+    struct alignas(64) block
+    {
+        double v[8];
+    };
+    std::vector<block> values;
+    ivec partners;
+    lebedev_rule rules[constants::max_LT];
+
+    lebedev_rule_storage()
+    {
+        // every array of every rule gets a slot of whole blocks
+        size_t blocks = 0, points = 0;
+        for (int i = 0; i < constants::max_LT; i++)
+        {
+            blocks += 4 * ((constants::lebedev_table[i] + 7) / 8);
+            points += constants::lebedev_table[i];
+        }
+        values.resize(blocks);
+        partners.assign(points, -1);
+        lebedev_sphere ls;
+        size_t block_off = 0, point_off = 0;
+        for (int i = 0; i < constants::max_LT; i++)
+        {
+            const int n = constants::lebedev_table[i];
+            const size_t slot = (n + 7) / 8;
+            double *x = values[block_off].v, *y = values[block_off + slot].v, *z = values[block_off + 2 * slot].v, *w = values[block_off + 3 * slot].v;
+            int *partner = partners.data() + point_off;
+            if (n > 0)
+            {
+                ls.ld_by_order(n, x, y, z, w);
+                // the generators only flip signs, so the partner coordinates are exact negatives
+                std::map<std::array<double, 3>, int> position;
+                for (int p = 0; p < n; p++)
+                    position[{x[p], y[p], z[p]}] = p;
+                for (int p = 0; p < n; p++)
+                {
+                    auto found = position.find({-x[p], -y[p], -z[p]});
+                    if (found != position.end() && found->second != p)
+                        partner[p] = found->second;
+                }
+            }
+            rules[i] = lebedev_rule{n, x, y, z, w, partner};
+            block_off += 4 * slot;
+            point_off += n;
+        }
+    }
+};
+
+const lebedev_rule &lebedev_rules(const int index)
+{
+    err_checkf(index >= 0 && index < constants::max_LT, "Invalid Lebedev order index " + std::to_string(index), std::cout);
+    static const lebedev_rule_storage storage;
+    return storage.rules[index];
+}
@@ -1,5 +1,29 @@
 #pragma once
 
+/**
+ * @brief A Lebedev rule as structure of arrays.
+ *
+ * The rules of all orders of constants::lebedev_table are generated once per process by lebedev_rules() and live
+ * until it ends, so grids can keep these pointers instead of copying the points. Every array starts on a 64 byte
+ * boundary.
+ */
+struct lebedev_rule
+{
+    int points;         ///< Number of points, 0 for unused entries of constants::lebedev_table
+    const double *x;    ///< Unit vectors
+    const double *y;
+    const double *z;
+    const double *w;    ///< Weights, summing to one
+    const int *partner; ///< Index of the point at -r with the same weight, -1 if there is none
+};
+
+/**
+ * @brief The rule of order constants::lebedev_table[index].
+ *
+ * All rules are built on the first call, which is thread safe.
+ */
+const lebedev_rule &lebedev_rules(const int index);
+
 class lebedev_sphere
 {
 public:
@@ -3,6 +3,8 @@
 #include "Thakkar_coefs.h"
 #include "def2-ECPs.h"
 
+#include <tuple>
+
 Thakkar::Thakkar(const int g_atom_number, const int ECP_m) : Spherical_Atom(g_atom_number, ECP_m)
 {
 	nex = &(Thakkar_nex[0]);
@@ -802,4 +804,83 @@ const double Gaussian_Atom::get_radial_density(double &dist)
 		Rho += occ[_offset + m] * pow(Orb[m], 2);
 	}
 	return Rho / (constants::FOUR_PI); // 4pi is the angular function
-};
\ No newline at end of file
+};
+spherical_density_spline::spherical_density_spline(Spherical_Atom &atom, const int n, const double cutoff) : cutoff(cutoff), coef(4, 0.0)
+{
+	// end of the table, searched on the geometric mesh of the former per run tables
+	double dist = 1E-7;
+	double current = atom.get_radial_density(dist);
+	// elements without tabulated density give a negative value and stay zero everywhere
+	if (current < 0)
+		return;
+	while (current >= cutoff)
+	{
+		dist *= 1.005;
+		current = atom.get_radial_density(dist);
+	}
+	radius = dist;
+	intervals = n;
+	const double h = std::sqrt(radius) / n;
+	inv_h = 1.0 / h;
+	vec f(n + 1);
+	for (int i = 0; i <= n; i++)
+	{
+		double r = (i * h) * (i * h);
+		f[i] = atom.get_radial_density(r);
+	}
+	// second derivatives in u of the spline, slope 0 at the nucleus and natural at the end, by the Thomas algorithm
+	vec m(n + 1, 0.0), sup(n + 1, 0.0), rhs(n + 1, 0.0);
+	const double s = 6.0 / (h * h);
+	sup[0] = 0.5;
+	rhs[0] = 0.5 * s * (f[1] - f[0]);
+	for (int i = 1; i < n; i++)
+	{
+		const double denom = 4.0 - sup[i - 1];
+		sup[i] = 1.0 / denom;
+		rhs[i] = (s * (f[i + 1] - 2.0 * f[i] + f[i - 1]) - rhs[i - 1]) / denom;
+	}
+	m[n] = 0.0;
+	for (int i = n - 1; i >= 0; i--)
+		m[i] = rhs[i] - sup[i] * m[i + 1];
+	coef.assign(4 * (n + 1), 0.0);
+	const double h2 = h * h;
+	for (int i = 0; i < n; i++)
+	{
+		coef[4 * i] = f[i];
+		coef[4 * i + 1] = (f[i + 1] - f[i]) - h2 * (2.0 * m[i] + m[i + 1]) / 6.0;
+		coef[4 * i + 2] = h2 * m[i] / 2.0;
+		coef[4 * i + 3] = h2 * (m[i + 1] - m[i]) / 6.0;
+	}
+}
+
+const spherical_density_spline &get_spherical_density_spline(const int atomic_number, const int charge, const double cutoff)
+{
+	err_checkf(charge >= -1 && charge <= 1, "Spherical densities are only tabulated for charges -1, 0 and +1", std::cout);
+	static std::map<std::tuple<int, int, double>, spherical_density_spline> splines;
+	const spherical_density_spline *result = NULL;
+#pragma omp critical(spherical_density_splines)
+	{
+		const std::tuple<int, int, double> key(atomic_number, charge, cutoff);
+		std::map<std::tuple<int, int, double>, spherical_density_spline>::iterator found = splines.find(key);
+		if (found == splines.end())
+		{
+			if (charge == 0)
+			{
+				Thakkar atom(atomic_number);
+				found = splines.emplace(key, spherical_density_spline(atom, spherical_density_intervals, cutoff)).first;
+			}
+			else if (charge > 0)
+			{
+				Thakkar_Cation atom(atomic_number);
+				found = splines.emplace(key, spherical_density_spline(atom, spherical_density_intervals, cutoff)).first;
+			}
+			else
+			{
+				Thakkar_Anion atom(atomic_number);
+				found = splines.emplace(key, spherical_density_spline(atom, spherical_density_intervals, cutoff)).first;
+			}
+		}
+		result = &found->second;
+	}
+	return *result;
+}
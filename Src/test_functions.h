@@ -4,6 +4,8 @@
 #include "convenience.h"
 #include "npy.h"
 #include "properties.h"
+#include "AtomGrid.h"
+#include "wfn_snapshot.h"
 
 void thakkar_d_test(options &opt)
 {
@@ -339,40 +341,13 @@ void sfac_scan(options &opt, std::ostream &log_file)
     const int imax = (int)dens.size();
     const int smax = (int)k_pt[0].size();
     int pmax = (int)dens[0].size();
-    const int step = max((int)floor(smax / 20), 1);
     std::cout << "Done with making k_pt " << smax << " " << imax << " " << pmax << endl;
     sf.resize(imax);
 #pragma omp parallel for
     for (int i = 0; i < imax; i++)
         sf[i].resize(k_pt[0].size());
-    double *dens_local, *d1_local, *d2_local, *d3_local;
-    complex<double> *sf_local;
-    const double *k1_local = k_pt[0].data();
-    const double *k2_local = k_pt[1].data();
-    const double *k3_local = k_pt[2].data();
-    double work, rho;
     progress_bar *progress = new progress_bar{std::cout, 60u, "Calculating scattering factors"};
-    for (int i = 0; i < imax; i++)
-    {
-        pmax = (int)dens[i].size();
-        dens_local = dens[i].data();
-        d1_local = d1[i].data();
-        d2_local = d2[i].data();
-        d3_local = d3[i].data();
-        sf_local = sf[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-                sf_local[s] += complex<double>(rho * cos(work), rho * sin(work));
-            }
-            if (s != 0 && s % step == 0)
-                progress->write(s / static_cast<double>(smax));
-        }
-    }
+    calc_sf_scheduled(opt.sf_kernel, make_sf_grid_views(d1, d2, d3, dens), k_pt, sf, progress);
     delete (progress);
     if (true)
     { // Change if oyu do not want X-ray
@@ -980,222 +955,24 @@ void sfac_scan_ECP(options &opt, std::ostream &log_file)
         sf_x2c[i].resize(k_pt[0].size());
         sf_x2c_val[i].resize(k_pt[0].size());
     }
-    double *dens_local, *d1_local, *d2_local, *d3_local;
-    complex<double> *sf_local;
-    const double *k1_local = k_pt[0].data();
-    const double *k2_local = k_pt[1].data();
-    const double *k3_local = k_pt[2].data();
-    double work, rho;
     progress_bar *progress = new progress_bar{std::cout, 60u, "Calculating scattering factors"};
     for (int i = 0; i < 1; i++)
     {
-        pmax = (int)dens[i].size();
-        dens_local = dens[i].data();
-        d1_local = d1[i].data();
-        d2_local = d2[i].data();
-        d3_local = d3[i].data();
-        sf_local = sf[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1[i], d2[i], d3[i], dens[i], k_pt, sf[i]);
         log_file << "Done with HAR SFs" << endl;
-        pmax = (int)dens_def2[i].size();
-        dens_local = dens_def2[i].data();
-        d1_local = d1_def2[i].data();
-        d2_local = d2_def2[i].data();
-        d3_local = d3_def2[i].data();
-        sf_local = sf_def2[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_def2[i], d2_def2[i], d3_def2[i], dens_def2[i], k_pt, sf_def2[i]);
         log_file << "Done with def2 SFs" << endl;
-        pmax = (int)dens_all[i].size();
-        dens_local = dens_all[i].data();
-        d1_local = d1_all[i].data();
-        d2_local = d2_all[i].data();
-        d3_local = d3_all[i].data();
-        sf_local = sf_all[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_all[i], d2_all[i], d3_all[i], dens_all[i], k_pt, sf_all[i]);
         log_file << "Done with Jorge SFs" << endl;
-        pmax = (int)dens_all_val[i].size();
-        dens_local = dens_all_val[i].data();
-        d1_local = d1_all_val[i].data();
-        d2_local = d2_all_val[i].data();
-        d3_local = d3_all_val[i].data();
-        sf_local = sf_all_val[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_all_val[i], d2_all_val[i], d3_all_val[i], dens_all_val[i], k_pt, sf_all_val[i]);
         log_file << "Done with Jorge Valence SFs" << endl;
-        pmax = (int)dens_ZORA[i].size();
-        dens_local = dens_ZORA[i].data();
-        d1_local = d1_ZORA[i].data();
-        d2_local = d2_ZORA[i].data();
-        d3_local = d3_ZORA[i].data();
-        sf_local = sf_ZORA[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_ZORA[i], d2_ZORA[i], d3_ZORA[i], dens_ZORA[i], k_pt, sf_ZORA[i]);
         log_file << "Done with ZORA-Jorge SFs" << endl;
-        pmax = (int)dens_ZORA_val[i].size();
-        dens_local = dens_ZORA_val[i].data();
-        d1_local = d1_ZORA_val[i].data();
-        d2_local = d2_ZORA_val[i].data();
-        d3_local = d3_ZORA_val[i].data();
-        sf_local = sf_ZORA_val[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_ZORA_val[i], d2_ZORA_val[i], d3_ZORA_val[i], dens_ZORA_val[i], k_pt, sf_ZORA_val[i]);
         log_file << "Done with ZORA-Jorge Valence SFs" << endl;
-        pmax = (int)dens_x2c[i].size();
-        dens_local = dens_x2c[i].data();
-        d1_local = d1_x2c[i].data();
-        d2_local = d2_x2c[i].data();
-        d3_local = d3_x2c[i].data();
-        sf_local = sf_x2c[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_x2c[i], d2_x2c[i], d3_x2c[i], dens_x2c[i], k_pt, sf_x2c[i]);
         log_file << "Done with X2C SFs" << endl;
-        pmax = (int)dens_x2c_val[i].size();
-        dens_local = dens_x2c_val[i].data();
-        d1_local = d1_x2c_val[i].data();
-        d2_local = d2_x2c_val[i].data();
-        d3_local = d3_x2c_val[i].data();
-        sf_local = sf_x2c_val[i].data();
-#pragma omp parallel for private(work, rho)
-        for (int s = 0; s < smax; s++)
-        {
-            for (int p = pmax - 1; p >= 0; p--)
-            {
-                rho = dens_local[p];
-                work = k1_local[s] * d1_local[p] + k2_local[s] * d2_local[p] + k3_local[s] * d3_local[p];
-#ifdef __APPLE__
-#if TARGET_OS_MAC
-                if (rho < 0)
-                {
-                    rho = -rho;
-                    work += M_PI;
-                }
-#endif
-#endif
-                sf_local[s] += polar(rho, work);
-            }
-        }
+        calc_atomic_sf(opt.sf_kernel, d1_x2c_val[i], d2_x2c_val[i], d3_x2c_val[i], dens_x2c_val[i], k_pt, sf_x2c_val[i]);
         log_file << "Done with X2C Valence SFs" << endl;
     }
     delete (progress);
@@ -1718,6 +1495,7 @@ void test_esp_dens()
     out << "Done with radial densities" << endl;
     */
 
+    const wfn_snapshot ECP_snapshot(ECP_way), ECP_core_snapshot(ECP_way_core);
     progress_bar *progress = new progress_bar{out, 50u, "Calculating Values", '-', 0.01};
 #pragma omp parallel for schedule(dynamic)
     for (int i = 0; i < res[0].size(); i++)
@@ -1728,11 +1506,11 @@ void test_esp_dens()
         res[1][i] = T_Li.get_core_density(sr, 2);
         res[2][i] = T_Li.get_radial_density(sr);
         res[3][i] = ECP_way.compute_dens(sr, 0, 0, false);
-        res[4][i] = ECP_way.computeESP_noCore(pos, d2);
+        res[4][i] = ECP_snapshot.compute_ESP(pos, d2, false);
         // res[5][i] = calc_pot_by_integral(dens_grid, sr, cube_dist, dr);
         // res[6][i] = calc_pot_by_integral(dens_grid, sr, cube_dist, dr);
         res[7][i] = ECP_way_core.compute_dens(sr, 0, 0, false);
-        res[8][i] = ECP_way_core.computeESP_noCore(pos, d2);
+        res[8][i] = ECP_core_snapshot.compute_ESP(pos, d2, false);
         if (i != 0 && i % static_cast<int>(points / 100) == 0)
             progress->write(i / static_cast<double>(res[0].size()));
     }
@@ -1750,3 +1528,77 @@ void test_esp_dens()
     dat_out << flush;
     dat_out.close();
 }
+
+/**
+ * @brief Compares the radial schemes of AtomGrid on the wavefunction opt.wfn: for every scheme and radial precision
+ * the shells and points of all atomic grids and the deviation of the Becke integrated density from the number of
+ * electrons. The angular grids are the same for all runs (230 to 590 points, linear pruning), so the differences come
+ * from the radial quadratures.
+ */
+void radial_grid_benchmark(options &opt, std::ostream &log_file)
+{
+    using namespace std;
+    WFN wave(0);
+    log_file << "Reading: " << setw(44) << opt.wfn << flush;
+    wave.read_known_wavefunction_format(opt.wfn, log_file, opt.debug);
+    log_file << " done!" << endl;
+    const int ncen = wave.get_ncen();
+    err_checkf(ncen != 0, "No Atoms in the wavefunction", log_file);
+
+    // basis parameters of every atom as for the Hirshfeld grids, l from the primitive type
+    vec alpha_max(ncen, 0.0), x(ncen), y(ncen), z(ncen);
+    ivec max_l(ncen, 0), charges(ncen);
+    vector<vec> alpha_min(ncen, vec(6, 100000000.0));
+    for (int i = 0; i < ncen; i++)
+    {
+        x[i] = wave.atoms[i].x;
+        y[i] = wave.atoms[i].y;
+        z[i] = wave.atoms[i].z;
+        charges[i] = wave.get_atom_charge(i);
+    }
+    for (int b = 0; b < wave.get_nex(); b++)
+    {
+        const int i = wave.get_center(b) - 1, type = wave.get_type(b);
+        const int l = type == 1 ? 0 : (type <= 4 ? 1 : (type <= 10 ? 2 : (type <= 20 ? 3 : (type <= 35 ? 4 : 5))));
+        alpha_max[i] = max(alpha_max[i], wave.get_exponent(b));
+        max_l[i] = max(max_l[i], l);
+        alpha_min[i][l] = min(alpha_min[i][l], wave.get_exponent(b));
+    }
+    double electrons = 0.0;
+    for (int m = 0; m < wave.get_nmo(); m++)
+        electrons += wave.get_MO_occ(m);
+    wave.delete_unoccupied_MOs();
+    const int nr_mos = wave.get_nmo(true);
+
+    log_file << "\nRadial quadratures, Becke partition, " << constants::lebedev_table[11] << "-" << constants::lebedev_table[16]
+             << " angular points, " << electrons << " electrons\n"
+             << "           scheme  precision  shells   points  electron error  time [ms]" << endl;
+    for (const int scheme : {RADIAL_LOG, RADIAL_TREUTLER, RADIAL_MURA, RADIAL_AUTO})
+        for (const double precision : {1E-4, 1E-6, 1E-8, 1E-10})
+        {
+            time_point start = get_time();
+            int shells = 0;
+            long long int points = 0;
+            double sum = 0.0;
+            for (int i = 0; i < ncen; i++)
+            {
+                AtomGrid grid(precision, constants::lebedev_table[11], constants::lebedev_table[16], charges[i], alpha_max[i], max_l[i], alpha_min[i].data(), log_file, PRUNING_LINEAR, scheme);
+                const int n = grid.get_num_grid_points();
+                vec gx(n), gy(n), gz(n), aw(n), mw(n);
+                grid.get_grid(ncen, i, x.data(), y.data(), z.data(), charges.data(), gx.data(), gy.data(), gz.data(), aw.data(), mw.data());
+                shells += grid.get_num_radial_grid_points();
+                points += n;
+#pragma omp parallel reduction(+ : sum)
+                {
+                    vector<vec> d(16, vec(ncen));
+                    vec phi(nr_mos);
+#pragma omp for
+                    for (int p = 0; p < n; p++)
+                        sum += mw[p] * wave.compute_dens(gx[p], gy[p], gz[p], d, phi, false);
+                }
+            }
+            log_file << setw(17) << radial_scheme_name(scheme) << setw(11) << scientific << setprecision(0) << precision
+                     << setw(8) << shells << setw(9) << points << setw(16) << setprecision(3) << sum - electrons
+                     << setw(11) << get_msec(start, get_time()) << defaultfloat << endl;
+        }
+}
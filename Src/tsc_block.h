@@ -432,6 +432,80 @@ public:
   }
 };
 
+/**
+ * @brief Writes a tscb file reflection chunk by reflection chunk, so the scattering factors never need to be held
+ * for all reflections at once.
+ *
+ * The file is byte identical to tsc_block::write_tscb_file for the same header, labels, indices and factors.
+ */
+class tscb_stream_writer
+{
+private:
+  std::ofstream tsc_file;
+  int nr_scatterers;
+  int nr_hkl;
+  int written;
+
+public:
+  tscb_stream_writer(const std::string &name, const std::string &header, const std::vector<std::string> &scatterer, const int given_nr_hkl)
+      : tsc_file(name.c_str(), std::ios::out | std::ios::binary | std::ios::trunc),
+        nr_scatterers(static_cast<int>(scatterer.size())), nr_hkl(given_nr_hkl), written(0)
+  {
+    int head[1] = {static_cast<int>(header.size())};
+    tsc_file.write((char *)&head, sizeof(head));
+    tsc_file.write(header.c_str(), head[0] * sizeof(char));
+    std::string sc;
+    for (int i = 0; i < nr_scatterers; i++)
+    {
+      sc.append(scatterer[i]);
+      if (i != nr_scatterers - 1)
+        sc.append(" ");
+    }
+    head[0] = (int)sc.size();
+    tsc_file.write((char *)&head, sizeof(head));
+    tsc_file.write(sc.c_str(), head[0] * sizeof(char));
+    tsc_file.write((char *)&nr_hkl, sizeof(nr_hkl));
+  }
+
+  /**
+   * @brief Appends the reflections of a chunk.
+   * @param hkl Miller indices of the chunk, in the order of the file.
+   * @param sf Scattering factors of the chunk, sf[scatterer][reflection of the chunk].
+   */
+  void write_chunk(const hkl_list &hkl, const std::vector<std::vector<std::complex<double>>> &sf)
+  {
+    const int size = static_cast<int>(hkl.size());
+    err_checkf(sf.size() == (size_t)nr_scatterers, "Wrong number of scatterers in tscb chunk!", std::cout);
+    err_checkf(written + size <= nr_hkl, "Too many reflections for tscb file!", std::cout);
+    std::vector<char> buffer(static_cast<size_t>(size) * (3 * sizeof(int) + nr_scatterers * sizeof(std::complex<double>)));
+    char *pos = buffer.data();
+    for (int run = 0; run < size; run++)
+    {
+      std::memcpy(pos, hkl.data() + 3 * run, 3 * sizeof(int));
+      pos += 3 * sizeof(int);
+      for (int i = 0; i < nr_scatterers; i++)
+      {
+        err_checkf(is_nan(sf[i][run]) == false, "NaN in SF!", std::cout);
+        std::memcpy(pos, &sf[i][run], sizeof(std::complex<double>));
+        pos += sizeof(std::complex<double>);
+      }
+    }
+    tsc_file.write(buffer.data(), buffer.size());
+    written += size;
+  }
+
+  /**
+   * @brief Flushes and closes the file, checking that all announced reflections were written.
+   */
+  void close()
+  {
+    err_checkf(written == nr_hkl, "Not all reflections were written to the tscb file!", std::cout);
+    tsc_file.flush();
+    tsc_file.close();
+    err_checkf(!tsc_file.bad(), "Error during writing of tsc file!", std::cout);
+  }
+};
+
 inline bool merge_tscs(
     const std::string &mode,
     const std::vector<std::string> &files,
@@ -1,4 +1,6 @@
 #include "./wfn_class.cpp"
+#include "./wfn_snapshot.cpp"
+#include "./density_batch.cpp"
 #include "./atoms.cpp"
 #include "./properties.cpp"
 #include "./spherical_density.cpp"
@@ -6,6 +8,9 @@
 #include "./basis_set.cpp"
 #include "./convenience.cpp"
 #include "./sphere_lebedev_rule.cpp"
+#include "./sf_kernels.cpp"
+#include "./grid_checkpoint.cpp"
+#include "./grid_arena.cpp"
 #include "./scattering_factors.cpp"
 #include "./cube.cpp"
 #include "./fchk.cpp"
@@ -29,27 +29,6 @@ const int ECP_electrons_pTB[] = {0, 0, 0,
 bool debug_wfn = false;
 bool debug_wfn_deep = false;
 
-void WFN::fill_pre()
-{
-    for (int j = 0; j < 9; j++)
-        for (int l = 0; l < 5; l++)
-            for (int m = 0; m < 5; m++)
-            {
-                int imax = min(j, l);
-                int imin = max(0, j - m);
-                for (int i = imin; i <= imax; i++)
-                    pre[j][l][m][i] = constants::ft[j] * constants::ft[l] / constants::ft[l - i] / constants::ft[i] * constants::ft[m] / constants::ft[m - j + i] / constants::ft[j - i];
-            }
-}
-
-void WFN::fill_Afac_pre()
-{
-    for (int l = 0; l < 9; l++)
-        for (int r = 0; r <= l / 2; r++)
-            for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                Afac_pre[l][r][s] = constants::ft[r] * constants::ft[s] * constants::ft[l - 2 * r - 2 * s];
-}
-
 WFN::WFN()
 {
     ncen = 0;
@@ -67,8 +46,6 @@ WFN::WFN()
     basis_set_name = " ";
     has_ECPs = false;
     comment = "Test";
-    fill_pre();
-    fill_Afac_pre();
 };
 
 WFN::WFN(int given_origin)
@@ -87,8 +64,6 @@ WFN::WFN(int given_origin)
     has_ECPs = false;
     basis_set_name = " ";
     comment = "Test";
-    fill_pre();
-    fill_Afac_pre();
 };
 
 bool WFN::push_back_atom(const string &label, const double &x, const double &y, const double &z, const int &_charge)
@@ -4741,7 +4716,7 @@ const double WFN::compute_dens(
     const double &Pos3,
     vector<vec> &d,
     vec &phi,
-    const bool &add_ECP_dens)
+    const bool &add_ECP_dens) const
 {
     if (d_f_switch)
     {
@@ -4783,60 +4758,13 @@ const double WFN::compute_dens(
     }
 };
 
-const double WFN::compute_spin_dens(
-    const double &Pos1,
-    const double &Pos2,
-    const double &Pos3,
-    vector<vec> &d,
-    vec &phi)
-{
-    if (d_f_switch)
-    {
-        err_checkf(d.size() >= 5, "d is too small!", std::cout);
-        err_checkf(phi.size() >= get_nmo(true), "phi is too small!", std::cout);
-        err_not_impl_f("Nah.. not yet implemented correctly", std::cout);
-        return compute_dens_spherical(Pos1, Pos2, Pos3, d, phi, true);
-    }
-    else
-    {
-        err_checkf(d.size() >= 4, "d is too small!", std::cout);
-        err_checkf(phi.size() >= get_nmo(true), "phi is too small!", std::cout);
-        return compute_spin_dens_cartesian(Pos1, Pos2, Pos3, d, phi);
-    }
-};
-
-const double WFN::compute_spin_dens(
-    const double &Pos1,
-    const double &Pos2,
-    const double &Pos3)
-{
-    vector<vec> d;
-    vec phi(nmo, 0.0);
-    // const int n = get_nmo(true);
-    if (d_f_switch)
-    {
-        d.resize(5);
-        for (int i = 0; i < 5; i++)
-            d[i].resize(ncen, 0.0);
-        err_not_impl_f("Nah.. not yet implemented correctly", std::cout);
-        return compute_dens_spherical(Pos1, Pos2, Pos3, d, phi, true);
-    }
-    else
-    {
-        d.resize(16);
-        for (int i = 0; i < 16; i++)
-            d[i].resize(ncen, 0.0);
-        return compute_spin_dens_cartesian(Pos1, Pos2, Pos3, d, phi);
-    }
-};
-
 const double WFN::compute_dens_cartesian(
     const double &Pos1,
     const double &Pos2,
     const double &Pos3,
     vector<vec> &d,
     vec &phi,
-    const bool &add_ECP_dens)
+    const bool &add_ECP_dens) const
 {
     std::fill(phi.begin(), phi.end(), 0.0);
     double Rho = 0.0;
@@ -4896,7 +4824,7 @@ const double WFN::compute_dens_cartesian(
                 ex *= d[k + 13][iat];
         }
         double *run = phi.data();
-        MO *run2 = MOs.data();
+        const MO *run2 = MOs.data();
         for (mo = 0; mo < nmo; mo++)
         {
             *run += (*run2).get_coefficient_f(j) * ex; // build MO values at this point
@@ -4905,7 +4833,7 @@ const double WFN::compute_dens_cartesian(
     }
 
     double *run = phi.data();
-    MO *run2 = MOs.data();
+    const MO *run2 = MOs.data();
     for (mo = 0; mo < nmo; mo++)
     {
         Rho += (*run2).get_occ() * pow(*run, 2);
@@ -4915,88 +4843,6 @@ const double WFN::compute_dens_cartesian(
     return Rho;
 }
 
-const double WFN::compute_spin_dens_cartesian(
-    const double &Pos1,
-    const double &Pos2,
-    const double &Pos3,
-    vector<vec> &d,
-    vec &phi)
-{
-    std::fill(phi.begin(), phi.end(), 0.0);
-    double alpha = 0.0, beta = 0.0;
-    int iat, j, k;
-    int l[3];
-    double ex;
-    int mo;
-
-    for (iat = 0; iat < ncen; iat++)
-    {
-        d[0][iat] = Pos1 - atoms[iat].x;
-        d[1][iat] = Pos2 - atoms[iat].y;
-        d[2][iat] = Pos3 - atoms[iat].z;
-        d[3][iat] = d[0][iat] * d[0][iat] + d[1][iat] * d[1][iat] + d[2][iat] * d[2][iat];
-        d[4][iat] = d[0][iat] * d[0][iat];
-        d[5][iat] = d[1][iat] * d[1][iat];
-        d[6][iat] = d[2][iat] * d[2][iat];
-        d[7][iat] = d[0][iat] * d[4][iat];
-        d[8][iat] = d[1][iat] * d[5][iat];
-        d[9][iat] = d[2][iat] * d[6][iat];
-        d[10][iat] = d[0][iat] * d[7][iat];
-        d[11][iat] = d[1][iat] * d[8][iat];
-        d[12][iat] = d[2][iat] * d[9][iat];
-        d[13][iat] = d[0][iat] * d[10][iat];
-        d[14][iat] = d[1][iat] * d[11][iat];
-        d[15][iat] = d[2][iat] * d[12][iat];
-    }
-
-    for (j = 0; j < nex; j++)
-    {
-        iat = centers[j] - 1;
-        type2vector(types[j], l);
-        ex = -exponents[j] * d[3][iat];
-        if (ex < -46.0517)
-        { // corresponds to cutoff of ex ~< 1E-20
-            continue;
-        }
-        ex = exp(ex);
-        for (k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-                continue;
-            else if (l[k] == 1)
-                ex *= d[k][iat];
-            else if (l[k] == 2)
-                ex *= d[k + 4][iat];
-            else if (l[k] == 3)
-                ex *= d[k + 7][iat];
-            else if (l[k] == 4)
-                ex *= d[k + 10][iat];
-            else if (l[k] == 5)
-                ex *= d[k + 13][iat];
-        }
-        double *run = phi.data();
-        MO *run2 = MOs.data();
-        for (mo = 0; mo < nmo; mo++)
-        {
-            *run += (*run2).get_coefficient_f(j) * ex; // build MO values at this point
-            run2++, run++;
-        }
-    }
-
-    double *run = phi.data();
-    MO *run2 = MOs.data();
-    for (mo = 0; mo < nmo; mo++)
-    {
-        if ((*run2).get_op())
-            beta += (*run2).get_occ() * pow(*run, 2);
-        else
-            alpha += (*run2).get_occ() * pow(*run, 2);
-        run++, run2++;
-    }
-
-    return alpha - beta;
-}
-
 const double WFN::compute_MO_spherical(
     const double &Pos1,
     const double &Pos2,
@@ -5156,7 +5002,7 @@ const double WFN::compute_dens_spherical(
     const double &Pos3,
     vector<vec> &d,
     vec &phi,
-    const bool &add_ECP_dens)
+    const bool &add_ECP_dens) const
 {
     err_not_impl_f("This one is not tested an will most likely not work, therefore aborting!", cout);
     return 0.0;
@@ -5327,814 +5173,6 @@ void WFN::pop_back_MO()
     nmo--;
 }
 
-const void WFN::computeValues(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Rho,           // Value of Electron Density
-    double &normGrad,      // Gradiant Vector
-    double *Hess,          // Hessian Matrix, later used to determine lambda2
-    double &Elf,           // Value of the ELF
-    double &Eli,           // Value of the ELI
-    double &Lap,           // Value for the Laplacian
-    const bool &add_ECP_dens)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(10 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[10]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double d[4]{0, 0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-    double Grad[3]{0, 0, 0};
-    double tau = 0;
-
-    Rho = 0;
-    Elf = 0;
-    Hess[0] = 0;
-    Hess[1] = 0;
-    Hess[2] = 0;
-    Hess[8] = 0;
-    Hess[4] = 0;
-    Hess[5] = 0;
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        d[3] = d[0] * d[0] + d[1] * d[1] + d[2] * d[2];
-        if (add_ECP_dens && has_ECPs && atoms[iat].ECP_electrons != 0)
-        {
-            Rho += 8 * atoms[iat].ECP_electrons * exp(-constants::FOUR_PI * d[3]);
-        }
-        double temp = -get_exponent(j) * (d[3]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        double temp_ex = pow(ex2, 2);
-        chi[4] = (xl[0][2] - ex2 * (2 * l[0] + 1) * xl[0][0] + temp_ex * pow(d[0], l[0] + 2)) * xl[1][0] * xl[2][0] * ex;
-        chi[5] = (xl[1][2] - ex2 * (2 * l[1] + 1) * xl[1][0] + temp_ex * pow(d[1], l[1] + 2)) * xl[2][0] * xl[0][0] * ex;
-        chi[6] = (xl[2][2] - ex2 * (2 * l[2] + 1) * xl[2][0] + temp_ex * pow(d[2], l[2] + 2)) * xl[0][0] * xl[1][0] * ex;
-        chi[7] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[2][0] * ex;
-        chi[8] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[1][0] * ex;
-        chi[9] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 10];
-            for (int i = 0; i < 10; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 10];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            Hess[0] += docc * (*phi_temp * phi_temp[4] + pow(phi_temp[1], 2));
-            Hess[4] += docc * (*phi_temp * phi_temp[5] + pow(phi_temp[2], 2));
-            Hess[8] += docc * (*phi_temp * phi_temp[6] + pow(phi_temp[3], 2));
-            Hess[1] += docc * (*phi_temp * phi_temp[7] + phi_temp[1] * phi_temp[2]);
-            Hess[2] += docc * (*phi_temp * phi_temp[8] + phi_temp[1] * phi_temp[3]);
-            Hess[5] += docc * (*phi_temp * phi_temp[9] + phi_temp[2] * phi_temp[3]);
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-
-    Hess[3] = Hess[1];
-    Hess[6] = Hess[2];
-    Hess[7] = Hess[5];
-    if (Rho > 0)
-    {
-        normGrad = constants::alpha_coef * sqrt(Grad[0] * Grad[0] + Grad[1] * Grad[1] + Grad[2] * Grad[2]) / pow(Rho, constants::c_43);
-        Elf = 1 / (1 + pow(constants::ctelf * pow(Rho, constants::c_m53) * (tau * 0.5 - 0.125 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2)) / Rho), 2));
-        Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
-    }
-    Lap = Hess[0] + Hess[4] + Hess[8];
-};
-
-const void WFN::computeELIELF(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Elf,           // Value of the ELF
-    double &Eli            // Value of the ELI
-)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(4 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[4]{0, 0, 0, 0};
-    double d[3]{0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        double temp = -get_exponent(j) * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 4];
-            for (int i = 0; i < 4; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    double Grad[3]{0, 0, 0};
-    double tau = 0;
-    double Rho = 0;
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 4];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-    if (Rho > 0)
-    {
-        Elf = 1 / (1 + pow(constants::ctelf * pow(Rho, constants::c_m53) * (tau * 0.5 - 0.125 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2)) / Rho), 2));
-        Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
-    }
-};
-
-const void WFN::computeELI(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Eli            // Value of the ELI
-)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(4 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[4]{0, 0, 0, 0};
-    double d[3]{0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        double temp = -get_exponent(j) * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 4];
-            for (int i = 0; i < 4; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    double Grad[3]{0, 0, 0};
-    double tau = 0;
-    double Rho = 0;
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 4];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-    Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
-};
-
-const void WFN::computeELF(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Elf            // Value of the ELF
-)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(4 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[4]{0, 0, 0, 0};
-    double d[3]{0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        double temp = -get_exponent(j) * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 4];
-            for (int i = 0; i < 4; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    double Grad[3]{0, 0, 0};
-    double tau = 0;
-    double Rho = 0;
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 4];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-    Elf = 1 / (1 + pow(constants::ctelf * pow(Rho, constants::c_m53) * (tau * 0.5 - 0.125 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2)) / Rho), 2));
-};
-
-const void WFN::computeLapELIELF(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Elf,           // Value of the ELF
-    double &Eli,           // Value of the ELI
-    double &Lap            // Value for the Laplacian
-)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(7 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[7]{0, 0, 0, 0, 0, 0, 0};
-    double d[3]{0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        double temp = -get_exponent(j) * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        double temp_ex = pow(ex2, 2);
-        chi[4] = (xl[0][2] - ex2 * (2 * l[0] + 1) * xl[0][0] + temp_ex * pow(d[0], l[0] + 2)) * xl[1][0] * xl[2][0] * ex;
-        chi[5] = (xl[1][2] - ex2 * (2 * l[1] + 1) * xl[1][0] + temp_ex * pow(d[1], l[1] + 2)) * xl[2][0] * xl[0][0] * ex;
-        chi[6] = (xl[2][2] - ex2 * (2 * l[2] + 1) * xl[2][0] + temp_ex * pow(d[2], l[2] + 2)) * xl[0][0] * xl[1][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 7];
-            for (int i = 0; i < 7; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    double Grad[3]{0, 0, 0};
-    double Hess[3]{0, 0, 0};
-    double tau = 0;
-    double Rho = 0;
-
-    Elf = 0;
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 7];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            Hess[0] += docc * (*phi_temp * phi_temp[4] + pow(phi_temp[1], 2));
-            Hess[1] += docc * (*phi_temp * phi_temp[5] + pow(phi_temp[2], 2));
-            Hess[2] += docc * (*phi_temp * phi_temp[6] + pow(phi_temp[3], 2));
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-    Elf = 1 / (1 + pow(constants::ctelf * pow(Rho, constants::c_m53) * (tau * 0.5 - 0.125 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2)) / Rho), 2));
-    Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
-    Lap = Hess[0] + Hess[1] + Hess[2];
-};
-
-const void WFN::computeLapELI(
-    const double *PosGrid, // [3] vector with current position on te grid
-    double &Eli,           // Value of the ELI
-    double &Lap            // Value for the Laplacian
-)
-{
-    const int _nmo = get_nmo(false);
-    vec phi(7 * _nmo, 0.0);
-    double *phi_temp;
-    double chi[7]{0, 0, 0, 0, 0, 0, 0};
-    double d[3]{0, 0, 0};
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-
-        type2vector(get_type(j), l);
-        d[0] = PosGrid[0] - atoms[iat].x;
-        d[1] = PosGrid[1] - atoms[iat].y;
-        d[2] = PosGrid[2] - atoms[iat].z;
-        double temp = -get_exponent(j) * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
-        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-            {
-                xl[k][0] = 1.0;
-                xl[k][1] = 0.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 1)
-            {
-                xl[k][0] = d[k];
-                xl[k][1] = 1.0;
-                xl[k][2] = 0.0;
-            }
-            else if (l[k] == 2)
-            {
-                xl[k][0] = d[k] * d[k];
-                xl[k][1] = 2 * d[k];
-                xl[k][2] = 2;
-            }
-            else if (l[k] == 3)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d[k];
-                xl[k][1] = 3 * d2;
-                xl[k][2] = 6 * d[k];
-            }
-            else if (l[k] == 4)
-            {
-                double d2 = d[k] * d[k];
-                xl[k][0] = d2 * d2;
-                xl[k][1] = 4 * d2 * d[k];
-                xl[k][2] = 12 * d2;
-            }
-            else
-            {
-                return;
-            }
-        }
-        double ex2 = 2 * get_exponent(j);
-        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
-        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
-        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
-        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
-        double temp_ex = pow(ex2, 2);
-        chi[4] = (xl[0][2] - ex2 * (2 * l[0] + 1) * xl[0][0] + temp_ex * pow(d[0], l[0] + 2)) * xl[1][0] * xl[2][0] * ex;
-        chi[5] = (xl[1][2] - ex2 * (2 * l[1] + 1) * xl[1][0] + temp_ex * pow(d[1], l[1] + 2)) * xl[2][0] * xl[0][0] * ex;
-        chi[6] = (xl[2][2] - ex2 * (2 * l[2] + 1) * xl[2][0] + temp_ex * pow(d[2], l[2] + 2)) * xl[0][0] * xl[1][0] * ex;
-        for (int mo = 0; mo < _nmo; mo++)
-        {
-            phi_temp = &phi[mo * 7];
-            for (int i = 0; i < 7; i++)
-                //				if( abs(chi[i]) * coefficients[nprim*maxc[j]+j] > pow(10.0,-10) )
-                phi_temp[i] += MOs[mo].get_coefficient_f(j) * chi[i]; // build MO values at this point
-        }
-    }
-
-    double Grad[3]{0, 0, 0};
-    double Hess[3]{0, 0, 0};
-    double tau = 0;
-    double Rho = 0;
-
-    for (int mo = 0; mo < _nmo; mo++)
-    {
-        const double occ = get_MO_occ(mo);
-        const double docc = 2 * occ;
-        if (occ != 0)
-        {
-            phi_temp = &phi[mo * 7];
-            Rho += occ * pow(*phi_temp, 2);
-            Grad[0] += docc * *phi_temp * phi_temp[1];
-            Grad[1] += docc * *phi_temp * phi_temp[2];
-            Grad[2] += docc * *phi_temp * phi_temp[3];
-            Hess[0] += docc * (*phi_temp * phi_temp[4] + pow(phi_temp[1], 2));
-            Hess[1] += docc * (*phi_temp * phi_temp[5] + pow(phi_temp[2], 2));
-            Hess[2] += docc * (*phi_temp * phi_temp[6] + pow(phi_temp[3], 2));
-            tau += occ * (pow(phi_temp[1], 2) + pow(phi_temp[2], 2) + pow(phi_temp[3], 2));
-        }
-    }
-    Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
-    Lap = Hess[0] + Hess[1] + Hess[2];
-};
-
-const double WFN::computeMO(
-    const double *PosGrid, // [3] array with current position on the grid
-    const int &mo)
-{
-    double result = 0.0;
-    int iat = 0;
-    int l[3]{0, 0, 0};
-    double ex = 0;
-    double temp = 0;
-
-    // x, y, z and dsqd
-    vector<vec> d(4);
-    for (int i = 0; i < 4; i++)
-        d[i].resize(ncen);
-
-    for (iat = 0; iat < ncen; iat++)
-    {
-        d[0][iat] = PosGrid[0] - atoms[iat].x;
-        d[1][iat] = PosGrid[1] - atoms[iat].y;
-        d[2][iat] = PosGrid[2] - atoms[iat].z;
-        d[3][iat] = d[0][iat] * d[0][iat] + d[1][iat] * d[1][iat] + d[2][iat] * d[2][iat];
-    }
-
-    for (int j = 0; j < nex; j++)
-    {
-        iat = get_center(j) - 1;
-        // if (iat != atom) continue;
-        type2vector(get_type(j), l);
-        temp = -get_exponent(j) * d[3][iat];
-        if (temp < -46.0517) // corresponds to cutoff of ex ~< 1E-20
-            continue;
-        ex = exp(temp);
-        for (int k = 0; k < 3; k++)
-        {
-            if (l[k] == 0)
-                continue;
-            else if (l[k] == 1)
-                ex *= d[k][iat];
-            else if (l[k] == 2)
-                ex *= d[k][iat] * d[k][iat];
-            else if (l[k] == 3)
-                ex *= pow(d[k][iat], 3);
-            else if (l[k] == 4)
-                ex *= pow(d[k][iat], 4);
-            else if (l[k] == 5)
-                ex *= pow(d[k][iat], 5);
-        }
-        result += MOs[mo].get_coefficient_f(j) * ex; // build MO values at this point
-    }
-    shrink_vector<vec>(d);
-    return result;
-}
-
-double Integrate(int &m, double i, double &expn)
-{
-    int x;
-    if (i <= 10)
-    {
-        if (expn == 0.0)
-            return 0.0;
-        double a = m + 0.5;
-        double term = 1 / a;
-        double partsum = term;
-        for (x = 2; x < 50; x++)
-        {
-            a++;
-            term *= (i / a);
-            partsum += term;
-            if (term / partsum < 1E-8)
-                return 0.5 * partsum * expn;
-        }
-    }
-    else
-    {
-        double a = m;
-        double b = a + 0.5;
-        a -= 0.5;
-        double id = 1 / i;
-        double approx = 0.88622692 * sqrt(id) * pow(id, m);
-        for (x = 0; x < m; x++)
-        {
-            b--;
-            approx *= b;
-        }
-        double mult = 0.5 * expn * id;
-        if (mult == 0)
-            return approx;
-        double prop = mult / approx;
-        double term = 1;
-        double partsum = 1;
-        for (x = 1; x < i + m; x++)
-        {
-            term *= a * id;
-            partsum += term;
-            if (abs(term * prop / partsum) < 1E-8)
-                return approx - mult * partsum;
-            a--;
-        }
-    }
-    return -1;
-};
-const double WFN::fj(int &j, int &l, int &m, double &aa, double &bb)
-{
-    double temp = 0.0;
-    double temp2 = 0.0;
-    int a = 0, b = 0;
-    for (int i = max(0, j - m); i <= min(j, l); i++)
-    {
-        // pre = factorial[l] / factorial[l - i] / factorial[i] * factorial[m] / factorial[m - j + i] / factorial[j - i];
-        temp2 = pre[j][l][m][i];
-        a = l - i;
-        b = m + i - j;
-        if (a != 0)
-            temp2 *= pow(aa, a);
-        if (b != 0)
-            temp2 *= pow(bb, b);
-        temp += temp2;
-    }
-    return temp;
-};
-
-const double WFN::Afac(int &l, int &r, int &i, double &PC, double &gamma, double &fjtmp)
-{
-    double temp = fjtmp * pow(0.25 / gamma, r + i) / Afac_pre[l][r][i];
-    int num = l - 2 * r - 2 * i;
-    if (num != 0)
-        temp *= pow(PC, num);
-    if (i % 2 == 1)
-        return -temp;
-    else
-        return temp;
-}
-
 bool WFN::read_ptb(const string &filename, ostream &file, const bool debug)
 {
     if (debug)
@@ -6478,326 +5516,6 @@ void WFN::write_wfn_CIF(const std::string &fileName)
     file.close();
 }
 
-const double WFN::computeESP(const double *PosGrid, const vector<vec> &d2)
-{
-    double ESP = 0;
-    double P[3]{0, 0, 0};
-    double Pi[3]{0, 0, 0};
-    double Pj[3]{0, 0, 0};
-    double PC[3]{0, 0, 0};
-    double Fn[11]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double Al[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double Am[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double An[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsl[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsm[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsn[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int l_i[3]{0, 0, 0};
-    int l_j[3]{0, 0, 0};
-    int iat = 0, jat = 0, MaxFn = 0;
-    double ex_sum = 0,
-           sqd = 0,
-           sqpc = 0,
-           prefac = 0,
-           expc = 0,
-           term = 0,
-           addesp = 0,
-           fjtmp = 0,
-           twoexpc = 0,
-           iex = 0,
-           jex = 0;
-
-    const int MO = get_nmo(true);
-    const int nprim = get_nex();
-
-    double temp;
-    int maxl, maxm, maxn;
-    vector<vec> pos(3);
-    for (int i = 0; i < 3; i++)
-        pos[i].resize(get_ncen());
-
-    for (iat = 0; iat < get_ncen(); iat++)
-    {
-        pos[0][iat] = atoms[iat].x;
-        pos[1][iat] = atoms[iat].y;
-        pos[2][iat] = atoms[iat].z;
-        ESP += get_atom_charge(iat) * pow(sqrt(pow(PosGrid[0] - pos[0][iat], 2) + pow(PosGrid[1] - pos[1][iat], 2) + pow(PosGrid[2] - pos[2][iat], 2)), -1);
-    }
-
-    for (int iprim = 0; iprim < nprim; iprim++)
-    {
-        iat = get_center(iprim) - 1;
-        type2vector(get_type(iprim), l_i);
-        iex = get_exponent(iprim);
-        for (int jprim = iprim; jprim < nprim; jprim++)
-        {
-            jat = get_center(jprim) - 1;
-            type2vector(get_type(jprim), l_j);
-            ex_sum = get_exponent(iprim) + get_exponent(jprim);
-            jex = get_exponent(jprim);
-
-            sqd = d2[iat][jat];
-
-            prefac = constants::TWO_PI / ex_sum * exp(-iex * jex * sqd / ex_sum);
-            if (prefac < 1E-10)
-                continue;
-
-            for (int i = 0; i < 3; i++)
-            {
-                P[i] = (pos[i][iat] * iex + pos[i][jat] * jex) / ex_sum;
-                Pi[i] = P[i] - pos[i][iat];
-                Pj[i] = P[i] - pos[i][jat];
-                PC[i] = P[i] - PosGrid[i];
-            }
-
-            sqpc = pow(PC[0], 2) + pow(PC[1], 2) + pow(PC[2], 2);
-
-            expc = exp(-ex_sum * sqpc);
-            MaxFn = 0;
-            for (int i = 0; i < 3; i++)
-                MaxFn += l_i[i] + l_j[i];
-            temp = Integrate(MaxFn, ex_sum * sqpc, expc);
-            Fn[MaxFn] = temp;
-            twoexpc = 2 * ex_sum * sqpc;
-            for (int nu = MaxFn - 1; nu >= 0; nu--)
-                Fn[nu] = (expc + twoexpc * Fn[nu + 1]) / (2 * (nu + 1) - 1);
-
-            maxl = -1;
-            for (int l = 0; l <= l_i[0] + l_j[0]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxl++;
-                        Al[maxl] = Afac(l, r, s, PC[0], ex_sum, fjtmp);
-                        maplrsl[maxl] = l - 2 * r - s;
-                    }
-            }
-            maxm = -1;
-            for (int l = 0; l <= l_i[1] + l_j[1]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxm++;
-                        Am[maxm] = Afac(l, r, s, PC[1], ex_sum, fjtmp);
-                        maplrsm[maxm] = l - 2 * r - s;
-                    }
-            }
-            maxn = -1;
-            for (int l = 0; l <= l_i[2] + l_j[2]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxn++;
-                        An[maxn] = Afac(l, r, s, PC[2], ex_sum, fjtmp);
-                        maplrsn[maxn] = l - 2 * r - s;
-                    }
-            }
-
-            term = 0.0;
-            for (int l = 0; l <= maxl; l++)
-            {
-                if (Al[l] == 0)
-                    continue;
-                for (int m = 0; m <= maxm; m++)
-                {
-                    if (Am[m] == 0)
-                        continue;
-                    for (int n = 0; n <= maxn; n++)
-                    {
-                        if (An[n] == 0)
-                            continue;
-                        term += Al[l] * Am[m] * An[n] * Fn[maplrsl[l] + maplrsm[m] + maplrsn[n]];
-                    }
-                }
-            }
-
-            if (term == 0)
-                continue;
-
-            if (iprim != jprim)
-                term *= 2.0;
-
-            term *= prefac;
-            addesp = 0.0;
-            for (int mo = 0; mo < MO; mo++)
-                addesp += get_MO_occ(mo) * get_MO_coef_f(mo, iprim) * get_MO_coef_f(mo, jprim);
-            ESP -= addesp * term;
-        }
-    }
-    return ESP;
-};
-
-const double WFN::computeESP_noCore(const double *PosGrid, const vector<vec> &d2)
-{
-    double ESP = 0;
-    double P[3]{0, 0, 0};
-    double Pi[3]{0, 0, 0};
-    double Pj[3]{0, 0, 0};
-    double PC[3]{0, 0, 0};
-    double Fn[11]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double Al[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double Am[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    double An[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsl[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsm[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int maplrsn[54]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
-    int l_i[3]{0, 0, 0};
-    int l_j[3]{0, 0, 0};
-    int iat = 0, jat = 0, MaxFn = 0;
-    double ex_sum = 0,
-           sqd = 0,
-           sqpc = 0,
-           prefac = 0,
-           expc = 0,
-           term = 0,
-           addesp = 0,
-           fjtmp = 0,
-           twoexpc = 0,
-           iex = 0,
-           jex = 0;
-
-    const int MO = get_nmo(true);
-    const int nprim = get_nex();
-
-    double temp;
-    int maxl, maxm, maxn;
-    vector<vec> pos(3);
-    for (int i = 0; i < 3; i++)
-        pos[i].resize(get_ncen());
-
-    for (int iprim = 0; iprim < nprim; iprim++)
-    {
-        iat = get_center(iprim) - 1;
-        type2vector(get_type(iprim), l_i);
-        iex = get_exponent(iprim);
-        for (int jprim = iprim; jprim < nprim; jprim++)
-        {
-            jat = get_center(jprim) - 1;
-            type2vector(get_type(jprim), l_j);
-            ex_sum = get_exponent(iprim) + get_exponent(jprim);
-            jex = get_exponent(jprim);
-
-            sqd = d2[iat][jat];
-
-            prefac = constants::TWO_PI / ex_sum * exp(-iex * jex * sqd / ex_sum);
-            if (prefac < 1E-10)
-                continue;
-
-            for (int i = 0; i < 3; i++)
-            {
-                P[i] = (pos[i][iat] * iex + pos[i][jat] * jex) / ex_sum;
-                Pi[i] = P[i] - pos[i][iat];
-                Pj[i] = P[i] - pos[i][jat];
-                PC[i] = P[i] - PosGrid[i];
-            }
-
-            sqpc = pow(PC[0], 2) + pow(PC[1], 2) + pow(PC[2], 2);
-
-            expc = exp(-ex_sum * sqpc);
-            MaxFn = 0;
-            for (int i = 0; i < 3; i++)
-                MaxFn += l_i[i] + l_j[i];
-            temp = Integrate(MaxFn, ex_sum * sqpc, expc);
-            Fn[MaxFn] = temp;
-            twoexpc = 2 * ex_sum * sqpc;
-            for (int nu = MaxFn - 1; nu >= 0; nu--)
-                Fn[nu] = (expc + twoexpc * Fn[nu + 1]) / (2 * (nu + 1) - 1);
-
-            maxl = -1;
-            for (int l = 0; l <= l_i[0] + l_j[0]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxl++;
-                        Al[maxl] = Afac(l, r, s, PC[0], ex_sum, fjtmp);
-                        maplrsl[maxl] = l - 2 * r - s;
-                    }
-            }
-            maxm = -1;
-            for (int l = 0; l <= l_i[1] + l_j[1]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxm++;
-                        Am[maxm] = Afac(l, r, s, PC[1], ex_sum, fjtmp);
-                        maplrsm[maxm] = l - 2 * r - s;
-                    }
-            }
-            maxn = -1;
-            for (int l = 0; l <= l_i[2] + l_j[2]; l++)
-            {
-                if (l % 2 != 1)
-                    fjtmp = fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // *factorial[l];
-                else
-                    fjtmp = -fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // * factorial[l];
-                for (int r = 0; r <= l / 2; r++)
-                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
-                    {
-                        maxn++;
-                        An[maxn] = Afac(l, r, s, PC[2], ex_sum, fjtmp);
-                        maplrsn[maxn] = l - 2 * r - s;
-                    }
-            }
-
-            term = 0.0;
-            for (int l = 0; l <= maxl; l++)
-            {
-                if (Al[l] == 0)
-                    continue;
-                for (int m = 0; m <= maxm; m++)
-                {
-                    if (Am[m] == 0)
-                        continue;
-                    for (int n = 0; n <= maxn; n++)
-                    {
-                        if (An[n] == 0)
-                            continue;
-                        term += Al[l] * Am[m] * An[n] * Fn[maplrsl[l] + maplrsm[m] + maplrsn[n]];
-                    }
-                }
-            }
-
-            if (term == 0)
-                continue;
-
-            if (iprim != jprim)
-                term *= 2.0;
-
-            term *= prefac;
-            addesp = 0.0;
-            for (int mo = 0; mo < MO; mo++)
-                addesp += get_MO_occ(mo) * get_MO_coef_f(mo, iprim) * get_MO_coef_f(mo, jprim);
-            ESP -= addesp * term;
-        }
-    }
-    return ESP;
-};
-
 bool WFN::delete_basis_set()
 {
     for (int a = 0; a < get_ncen(); a++)
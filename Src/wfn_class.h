@@ -57,16 +57,8 @@ private:
     bool d_f_switch; // true if spherical harmonics are used for the basis set
     bool distance_switch;
     bool has_ECPs;
-    // precomputed factors and helper functions for ESP calc
-    long long int pre[9][5][5][9];
-    void fill_pre();
-    long long int Afac_pre[9][5][9];
-    void fill_Afac_pre();
-    const double fj(int &j, int &l, int &m, double &aa, double &bb);
-    const double Afac(int &l, int &r, int &i, double &PC, double &gamma, double &fjtmp);
-    const double compute_dens_cartesian(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens);
-    const double compute_spin_dens_cartesian(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi);
-    const double compute_dens_spherical(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens);
+    const double compute_dens_cartesian(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens) const;
+    const double compute_dens_spherical(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens) const;
 
 public:
     WFN();
@@ -150,7 +142,7 @@ public:
     void set_modified() { modified = true; };
     const bool get_modified() { return modified; };
     void set_d_f_switch(const bool &in) { d_f_switch = in; };
-    const bool get_d_f_switch() { return d_f_switch; };
+    const bool get_d_f_switch() const { return d_f_switch; };
     int check_order(const bool &debug);
     bool sort_wfn(const int &g_order, const bool &debug);
     void set_dist_switch() { distance_switch = true; };
@@ -220,19 +212,8 @@ public:
     // double compute_dens(const double* PosGrid, const int atom = -1);
     // This second version will use phi[nmo] and d[4][ncen] as scratch instead of allocating new ones
     const double compute_dens(const double &Pos1, const double &Pos2, const double &Pos3, const bool &add_ECP_dens = true);
-    const double compute_dens(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens = true);
-    const double compute_spin_dens(const double &Pos1, const double &Pos2, const double &Pos3);
-    const double compute_spin_dens(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi);
-    const void computeValues(const double *PosGrid, double &Rho, double &normGrad, double *Hess, double &Elf, double &Eli, double &Lap, const bool &add_ECP_dens = true);
-    const void computeLapELIELF(const double *PosGrid, double &Elf, double &Eli, double &Lap);
-    const void computeELIELF(const double *PosGrid, double &Elf, double &Eli);
-    const void computeLapELI(const double *PosGrid, double &Eli, double &Lap);
-    const void computeELI(const double *PosGrid, double &Eli);
-    const void computeELF(const double *PosGrid, double &Elf);
-    const double computeMO(const double *PosGrid, const int &mo);
+    const double compute_dens(const double &Pos1, const double &Pos2, const double &Pos3, std::vector<std::vector<double>> &d, std::vector<double> &phi, const bool &add_ECP_dens = true) const;
     const double compute_MO_spherical(const double &Pos1, const double &Pos2, const double &Pos3, const int &MO);
-    const double computeESP(const double *PosGrid, const std::vector<std::vector<double>> &d2);
-    const double computeESP_noCore(const double *PosGrid, const std::vector<std::vector<double>> &d2);
     //----------DM Handling--------------------------------
     void push_back_DM(const double &value = 0.0);
     bool set_DM(const int &nr, const double &value = 0.0);
@@ -0,0 +1,521 @@
+/**
+ * @file wfn_snapshot.cpp
+ * @brief Packing of a WFN and the point kernels evaluating the packed MOs.
+ */
+
+#include "wfn_snapshot.h"
+#include "wfn_class.h"
+
+#include <algorithm>
+#include <cstdint>
+
+// number of doubles or ints rounded up to 64 bytes
+static size_t padded(const size_t n)
+{
+    return (n + 7) / 8 * 8;
+}
+
+static size_t padded_int(const size_t n)
+{
+    return (n + 15) / 16 * 16;
+}
+
+wfn_snapshot::wfn_snapshot(const WFN &wave, const bool only_occ)
+    : m_nex(wave.get_nex()), m_ncen(wave.get_ncen()), m_spherical(wave.get_d_f_switch()),
+      m_has_ECPs(wave.get_has_ECPs()), m_wave(&wave)
+{
+    for (int mo = 0; mo < wave.get_nmo(); mo++)
+        if (!only_occ || wave.get_MO_occ(mo) != 0.0)
+            m_mo_number.push_back(mo);
+    m_nmo = (int)m_mo_number.size();
+    m_nmo_pad = (int)padded(m_nmo);
+
+    // every array starts on a 64 byte boundary, the ints are stored behind the doubles
+    const size_t coef_size = (size_t)m_nex * m_nmo_pad;
+    const size_t doubles = coef_size + 2 * padded(m_nmo_pad) + padded(m_nex) + padded(3 * m_ncen) + 2 * padded(m_ncen);
+    const size_t ints = padded_int(m_nex) + padded_int(3 * m_nex);
+    m_block = std::calloc(doubles * sizeof(double) + ints * sizeof(int) + 64, 1);
+    err_checkf(m_block != NULL, "Could not allocate " + std::to_string(doubles * sizeof(double) / 1048576) + " MB for the wavefunction", std::cout);
+    double *run = reinterpret_cast<double *>((reinterpret_cast<std::uintptr_t>(m_block) + 63) / 64 * 64);
+    m_coef = run, run += coef_size;
+    m_occ = run, run += padded(m_nmo_pad);
+    m_spin = run, run += padded(m_nmo_pad);
+    m_exponent = run, run += padded(m_nex);
+    m_center = run, run += padded(3 * m_ncen);
+    m_charge = run, run += padded(m_ncen);
+    m_ecp = run, run += padded(m_ncen);
+    m_prim_center = reinterpret_cast<int *>(run);
+    m_prim_l = m_prim_center + padded_int(m_nex);
+
+    for (int m = 0; m < m_nmo; m++)
+    {
+        const int mo = m_mo_number[m];
+        m_occ[m] = wave.get_MO_occ(mo);
+        m_spin[m] = wave.get_MO_op(mo) ? -m_occ[m] : m_occ[m];
+    }
+#pragma omp parallel for schedule(static)
+    for (int j = 0; j < m_nex; j++)
+    {
+        double *row = m_coef + (size_t)j * m_nmo_pad;
+        for (int m = 0; m < m_nmo; m++)
+            row[m] = wave.get_MO_coef_f(m_mo_number[m], j);
+    }
+    for (int j = 0; j < m_nex; j++)
+    {
+        m_exponent[j] = wave.get_exponent(j);
+        m_prim_center[j] = wave.get_center(j) - 1;
+        type2vector(wave.get_type(j), m_prim_l + 3 * j);
+    }
+    for (int c = 0; c < m_ncen; c++)
+    {
+        m_center[3 * c] = wave.atoms[c].x;
+        m_center[3 * c + 1] = wave.atoms[c].y;
+        m_center[3 * c + 2] = wave.atoms[c].z;
+        m_charge[c] = wave.get_atom_charge(c);
+        if (m_has_ECPs)
+            m_ecp[c] = wave.atoms[c].ECP_electrons;
+    }
+
+    for (int j = 0; j < 9; j++)
+        for (int l = 0; l < 5; l++)
+            for (int m = 0; m < 5; m++)
+            {
+                int imax = std::min(j, l);
+                int imin = std::max(0, j - m);
+                for (int i = imin; i <= imax; i++)
+                    pre[j][l][m][i] = constants::ft[j] * constants::ft[l] / constants::ft[l - i] / constants::ft[i] * constants::ft[m] / constants::ft[m - j + i] / constants::ft[j - i];
+            }
+    for (int l = 0; l < 9; l++)
+        for (int r = 0; r <= l / 2; r++)
+            for (int s = 0; s <= (l - 2 * r) / 2; s++)
+                Afac_pre[l][r][s] = constants::ft[r] * constants::ft[s] * constants::ft[l - 2 * r - 2 * s];
+}
+
+double wfn_snapshot::pair_density(const int i, const int j) const
+{
+    const double *ci = coef_row(i), *cj = coef_row(j);
+    double sum = 0.0;
+    for (int m = 0; m < m_nmo_pad; m++)
+        sum += m_occ[m] * ci[m] * cj[m];
+    return sum;
+}
+
+// x^l as a product, as in the cartesian angular parts
+static double int_pow(const double x, const int l)
+{
+    double result = 1.0;
+    for (int i = 0; i < l; i++)
+        result *= x;
+    return result;
+}
+
+double wfn_snapshot::compute_spin_dens(const double *PosGrid, double *phi) const
+{
+    std::fill(phi, phi + m_nmo_pad, 0.0);
+    for (int j = 0; j < m_nex; j++)
+    {
+        const double *pos = center(m_prim_center[j]);
+        const double d[3]{PosGrid[0] - pos[0], PosGrid[1] - pos[1], PosGrid[2] - pos[2]};
+        double ex = -m_exponent[j] * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (ex < -46.0517) // corresponds to cutoff of ex ~< 1E-20
+            continue;
+        const int *l = prim_l(j);
+        ex = exp(ex) * int_pow(d[0], l[0]) * int_pow(d[1], l[1]) * int_pow(d[2], l[2]);
+        const double *c = coef_row(j);
+        for (int m = 0; m < m_nmo_pad; m++)
+            phi[m] += c[m] * ex;
+    }
+    double spin = 0.0;
+    for (int m = 0; m < m_nmo_pad; m++)
+        spin += m_spin[m] * phi[m] * phi[m];
+    return spin;
+}
+
+double wfn_snapshot::compute_MO(const double *PosGrid, const int mo) const
+{
+    double result = 0.0;
+    for (int j = 0; j < m_nex; j++)
+    {
+        const double *pos = center(m_prim_center[j]);
+        const double d[3]{PosGrid[0] - pos[0], PosGrid[1] - pos[1], PosGrid[2] - pos[2]};
+        double ex = -m_exponent[j] * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (ex < -46.0517) // corresponds to cutoff of ex ~< 1E-20
+            continue;
+        const int *l = prim_l(j);
+        ex = exp(ex) * int_pow(d[0], l[0]) * int_pow(d[1], l[1]) * int_pow(d[2], l[2]);
+        result += m_coef[(size_t)j * m_nmo_pad + mo] * ex;
+    }
+    return result;
+}
+
+void wfn_snapshot::compute_values(const double *PosGrid, const int order, double &Rho, double &normGrad, double *Hess,
+                                  double &Elf, double &Eli, double &Lap, double *phi, const bool add_ECP_dens) const
+{
+    const int nchi = order > 1 ? 10 : 4;
+    std::fill(phi, phi + (size_t)nchi * m_nmo_pad, 0.0);
+    double chi[10]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    double xl[3][3]{{0, 0, 0}, {0, 0, 0}, {0, 0, 0}};
+    double Grad[3]{0, 0, 0};
+    double tau = 0;
+
+    Rho = 0;
+    normGrad = 0;
+    Elf = 0;
+    Eli = 0;
+    Lap = 0;
+    for (int i = 0; i < 9; i++)
+        Hess[i] = 0;
+
+    if (add_ECP_dens && m_has_ECPs)
+        for (int c = 0; c < m_ncen; c++)
+            if (m_ecp[c] != 0)
+            {
+                const double *pos = center(c);
+                const double r2 = pow(PosGrid[0] - pos[0], 2) + pow(PosGrid[1] - pos[1], 2) + pow(PosGrid[2] - pos[2], 2);
+                Rho += 8 * m_ecp[c] * exp(-constants::FOUR_PI * r2);
+            }
+
+    for (int j = 0; j < m_nex; j++)
+    {
+        const double *pos = center(m_prim_center[j]);
+        const double d[3]{PosGrid[0] - pos[0], PosGrid[1] - pos[1], PosGrid[2] - pos[2]};
+        const double temp = -m_exponent[j] * (d[0] * d[0] + d[1] * d[1] + d[2] * d[2]);
+        if (temp < -34.5388) // corresponds to cutoff of ex < 1E-15
+            continue;
+        const double ex = exp(temp);
+        const int *l = prim_l(j);
+        for (int k = 0; k < 3; k++)
+        {
+            if (l[k] == 0)
+            {
+                xl[k][0] = 1.0;
+                xl[k][1] = 0.0;
+                xl[k][2] = 0.0;
+            }
+            else if (l[k] == 1)
+            {
+                xl[k][0] = d[k];
+                xl[k][1] = 1.0;
+                xl[k][2] = 0.0;
+            }
+            else if (l[k] == 2)
+            {
+                xl[k][0] = d[k] * d[k];
+                xl[k][1] = 2 * d[k];
+                xl[k][2] = 2;
+            }
+            else if (l[k] == 3)
+            {
+                double d2 = d[k] * d[k];
+                xl[k][0] = d2 * d[k];
+                xl[k][1] = 3 * d2;
+                xl[k][2] = 6 * d[k];
+            }
+            else if (l[k] == 4)
+            {
+                double d2 = d[k] * d[k];
+                xl[k][0] = d2 * d2;
+                xl[k][1] = 4 * d2 * d[k];
+                xl[k][2] = 12 * d2;
+            }
+            else
+            {
+                xl[k][0] = int_pow(d[k], l[k]);
+                xl[k][1] = l[k] * int_pow(d[k], l[k] - 1);
+                xl[k][2] = l[k] * (l[k] - 1) * int_pow(d[k], l[k] - 2);
+            }
+        }
+        const double ex2 = 2 * m_exponent[j];
+        chi[0] = xl[0][0] * xl[1][0] * xl[2][0] * ex;
+        chi[1] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * xl[1][0] * xl[2][0] * ex;
+        chi[2] = (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * xl[2][0] * ex;
+        chi[3] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[0][0] * xl[1][0] * ex;
+        if (order > 1)
+        {
+            const double temp_ex = pow(ex2, 2);
+            chi[4] = (xl[0][2] - ex2 * (2 * l[0] + 1) * xl[0][0] + temp_ex * pow(d[0], l[0] + 2)) * xl[1][0] * xl[2][0] * ex;
+            chi[5] = (xl[1][2] - ex2 * (2 * l[1] + 1) * xl[1][0] + temp_ex * pow(d[1], l[1] + 2)) * xl[2][0] * xl[0][0] * ex;
+            chi[6] = (xl[2][2] - ex2 * (2 * l[2] + 1) * xl[2][0] + temp_ex * pow(d[2], l[2] + 2)) * xl[0][0] * xl[1][0] * ex;
+            chi[7] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[2][0] * ex;
+            chi[8] = (xl[0][1] - ex2 * pow(d[0], l[0] + 1)) * (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * xl[1][0] * ex;
+            chi[9] = (xl[2][1] - ex2 * pow(d[2], l[2] + 1)) * (xl[1][1] - ex2 * pow(d[1], l[1] + 1)) * xl[0][0] * ex;
+        }
+        // one row of MO values per derivative, so the update runs along the coefficient row
+        const double *c = coef_row(j);
+        for (int i = 0; i < nchi; i++)
+        {
+            double *f = phi + (size_t)i * m_nmo_pad;
+            const double ci = chi[i];
+            for (int m = 0; m < m_nmo_pad; m++)
+                f[m] += c[m] * ci;
+        }
+    }
+
+    const double *f[10];
+    for (int i = 0; i < nchi; i++)
+        f[i] = phi + (size_t)i * m_nmo_pad;
+    for (int m = 0; m < m_nmo; m++)
+    {
+        const double occ = m_occ[m];
+        const double docc = 2 * occ;
+        if (occ == 0)
+            continue;
+        Rho += occ * pow(f[0][m], 2);
+        Grad[0] += docc * f[0][m] * f[1][m];
+        Grad[1] += docc * f[0][m] * f[2][m];
+        Grad[2] += docc * f[0][m] * f[3][m];
+        tau += occ * (pow(f[1][m], 2) + pow(f[2][m], 2) + pow(f[3][m], 2));
+        if (order > 1)
+        {
+            Hess[0] += docc * (f[0][m] * f[4][m] + pow(f[1][m], 2));
+            Hess[4] += docc * (f[0][m] * f[5][m] + pow(f[2][m], 2));
+            Hess[8] += docc * (f[0][m] * f[6][m] + pow(f[3][m], 2));
+            Hess[1] += docc * (f[0][m] * f[7][m] + f[1][m] * f[2][m]);
+            Hess[2] += docc * (f[0][m] * f[8][m] + f[1][m] * f[3][m]);
+            Hess[5] += docc * (f[0][m] * f[9][m] + f[2][m] * f[3][m]);
+        }
+    }
+
+    Hess[3] = Hess[1];
+    Hess[6] = Hess[2];
+    Hess[7] = Hess[5];
+    if (Rho > 0)
+    {
+        normGrad = constants::alpha_coef * sqrt(Grad[0] * Grad[0] + Grad[1] * Grad[1] + Grad[2] * Grad[2]) / pow(Rho, constants::c_43);
+        Elf = 1 / (1 + pow(constants::ctelf * pow(Rho, constants::c_m53) * (tau * 0.5 - 0.125 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2)) / Rho), 2));
+        Eli = Rho * pow(12 / (Rho * tau - 0.25 * (pow(Grad[0], 2) + pow(Grad[1], 2) + pow(Grad[2], 2))), constants::c_38);
+    }
+    Lap = Hess[0] + Hess[4] + Hess[8];
+}
+
+static double Integrate(int &m, double i, double &expn)
+{
+    int x;
+    if (i <= 10)
+    {
+        if (expn == 0.0)
+            return 0.0;
+        double a = m + 0.5;
+        double term = 1 / a;
+        double partsum = term;
+        for (x = 2; x < 50; x++)
+        {
+            a++;
+            term *= (i / a);
+            partsum += term;
+            if (term / partsum < 1E-8)
+                return 0.5 * partsum * expn;
+        }
+    }
+    else
+    {
+        double a = m;
+        double b = a + 0.5;
+        a -= 0.5;
+        double id = 1 / i;
+        double approx = 0.88622692 * sqrt(id) * pow(id, m);
+        for (x = 0; x < m; x++)
+        {
+            b--;
+            approx *= b;
+        }
+        double mult = 0.5 * expn * id;
+        if (mult == 0)
+            return approx;
+        double prop = mult / approx;
+        double term = 1;
+        double partsum = 1;
+        for (x = 1; x < i + m; x++)
+        {
+            term *= a * id;
+            partsum += term;
+            if (std::abs(term * prop / partsum) < 1E-8)
+                return approx - mult * partsum;
+            a--;
+        }
+    }
+    return -1;
+};
+
+double wfn_snapshot::fj(const int j, const int l, const int m, const double aa, const double bb) const
+{
+    double temp = 0.0;
+    double temp2 = 0.0;
+    int a = 0, b = 0;
+    for (int i = std::max(0, j - m); i <= std::min(j, l); i++)
+    {
+        // pre = factorial[l] / factorial[l - i] / factorial[i] * factorial[m] / factorial[m - j + i] / factorial[j - i];
+        temp2 = pre[j][l][m][i];
+        a = l - i;
+        b = m + i - j;
+        if (a != 0)
+            temp2 *= pow(aa, a);
+        if (b != 0)
+            temp2 *= pow(bb, b);
+        temp += temp2;
+    }
+    return temp;
+};
+
+double wfn_snapshot::Afac(const int l, const int r, const int i, const double PC, const double gamma, const double fjtmp) const
+{
+    double temp = fjtmp * pow(0.25 / gamma, r + i) / Afac_pre[l][r][i];
+    int num = l - 2 * r - 2 * i;
+    if (num != 0)
+        temp *= pow(PC, num);
+    if (i % 2 == 1)
+        return -temp;
+    else
+        return temp;
+}
+
+double wfn_snapshot::compute_ESP(const double *PosGrid, const std::vector<vec> &d2, const bool add_core) const
+{
+    double ESP = 0;
+    double P[3]{0, 0, 0};
+    double Pi[3]{0, 0, 0};
+    double Pj[3]{0, 0, 0};
+    double PC[3]{0, 0, 0};
+    double Fn[11]{0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0};
+    double Al[54]{0};
+    double Am[54]{0};
+    double An[54]{0};
+    int maplrsl[54]{0};
+    int maplrsm[54]{0};
+    int maplrsn[54]{0};
+    int iat = 0, jat = 0, MaxFn = 0;
+    double ex_sum = 0,
+           sqd = 0,
+           sqpc = 0,
+           prefac = 0,
+           expc = 0,
+           term = 0,
+           fjtmp = 0,
+           twoexpc = 0,
+           iex = 0,
+           jex = 0;
+
+    double temp;
+    int maxl, maxm, maxn;
+
+    if (add_core)
+        for (iat = 0; iat < m_ncen; iat++)
+        {
+            const double *pos = center(iat);
+            ESP += m_charge[iat] * pow(sqrt(pow(PosGrid[0] - pos[0], 2) + pow(PosGrid[1] - pos[1], 2) + pow(PosGrid[2] - pos[2], 2)), -1);
+        }
+
+    for (int iprim = 0; iprim < m_nex; iprim++)
+    {
+        iat = m_prim_center[iprim];
+        const int *l_i = prim_l(iprim);
+        iex = m_exponent[iprim];
+        for (int jprim = iprim; jprim < m_nex; jprim++)
+        {
+            jat = m_prim_center[jprim];
+            const int *l_j = prim_l(jprim);
+            jex = m_exponent[jprim];
+            ex_sum = iex + jex;
+
+            sqd = d2[iat][jat];
+
+            prefac = constants::TWO_PI / ex_sum * exp(-iex * jex * sqd / ex_sum);
+            if (prefac < 1E-10)
+                continue;
+
+            for (int i = 0; i < 3; i++)
+            {
+                P[i] = (center(iat)[i] * iex + center(jat)[i] * jex) / ex_sum;
+                Pi[i] = P[i] - center(iat)[i];
+                Pj[i] = P[i] - center(jat)[i];
+                PC[i] = P[i] - PosGrid[i];
+            }
+
+            sqpc = pow(PC[0], 2) + pow(PC[1], 2) + pow(PC[2], 2);
+
+            expc = exp(-ex_sum * sqpc);
+            MaxFn = 0;
+            for (int i = 0; i < 3; i++)
+                MaxFn += l_i[i] + l_j[i];
+            temp = Integrate(MaxFn, ex_sum * sqpc, expc);
+            Fn[MaxFn] = temp;
+            twoexpc = 2 * ex_sum * sqpc;
+            for (int nu = MaxFn - 1; nu >= 0; nu--)
+                Fn[nu] = (expc + twoexpc * Fn[nu + 1]) / (2 * (nu + 1) - 1);
+
+            maxl = -1;
+            for (int l = 0; l <= l_i[0] + l_j[0]; l++)
+            {
+                if (l % 2 != 1)
+                    fjtmp = fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // *factorial[l];
+                else
+                    fjtmp = -fj(l, l_i[0], l_j[0], Pi[0], Pj[0]); // * factorial[l];
+                for (int r = 0; r <= l / 2; r++)
+                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
+                    {
+                        maxl++;
+                        Al[maxl] = Afac(l, r, s, PC[0], ex_sum, fjtmp);
+                        maplrsl[maxl] = l - 2 * r - s;
+                    }
+            }
+            maxm = -1;
+            for (int l = 0; l <= l_i[1] + l_j[1]; l++)
+            {
+                if (l % 2 != 1)
+                    fjtmp = fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // *factorial[l];
+                else
+                    fjtmp = -fj(l, l_i[1], l_j[1], Pi[1], Pj[1]); // * factorial[l];
+                for (int r = 0; r <= l / 2; r++)
+                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
+                    {
+                        maxm++;
+                        Am[maxm] = Afac(l, r, s, PC[1], ex_sum, fjtmp);
+                        maplrsm[maxm] = l - 2 * r - s;
+                    }
+            }
+            maxn = -1;
+            for (int l = 0; l <= l_i[2] + l_j[2]; l++)
+            {
+                if (l % 2 != 1)
+                    fjtmp = fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // *factorial[l];
+                else
+                    fjtmp = -fj(l, l_i[2], l_j[2], Pi[2], Pj[2]); // * factorial[l];
+                for (int r = 0; r <= l / 2; r++)
+                    for (int s = 0; s <= (l - 2 * r) / 2; s++)
+                    {
+                        maxn++;
+                        An[maxn] = Afac(l, r, s, PC[2], ex_sum, fjtmp);
+                        maplrsn[maxn] = l - 2 * r - s;
+                    }
+            }
+
+            term = 0.0;
+            for (int l = 0; l <= maxl; l++)
+            {
+                if (Al[l] == 0)
+                    continue;
+                for (int m = 0; m <= maxm; m++)
+                {
+                    if (Am[m] == 0)
+                        continue;
+                    for (int n = 0; n <= maxn; n++)
+                    {
+                        if (An[n] == 0)
+                            continue;
+                        term += Al[l] * Am[m] * An[n] * Fn[maplrsl[l] + maplrsm[m] + maplrsn[n]];
+                    }
+                }
+            }
+
+            if (term == 0)
+                continue;
+
+            if (iprim != jprim)
+                term *= 2.0;
+
+            term *= prefac;
+            ESP -= pair_density(iprim, jprim) * term;
+        }
+    }
+    return ESP;
+};
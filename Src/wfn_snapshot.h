@@ -0,0 +1,111 @@
+/**
+ * @file wfn_snapshot.h
+ * @brief Read-only packed copy of the data of a WFN needed to evaluate it in space.
+ *
+ * The WFN keeps its coefficients in one vector per MO and the primitives as types, 1-based centers and exponents,
+ * so every evaluation re-derives the angular exponents and gathers the coefficients of a primitive from all MO
+ * objects. The snapshot is built once from a WFN and holds the MOs in one 64 byte aligned block: the coefficient
+ * matrix primitive-major (one row of all MOs per primitive), the occupations, the angular exponents, centers and
+ * exponents of the primitives and the positions, charges and ECP electrons of the centers.
+ *
+ * Nothing in a snapshot changes after construction, so a single one is shared by all threads. It does not follow
+ * later changes of the WFN and has to be rebuilt after them.
+ */
+#pragma once
+
+#include "convenience.h"
+
+#include <cstdlib>
+
+class WFN;
+
+class wfn_snapshot
+{
+    void *m_block = NULL;
+    double *m_coef = NULL;     ///< nex rows of nmo_pad coefficients
+    double *m_occ = NULL;      ///< nmo_pad occupations, zero in the padding
+    double *m_spin = NULL;     ///< nmo_pad occupations, negative for beta MOs
+    double *m_exponent = NULL; ///< nex exponents
+    double *m_center = NULL;   ///< x, y, z of the ncen centers
+    double *m_charge = NULL;   ///< ncen nuclear charges
+    double *m_ecp = NULL;      ///< ncen numbers of ECP electrons
+    int *m_prim_center = NULL; ///< nex 0-based centers
+    int *m_prim_l = NULL;      ///< lx, ly, lz of the nex primitives
+    int m_nex = 0, m_nmo = 0, m_nmo_pad = 0, m_ncen = 0;
+    bool m_spherical = false, m_has_ECPs = false;
+    ivec m_mo_number; ///< Index in the WFN of every MO of the snapshot
+    const WFN *m_wave = NULL;
+
+    // tables of the ESP integrals
+    long long int pre[9][5][5][9];
+    long long int Afac_pre[9][5][9];
+    double fj(const int j, const int l, const int m, const double aa, const double bb) const;
+    double Afac(const int l, const int r, const int i, const double PC, const double gamma, const double fjtmp) const;
+
+public:
+    /**
+     * @brief Packs the primitives and MOs of wave.
+     * @param only_occ Keep only the MOs with non zero occupation
+     */
+    wfn_snapshot(const WFN &wave, const bool only_occ = true);
+    ~wfn_snapshot() { std::free(m_block); }
+    wfn_snapshot(const wfn_snapshot &) = delete;
+    wfn_snapshot &operator=(const wfn_snapshot &) = delete;
+
+    int get_nex() const { return m_nex; }
+    int get_nmo() const { return m_nmo; }
+    /**
+     * @brief Length of a coefficient row, a multiple of 8 so every row starts on a 64 byte boundary.
+     */
+    int get_nmo_pad() const { return m_nmo_pad; }
+    int get_ncen() const { return m_ncen; }
+    /**
+     * @brief True if the types of the primitives are spherical harmonics, which the kernels below do not handle.
+     */
+    bool is_spherical() const { return m_spherical; }
+    bool get_has_ECPs() const { return m_has_ECPs; }
+    int get_mo_number(const int mo) const { return m_mo_number[mo]; }
+    const WFN &get_wfn() const { return *m_wave; }
+
+    const double *coef_row(const int prim) const { return m_coef + (size_t)prim * m_nmo_pad; }
+    const double *occupations() const { return m_occ; }
+    double exponent(const int prim) const { return m_exponent[prim]; }
+    int prim_center(const int prim) const { return m_prim_center[prim]; }
+    const int *prim_l(const int prim) const { return m_prim_l + 3 * prim; }
+    const double *center(const int c) const { return m_center + 3 * c; }
+    double ecp_electrons(const int c) const { return m_ecp[c]; }
+
+    /**
+     * @brief Element of the density matrix in the primitive basis, sum_mo occ_mo c_mo,i c_mo,j.
+     */
+    double pair_density(const int i, const int j) const;
+
+    /**
+     * @brief Spin density, alpha minus beta.
+     * @param phi Scratch of get_nmo_pad() doubles
+     */
+    double compute_spin_dens(const double *PosGrid, double *phi) const;
+
+    /**
+     * @brief Value of MO mo of the snapshot.
+     */
+    double compute_MO(const double *PosGrid, const int mo) const;
+
+    /**
+     * @brief Density and the properties following from its derivatives.
+     *
+     * order 1 evaluates the gradient, which is enough for ELF, ELI and the reduced density gradient normGrad.
+     * order 2 adds the Hessian and the Laplacian, otherwise both are set to 0.
+     * @param phi Scratch of 10 * get_nmo_pad() doubles
+     * @param add_ECP_dens Whether the core density replacing ECP electrons is added to Rho
+     */
+    void compute_values(const double *PosGrid, const int order, double &Rho, double &normGrad, double *Hess,
+                        double &Elf, double &Eli, double &Lap, double *phi, const bool add_ECP_dens = true) const;
+
+    /**
+     * @brief Electrostatic potential.
+     * @param d2 Squared distances between all pairs of centers
+     * @param add_core Whether the potential of the nuclei is included
+     */
+    double compute_ESP(const double *PosGrid, const std::vector<vec> &d2, const bool add_core = true) const;
+};